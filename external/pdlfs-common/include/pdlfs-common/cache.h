@@ -93,6 +93,19 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Change the capacity of the cache. Shrinking the cache evicts entries
+  // until their combined charge fits the new capacity. Entries still in use
+  // are kicked out of the cache but stay alive until their handles are
+  // released.
+  virtual void SetCapacity(size_t capacity) = 0;
+
+  // Return the combined charge of all entries currently in the cache.
+  virtual size_t TotalCharge() = 0;
+
+  // Retrieve the number of lookups performed so far and the number of those
+  // that found their keys.
+  virtual void GetHitStats(uint64_t* lookups, uint64_t* hits) = 0;
+
  private:
   // No copying allowed
   void operator=(const Cache& cache);
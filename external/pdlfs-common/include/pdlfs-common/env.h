@@ -39,6 +39,7 @@ class Logger;
 class RandomAccessFile;
 class SequentialFile;
 class Slice;
+class ThreadPool;
 class WritableFile;
 
 class Env {
@@ -67,6 +68,13 @@ class Env {
   // Result of this call belongs to the caller and should be deleted after use.
   static Env* NewMmapIoEnvWrapper(Env* base);
 
+  // Return a new Env wrapper object running Schedule()'d work on "pool"
+  // instead of base's own background threads, such as a pool created by
+  // ThreadPool::NewWorkStealing(). Other operations go to base unchanged.
+  // "pool" must outlive the result. Result of this call belongs to the
+  // caller and should be deleted after use.
+  static Env* NewThreadPoolEnvWrapper(Env* base, ThreadPool* pool);
+
   // Return an Env implementation that performs sequential io using standard os
   // io calls such as open(), read(), write(), lseek(), fsync(), and
   // close(), and random reads using pread(). Result of this call belongs to the
@@ -403,6 +411,17 @@ class ThreadPool {
   static ThreadPool* NewFixed(int num_threads, bool eager_init = false,
                               void* attr = NULL);
 
+  // Instantiate a new work-stealing thread pool with a fixed number of
+  // threads. Each thread has its own task queue and takes tasks from its
+  // peers when its own queue runs dry, so scheduling does not contend on a
+  // single pool-wide queue. If "pin_threads" is true, the i-th thread is
+  // pinned to the i-th cpu (modulo the number of cpus) where supported.
+  // The caller should delete the pool to free associated resources.
+  static ThreadPool* NewWorkStealing(int num_threads, bool pin_threads = false);
+
+  // Task priorities understood by ScheduleWithPriority().
+  enum Priority { kHigh, kNormal };
+
   // Arrange to run "(*function)(arg)" once in one of a pool of
   // background threads.
   //
@@ -412,6 +431,13 @@ class ThreadPool {
   // serialized.
   virtual void Schedule(void (*function)(void*), void* arg) = 0;
 
+  // Like Schedule(), but with a priority. Queued kHigh tasks run before
+  // queued kNormal tasks. Pools without priorities ignore it.
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri) {
+    Schedule(function, arg);
+  }
+
   // Return a description of the pool implementation.
   virtual std::string ToDebugString() = 0;
 
@@ -12,6 +12,7 @@
 
 #include "pdlfs-common/fsdbbase.h"
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/fstypes.h"
 
 #include <vector>
 
@@ -71,11 +72,22 @@ class MXDB {
   template <typename KX, typename TX, typename OPT>
   Status DELETE(const DirId& id, const Slice& suf, OPT* opt, TX* tx);
 
+  typedef std::vector<std::string> NameList;
+  typedef std::vector<Stat> StatList;
+
+  // Entries are read ahead from the iterator in batches of up to
+  // kReaddirBatchSize so that their stats are decoded together.
+  enum { kReaddirBatchSize = 64 };
   template <typename Iter>
   struct Dir {
     size_t n;  // Number dir entries scanned
     std::string key_prefix;
     Iter* iter;
+    // Entries read ahead but not yet returned, starting at the pos-th
+    StatBatch stats;
+    NameList names;
+    size_t pos;
+    Status status;  // Returned once read-ahead entries are exhausted
   };
   template <typename Iter, typename KX, typename TX, typename OPT>
   Dir<Iter>* OPENDIR(const DirId& id, OPT* opt, TX* tx);
@@ -83,9 +95,9 @@ class MXDB {
   Status READDIR(Dir<Iter>* dir, Stat* stat, std::string* name);
   template <typename Iter>
   void CLOSEDIR(Dir<Iter>* dir);
+  template <typename Iter>
+  void READAHEAD(Dir<Iter>* dir);
 
-  typedef std::vector<std::string> NameList;
-  typedef std::vector<Stat> StatList;
   template <typename Iter, typename KX, typename TX, typename OPT>
   size_t LIST(const DirId& id, StatList* stats, NameList* names, OPT* opt,
               TX* tx, size_t limit);
@@ -267,6 +279,7 @@ MXDB<DX, xslice, xstatus, fmt>::OPENDIR(  ////
   dir->key_prefix = prefix.ToString();
   dir->iter = iter;
   dir->n = 0;
+  dir->pos = 0;
   return dir;
 }
 
@@ -275,42 +288,93 @@ template <typename Iter>
 Status MXDB<DX, xslice, xstatus, fmt>::READDIR(  ////
     Dir<Iter>* dir, Stat* stat, std::string* name) {
   if (dir == NULL) return Status::NotFound(Slice());
-  Iter* const iter = dir->iter;
-  if (!iter->Valid()) {  // Either we hit the bottom or an error
-    xstatus st = iter->status();
-    if (st.ok()) {
-      return Status::NotFound(Slice());
-    } else {
-      return XSTATUS(st);
+  if (dir->pos == dir->names.size()) {
+    if (!dir->status.ok()) {  // Either we hit the bottom or an error
+      return dir->status;
+    }
+    READAHEAD(dir);
+    if (dir->pos == dir->names.size()) {
+      return dir->status;
     }
   }
 
-  xslice xinput = iter->value();
-  xslice xkey = iter->key();
+  dir->stats.Get(dir->pos, stat);
+  name->swap(dir->names[dir->pos]);
+  dir->pos++;
+  dir->n++;  // +1 entries scanned
 
-  Slice input = Slice(xinput.data(), xinput.size());
-  Slice key = Slice(xkey.data(), xkey.size());
-  if (!key.starts_with(dir->key_prefix))  // Hitting the end of directory
-    return Status::NotFound(Slice());
-  if (!stat->DecodeFrom(&input)) {
-    return Status::Corruption("Cannot parse Stat");
-  }
+  return Status::OK();
+}
 
-  Slice filename;
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename Iter>
+void MXDB<DX, xslice, xstatus, fmt>::READAHEAD(  ////
+    Dir<Iter>* dir) {
+  dir->stats.Clear();
+  dir->names.clear();
+  dir->pos = 0;
+  Iter* const iter = dir->iter;
+  // Values are copied out during the scan and their stats are decoded
+  // afterwards as a single batch.
+  std::string values;
+  std::vector<size_t> ends;
+  size_t num_entries = 0;
+  for (; num_entries < kReaddirBatchSize; num_entries++) {
+    if (!iter->Valid()) {
+      xstatus st = iter->status();
+      if (st.ok()) {
+        dir->status = Status::NotFound(Slice());
+      } else {
+        dir->status = XSTATUS(st);
+      }
+      break;
+    }
 
-  if (fmt == kNameInKey) {
-    key.remove_prefix(dir->key_prefix.length());
-    filename = key;
-  } else if (!GetLengthPrefixedSlice(&input, &filename)) {
-    return Status::Corruption("Cannot parse filename");
-  }
+    xslice xinput = iter->value();
+    xslice xkey = iter->key();
 
-  *name = filename.ToString();
-  dir->n++;  // +1 entries scanned
-  // Seek to the next entry
-  iter->Next();
+    Slice key = Slice(xkey.data(), xkey.size());
+    if (!key.starts_with(dir->key_prefix)) {  // Hitting the end of directory
+      dir->status = Status::NotFound(Slice());
+      break;
+    }
+    values.append(xinput.data(), xinput.size());
+    ends.push_back(values.size());
 
-  return Status::OK();
+    if (fmt == kNameInKey) {
+      key.remove_prefix(dir->key_prefix.length());
+      dir->names.push_back(key.ToString());
+    }
+
+    // Seek to the next entry
+    iter->Next();
+  }
+
+  std::vector<Slice> inputs(num_entries);
+  for (size_t i = 0; i < num_entries; i++) {
+    const size_t start = i != 0 ? ends[i - 1] : 0;
+    inputs[i] = Slice(values.data() + start, ends[i] - start);
+  }
+  size_t num_stats = 0;
+  if (num_entries != 0) {
+    num_stats = DecodeStats(&inputs[0], num_entries, &dir->stats);
+  }
+  // Entries are returned up to the first one that fails to parse
+  if (fmt == kNameInKey) {
+    dir->names.resize(num_stats);
+  } else {
+    Slice filename;
+    for (size_t i = 0; i < num_stats; i++) {
+      if (!GetLengthPrefixedSlice(&inputs[i], &filename)) {
+        dir->status = Status::Corruption("Cannot parse filename");
+        return;
+      }
+      dir->names.push_back(filename.ToString());
+    }
+  }
+  if (num_stats < num_entries) {
+    dir->status = Status::Corruption("Cannot parse Stat");
+  }
 }
 
 MXDBTEMDECL(DX, xslice, xstatus, fmt)
@@ -335,31 +399,27 @@ size_t MXDB<DX, xslice, xstatus, fmt>::LIST(  ////
   Slice prefix = prefix_key.prefix();
   Iter* const iter = dx_->NewIterator(*opt);
   iter->Seek(prefix);
-  Slice name;
-  Stat stat;
+  // Values are copied out during the scan and their stats are decoded
+  // afterwards as a single batch.
+  std::string values;
+  std::vector<size_t> ends;
+  const size_t names_start = names != NULL ? names->size() : 0;
   size_t num_entries = 0;
   for (; iter->Valid() && num_entries < limit; iter->Next()) {
     xslice xinput = iter->value();
     xslice xkey = iter->key();
 
-    Slice input = Slice(xinput.data(), xinput.size());
     Slice key = Slice(xkey.data(), xkey.size());
     if (!key.starts_with(prefix))  // Hitting end of directory
       break;
-    if (!stat.DecodeFrom(&input)) {
-      break;  // Error
-    }
+    values.append(xinput.data(), xinput.size());
+    ends.push_back(values.size());
 
-    if (fmt == kNameInKey) {
+    if (fmt == kNameInKey && names != NULL) {
       key.remove_prefix(prefix.size());
-      name = key;
-    } else if (!GetLengthPrefixedSlice(&input, &name)) {
-      break;  // Error
+      names->push_back(key.ToString());
     }
 
-    if (names != NULL) names->push_back(name.ToString());
-    if (stats != NULL) stats->push_back(stat);
-
     num_entries++;
   }
 
@@ -367,6 +427,34 @@ size_t MXDB<DX, xslice, xstatus, fmt>::LIST(  ////
   // Use ReadDir instead.
   delete iter;
 
+  std::vector<Slice> inputs(num_entries);
+  for (size_t i = 0; i < num_entries; i++) {
+    const size_t start = i != 0 ? ends[i - 1] : 0;
+    inputs[i] = Slice(values.data() + start, ends[i] - start);
+  }
+  StatBatch batch;
+  if (num_entries != 0) {
+    num_entries = DecodeStats(&inputs[0], num_entries, &batch);
+  }
+  Slice name;
+  size_t i = 0;
+  for (; i < num_entries; i++) {
+    if (fmt != kNameInKey) {
+      if (!GetLengthPrefixedSlice(&inputs[i], &name)) {
+        break;  // Error
+      }
+      if (names != NULL) names->push_back(name.ToString());
+    }
+    if (stats != NULL) {
+      stats->push_back(Stat());
+      batch.Get(i, &stats->back());
+    }
+  }
+  num_entries = i;
+  if (names != NULL) {  // Drop the names of entries that failed to parse
+    names->resize(names_start + num_entries);
+  }
+
   return num_entries;
 }
 
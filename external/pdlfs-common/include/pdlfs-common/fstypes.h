@@ -13,6 +13,7 @@
 #include "pdlfs-common/slice.h"
 
 #include <stdint.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -192,6 +193,46 @@ class Stat {
   }
 };
 
+// A run of decoded stats stored as a structure of arrays. Directory scans
+// that only look at one or two fields of many entries can read these
+// arrays linearly instead of striding over whole Stat objects.
+struct StatBatch {
+#if defined(DELTAFS_PROTO)
+  std::vector<uint64_t> dno;
+#endif
+#if defined(DELTAFS)
+  std::vector<uint64_t> reg_id;
+  std::vector<uint64_t> snap_id;
+#endif
+  std::vector<uint64_t> ino;
+  std::vector<uint64_t> size;
+  std::vector<uint32_t> mode;
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  std::vector<uint32_t> zeroth_server;
+#endif
+  std::vector<uint32_t> uid;
+  std::vector<uint32_t> gid;
+  std::vector<uint64_t> mtime;
+  std::vector<uint64_t> ctime;
+
+  size_t count() const { return ino.size(); }
+  void Clear();
+  void Append(const Stat& stat);
+  // Store the i-th stat of the batch in *stat.
+  void Get(size_t i, Stat* stat) const;
+};
+
+// Decode the stats at the beginning of encodings[0,n-1] and append them to
+// *batch. Like Stat::DecodeFrom(Slice*), each encoding is advanced past its
+// stat so that callers may parse whatever follows it. Stop at the first
+// encoding that cannot be parsed. Return the number of stats decoded.
+//
+// Varint boundaries are located for a whole stat at a time (using SSE2 when
+// the compiler targets it) and each field is then extracted without a
+// per-byte loop. Unusual encodings are handed to Stat::DecodeFrom, so the
+// result is always the same as decoding each stat one by one.
+extern size_t DecodeStats(Slice* encodings, size_t n, StatBatch* batch);
+
 #if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
 // The result of lookup requests sent to clients during pathname resolution.
 // If the lease due date is not zero, the client may cache
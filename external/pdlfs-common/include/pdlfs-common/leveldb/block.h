@@ -25,6 +25,7 @@ struct BlockContents;
 
 class Comparator;
 class Iterator;
+class Slice;
 
 class Block {
  public:
@@ -36,13 +37,29 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
- private:
-  uint32_t NumRestarts() const;
+  // Return an iterator whose first Seek() starts at the given restart
+  // interval instead of searching for it. The caller must know the
+  // sought key, if present, is in that interval.
+  Iterator* NewIterator(const Comparator* comparator, uint32_t restart_index);
+
+  // Results of HashLookup() besides a restart interval.
+  static const uint32_t kNotInBlock;
+  static const uint32_t kUnknownInterval;
 
+  // Consult the block's hash index for the restart interval that may hold
+  // keys whose leading bytes, as hashed by the block builder, equal
+  // "hash_key". Return kNotInBlock if no such key is in the block, or
+  // kUnknownInterval if the block has no index or the index cannot tell.
+  uint32_t HashLookup(const Slice& hash_key) const;
+
+ private:
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;  // Offset in data_ of restart array
-  bool owned_;               // Block owns data_[]
+  uint32_t num_restarts_;
+  const uint8_t* hash_buckets_;  // NULL if block has no hash index
+  uint32_t num_buckets_;
+  bool owned_;  // Block owns data_[]
 
   // No copying allowed
   void operator=(const Block&);
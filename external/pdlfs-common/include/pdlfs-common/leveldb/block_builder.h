@@ -110,6 +110,14 @@ class BlockBuilder : public AbstractBlockBuilder {
   // Set a new restart interval.
   void ChangeRestartInterval(int interval) { restart_interval_ = interval; }
 
+  // Append a hash index to each block, mapping every key, minus its last
+  // "trailer_size" bytes, to the restart interval holding it. Point lookups
+  // may then jump to that interval without a binary search over the
+  // restart array. Blocks with too many restart intervals for the index to
+  // address are written without it.
+  // REQUIRES: no keys have been added since the last call to Reset().
+  void EnableHashIndex(size_t trailer_size);
+
   // Reset the contents as if the BlockBuilder was just constructed.
   void Reset();
 
@@ -128,6 +136,13 @@ class BlockBuilder : public AbstractBlockBuilder {
   std::vector<uint32_t> restarts_;  // Restart points
   int counter_;                     // Number of entries emitted since restart
   std::string last_key_;
+  bool hash_index_;
+  size_t hash_trailer_size_;
+  // Hash of each key paired with its restart interval. Consecutive keys
+  // sharing both are only kept once.
+  std::vector<std::pair<uint32_t, uint32_t> > hashes_;
+
+  void AppendHashIndex();
 
   // No copying allowed
   void operator=(const BlockBuilder&);
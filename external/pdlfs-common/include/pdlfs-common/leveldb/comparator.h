@@ -28,6 +28,14 @@ class Comparator;
 // must not be deleted.
 extern const Comparator* BytewiseComparator();
 
+// Return a builtin comparator that orders keys exactly as the bytewise
+// comparator does, so the two may be used on the same db, but compares the
+// first 8 bytes of keys as a single big-endian integer. Suits keys led by a
+// fixed-width big-endian prefix, such as the filesystem keys of tablefs and
+// indexfs. The result remains the property of this module and must not be
+// deleted.
+extern const Comparator* FixedPrefixComparator();
+
 // A Comparator object provides a total order across slices that are
 // used as keys in an sstable or a database.  A Comparator implementation
 // must be thread-safe since leveldb may invoke its methods concurrently
@@ -67,6 +67,22 @@ class DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Append a merge operand "value" for "key" without reading the key's
+  // current value. The operand is folded into the key's value by the
+  // merge operator specified in options. Returns OK on success, and a
+  // non-OK status on error or if the database has no merge operator.
+  // Note: consider setting options.sync = true.
+  virtual Status Merge(const WriteOptions& options, const Slice& key,
+                       const Slice& value);
+
+  // Remove all database entries (if any) whose keys fall in the range
+  // ["begin", "end").  Returns OK on success, and a non-OK status on
+  // error.  Costs the same as a single Delete() no matter how many
+  // entries are removed; covered entries are dropped by later compactions.
+  // Note: consider setting options.sync = true.
+  virtual Status DeleteRange(const WriteOptions& options, const Slice& begin,
+                             const Slice& end);
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
@@ -142,6 +158,26 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.read-stats" - returns a multi-line string that summarizes
+  //     the read path of all point lookups (memtable hits, sstables
+  //     probed, filter effectiveness, and block cache hits).
+  //  "leveldb.write-controller" - returns a multi-line string that shows
+  //     the rate writes are currently admitted at (0 if not throttled),
+  //     the bytes admitted ahead of that rate, and the delays imposed.
+  //  "leveldb.num-immutable-mem-table" - returns the number of immutable
+  //     memtables waiting to be compacted.
+  //  "leveldb.memtable-usage" - returns the approximate number of bytes of
+  //     memory used by the current and all immutable memtables.
+  //  "leveldb.write-buffer-full" - returns "1" if the current memtable has
+  //     grown past the write buffer size, and "0" otherwise.
+  //  "leveldb.write-amplification" - returns the total number of bytes
+  //     written to tables divided by the number of bytes written to tables
+  //     built from memtables.
+  //  "leveldb.num-range-deletions" - returns the number of range deletions
+  //     kept with the tables because they may still remove table entries.
+  //  "leveldb.open-micros" - returns the number of micros spent opening the
+  //     DB, including log replay and, unless done in the background, table
+  //     loading.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -89,6 +89,15 @@ static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// Data blocks may end with a hash index mapping keys to the restart
+// intervals holding them (see block_builder.cc). Such blocks have the top
+// bit of their restart count set. Each bucket of the index holds a restart
+// interval, or one of the two markers below.
+static const uint32_t kBlockHashIndexFlag = 0x80000000u;
+static const uint32_t kBlockHashSeed = 0x9e3779b9u;
+static const uint8_t kBlockHashNoEntry = 255;
+static const uint8_t kBlockHashCollision = 254;  // Keys of several intervals
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
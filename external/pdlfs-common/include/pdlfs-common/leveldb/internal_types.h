@@ -38,7 +38,8 @@ class InternalKey;
 // THESE ENUM VALUES: they are embedded in the on-disk data structures.
 enum ValueType {
   kTypeDeletion = 0x0,  // Tombstone
-  kTypeValue = 0x1
+  kTypeValue = 0x1,
+  kTypeMerge = 0x2  // Merge operand
 };
 
 // kValueTypeForSeek defines the ValueType that should be passed when
@@ -47,7 +48,7 @@ enum ValueType {
 // and the value type is embedded as the low 8 bits in the sequence
 // number in internal keys, we need to use the highest-numbered
 // ValueType, not the lowest).
-static const ValueType kValueTypeForSeek = kTypeValue;
+static const ValueType kValueTypeForSeek = kTypeMerge;
 
 typedef int64_t SequenceOff;
 
@@ -176,7 +177,7 @@ inline bool ParseInternalKey(const Slice& internal_key,
   result->sequence = num >> 8;
   result->type = static_cast<ValueType>(c);
   result->user_key = Slice(internal_key.data(), n - 8);
-  return (c <= static_cast<unsigned char>(kTypeValue));
+  return (c <= static_cast<unsigned char>(kTypeMerge));
 }
 
 // A helper class useful for DBImpl::Get()
@@ -196,6 +197,9 @@ class LookupKey {
   // Return the user key
   Slice user_key() const { return Slice(kstart_, end_ - kstart_ - 8); }
 
+  // Return the snapshot sequence number
+  SequenceNumber sequence() const { return DecodeFixed64(end_ - 8) >> 8; }
+
  private:
   // We construct a char array of the form:
   //    klength  varint32               <-- start_
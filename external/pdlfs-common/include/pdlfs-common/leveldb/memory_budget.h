@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/port.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace pdlfs {
+
+class Cache;
+
+// A MemoryBudget caps the memory used by one or more dbs at a single number
+// of bytes. The budget is split between write buffering and read caching.
+// Memtables of all dbs sharing the budget get the write share, divided
+// evenly among the write buffers the dbs may hold. Data blocks and open
+// tables (their index blocks and filters) of all dbs go to a single shared
+// cache sized to the read share. Memory managed outside of the dbs, such as
+// an application-level cache, may set aside part of the budget up front.
+//
+// The split starts at 1/4 for writes and moves in 1/16 steps between 1/8
+// and 3/4. Each time a db switches to a new memtable, the budget compares
+// the writer stalls and the cache hit rate observed since the previous
+// switch. Writes gain memory when writers stalled on full memtables while
+// the cache served most lookups. Reads gain memory when the cache missed
+// often while writers did not stall.
+//
+// The footprint is approximate: a memtable may exceed its size by the last
+// write batch it absorbed, and cache entries pinned by live iterators are
+// kept beyond the cache's capacity until released.
+//
+// Thread-safe. A MemoryBudget must outlive all dbs using it.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t budget);
+  ~MemoryBudget();
+
+  size_t budget() const { return budget_; }
+
+  // The cache shared by all dbs using the budget as both their block cache
+  // and their table cache.
+  Cache* cache() const { return cache_; }
+
+  // Set aside "bytes" of the budget for memory managed by the caller.
+  void Reserve(size_t bytes);
+  void Release(size_t bytes);
+
+  // Called by a db as it opens and closes. "n" is its max number of write
+  // buffers.
+  void AddWriteBuffers(int n);
+  void RemoveWriteBuffers(int n);
+
+  // Current size of each write buffer.
+  size_t write_buffer_size() const {
+    return reinterpret_cast<uintptr_t>(write_buffer_size_.Acquire_Load());
+  }
+
+  // Current number of bytes given to write buffering and read caching.
+  size_t write_share() const;
+  size_t cache_share() const;
+
+  // Called by a db each time its writers wait for a write buffer to free up.
+  void RecordStall();
+
+  // Move memory between write buffering and read caching according to the
+  // stalls and cache hits observed since the last call. Called by a db each
+  // time it switches to a new memtable.
+  void Rebalance();
+
+ private:
+  // REQUIRES: mu_ has been locked.
+  size_t Usable() const;
+  void Apply();
+
+  const size_t budget_;
+  Cache* const cache_;
+
+  mutable port::Mutex mu_;
+  size_t reserved_;
+  int write_buffers_;  // Total write buffers of all dbs using the budget
+  int write_parts_;    // Write share of the usable budget in 1/16 units
+  port::AtomicPointer write_buffer_size_;
+
+  uint64_t stalls_;
+  uint64_t last_stalls_;
+  uint64_t last_lookups_;
+  uint64_t last_hits_;
+
+  // No copying allowed
+  void operator=(const MemoryBudget&);
+  MemoryBudget(const MemoryBudget&);
+};
+
+}  // namespace pdlfs
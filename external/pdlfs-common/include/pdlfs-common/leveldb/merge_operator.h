@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include <string>
+
+namespace pdlfs {
+
+class Slice;
+
+// A database can be configured with a MergeOperator to support read-free
+// updates. DB::Merge() blindly appends an update operand for a key. Operands
+// are later folded into the key's base value by the operator: at read time
+// by DB::Get() and DB iterators, and in the background by compactions.
+//
+// A MergeOperator must be thread-safe and must remain alive until any
+// database using it has been closed.
+class MergeOperator {
+ public:
+  virtual ~MergeOperator();
+
+  // Apply "operand" to "existing_value" and store the result in *new_value.
+  // "existing_value" is NULL if the key does not have a value at the time
+  // the operand is applied. Return false if the key should have no value
+  // after the merge, in which case *new_value is ignored.
+  virtual bool Merge(const Slice& key, const Slice* existing_value,
+                     const Slice& operand, std::string* new_value) const = 0;
+
+  // Return the name of this operator. Operands written using one operator
+  // must not be merged by another operator of a different name.
+  virtual const char* Name() const = 0;
+};
+
+}  // namespace pdlfs
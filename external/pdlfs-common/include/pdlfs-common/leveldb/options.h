@@ -20,6 +20,7 @@
 #include "pdlfs-common/leveldb/types.h"
 
 #include <stddef.h>
+#include <string>
 
 namespace pdlfs {
 
@@ -28,9 +29,22 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class MemoryBudget;
+class MergeOperator;
+class RateLimiter;
 class Snapshot;
 class ThreadPool;
 
+// Background compaction styles.
+enum CompactionStyle {
+  // Each level is kept level_factor times larger than the level above it
+  // by merging its tables into the next level as it grows out of its budget.
+  kCompactionStyleLeveled = 0x0,
+  // Each level is a single sorted run that is newer than all runs below it.
+  // Runs are only merged when they are of similar size.
+  kCompactionStyleTiered = 0x1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct DBOptions {
   // -------------------
@@ -80,6 +94,34 @@ struct DBOptions {
   // Default: NULL
   ThreadPool* compaction_pool;
 
+  // Thread pool for replaying write-ahead logs and loading tables in parallel
+  // when the DB is opened. Each log is replayed into memtables of its own,
+  // which are then written out in log order. If NULL, logs are replayed one
+  // at a time by the opening thread.
+  // Default: NULL
+  ThreadPool* open_pool;
+
+  // Load the index and filter blocks of all live tables into the table cache
+  // when the DB is opened instead of on first access. Tables are loaded in
+  // parallel on open_pool when it is set.
+  // Default: false
+  bool load_tables_on_open;
+
+  // Return from opening the DB without waiting for its tables to be loaded.
+  // Loading continues in the background, on open_pool if it is set and on
+  // env's background thread otherwise. Ignored unless load_tables_on_open
+  // is set.
+  // Default: false
+  bool load_tables_in_background;
+
+  // If non-NULL, charge all table writes made by memtable compactions (at
+  // high priority) and table compactions (at low priority) against the
+  // limiter. The db also reports the latency of its point lookups to the
+  // limiter for auto-tuning. Writes to the write-ahead log and all reads are
+  // never limited. The limiter may be shared by multiple dbs.
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
   // -------------------
   // Parameters that affect performance
 
@@ -87,14 +129,35 @@ struct DBOptions {
   // on disk) before converting to a sorted on-disk file.
   //
   // Larger values increase performance, especially during bulk loads.
-  // Up to two write buffers may be held in memory at the same time,
-  // so you may wish to adjust this parameter to control memory usage.
+  // Up to max_write_buffer_number write buffers may be held in memory at the
+  // same time, so you may wish to adjust this parameter to control memory usage.
   // Also, a larger write buffer will result in a longer recovery time
   // the next time the database is opened.
   //
   // Default: 4MB
   size_t write_buffer_size;
 
+  // Max number of write buffers (the active memtable plus all immutable
+  // memtables waiting to be flushed) that may be held in memory at the
+  // same time. A full memtable is frozen and flushed to a level-0 table in
+  // the background while writes go to a new one. Writers stall only when
+  // all write buffers are full. Frozen memtables may be flushed in parallel
+  // if compaction_pool has more than one thread, but their tables are
+  // always installed in the order they were frozen.
+  //
+  // Default: 2
+  int max_write_buffer_number;
+
+  // If not 0, each memtable keeps a hash index with this many buckets next
+  // to its skiplist. Point lookups, such as the existence checks preceding
+  // inserts, are served from the index whenever the newest entry of a key
+  // answers them, and keys absent from a memtable are ruled out without
+  // searching its skiplist. Ordered iteration still uses the skiplist.
+  // REQUIRES: keys compare equal only if their bytes are equal.
+  //
+  // Default: 0
+  size_t memtable_hash_buckets;
+
   // Control over open tables (max number of tables that can be opened).
   // You may need to increase this if your database has a large working set (
   // budget one open file per 2MB of working set).
@@ -113,6 +176,13 @@ struct DBOptions {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-NULL, cap the memory of memtables, open tables, and cached blocks
+  // at a budget possibly shared with other dbs. The budget's cache is used as
+  // both table_cache and block_cache if they are NULL, and write_buffer_size
+  // is replaced by a size set by the budget. The budget must outlive the db.
+  // Default: NULL
+  MemoryBudget* memory_budget;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -128,6 +198,15 @@ struct DBOptions {
   // Default: 16
   int block_restart_interval;
 
+  // If true, data blocks end with a hash index mapping each user key to
+  // the restart interval holding it. Point lookups consult the index to
+  // skip the binary search within a block, or the block scan altogether
+  // if the key is absent. Costs about one byte per key. Tables written
+  // with or without the index remain readable either way.
+  //
+  // Default: false
+  bool data_block_hash_index;
+
   // Number of keys between restart points for delta encoding for keys
   // in the index block.
   // This parameter can be changed dynamically.  Most clients should
@@ -194,6 +273,16 @@ struct DBOptions {
   // Default: false
   bool disable_write_ahead_log;
 
+  // Set to true to only switch to a new memtable when FlushMemTable() is
+  // called. Nothing written after the last FlushMemTable() reaches a table
+  // on its own. Combined with disable_write_ahead_log, a db reopened after a
+  // crash holds exactly the writes made before the last FlushMemTable().
+  // The current memtable is not bounded by the write buffer size; users are
+  // expected to watch the "leveldb.write-buffer-full" property and call
+  // FlushMemTable() once it turns to "1".
+  // Default: false
+  bool disable_auto_flush;
+
   // If true, no background compaction will be performed except for
   // those triggered by MemTable dumps.
   // All Tables will stay in Level-0 forever.
@@ -225,6 +314,16 @@ struct DBOptions {
   // Default: 2MB
   size_t table_file_size;
 
+  // If not 0, keys sharing their first this many bytes form a group, such as
+  // the entries of a single filesystem directory, that compactions try to
+  // keep within a single output table. Once an output table reaches 3/4 of
+  // its target size, it is closed at the next group boundary instead of at
+  // the target size. Group sizes are not known in advance, so a group that
+  // starts while the table is less than 3/4 full is still split at the
+  // target size, as is any group larger than a table.
+  // Default: 0
+  size_t table_split_prefix_length;
+
   // Maximum level to which a new compacted memtable is pushed if it does not
   // create overlap.
   // Default: 2; we try to push to level 2 to avoid relatively expensive level
@@ -237,6 +336,20 @@ struct DBOptions {
   // Default: 10
   int level_factor;
 
+  // Policy background compactions use to arrange tables into sorted runs.
+  // Tiered compactions rewrite fewer bytes per insertion than leveled ones
+  // at the expense of reads and space, which makes them a good fit for
+  // insert-heavy workloads that rarely overwrite keys.
+  // Default: kCompactionStyleLeveled
+  CompactionStyle compaction_style;
+
+  // In tiered style, two neighboring sorted runs are considered similar in
+  // size when the older run is at most this many times larger than the newer
+  // one. Runs are merged only when there is no room for new runs, and then
+  // the longest span of similar runs is merged.
+  // Default: 2
+  int tiered_size_ratio;
+
   // Number of files in Level-1 until compaction starts.
   // Default: 5
   int l1_compaction_trigger;
@@ -245,7 +358,10 @@ struct DBOptions {
   // Default: 4
   int l0_compaction_trigger;
 
-  // Number of files in Level-0 until writes are slowed down.
+  // Number of files in Level-0 until writes are slowed down. Once there,
+  // writes are admitted at a rate derived from the measured throughput of
+  // background compactions, lowered further as Level-0 approaches
+  // l0_hard_limit and as more bytes wait to be compacted.
   // Default: 8
   int l0_soft_limit;
 
@@ -253,9 +369,45 @@ struct DBOptions {
   // Default: 12
   int l0_hard_limit;
 
+  // Rate in bytes per second at which writes are admitted when writes are
+  // first slowed down, before background compaction throughput has been
+  // measured.
+  // Default: 16MB
+  uint64_t delayed_write_rate;
+
+  // If non-NULL, use the specified operator to fold operands written by
+  // DB::Merge() into their keys' values.
+  // Default: NULL
+  const MergeOperator* merge_operator;
+
   DBOptions();
 };
 
+// Read-path profiling context. Counters are accumulated by each read that
+// carries a pointer to the context in its ReadOptions. A context is not
+// synchronized and should not be shared by concurrent reads.
+struct ReadStats {
+  ReadStats();
+  void Clear();
+  void Merge(const ReadStats& other);
+  std::string ToString() const;
+
+  uint64_t gets;              // Number of point lookups
+  uint64_t mem_hits;          // Lookups served by the active memtable
+  uint64_t imm_hits;          // Lookups served by the immutable memtable
+  uint64_t table_probes;      // Number of sstables searched
+  uint64_t l0_table_probes;   // Number of level-0 sstables searched
+  uint64_t table_opens;       // Sstables opened due to table cache misses
+  uint64_t filter_checks;     // Number of filter block checks
+  uint64_t filter_negatives;  // Filter checks that avoided a block read
+  uint64_t hash_checks;       // Data block hash index lookups
+  uint64_t hash_negatives;    // Hash lookups that avoided a block scan
+  uint64_t block_cache_hits;
+  uint64_t block_cache_misses;
+  uint64_t block_reads;       // Data blocks read from storage
+  uint64_t block_read_bytes;  // Total size of data blocks read from storage
+};
+
 // Options that control read operations
 struct ReadOptions {
   // If true, all data read from underlying storage will be
@@ -268,6 +420,13 @@ struct ReadOptions {
   // Default: true
   bool fill_cache;
 
+  // If not 0, iterators read table data blocks ahead of their position,
+  // fetching this many bytes at a time. The amount doubles, up to 1MB, as
+  // long as blocks keep being read in file order. Meant for long scans,
+  // typically together with fill_cache=false. Point lookups ignore it.
+  // Default: 0
+  size_t readahead_size;
+
   // Only fetch the first "limit" bytes of value
   // (instead of fetching the value in its entirety).
   // This is useful when the caller only needs a small prefix of the value,
@@ -284,6 +443,10 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-NULL, accumulate read-path profiling events into "*stats".
+  // Default: NULL
+  ReadStats* stats;
+
   ReadOptions();
 };
 
@@ -319,6 +482,10 @@ struct FlushOptions {
   // Wait synchronously until the flush operation finishes.
   // Default: true
   bool wait;
+  // Do not switch to a new memtable. Only wait for memtables switched out
+  // earlier to finish flushing.
+  // Default: false
+  bool wait_only;
 
   FlushOptions();
 };
@@ -70,6 +70,11 @@ class Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const Slice& key) const;
 
+  // Return an estimate of the memory held by this table: its index block
+  // and its filter. Does not count data blocks, which are held in the block
+  // cache.
+  size_t ApproximateMemoryUsage() const;
+
   // Return the properties associated with the table or NULL
   // if no valid properties can be found.
   const TableProperties* GetProperties() const;
@@ -81,6 +86,18 @@ class Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void* table, const ReadOptions& options,
                                const Slice& block_handle);
+  // Same as above, but reading through a readahead buffer owned by the
+  // iterator using it. See ReadOptions::readahead_size.
+  static Iterator* ReadaheadBlockReader(void* readahead,
+                                        const ReadOptions& options,
+                                        const Slice& block_handle);
+  // Read a block from "file", which is either the table's own file or a
+  // readahead buffer over it. If "hash_key" is not NULL, consult the block's
+  // hash index to position the returned iterator's first Seek() or to skip
+  // the block when the key is absent.
+  Iterator* BlockReader(RandomAccessFile* file, const ReadOptions& options,
+                        const Slice& block_handle,
+                        const Slice* hash_key) const;
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
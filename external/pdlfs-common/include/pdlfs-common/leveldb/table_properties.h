@@ -40,6 +40,19 @@ class TableProperties {
     }
   }
 
+  // Mark the table's data blocks as carrying a hash index.
+  void SetDataBlockHashIndex(bool b) {
+    if (b) {
+      flags_ |= kDataBlockHashIndex;
+    } else {
+      flags_ &= ~kDataBlockHashIndex;
+    }
+  }
+
+  bool data_block_hash_index() const {
+    return (flags_ & kDataBlockHashIndex) != 0;
+  }
+
   Slice first_key() const { return first_key_; }
   Slice last_key() const { return last_key_; }
   uint64_t min_seq() const { return min_seq_; }
@@ -54,6 +67,10 @@ class TableProperties {
   std::string last_key_;
   uint64_t min_seq_;
   uint64_t max_seq_;
+  // Encoded after all other properties. Tables written before flags were
+  // introduced lack it and decode with all flags unset.
+  enum { kDataBlockHashIndex = 1 };
+  uint32_t flags_;
 };
 
 }  // namespace pdlfs
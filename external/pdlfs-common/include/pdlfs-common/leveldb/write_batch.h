@@ -50,6 +50,15 @@ class WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Append a merge operand "value" to be folded into the value of "key" by
+  // the database's merge operator.
+  void Merge(const Slice& key, const Slice& value);
+
+  // Erase every key in the range ["begin", "end") that the database
+  // contains at the time the batch is applied. Costs a single record
+  // regardless of how many keys the range holds.
+  void DeleteRange(const Slice& begin, const Slice& end);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -59,6 +68,9 @@ class WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    virtual void Merge(const Slice& key, const Slice& value) = 0;
+    // The default implementation ignores range deletions.
+    virtual void DeleteRange(const Slice& begin, const Slice& end);
   };
   Status Iterate(Handler* handler) const;
 
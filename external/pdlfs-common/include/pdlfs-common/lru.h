@@ -259,6 +259,24 @@ class LRUCache {
     // Separate from constructor so caller can easily
     // make an array of LRUCache
     capacity_ = c;
+    // Evict idle entries first. If that is not enough, kick out entries
+    // still in use; these remain alive until their clients release them.
+    while (usage_ > capacity_ && lru_.next != &lru_) {
+      E* const a = lru_.next;
+      assert(a->refs == 1);
+      E* const victim = table_.Remove(a->key(), a->hash);
+      assert(a == victim);
+      Remove(victim);
+    }
+    for (E* e = in_use_.next; usage_ > capacity_ && e != &in_use_;) {
+      E* const next = e->next;
+      if (e->in_cache) {
+        E* const victim = table_.Remove(e->key(), e->hash);
+        assert(e == victim);
+        Remove(victim);
+      }
+      e = next;
+    }
   }
 
   // Add a KV entry into the cache. If an entry with the same key is present in
@@ -60,4 +60,34 @@ class MutexLock {
   port::Mutex* const mu_;
 };
 
+// Helper classes that lock a reader-writer lock in shared or exclusive mode
+// on construction and unlock it on destruction.
+class ReadLock {
+ public:
+  explicit ReadLock(port::RWLock* mu) : mu_(mu) { mu_->ReadLock(); }
+
+  ~ReadLock() { mu_->ReadUnlock(); }
+
+ private:
+  // No copying allowed
+  ReadLock(const ReadLock&);
+  ReadLock& operator=(const ReadLock&);
+
+  port::RWLock* const mu_;
+};
+
+class WriteLock {
+ public:
+  explicit WriteLock(port::RWLock* mu) : mu_(mu) { mu_->WriteLock(); }
+
+  ~WriteLock() { mu_->WriteUnlock(); }
+
+ private:
+  // No copying allowed
+  WriteLock(const WriteLock&);
+  WriteLock& operator=(const WriteLock&);
+
+  port::RWLock* const mu_;
+};
+
 }  // namespace pdlfs
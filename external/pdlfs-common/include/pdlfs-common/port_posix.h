@@ -150,6 +150,30 @@ class CondVar {
   Mutex* mu_;
 };
 
+// A reader-writer lock. Once a writer waits, new readers wait behind it so
+// that a steady stream of readers cannot starve writers. Readers must
+// therefore not lock recursively.
+class RWLock {
+ public:
+  RWLock();
+  void ReadLock();
+  void ReadUnlock();
+  void WriteLock();
+  void WriteUnlock();
+  ~RWLock();
+
+ private:
+  Mutex mu_;
+  CondVar cv_;
+  int readers_;  // Number of readers holding the lock
+  int writers_;  // Number of writers holding or waiting for the lock
+  bool writing_;
+
+  // No copying
+  void operator=(const RWLock&);
+  RWLock(const RWLock&);
+};
+
 typedef pthread_once_t OnceType;
 #define PDLFS_ONCE_INIT PTHREAD_ONCE_INIT
 extern void InitOnce(OnceType* once, void (*initializer)());
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace pdlfs {
+
+// Priorities of rate limited I/O. Pending requests at a higher priority are
+// always granted before any request at a lower priority.
+enum IOPriority {
+  kIOPriorityLow,   // Table compactions
+  kIOPriorityHigh,  // Memtable compactions
+  kNumIOPriorities  // Must be the last
+};
+
+// A RateLimiter caps the bandwidth used by background I/O so that it does
+// not inflate the latency of foreground operations sharing the same device.
+// Foreground reads and writes are never charged against the limiter. A single
+// limiter may be shared by multiple DBs and by jobs running on different
+// threads, including the Env's background thread and any compaction_pool.
+// Implementations are thread-safe.
+class RateLimiter {
+ public:
+  RateLimiter() {}
+  virtual ~RateLimiter();
+
+  // Change the max number of bytes admitted per second. A rate of 0 admits
+  // all requests immediately.
+  virtual void SetBytesPerSecond(uint64_t bytes_per_sec) = 0;
+  virtual uint64_t GetBytesPerSecond() = 0;
+
+  // Max number of bytes a single request may ask for. Callers must break up
+  // larger I/O into multiple requests.
+  virtual size_t GetSingleBurstBytes() = 0;
+
+  // Block until "bytes" can be admitted at priority "pri".
+  // REQUIRES: bytes <= GetSingleBurstBytes().
+  virtual void Request(size_t bytes, IOPriority pri) = 0;
+
+  // Report the latency of a foreground operation. Auto-tuned limiters lower
+  // their rate when foreground latency exceeds the target, and raise it back
+  // toward the configured rate when foreground latency is under the target.
+  virtual void ReportForegroundLatency(uint64_t micros) = 0;
+
+  // Total number of bytes admitted at priority "pri".
+  virtual uint64_t GetTotalBytesThrough(IOPriority pri) = 0;
+
+ private:
+  // No copying allowed
+  void operator=(const RateLimiter&);
+  RateLimiter(const RateLimiter&);
+};
+
+// Create a token-bucket rate limiter admitting up to "bytes_per_sec" bytes
+// each second. Tokens are refilled every "refill_period_micros". If
+// "target_latency_micros" is not 0, the rate is auto-tuned between 1/20 of
+// "bytes_per_sec" and "bytes_per_sec" to keep the average foreground latency
+// reported through ReportForegroundLatency() under the target.
+extern RateLimiter* NewGenericRateLimiter(uint64_t bytes_per_sec,
+                                          uint64_t target_latency_micros = 0,
+                                          uint64_t refill_period_micros = 10000);
+
+// A WritableFile that charges all appends against a rate limiter. Owns the
+// base file but not the limiter.
+class RateLimitedWritableFile : public WritableFile {
+ public:
+  RateLimitedWritableFile(WritableFile* base, RateLimiter* limiter,
+                          IOPriority pri)
+      : base_(base), limiter_(limiter), pri_(pri) {}
+
+  virtual ~RateLimitedWritableFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    const size_t burst = limiter_->GetSingleBurstBytes();
+    Slice remaining = data;
+    while (remaining.size() > burst) {
+      limiter_->Request(burst, pri_);
+      Status s = base_->Append(Slice(remaining.data(), burst));
+      if (!s.ok()) {
+        return s;
+      }
+      remaining.remove_prefix(burst);
+    }
+    limiter_->Request(remaining.size(), pri_);
+    return base_->Append(remaining);
+  }
+
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+
+ private:
+  WritableFile* const base_;
+  RateLimiter* const limiter_;
+  const IOPriority pri_;
+};
+
+}  // namespace pdlfs
@@ -84,12 +84,16 @@ class ShardedLRUCache : public Cache {
   typedef LRUEntry<> E;
   LRUCache<E> sh_[kNumShards];
   port::Mutex mu_[kNumShards];
+  // Per-shard lookup stats. Protected by the shard's mutex.
+  uint64_t lookups_[kNumShards];
+  uint64_t hits_[kNumShards];
 
  public:
   explicit ShardedLRUCache(size_t capacity) : id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
       sh_[s].SetCapacity(per_shard);
+      lookups_[s] = hits_[s] = 0;
     }
   }
 
@@ -109,6 +113,8 @@ class ShardedLRUCache : public Cache {
     const uint32_t s = sha(hash);
     MutexLock l(&mu_[s]);
     E* e = sh_[s].Lookup(key, hash);
+    lookups_[s]++;
+    if (e != NULL) hits_[s]++;
     return reinterpret_cast<Handle*>(e);
   }
 
@@ -135,6 +141,32 @@ class ShardedLRUCache : public Cache {
     MutexLock l(&id_mu_);
     return ++(id_);
   }
+
+  virtual void SetCapacity(size_t capacity) {
+    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+    for (int s = 0; s < kNumShards; s++) {
+      MutexLock l(&mu_[s]);
+      sh_[s].SetCapacity(per_shard);
+    }
+  }
+
+  virtual size_t TotalCharge() {
+    size_t total = 0;
+    for (int s = 0; s < kNumShards; s++) {
+      MutexLock l(&mu_[s]);
+      total += sh_[s].usage();
+    }
+    return total;
+  }
+
+  virtual void GetHitStats(uint64_t* lookups, uint64_t* hits) {
+    *lookups = *hits = 0;
+    for (int s = 0; s < kNumShards; s++) {
+      MutexLock l(&mu_[s]);
+      *lookups += lookups_[s];
+      *hits += hits_[s];
+    }
+  }
 };
 
 Cache* NewLRUCache(size_t capacity) {
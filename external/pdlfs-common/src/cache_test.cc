@@ -179,6 +179,46 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
 }
 
+TEST(CacheTest, SetCapacity) {
+  const int n = 256;  // Leaves room for uneven sharding
+  for (int i = 0; i < n; i++) {
+    Insert(i, 1000 + i);
+  }
+  ASSERT_EQ(n, cache_->TotalCharge());
+  Cache::Handle* h = cache_->Lookup(EncodeKey(n - 1));
+  ASSERT_TRUE(h != NULL);
+
+  // Shrinking the cache evicts entries, including pinned ones
+  cache_->SetCapacity(n / 2);
+  ASSERT_LE(cache_->TotalCharge(), n / 2);
+  cache_->SetCapacity(0);
+  ASSERT_EQ(0, cache_->TotalCharge());
+  ASSERT_EQ(n - 1, deleted_keys_.size());
+  ASSERT_EQ(-1, Lookup(n - 1));
+  ASSERT_EQ(1000 + n - 1, DecodeValue(cache_->Value(h)));
+  cache_->Release(h);
+  ASSERT_EQ(n, deleted_keys_.size());
+
+  cache_->SetCapacity(kCacheSize);
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(1, cache_->TotalCharge());
+}
+
+TEST(CacheTest, HitStats) {
+  uint64_t lookups, hits;
+  cache_->GetHitStats(&lookups, &hits);
+  ASSERT_EQ(0, lookups);
+  ASSERT_EQ(0, hits);
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(-1, Lookup(300));
+  cache_->GetHitStats(&lookups, &hits);
+  ASSERT_EQ(3, lookups);
+  ASSERT_EQ(1, hits);
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
@@ -15,6 +15,7 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
@@ -108,6 +109,116 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+struct PoolState {
+  PoolState() : cv(&mu), done(0), blocked(true) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  int done;
+  bool blocked;
+  std::string order;
+  ThreadPool* pool;
+};
+
+static void CountTask(void* arg) {
+  PoolState* s = reinterpret_cast<PoolState*>(arg);
+  MutexLock ml(&s->mu);
+  s->done++;
+  s->cv.SignalAll();
+}
+
+static void SpawnTask(void* arg) {  // Schedules more tasks from a pool thread
+  PoolState* s = reinterpret_cast<PoolState*>(arg);
+  for (int i = 0; i < 10; i++) {
+    s->pool->Schedule(&CountTask, s);
+  }
+  CountTask(s);
+}
+
+static void WaitForTasks(PoolState* s, int n) {
+  MutexLock ml(&s->mu);
+  while (s->done < n) {
+    s->cv.Wait();
+  }
+}
+
+TEST(EnvPosixTest, WorkStealingRunMany) {
+  PoolState state;
+  state.pool = ThreadPool::NewWorkStealing(4);
+  for (int i = 0; i < 1000; i++) {
+    state.pool->Schedule(&SpawnTask, &state);
+  }
+  WaitForTasks(&state, 11000);
+  ASSERT_TRUE(Slice(state.pool->ToDebugString()).starts_with("Tpool: work"));
+  delete state.pool;
+  ASSERT_EQ(state.done, 11000);
+}
+
+static void BlockTask(void* arg) {
+  PoolState* s = reinterpret_cast<PoolState*>(arg);
+  MutexLock ml(&s->mu);
+  while (s->blocked) {
+    s->cv.Wait();
+  }
+}
+
+static void HighTask(void* arg) {
+  PoolState* s = reinterpret_cast<PoolState*>(arg);
+  MutexLock ml(&s->mu);
+  s->order.push_back('h');
+  s->done++;
+  s->cv.SignalAll();
+}
+
+static void NormalTask(void* arg) {
+  PoolState* s = reinterpret_cast<PoolState*>(arg);
+  MutexLock ml(&s->mu);
+  s->order.push_back('n');
+  s->done++;
+  s->cv.SignalAll();
+}
+
+TEST(EnvPosixTest, WorkStealingPriorities) {
+  PoolState state;
+  state.pool = ThreadPool::NewWorkStealing(1);
+  state.pool->Schedule(&BlockTask, &state);
+  state.pool->ScheduleWithPriority(&NormalTask, &state, ThreadPool::kNormal);
+  state.pool->ScheduleWithPriority(&HighTask, &state, ThreadPool::kHigh);
+  state.pool->ScheduleWithPriority(&NormalTask, &state, ThreadPool::kNormal);
+  {
+    MutexLock ml(&state.mu);
+    state.blocked = false;
+    state.cv.SignalAll();
+  }
+  WaitForTasks(&state, 3);
+  ASSERT_EQ(state.order, "hnn");
+  delete state.pool;
+}
+
+TEST(EnvPosixTest, WorkStealingPause) {
+  PoolState state;
+  state.pool = ThreadPool::NewWorkStealing(2);
+  state.pool->Pause();
+  state.pool->Schedule(&CountTask, &state);
+  SleepForMicroseconds(kDelayMicros);
+  {
+    MutexLock ml(&state.mu);
+    ASSERT_EQ(state.done, 0);
+  }
+  state.pool->Resume();
+  WaitForTasks(&state, 1);
+  delete state.pool;
+}
+
+TEST(EnvPosixTest, ThreadPoolEnvWrapper) {
+  PoolState state;
+  state.pool = ThreadPool::NewWorkStealing(2);
+  Env* const env = Env::NewThreadPoolEnvWrapper(env_, state.pool);
+  env->Schedule(&SpawnTask, &state);
+  WaitForTasks(&state, 11);
+  delete env;
+  delete state.pool;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
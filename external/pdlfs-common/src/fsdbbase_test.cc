@@ -10,8 +10,13 @@
  */
 
 #include "pdlfs-common/fsdbbase.h"
+#include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 
 class KeyTest {
@@ -131,6 +136,56 @@ class DirIdTest {
   // Empty
 };
 
+#if !defined(DELTAFS_PROTO) && !defined(DELTAFS)
+TEST(KeyTest, FixedPrefixOrder) {
+  const Comparator* const bytewise = BytewiseComparator();
+  const Comparator* const cmp = FixedPrefixComparator();
+  ASSERT_EQ(std::string(cmp->Name()), bytewise->Name());
+  Random rnd(301);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 200; i++) {
+    Key key(rnd.Skewed(30), static_cast<KeyType>(rnd.Uniform(8)));
+    std::string name;
+    for (int j = rnd.Uniform(4); j > 0; j--) {
+      name.push_back(static_cast<char>(rnd.Uniform(256)));
+    }
+    key.SetName(name);
+    keys.push_back(key.Encode().ToString());
+    if (i % 10 == 0) {  // Short keys
+      keys.push_back(keys.back().substr(0, rnd.Uniform(8)));
+    }
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    for (size_t j = 0; j < keys.size(); j++) {
+      const Slice a = keys[i];
+      const Slice b = keys[j];
+      const int r = cmp->Compare(a, b);
+      const int expected = bytewise->Compare(a, b);
+      ASSERT_EQ(r < 0, expected < 0);
+      ASSERT_EQ(r > 0, expected > 0);
+      if (r < 0) {
+        std::string sep = keys[i];
+        cmp->FindShortestSeparator(&sep, b);
+        ASSERT_TRUE(sep.size() <= a.size());
+        ASSERT_TRUE(cmp->Compare(a, sep) <= 0);
+        ASSERT_TRUE(cmp->Compare(sep, b) < 0);
+      }
+    }
+    std::string succ = keys[i];
+    cmp->FindShortSuccessor(&succ);
+    ASSERT_TRUE(cmp->Compare(keys[i], succ) <= 0);
+  }
+  // Keys under different dirs are separated by a bare prefix
+  Key k1(7, kDirEntType);
+  k1.SetName("abcdefg");
+  Key k2(9, kDirEntType);
+  k2.SetName("a");
+  std::string sep = k1.Encode().ToString();
+  cmp->FindShortestSeparator(&sep, k2.Encode());
+  ASSERT_EQ(Slice(sep), Key(7, static_cast<KeyType>(kDirEntType + 1)).prefix());
+}
+#endif
+
 TEST(DirIdTest, DirIdEnc1) {
   DirId id1(2);
   ASSERT_EQ(id1.ino, 2);
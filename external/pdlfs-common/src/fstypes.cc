@@ -12,6 +12,15 @@
 #include "pdlfs-common/fstypes.h"
 #include "pdlfs-common/coding.h"
 
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace pdlfs {
 // Ensure a filesystem definition if none is given
 #if !defined(DELTAFS_PROTO) && !defined(DELTAFS) && !defined(INDEXFS) && \
@@ -109,6 +118,211 @@ bool Stat::DecodeFrom(Slice* input) {
   return true;
 }
 
+void StatBatch::Clear() {
+#if defined(DELTAFS_PROTO)
+  dno.clear();
+#endif
+#if defined(DELTAFS)
+  reg_id.clear();
+  snap_id.clear();
+#endif
+  ino.clear();
+  size.clear();
+  mode.clear();
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  zeroth_server.clear();
+#endif
+  uid.clear();
+  gid.clear();
+  mtime.clear();
+  ctime.clear();
+}
+
+void StatBatch::Append(const Stat& stat) {
+#if defined(DELTAFS_PROTO)
+  dno.push_back(stat.DnodeNo());
+#endif
+#if defined(DELTAFS)
+  reg_id.push_back(stat.RegId());
+  snap_id.push_back(stat.SnapId());
+#endif
+  ino.push_back(stat.InodeNo());
+  size.push_back(stat.FileSize());
+  mode.push_back(stat.FileMode());
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  zeroth_server.push_back(stat.ZerothServer());
+#endif
+  uid.push_back(stat.UserId());
+  gid.push_back(stat.GroupId());
+  mtime.push_back(stat.ModifyTime());
+  ctime.push_back(stat.ChangeTime());
+}
+
+void StatBatch::Get(size_t i, Stat* stat) const {
+  assert(i < count());
+#if defined(DELTAFS_PROTO)
+  stat->SetDnodeNo(dno[i]);
+#endif
+#if defined(DELTAFS)
+  stat->SetRegId(reg_id[i]);
+  stat->SetSnapId(snap_id[i]);
+#endif
+  stat->SetInodeNo(ino[i]);
+  stat->SetFileSize(size[i]);
+  stat->SetFileMode(mode[i]);
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  stat->SetZerothServer(zeroth_server[i]);
+#endif
+  stat->SetUserId(uid[i]);
+  stat->SetGroupId(gid[i]);
+  stat->SetModifyTime(mtime[i]);
+  stat->SetChangeTime(ctime[i]);
+}
+
+namespace {
+
+// Whether each varint of a stat encoding, in encoding order, is 64 bits.
+const bool kWideField[] = {
+#if defined(DELTAFS_PROTO)
+    true,  // dno
+#endif
+#if defined(DELTAFS)
+    true,  // reg_id
+    true,  // snap_id
+#endif
+    true,   // ino
+    true,   // size
+    false,  // mode
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+    false,  // zeroth_server
+#endif
+    false,  // uid
+    false,  // gid
+    true,   // mtime
+    true    // ctime
+};
+
+enum { kNumFields = sizeof(kWideField) / sizeof(kWideField[0]) };
+
+// Stats are decoded from a local copy of at most this many bytes so that
+// word-sized loads never read past the end of the caller's buffer.
+enum { kWindow = 64 };
+
+// Return a mask with bit i set iff p[i] ends a varint (its high bit is
+// clear), for i in [0,kWindow).
+inline uint64_t StopBits(const char* p) {
+  uint64_t cont = 0;
+#if defined(__SSE2__)
+  for (int i = 0; i < kWindow; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    uint64_t m = static_cast<uint32_t>(_mm_movemask_epi8(v));
+    cont |= m << i;
+  }
+#else
+  for (int i = 0; i < kWindow; i += 8) {
+    // Gather the high bit of each byte into the top byte of the product
+    uint64_t w = DecodeFixed64(p + i) & 0x8080808080808080ull;
+    uint64_t m = (w * 0x0002040810204081ull) >> 56;
+    cont |= m << i;
+  }
+#endif
+  return ~cont;
+}
+
+inline int CountTrailingZeros(uint64_t x) {
+  assert(x != 0);
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+// Return the value of the len-byte varint at p, where 0 < len <= 8 and p
+// has at least 8 readable bytes.
+inline uint64_t ExtractVarint(const char* p, int len) {
+  uint64_t x = DecodeFixed64(p);
+  if (len < 8) x &= (1ull << (8 * len)) - 1;
+  x &= 0x7f7f7f7f7f7f7f7full;
+  // Squeeze out the continuation bits: 7-bit groups are merged pairwise
+  // into 14-, 28-, and then 56-bit groups.
+  x = (x & 0x007f007f007f007full) | ((x & 0x7f007f007f007f00ull) >> 1);
+  x = (x & 0x00003fff00003fffull) | ((x & 0x3fff00003fff0000ull) >> 2);
+  x = (x & 0x000000000fffffffull) | ((x & 0x0fffffff00000000ull) >> 4);
+  return x;
+}
+
+// Decode the fields of the stat at the beginning of *input into vals[].
+// Return false if the stat is not entirely within the first kWindow bytes,
+// or if any of its fields needs more than 8 bytes or is too long for its
+// type, leaving the stat to the scalar decoder.
+bool DecodeStatFast(Slice* input, uint64_t* vals) {
+  char buf[kWindow + 8];
+  const size_t n = std::min<size_t>(input->size(), kWindow);
+  memcpy(buf, input->data(), n);
+  memset(buf + n, 0, sizeof(buf) - n);
+  uint64_t stops = StopBits(buf);
+  size_t pos = 0;
+  for (int i = 0; i < kNumFields; i++) {
+    if (pos >= kWindow || (stops >> pos) == 0) {
+      return false;
+    }
+    const int len = CountTrailingZeros(stops >> pos) + 1;
+    if (pos + len > n || len > (kWideField[i] ? 8 : 5)) {
+      return false;
+    }
+    vals[i] = ExtractVarint(buf + pos, len);
+    if (!kWideField[i]) {  // Same truncation as GetVarint32
+      vals[i] = static_cast<uint32_t>(vals[i]);
+    }
+    pos += len;
+  }
+  input->remove_prefix(pos);
+  return true;
+}
+
+}  // namespace
+
+size_t DecodeStats(Slice* encodings, size_t n, StatBatch* batch) {
+  uint64_t vals[kNumFields];
+  Stat stat;
+  size_t i = 0;
+  for (; i < n; i++) {
+    if (!DecodeStatFast(&encodings[i], vals)) {
+      if (!stat.DecodeFrom(&encodings[i])) {
+        break;
+      }
+      batch->Append(stat);
+      continue;
+    }
+    int f = 0;
+#if defined(DELTAFS_PROTO)
+    batch->dno.push_back(vals[f++]);
+#endif
+#if defined(DELTAFS)
+    batch->reg_id.push_back(vals[f++]);
+    batch->snap_id.push_back(vals[f++]);
+#endif
+    batch->ino.push_back(vals[f++]);
+    batch->size.push_back(vals[f++]);
+    batch->mode.push_back(static_cast<uint32_t>(vals[f++]));
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+    batch->zeroth_server.push_back(static_cast<uint32_t>(vals[f++]));
+#endif
+    batch->uid.push_back(static_cast<uint32_t>(vals[f++]));
+    batch->gid.push_back(static_cast<uint32_t>(vals[f++]));
+    batch->mtime.push_back(vals[f++]);
+    batch->ctime.push_back(vals[f++]);
+    assert(f == kNumFields);
+  }
+  return i;
+}
+
 #if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
 Slice LookupStat::EncodeTo(char* scratch) const {
   char* p = scratch;
@@ -10,8 +10,16 @@
  */
 
 #include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 
 class StatTest {
@@ -49,6 +57,85 @@ TEST(StatTest, StatEncoding) {
   ASSERT_EQ(encoding, encoding2);
 }
 
+namespace {
+uint64_t RandomValue(Random* rnd) {
+  uint64_t v = rnd->Next();
+  return (v << 32 | rnd->Next()) >> rnd->Uniform(64);
+}
+
+void RandomStat(Random* rnd, Stat* stat) {
+#if defined(DELTAFS_PROTO)
+  stat->SetDnodeNo(RandomValue(rnd));
+#endif
+#if defined(DELTAFS)
+  stat->SetRegId(RandomValue(rnd));
+  stat->SetSnapId(RandomValue(rnd));
+#endif
+  stat->SetInodeNo(RandomValue(rnd));
+  stat->SetFileSize(RandomValue(rnd));
+  stat->SetFileMode(rnd->Skewed(31));
+#if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
+  stat->SetZerothServer(rnd->Skewed(31));
+#endif
+  stat->SetUserId(rnd->Skewed(31));
+  stat->SetGroupId(rnd->Skewed(31));
+  stat->SetModifyTime(RandomValue(rnd));
+  stat->SetChangeTime(RandomValue(rnd));
+}
+
+std::string EncodeStat(const Stat& stat) {
+  char tmp[Stat::kMaxEncodedLength];
+  return stat.EncodeTo(tmp).ToString();
+}
+}  // namespace
+
+TEST(StatTest, BatchDecoding) {
+  Random rnd(301);
+  std::vector<std::string> encodings;
+  for (int i = 0; i < 1000; i++) {
+    Stat stat;
+    RandomStat(&rnd, &stat);
+    encodings.push_back(EncodeStat(stat));
+    if (i % 3 == 0) {  // Something after the stat
+      PutLengthPrefixedSlice(&encodings.back(), "name");
+    }
+  }
+  // A mode needing more than 5 bytes is rejected by the scalar decoder
+  std::string bad;
+  PutVarint64(&bad, 1);
+  PutVarint64(&bad, 2);
+  PutVarint64(&bad, 1ull << 40);
+  bad.append(16, '\0');
+  encodings.push_back(bad);
+  std::vector<Slice> inputs(encodings.begin(), encodings.end());
+  StatBatch batch;
+  size_t n = DecodeStats(&inputs[0], inputs.size(), &batch);
+  ASSERT_EQ(n, encodings.size() - 1);
+  ASSERT_EQ(batch.count(), n);
+  for (size_t i = 0; i < n; i++) {
+    Slice input = encodings[i];
+    Stat expected;
+    ASSERT_TRUE(expected.DecodeFrom(&input));
+    ASSERT_EQ(inputs[i], input);  // Same bytes consumed
+    Stat stat;
+    batch.Get(i, &stat);
+    ASSERT_EQ(EncodeStat(stat), EncodeStat(expected));
+    ASSERT_EQ(batch.ino[i], expected.InodeNo());
+    ASSERT_EQ(batch.mtime[i], expected.ModifyTime());
+  }
+  // Truncated stats are rejected
+  batch.Clear();
+  for (size_t i = 0; i < 100; i++) {
+    std::string enc = encodings[i];
+    Slice input = enc;
+    Stat stat;
+    ASSERT_TRUE(stat.DecodeFrom(&input));
+    Slice truncated(enc.data(), enc.size() - input.size() - 1);
+    ASSERT_EQ(DecodeStats(&truncated, 1, &batch), 0);
+  }
+  ASSERT_EQ(batch.count(), 0);
+}
+
 #if defined(DELTAFS_PROTO) || defined(DELTAFS) || defined(INDEXFS)
 class LookupEntryTest {
   // Empty
@@ -85,6 +172,57 @@ TEST(LookupEntryTest, EntryEncoding) {
 
 }  // namespace pdlfs
 
+namespace pdlfs {
+namespace {
+// Compare decoding stats one by one with decoding them in batches.
+void BM_DecodeStats(int num_stats, int reps) {
+  Random rnd(301);
+  std::vector<std::string> encodings(num_stats);
+  for (int i = 0; i < num_stats; i++) {
+    Stat stat;
+    RandomStat(&rnd, &stat);
+    stat.SetFileMode(0100644);  // Keep to typical values
+    stat.SetUserId(1000);
+    stat.SetGroupId(1000);
+    stat.SetModifyTime(1600000000000000ull + i);
+    stat.SetChangeTime(1600000000000000ull + i);
+    encodings[i] = EncodeStat(stat);
+  }
+  std::vector<Slice> inputs(num_stats);
+  uint64_t sum = 0;
+  uint64_t start = CurrentMicros();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < num_stats; i++) {
+      Stat stat;
+      stat.DecodeFrom(encodings[i]);
+      sum += stat.FileSize();
+    }
+  }
+  const uint64_t scalar = CurrentMicros() - start;
+  StatBatch batch;
+  start = CurrentMicros();
+  for (int r = 0; r < reps; r++) {
+    inputs.assign(encodings.begin(), encodings.end());
+    batch.Clear();
+    DecodeStats(&inputs[0], num_stats, &batch);
+    for (int i = 0; i < num_stats; i++) {
+      sum += batch.size[i];
+    }
+  }
+  const uint64_t batched = CurrentMicros() - start;
+  const double total = double(num_stats) * reps;
+  fprintf(stderr, "scalar: %8.3f ns/stat\n", 1000.0 * scalar / total);
+  fprintf(stderr, "batch:  %8.3f ns/stat\n", 1000.0 * batched / total);
+  fprintf(stderr, "(checksum: %llu)\n", static_cast<unsigned long long>(sum));
+}
+}  // namespace
+}  // namespace pdlfs
+
 int main(int argc, char** argv) {
-  return ::pdlfs::test::RunAllTests(&argc, &argv);
+  if (argc < 2 || strcmp(argv[argc - 1], "--bench") != 0) {
+    return ::pdlfs::test::RunAllTests(&argc, &argv);
+  } else {
+    ::pdlfs::BM_DecodeStats(4096, 1000);
+    return 0;
+  }
 }
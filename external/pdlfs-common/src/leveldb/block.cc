@@ -20,6 +20,7 @@
 #include "pdlfs-common/leveldb/iterator.h"
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/strutil.h"
 
 #include <algorithm>
@@ -28,25 +29,59 @@
 // Decodes the blocks generated by block_builder.cc.
 namespace pdlfs {
 
-inline uint32_t Block::NumRestarts() const {
-  assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
-}
+const uint32_t Block::kNotInBlock = 0xffffffffu;
+const uint32_t Block::kUnknownInterval = 0xfffffffeu;
 
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
+      restart_offset_(0),
+      num_restarts_(0),
+      hash_buckets_(NULL),
+      num_buckets_(0),
       owned_(contents.heap_allocated) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
-    if (NumRestarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
+    return;
+  }
+  size_t limit = size_ - sizeof(uint32_t);
+  num_restarts_ = DecodeFixed32(data_ + limit);
+  if ((num_restarts_ & kBlockHashIndexFlag) != 0) {
+    num_restarts_ &= ~kBlockHashIndexFlag;
+    if (limit < sizeof(uint16_t)) {
       size_ = 0;
-    } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      return;
+    }
+    limit -= sizeof(uint16_t);
+    num_buckets_ = DecodeFixed16(data_ + limit);
+    if (num_buckets_ == 0 || limit < num_buckets_) {
+      size_ = 0;
+      return;
     }
+    limit -= num_buckets_;
+    hash_buckets_ = reinterpret_cast<const uint8_t*>(data_ + limit);
+  }
+  const size_t max_restarts_allowed = limit / sizeof(uint32_t);
+  if (num_restarts_ > max_restarts_allowed) {
+    // The size is too small for num_restarts_
+    size_ = 0;
+  } else {
+    restart_offset_ = limit - num_restarts_ * sizeof(uint32_t);
+  }
+}
+
+uint32_t Block::HashLookup(const Slice& hash_key) const {
+  if (hash_buckets_ == NULL || size_ == 0) {
+    return kUnknownInterval;
+  }
+  const uint32_t h = Hash(hash_key.data(), hash_key.size(), kBlockHashSeed);
+  const uint8_t b = hash_buckets_[h % num_buckets_];
+  if (b == kBlockHashNoEntry) {
+    return kNotInBlock;
+  } else if (b == kBlockHashCollision || b >= num_restarts_) {
+    return kUnknownInterval;
+  } else {
+    return b;
   }
 }
 
@@ -95,6 +130,9 @@ class Block::Iter : public Iterator {
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
   uint32_t restart_index_;  // Index of restart block in which current_ falls
+  // Restart interval for the next Seek() to scan, or num_restarts_ to
+  // binary search for it
+  uint32_t seek_hint_;
   std::string key_;
   Slice value_;
   Status status_;
@@ -125,13 +163,14 @@ class Block::Iter : public Iterator {
 
  public:
   Iter(const Comparator* comparator, const char* data, uint32_t restarts,
-       uint32_t num_restarts)
+       uint32_t num_restarts, uint32_t seek_hint)
       : comparator_(comparator),
         data_(data),
         restarts_(restarts),
         num_restarts_(num_restarts),
         current_(restarts_),
-        restart_index_(num_restarts_) {
+        restart_index_(num_restarts_),
+        seek_hint_(seek_hint) {
     assert(num_restarts_ > 0);
   }
 
@@ -173,6 +212,25 @@ class Block::Iter : public Iterator {
   }
 
   virtual void Seek(const Slice& target) {
+    if (seek_hint_ < num_restarts_) {
+      // Scan the hinted restart interval. Fall back to the binary search
+      // below unless the interval holds the answer.
+      const uint32_t hint = seek_hint_;
+      seek_hint_ = num_restarts_;  // Later seeks may be for other keys
+      SeekToRestartPoint(hint);
+      bool first = true;
+      while (ParseNextKey() && restart_index_ == hint) {
+        if (Compare(key_, target) >= 0) {
+          if (!first || hint == 0) return;
+          break;
+        }
+        first = false;
+      }
+      if (!status_.ok()) {
+        return;
+      }
+    }
+
     // Binary search in restart array to find the last restart point
     // with a key < target
     uint32_t left = 0;
@@ -264,14 +322,18 @@ class Block::Iter : public Iterator {
 };
 
 Iterator* Block::NewIterator(const Comparator* cmp) {
+  return NewIterator(cmp, num_restarts_);
+}
+
+Iterator* Block::NewIterator(const Comparator* cmp, uint32_t restart_index) {
   if (size_ < sizeof(uint32_t)) {
     return NewErrorIterator(Status::Corruption("bad block contents"));
   }
-  const uint32_t num_restarts = NumRestarts();
-  if (num_restarts == 0) {
+  if (num_restarts_ == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(cmp, data_, restart_offset_, num_restarts);
+    return new Iter(cmp, data_, restart_offset_, num_restarts_,
+                    std::min(restart_index, num_restarts_));
   }
 }
 
@@ -20,6 +20,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/port.h"
 
 #include <assert.h>
@@ -48,6 +49,15 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// Blocks with a hash index instead end with:
+//     restarts: uint32[num_restarts]
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint16
+//     num_restarts | kBlockHashIndexFlag: uint32
+// buckets[Hash(key) % num_buckets] holds the restart interval of key, or
+// kBlockHashNoEntry if no key in the block hashes to it, or
+// kBlockHashCollision if keys from several restart intervals do.
 namespace pdlfs {
 
 AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
@@ -56,12 +66,20 @@ AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
       compression_(kNoCompression),
       finished_(false) {}
 
+// Restart intervals a hash index can address
+static const size_t kMaxHashIndexRestarts = kBlockHashCollision;
+
+// Buckets per key of a hash index
+static const double kHashIndexRatio = 4.0 / 3.0;
+
 // By default, we assume keys are inserted in strict binary order.
 // This is consistent with LevelDb's semantics.
 BlockBuilder::BlockBuilder(int restart_interval)
     : AbstractBlockBuilder(BytewiseComparator()),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false),
+      hash_trailer_size_(0) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
@@ -73,13 +91,21 @@ BlockBuilder::BlockBuilder(int restart_interval)
 BlockBuilder::BlockBuilder(int restart_interval, const Comparator* cmp)
     : AbstractBlockBuilder(cmp),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false),
+      hash_trailer_size_(0) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
   }
 }
 
+void BlockBuilder::EnableHashIndex(size_t trailer_size) {
+  assert(empty());
+  hash_index_ = true;
+  hash_trailer_size_ = trailer_size;
+}
+
 void AbstractBlockBuilder::TEST_SwitchBuffer(std::string* buffer) {
   if (buffer != NULL && buffer != &buffer_) buffer->swap(buffer_);
   buffer_start_ = buffer_.size();
@@ -135,13 +161,19 @@ void BlockBuilder::Reset() {
   restarts_.clear();
   restarts_.push_back(0);  // First restart point is at offset 0
   counter_ = 0;
+  hashes_.clear();
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
   size_t result = buffer_.size() - buffer_start_;
   if (!finished_) {
     // Plus restart array contents and its length
-    return result + restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    result += restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    if (hash_index_) {  // Plus hash buckets and their count
+      result += static_cast<size_t>(hashes_.size() * kHashIndexRatio) + 1 +
+                sizeof(uint16_t);
+    }
+    return result;
   } else {
     return result;
   }
@@ -155,11 +187,37 @@ Slice BlockBuilder::Finish(CompressionType compression,
     PutFixed32(&buffer_, restarts_[i]);
   }
   uint32_t num_restarts = static_cast<uint32_t>(restarts_.size());
+  if (hash_index_ && !hashes_.empty() &&
+      restarts_.size() <= kMaxHashIndexRestarts) {
+    AppendHashIndex();
+    num_restarts |= kBlockHashIndexFlag;
+  }
   // Remember the array size
   PutFixed32(&buffer_, num_restarts);
   return AbstractBlockBuilder::Finish(compression, force_compression);
 }
 
+void BlockBuilder::AppendHashIndex() {
+  size_t num_buckets = static_cast<size_t>(hashes_.size() * kHashIndexRatio);
+  num_buckets = std::max<size_t>(num_buckets, 1);
+  num_buckets = std::min<size_t>(num_buckets, 65535);
+  const size_t start = buffer_.size();
+  buffer_.resize(start + num_buckets, static_cast<char>(kBlockHashNoEntry));
+  uint8_t* const buckets = reinterpret_cast<uint8_t*>(&buffer_[start]);
+  for (size_t i = 0; i < hashes_.size(); i++) {
+    uint8_t* const b = &buckets[hashes_[i].first % num_buckets];
+    const uint8_t restart = static_cast<uint8_t>(hashes_[i].second);
+    if (*b == kBlockHashNoEntry) {
+      *b = restart;
+    } else if (*b != restart) {
+      *b = kBlockHashCollision;
+    }
+  }
+  char buf[2];
+  EncodeFixed16(buf, static_cast<uint16_t>(num_buckets));
+  buffer_.append(buf, sizeof(buf));
+}
+
 Slice AbstractBlockBuilder::Finalize(bool crc32c, uint32_t padding_target,
                                      char padding_char) {
   assert(finished_);
@@ -219,6 +277,18 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   last_key_.append(key.data() + shared, non_shared);
   assert(Slice(last_key_) == key);
   counter_++;
+
+  if (hash_index_) {
+    const size_t n = key.size() > hash_trailer_size_
+                         ? key.size() - hash_trailer_size_
+                         : 0;
+    const uint32_t restart = static_cast<uint32_t>(restarts_.size() - 1);
+    const std::pair<uint32_t, uint32_t> h(
+        Hash(key.data(), n, kBlockHashSeed), restart);
+    if (hashes_.empty() || hashes_.back() != h) {
+      hashes_.push_back(h);
+    }
+  }
 }
 
 }  // namespace pdlfs
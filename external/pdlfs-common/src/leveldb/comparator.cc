@@ -21,6 +21,7 @@
 #include "pdlfs-common/strutil.h"
 
 #include <stdint.h>
+#include <string.h>
 #include <algorithm>
 
 namespace pdlfs {
@@ -75,16 +76,107 @@ class BytewiseComparatorImpl : public Comparator {
     // *key is a run of 0xffs.  Leave it alone.
   }
 };
+
+// Orders keys exactly as BytewiseComparatorImpl does, but compares the
+// leading kPrefixLength bytes of two keys as a single big-endian integer
+// before looking at the rest of them. Shares the name of the bytewise
+// comparator as the order is the same.
+class FixedPrefixComparatorImpl : public BytewiseComparatorImpl {
+ public:
+  enum { kPrefixLength = 8 };
+
+  FixedPrefixComparatorImpl() {}
+
+  virtual int Compare(const Slice& a, const Slice& b) const {
+    if (a.size() < kPrefixLength || b.size() < kPrefixLength) {
+      return a.compare(b);
+    }
+    const uint64_t x = Prefix(a.data());
+    const uint64_t y = Prefix(b.data());
+    if (x != y) {
+      return x < y ? -1 : +1;
+    }
+    return Slice(a.data() + kPrefixLength, a.size() - kPrefixLength)
+        .compare(Slice(b.data() + kPrefixLength, b.size() - kPrefixLength));
+  }
+
+  // Between keys with different prefixes, use the smallest prefix above
+  // that of *start. The result is a bare prefix and remains on the fast
+  // path of Compare(), unlike the arbitrarily short strings produced by
+  // bytewise shortening.
+  virtual void FindShortestSeparator(std::string* start,
+                                     const Slice& limit) const {
+    if (start->size() >= kPrefixLength && limit.size() >= kPrefixLength) {
+      const uint64_t x = Prefix(start->data());
+      const uint64_t y = Prefix(limit.data());
+      if (x < y) {
+        if (x + 1 < y || limit.size() > kPrefixLength) {
+          SetPrefix(start, x + 1);
+          assert(Compare(*start, limit) < 0);
+        }
+        return;
+      }
+    }
+    BytewiseComparatorImpl::FindShortestSeparator(start, limit);
+  }
+
+  virtual void FindShortSuccessor(std::string* key) const {
+    if (key->size() >= kPrefixLength) {
+      const uint64_t x = Prefix(key->data());
+      if (x != ~static_cast<uint64_t>(0)) {
+        SetPrefix(key, x + 1);
+        return;
+      }
+    }
+    BytewiseComparatorImpl::FindShortSuccessor(key);
+  }
+
+ private:
+  static uint64_t ByteSwap(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_bswap64(x);
+#else
+    uint64_t r = 0;
+    for (int i = 0; i < 8; i++) {
+      r = (r << 8) | (x & 0xff);
+      x >>= 8;
+    }
+    return r;
+#endif
+  }
+
+  // Prefixes are stored in big-endian byte order
+  static uint64_t Prefix(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return port::kLittleEndian ? ByteSwap(x) : x;
+  }
+
+  static void SetPrefix(std::string* key, uint64_t x) {
+    if (port::kLittleEndian) x = ByteSwap(x);
+    key->resize(kPrefixLength);
+    memcpy(&(*key)[0], &x, sizeof(x));
+  }
+};
 }  // namespace
 
 static port::OnceType once = PDLFS_ONCE_INIT;
 static const Comparator* bytewise;
+static const Comparator* fixed_prefix;
 
-static void InitModule() { bytewise = new BytewiseComparatorImpl; }
+static void InitModule() {
+  bytewise = new BytewiseComparatorImpl;
+  fixed_prefix = new FixedPrefixComparatorImpl;
+}
 
 const Comparator* BytewiseComparator() {
   port::InitOnce(&once, InitModule);
   return bytewise;
 }
 
+const Comparator* FixedPrefixComparator() {
+  port::InitOnce(&once, InitModule);
+  return fixed_prefix;
+}
+
 }  // namespace pdlfs
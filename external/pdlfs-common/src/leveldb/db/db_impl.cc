@@ -19,6 +19,8 @@
 #include "builder.h"
 #include "db_iter.h"
 #include "memtable.h"
+#include "merge_context.h"
+#include "range_del.h"
 #include "table_cache.h"
 #include "version_set.h"
 
@@ -29,6 +31,7 @@
 #include "pdlfs-common/leveldb/filenames.h"
 #include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator_wrapper.h"
+#include "pdlfs-common/leveldb/memory_budget.h"
 #include "pdlfs-common/leveldb/table.h"
 #include "pdlfs-common/leveldb/table_builder.h"
 #include "pdlfs-common/leveldb/table_properties.h"
@@ -38,6 +41,7 @@
 #include "pdlfs-common/log_writer.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/status.h"
 #include "pdlfs-common/strutil.h"
 
@@ -84,6 +88,9 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Key group of the last entry added to the current output
+  std::string last_prefix;
+
   Output* current_output() { return &outputs[outputs.size() - 1]; }
 
   explicit CompactionState(Compaction* c)
@@ -112,6 +119,50 @@ struct DBImpl::InsertionState {
       : options(&options), source_dir(dir) {}
 };
 
+struct DBImpl::ImmTable {
+  MemTable* const mem;
+  // Log files older than this become obsolete once mem is compacted
+  const uint64_t log_number;
+  bool claimed;  // Is a thread writing mem to a level-0 table?
+
+  // Takes over the caller's reference to m.
+  ImmTable(MemTable* m, uint64_t n) : mem(m), log_number(n), claimed(false) {}
+
+  ~ImmTable() { mem->Unref(); }
+};
+
+// An immutable list of immutable memtables, newest first. Readers reference
+// the list instead of each memtable in it. The list is replaced whenever a
+// memtable is frozen or compacted.
+struct DBImpl::ImmList {
+  std::vector<MemTable*> mems;
+  int refs;
+
+  explicit ImmList(const std::deque<ImmTable*>& imms) : refs(0) {
+    std::deque<ImmTable*>::const_reverse_iterator it = imms.rbegin();
+    for (; it != imms.rend(); ++it) {
+      MemTable* const mem = (*it)->mem;
+      mems.push_back(mem);
+      mem->Ref();
+    }
+  }
+
+  // REQUIRES: mutex_ has been locked.
+  void Ref() { ++refs; }
+
+  // REQUIRES: mutex_ has been locked.
+  void Unref() {
+    --refs;
+    assert(refs >= 0);
+    if (refs <= 0) {
+      for (size_t i = 0; i < mems.size(); i++) {
+        mems[i]->Unref();
+      }
+      delete this;
+    }
+  }
+};
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
@@ -119,8 +170,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       options_(SanitizeOptions(dbname, &internal_comparator_,
                                &internal_filter_policy_, raw_options, true)),
       owns_info_log_(options_.info_log != raw_options.info_log),
-      owns_cache_(options_.block_cache != raw_options.block_cache),
-      owns_table_cache_(options_.table_cache != raw_options.table_cache),
+      owns_cache_(options_.block_cache != raw_options.block_cache &&
+                  raw_options.memory_budget == NULL),
+      owns_table_cache_(options_.table_cache != raw_options.table_cache &&
+                        raw_options.memory_budget == NULL),
       dbname_(dbname),
       db_lock_(NULL),
       shutting_down_(NULL),
@@ -134,14 +187,21 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       l0_soft_limits_(0),
       l0_hard_limits_(0),
       l0_waits_(0),
+      bg_write_rate_(0),
+      bytes_flushed_(0),
       bg_compaction_disabled_(0),
       bg_compaction_paused_(0),
       bg_compaction_scheduled_(false),
       bg_compaction_in_progress_(false),
       bulk_insert_in_progress_(false),
+      bg_flushes_scheduled_(0),
+      bg_flushes_in_progress_(0),
+      manifest_busy_(false),
+      table_load_jobs_(0),
+      open_micros_(0),
       manual_compaction_(NULL) {
   if (!options_.no_memtable) {
-    mem_ = new MemTable(internal_comparator_);
+    mem_ = new MemTable(internal_comparator_, options_.memtable_hash_buckets);
     mem_->Ref();
   }
   has_imm_.Release_Store(NULL);
@@ -153,6 +213,9 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
   if (options_.info_log == Logger::Default()) {
     owns_info_log_ = false;
   }
+  if (options_.memory_budget != NULL && !options_.no_memtable) {
+    options_.memory_budget->AddWriteBuffers(options_.max_write_buffer_number);
+  }
 }
 
 DBImpl::~DBImpl() {
@@ -162,7 +225,9 @@ DBImpl::~DBImpl() {
   Log(options_.info_log, 1, "Shutting down ...");
 #endif
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_ || bg_compaction_paused_) {
+  while (bg_compaction_scheduled_ || bg_compaction_paused_ ||
+         bg_flushes_scheduled_ != 0 || bg_flushes_in_progress_ != 0 ||
+         table_load_jobs_ != 0) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
@@ -170,6 +235,10 @@ DBImpl::~DBImpl() {
   delete versions_;
   if (mem_ != NULL) mem_->Unref();
   if (imm_ != NULL) imm_->Unref();
+  while (!imms_.empty()) {
+    delete imms_.front();
+    imms_.pop_front();
+  }
   if (log_ != NULL) {
     if (options_.sync_log_on_close) {
       log_->Sync();
@@ -178,6 +247,10 @@ DBImpl::~DBImpl() {
   }
   delete logfile_;
   delete table_cache_;
+  if (options_.memory_budget != NULL && !options_.no_memtable) {
+    options_.memory_budget->RemoveWriteBuffers(
+        options_.max_write_buffer_number);
+  }
 
   if (owns_info_log_) delete options_.info_log;
   if (owns_table_cache_) delete options_.table_cache;
@@ -242,14 +315,17 @@ Status DBImpl::SyncWAL() {  // Force fsync on the write ahead log file
 }
 
 Status DBImpl::FlushMemTable(const FlushOptions& options) {
-  Status s = Write(WriteOptions(), &flush_memtable_);
+  Status s;
+  if (!options.wait_only) {
+    s = Write(WriteOptions(), &flush_memtable_);
+  }
   if (!s.ok()) {
     // Abort on errors
-  } else if (options.wait || options.force_flush_l0) {
+  } else if (options.wait || options.wait_only || options.force_flush_l0) {
     MutexLock l(&mutex_);
     // Either mine is being compacted, or someone else's table
     // is being compacted.
-    while (imm_ != NULL && bg_error_.ok()) {
+    while (!imms_.empty() && bg_error_.ok()) {
       bg_cv_.Wait();
     }
     if (options.force_flush_l0 && bg_error_.ok()) {
@@ -283,7 +359,7 @@ Status DBImpl::ResumeDbCompaction() {
 Status DBImpl::DrainCompactions() {
   Status s;
   MutexLock l(&mutex_);
-  while (HasCompaction() && bg_error_.ok()) {
+  while ((HasCompaction() || !imms_.empty()) && bg_error_.ok()) {
     MaybeScheduleCompaction();
     bg_cv_.Wait();
   }
@@ -444,13 +520,17 @@ Status DBImpl::Recover(VersionEdit* edit) {
 
     // Recover in the order in which the logs were generated
     std::sort(logs.begin(), logs.end());
-    for (size_t i = 0; i < logs.size(); i++) {
-      s = RecoverLogFile(logs[i], edit, &max_sequence);
+    if (options_.open_pool != NULL && logs.size() > 1) {
+      s = RecoverLogFilesInParallel(logs, edit, &max_sequence);
+    } else {
+      for (size_t i = 0; i < logs.size(); i++) {
+        s = RecoverLogFile(logs[i], edit, &max_sequence);
 
-      // The previous incarnation may not have written any MANIFEST
-      // records after allocating this log number.  So we manually
-      // update the file number allocation counter in VersionSet.
-      versions_->MarkFileNumberUsed(logs[i]);
+        // The previous incarnation may not have written any MANIFEST
+        // records after allocating this log number.  So we manually
+        // update the file number allocation counter in VersionSet.
+        versions_->MarkFileNumberUsed(logs[i]);
+      }
     }
 
     if (s.ok()) {
@@ -466,8 +546,117 @@ Status DBImpl::Recover(VersionEdit* edit) {
   return s;
 }
 
+// A parallel replay stops once this many of its memtables are waiting to be
+// written out, so that memory held by replays stays bounded.
+static const size_t kMaxQueuedReplayMemTables = 2;
+
+struct DBImpl::LogReplay {
+  DBImpl* db;
+  uint64_t log_number;
+  // Memtables are dumped into this edit as they fill in a sequential replay.
+  // NULL in a parallel replay.
+  VersionEdit* edit;
+  // Full memtables of a parallel replay waiting to be written out, oldest
+  // first. Protected by db->mutex_.
+  std::deque<MemTable*> mems;
+  SequenceNumber max_sequence;
+  Status status;
+  bool done;  // Protected by db->mutex_
+};
+
 Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
                               SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  LogReplay r;
+  r.db = this;
+  r.log_number = log_number;
+  r.edit = edit;
+  r.max_sequence = 0;
+  Status status = ReplayLogFile(&r);
+  if (r.max_sequence > *max_sequence) {
+    *max_sequence = r.max_sequence;
+  }
+  return status;
+}
+
+Status DBImpl::ReplayedMemTable(LogReplay* r, MemTable* mem) {
+  Status s;
+  if (r->edit != NULL) {
+    mutex_.AssertHeld();
+    // Reflect errors immediately so that conditions like full
+    // file-systems cause the DB::Open() to fail.
+    s = DumpMemTable(mem, r->edit, NULL);
+    mem->Unref();
+  } else {
+    MutexLock l(&mutex_);
+    while (r->mems.size() >= kMaxQueuedReplayMemTables) {
+      bg_cv_.Wait();
+    }
+    r->mems.push_back(mem);
+    bg_cv_.SignalAll();
+  }
+  return s;
+}
+
+void DBImpl::ReplayLogWork(void* arg) {
+  LogReplay* const r = reinterpret_cast<LogReplay*>(arg);
+  DBImpl* const db = r->db;
+  Status s = db->ReplayLogFile(r);
+  MutexLock l(&db->mutex_);
+  r->status = s;
+  r->done = true;
+  db->bg_cv_.SignalAll();
+}
+
+Status DBImpl::RecoverLogFilesInParallel(const std::vector<uint64_t>& logs,
+                                         VersionEdit* edit,
+                                         SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  std::vector<LogReplay> replays(logs.size());
+  for (size_t i = 0; i < logs.size(); i++) {
+    replays[i].db = this;
+    replays[i].log_number = logs[i];
+    replays[i].edit = NULL;
+    replays[i].max_sequence = 0;
+    replays[i].done = false;
+    options_.open_pool->Schedule(&DBImpl::ReplayLogWork, &replays[i]);
+  }
+  // Tables are written in log order so that tables holding newer updates
+  // get larger file numbers. A log's memtables are written out while it is
+  // still being replayed. Replays of later logs wait once they have filled
+  // kMaxQueuedReplayMemTables memtables, which cannot deadlock as long as
+  // the pool starts the replay of a log no later than those of later logs.
+  // All replays are drained and waited for even after an error.
+  Status s;
+  for (size_t i = 0; i < logs.size(); i++) {
+    LogReplay* const r = &replays[i];
+    while (!r->done || !r->mems.empty()) {
+      if (r->mems.empty()) {
+        bg_cv_.Wait();
+        continue;
+      }
+      MemTable* const mem = r->mems.front();
+      r->mems.pop_front();
+      bg_cv_.SignalAll();  // Let the replay continue
+      if (s.ok()) {
+        s = DumpMemTable(mem, edit, NULL);
+      }
+      mem->Unref();
+    }
+    if (s.ok()) {
+      s = r->status;
+    }
+    if (r->max_sequence > *max_sequence) {
+      *max_sequence = r->max_sequence;
+    }
+    // The previous incarnation may not have written any MANIFEST
+    // records after allocating this log number.
+    versions_->MarkFileNumberUsed(logs[i]);
+  }
+  return s;
+}
+
+Status DBImpl::ReplayLogFile(LogReplay* r) {
   struct LogReporter : public log::Reader::Reporter {
     Env* env;
     Logger* info_log;
@@ -485,10 +674,8 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     }
   };
 
-  mutex_.AssertHeld();
-
   // Open the log file
-  const std::string fname = LogFileName(dbname_, log_number);
+  const std::string fname = LogFileName(dbname_, r->log_number);
   SequentialFile* file;
   Status status = env_->NewSequentialFile(fname.c_str(), &file);
   if (!status.ok()) {
@@ -511,7 +698,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
   Log(options_.info_log, 1, "Recovering log into memtable: %s", fname.c_str());
 #endif
 
-  // Read all the records and add to a memtable
+  // Read all the records and add to memtables
   std::string scratch;
   Slice record;
   WriteBatch batch;
@@ -525,7 +712,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == NULL) {
-      mem = new MemTable(internal_comparator_);
+      mem = new MemTable(internal_comparator_, options_.memtable_hash_buckets);
       mem->Ref();
     }
     status = WriteBatchInternal::InsertInto(&batch, mem);
@@ -535,33 +722,108 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     }
     const SequenceNumber last_seq = WriteBatchInternal::Sequence(&batch) +
                                     WriteBatchInternal::Count(&batch) - 1;
-    if (last_seq > *max_sequence) {
-      *max_sequence = last_seq;
+    if (last_seq > r->max_sequence) {
+      r->max_sequence = last_seq;
     }
 
-    if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      status = DumpMemTable(mem, edit, NULL);
-      if (!status.ok()) {
-        // Reflect errors immediately so that conditions like full
-        // file-systems cause the DB::Open() to fail.
-        break;
-      }
-      mem->Unref();
+    if (mem->ApproximateMemoryUsage() > WriteBufferSize()) {
+      status = ReplayedMemTable(r, mem);
       mem = NULL;
     }
   }
 
-  if (status.ok() && mem != NULL) {
-    status = DumpMemTable(mem, edit, NULL);
-    // Reflect errors immediately so that conditions like full
-    // file-systems cause the DB::Open() to fail.
+  if (mem != NULL) {
+    if (status.ok()) {
+      status = ReplayedMemTable(r, mem);
+    } else {
+      mem->Unref();
+    }
   }
 
-  if (mem != NULL) mem->Unref();
   delete file;
   return status;
 }
 
+struct DBImpl::TableLoader {
+  DBImpl* db;
+  Version* v;  // Pins the tables being loaded
+  std::vector<FileMetaData*> files;
+  // State below is protected by db->mutex_
+  size_t next;  // Index of the next file to load
+  int jobs;     // Number of jobs not yet finished
+};
+
+// Up to this many jobs are scheduled on options_.open_pool to load tables.
+static const int kMaxTableLoadJobs = 16;
+
+void DBImpl::LoadTables() {
+  mutex_.AssertHeld();
+  TableLoader* const loader = new TableLoader;
+  loader->db = this;
+  loader->v = versions_->current();
+  loader->v->Ref();
+  for (int level = 0; level < config::kNumLevels; level++) {
+    const std::vector<FileMetaData*>& files = loader->v->files(level);
+    loader->files.insert(loader->files.end(), files.begin(), files.end());
+  }
+  loader->next = 0;
+  loader->jobs = 1;
+  if (options_.open_pool != NULL) {
+    loader->jobs = static_cast<int>(std::min<size_t>(
+        std::max<size_t>(loader->files.size(), 1), kMaxTableLoadJobs));
+  }
+
+  const bool wait = !options_.load_tables_in_background;
+  table_load_jobs_ += loader->jobs;
+  if (options_.open_pool != NULL) {
+    for (int i = loader->jobs; i > 0; i--) {
+      options_.open_pool->Schedule(&DBImpl::LoadTablesWork, loader);
+    }
+  } else if (!wait) {
+    env_->Schedule(&DBImpl::LoadTablesWork, loader);
+  } else {
+    LoadTablesLoop(loader);  // Loader may be deleted after this call
+  }
+  while (wait && table_load_jobs_ != 0) {
+    bg_cv_.Wait();
+  }
+}
+
+void DBImpl::LoadTablesWork(void* arg) {
+  TableLoader* const loader = reinterpret_cast<TableLoader*>(arg);
+  DBImpl* const db = loader->db;
+  MutexLock l(&db->mutex_);
+  db->LoadTablesLoop(loader);
+}
+
+void DBImpl::LoadTablesLoop(TableLoader* loader) {
+  mutex_.AssertHeld();
+  while (loader->next < loader->files.size() &&
+         !shutting_down_.Acquire_Load()) {
+    const FileMetaData* const f = loader->files[loader->next++];
+    mutex_.Unlock();
+    // Errors are ignored here and will surface when the table is accessed
+    table_cache_->Load(f->number, f->file_size, f->seq_off);
+    mutex_.Lock();
+  }
+  table_load_jobs_--;
+  if (--loader->jobs == 0) {
+    loader->v->Unref();
+    delete loader;
+  }
+  bg_cv_.SignalAll();
+}
+
+// Range deletions are kept with the version rather than in tables. Hand
+// those of a memtable being written out over to the version.
+void DBImpl::AddRangeDeletions(MemTable* mem, VersionEdit* edit) {
+  std::vector<RangeTombstone> tombstones;
+  mem->GetRangeDeletions(&tombstones);
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    edit->AddRangeDeletion(tombstones[i]);
+  }
+}
+
 // REQUIRES: mutex_ has been locked.
 Status DBImpl::DumpMemTable(MemTable* mem, VersionEdit* edit, Version* base) {
   mutex_.AssertHeld();
@@ -572,6 +834,9 @@ Status DBImpl::DumpMemTable(MemTable* mem, VersionEdit* edit, Version* base) {
       iter, edit, base, &ignored_min_seq,
       &ignored_max_seq);  // Will temporarily unlock when writing the table
   delete iter;
+  if (s.ok()) {
+    AddRangeDeletions(mem, edit);
+  }
   return s;
 }
 
@@ -630,45 +895,122 @@ Status DBImpl::WriteLevel0Table(Iterator* iter, VersionEdit* edit,
 
   stats.micros = CurrentMicros() - start_micros;
   stats_[level].Add(stats);
+  bytes_flushed_ += stats.bytes_written;
   return s;
 }
 
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
-  assert(imm_ != NULL);
+  ImmTable* imm = NULL;
+  for (size_t i = 0; i < imms_.size(); i++) {
+    if (!imms_[i]->claimed) {
+      imm = imms_[i];
+      break;
+    }
+  }
+  if (imm == NULL) {
+    return;  // All being compacted by other threads
+  }
+  imm->claimed = true;
+  bg_flushes_in_progress_++;
+  UpdateImmList();
 
-  // Save memtable contents into a new table file
-  VersionEdit edit;
-  Version* base = versions_->current();
-  base->Ref();
-  Status s = DumpMemTable(imm_, &edit, base);
-  base->Unref();
+  // Save memtable contents into a new table file. Other threads may be
+  // writing out other memtables at the same time.
+  const uint64_t start_micros = CurrentMicros();
+  FileMetaData meta;
+  meta.number = versions_->NewFileNumber();
+  pending_outputs_.insert(meta.number);
+#if VERBOSE >= 3
+  Log(options_.info_log, 3, "Building L0 table ...");
+#endif
 
+  Status s;
+  {
+    SequenceNumber ignored_min_seq;
+    SequenceNumber ignored_max_seq;
+    Iterator* const iter = imm->mem->NewIterator();
+    mutex_.Unlock();
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter,
+                   &ignored_min_seq, &ignored_max_seq, &meta);
+    delete iter;
+    mutex_.Lock();
+  }
+#if VERBOSE >= 2
+  if (s.ok()) {
+    Log(options_.info_log, 2, "L0 table #%llu => %llu bytes",
+        static_cast<unsigned long long>(meta.number),
+        static_cast<unsigned long long>(meta.file_size));
+  }
+#endif
+
+  CompactionStats stats;
+  stats.n = 1;
+  stats.micros = CurrentMicros() - start_micros;
+
+  // Tables must be installed in the same order their memtables were frozen.
+  // Otherwise, a newer table may be pushed to a deeper level ahead of an
+  // older table that overlaps it, breaking the newest-first search order.
+  while (s.ok() && imms_.front() != imm && bg_error_.ok() &&
+         !shutting_down_.Acquire_Load()) {
+    bg_cv_.Wait();
+  }
+  if (s.ok() && !bg_error_.ok()) {
+    s = bg_error_;
+  }
   if (s.ok() && shutting_down_.Acquire_Load()) {
     s = Status::IOError("Deleting db during memtable compaction");
   }
 
   // Replace the memtable we just compacted with the newly generated table by
-  // recording the current log number (logfile_number_) in the new version; logs
-  // earlier than that (including the one backing the memtable we just
-  // compacted) are no longer needed (and will be garbage collected).
+  // recording the log number that was current when the memtable was frozen
+  // in the new version; logs earlier than that (including the one backing
+  // the memtable we just compacted) are no longer needed (and will be garbage
+  // collected).
   //
   // Note that the recoding of a previous log number is no longer used. So we
   // simply set it to 0.
+  int level = 0;
   if (s.ok()) {
+    AcquireManifest();
+    VersionEdit edit;
+    // Note that if file_size is zero, the file has been deleted and
+    // should not be added to the manifest.
+    if (meta.file_size > 0) {
+      if (!options_.disable_compaction) {
+        level = versions_->current()->PickLevelForMemTableOutput(
+            meta.smallest.user_key(), meta.largest.user_key());
+      }
+      edit.AddFile(level, meta.number, meta.file_size, meta.seq_off,
+                   meta.smallest, meta.largest);
+      stats.bytes_written = meta.file_size;
+      stats.files = 1;
+    }
+    AddRangeDeletions(imm->mem, &edit);
     // Do not record any log changes if we didn't write any logs.
     if (!options_.disable_write_ahead_log) {
       edit.SetPrevLogNumber(0);
-      edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+      edit.SetLogNumber(imm->log_number);  // Earlier logs no longer needed
     }
     s = versions_->LogAndApply(&edit, &mutex_);
+    ReleaseManifest();
   }
 
+  pending_outputs_.erase(meta.number);
+  stats_[level].Add(stats);
+  bytes_flushed_ += stats.bytes_written;
+  if (s.ok()) {
+    RecordBackgroundWrite(stats.bytes_written, stats.micros);
+    UpdateWriteRate();
+  }
+  bg_flushes_in_progress_--;
+
   if (s.ok()) {
     // Commit to the new state
-    imm_->Unref();
-    imm_ = NULL;
-    has_imm_.Release_Store(NULL);
+    assert(imms_.front() == imm);
+    imms_.pop_front();
+    delete imm;
+    UpdateImmList();
     DeleteObsoleteFiles();
 #if VERBOSE >= 1
     VersionSet::LevelSummaryStorage tmp;
@@ -676,8 +1018,73 @@ void DBImpl::CompactMemTable() {
         versions_->LevelSummary(&tmp));
 #endif
   } else {
+    imm->claimed = false;
+    UpdateImmList();
     RecordBackgroundError(s);
   }
+  // Wake up threads waiting for write buffer room or their turn to install
+  bg_cv_.SignalAll();
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::FreezeMemTable() {
+  mutex_.AssertHeld();
+  imms_.push_back(new ImmTable(mem_, logfile_number_));
+  mem_ = new MemTable(internal_comparator_, options_.memtable_hash_buckets);
+  mem_->Ref();
+  UpdateImmList();
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::UpdateImmList() {
+  mutex_.AssertHeld();
+  bool has_unclaimed = false;
+  for (size_t i = 0; i < imms_.size(); i++) {
+    if (!imms_[i]->claimed) {
+      has_unclaimed = true;
+      break;
+    }
+  }
+  has_imm_.Release_Store(has_unclaimed ? this : NULL);
+  if (imm_ != NULL && imm_->mems.size() == imms_.size()) {
+    return;  // Readers' view remains the same
+  }
+  if (imm_ != NULL) {
+    imm_->Unref();
+    imm_ = NULL;
+  }
+  if (!imms_.empty()) {
+    imm_ = new ImmList(imms_);
+    imm_->Ref();
+  }
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::AcquireManifest() {
+  mutex_.AssertHeld();
+  while (manifest_busy_) {
+    bg_cv_.Wait();
+  }
+  manifest_busy_ = true;
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::ReleaseManifest() {
+  mutex_.AssertHeld();
+  assert(manifest_busy_);
+  manifest_busy_ = false;
+  bg_cv_.SignalAll();
+}
+
+// REQUIRES: mutex_ has been locked.
+Status DBImpl::ApplyEdit(VersionEdit* edit) {
+  AcquireManifest();
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  ReleaseManifest();
+  if (s.ok()) {
+    UpdateWriteRate();
+  }
+  return s;
 }
 
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
@@ -741,10 +1148,10 @@ Status DBImpl::TEST_CompactMemTable() {
   if (s.ok()) {
     // Wait until the compaction completes
     MutexLock l(&mutex_);
-    while (imm_ != NULL && bg_error_.ok()) {
+    while (!imms_.empty() && bg_error_.ok()) {
       bg_cv_.Wait();
     }
-    if (imm_ != NULL) {
+    if (!imms_.empty()) {
       s = bg_error_;
     }
   }
@@ -760,7 +1167,8 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 }
 
 bool DBImpl::HasCompaction() {
-  if (imm_ != NULL) {
+  // Immutable memtables are normally compacted by dedicated flush jobs
+  if (has_imm_.NoBarrier_Load() != NULL && bg_flushes_scheduled_ == 0) {
     return true;
   } else if (manual_compaction_ != NULL) {
     return true;
@@ -777,6 +1185,7 @@ bool DBImpl::HasCompaction() {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
+  MaybeScheduleFlush();
   if (bg_compaction_scheduled_ || bg_compaction_paused_) {
     // Already scheduled or paused
   } else if (shutting_down_.Acquire_Load()) {
@@ -799,6 +1208,58 @@ void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+// Schedule dedicated jobs for compacting immutable memtables so that they
+// don't have to wait for an ongoing table compaction to finish. One job per
+// immutable memtable not yet being compacted.
+void DBImpl::MaybeScheduleFlush() {
+  mutex_.AssertHeld();
+  if (bg_compaction_paused_) {
+    // Paused
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background compactions
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else {
+    int unclaimed = 0;
+    for (size_t i = 0; i < imms_.size(); i++) {
+      if (!imms_[i]->claimed) unclaimed++;
+    }
+    while (bg_flushes_scheduled_ < unclaimed) {
+      bg_flushes_scheduled_++;
+      if (options_.compaction_pool != NULL) {
+        // Flushes free up write buffers writers may be waiting for
+        options_.compaction_pool->ScheduleWithPriority(&DBImpl::BGFlushWork,
+                                                       this, ThreadPool::kHigh);
+      } else {
+        env_->Schedule(&DBImpl::BGFlushWork, this);
+      }
+    }
+  }
+}
+
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flushes_scheduled_ > 0);
+  bg_flushes_scheduled_--;
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (bg_compaction_paused_) {
+    // Abort
+  } else if (has_imm_.NoBarrier_Load() != NULL) {
+    CompactMemTable();
+  }
+
+  // The new table may trigger a compaction
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
   assert(bg_compaction_scheduled_);
@@ -829,7 +1290,7 @@ void DBImpl::BackgroundCompactionWrapper() {
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
+  if (has_imm_.NoBarrier_Load() != NULL && bg_flushes_scheduled_ == 0) {
     CompactMemTable();
     return;
   }
@@ -861,22 +1322,22 @@ void DBImpl::BackgroundCompaction() {
   if (c == NULL) {
     // Nothing to do
   } else if (!is_manual && c->IsTrivialMove()) {
-    // Move file to next level
-    assert(c->num_input_files(0) == 1);
-    FileMetaData* f = c->input(0, 0);
-    c->edit()->DeleteFile(c->level(), f->number);
-    c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->seq_off,
-                       f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    // Move files to next level
+    for (int i = 0; i < c->num_input_files(0); i++) {
+      FileMetaData* f = c->input(0, i);
+      c->edit()->DeleteFile(c->level(), f->number);
+      c->edit()->AddFile(c->output_level(), f->number, f->file_size, f->seq_off,
+                         f->smallest, f->largest);
+    }
+    status = ApplyEdit(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
 #if VERBOSE >= 3
     VersionSet::LevelSummaryStorage tmp;
-    Log(options_.info_log, 3, "Moved #%lld to level-%d %lld bytes %s: %s",
-        static_cast<unsigned long long>(f->number), c->level() + 1,
-        static_cast<unsigned long long>(f->file_size),
-        status.ToString().c_str(), versions_->LevelSummary(&tmp));
+    Log(options_.info_log, 3, "Moved %d files to level-%d %s: %s",
+        c->num_input_files(0), c->output_level(), status.ToString().c_str(),
+        versions_->LevelSummary(&tmp));
 #endif
   } else {
     CompactionState* compact = new CompactionState(c);
@@ -936,7 +1397,7 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   assert(compact->builder == NULL);
 #if VERBOSE >= 3
   Log(options_.info_log, 3, "Building L%d table ...",
-      compact->compaction->level() + 1);
+      compact->compaction->output_level());
 #endif
   uint64_t file_number;
   {
@@ -955,6 +1416,10 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname.c_str(), &compact->outfile);
   if (s.ok()) {
+    if (options_.rate_limiter != NULL) {
+      compact->outfile = new RateLimitedWritableFile(
+          compact->outfile, options_.rate_limiter, kIOPriorityLow);
+    }
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
   return s;
@@ -1010,7 +1475,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
 #if VERBOSE >= 2
     if (s.ok()) {
       Log(options_.info_log, 2, "L%d table #%llu => %llu keys, %llu bytes",
-          compact->compaction->level() + 1,
+          compact->compaction->output_level(),
           static_cast<unsigned long long>(output_number),
           static_cast<unsigned long long>(current_entries),
           static_cast<unsigned long long>(current_bytes));
@@ -1025,19 +1490,139 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
 #if VERBOSE >= 4
   Log(options_.info_log, 4, "Compacted %d@%d + %d@%d files => %lld bytes",
       compact->compaction->num_input_files(0), compact->compaction->level(),
-      compact->compaction->num_input_files(1), compact->compaction->level() + 1,
+      compact->compaction->num_input_files(1),
+      compact->compaction->output_level(),
       static_cast<long long>(compact->total_bytes));
 #endif
   // Add compaction outputs
   compact->compaction->AddInputDeletions(compact->compaction->edit());
-  const int level = compact->compaction->level();
+  versions_->UpdateRangeDeletions(compact->compaction,
+                                  compact->smallest_snapshot);
+  const int level = compact->compaction->output_level();
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const SequenceOff off = 0;
     const CompactionState::Output& out = compact->outputs[i];
-    compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
+    compact->compaction->edit()->AddFile(level, out.number, out.file_size,
                                          off, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return ApplyEdit(compact->compaction->edit());
+}
+
+Status DBImpl::AddCompactionOutput(CompactionState* compact, Iterator* input,
+                                   const Slice& key, const Slice& value) {
+  Status status;
+  const size_t prefix_len = options_.table_split_prefix_length;
+  if (prefix_len != 0) {
+    Slice prefix = ExtractUserKey(key);
+    if (prefix.size() > prefix_len) {
+      prefix.remove_suffix(prefix.size() - prefix_len);
+    }
+    // Close the current output at a group boundary if it is close to full
+    if (compact->builder != NULL && prefix != compact->last_prefix &&
+        compact->builder->FileSize() >=
+            compact->compaction->MaxOutputFileSize() / 4 * 3) {
+      status = FinishCompactionOutputFile(compact, input);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    compact->last_prefix.assign(prefix.data(), prefix.size());
+  }
+
+  // Open output file if necessary
+  if (compact->builder == NULL) {
+    status = OpenCompactionOutputFile(compact);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  compact->builder->Add(key, value);
+
+  // Close output file if it is big enough
+  if (compact->builder->FileSize() >=
+      compact->compaction->MaxOutputFileSize()) {
+    status = FinishCompactionOutputFile(compact, input);
+  }
+  return status;
+}
+
+// Fold the merge operand at "input" together with all older entries of the
+// same user key into a single value. This is only possible if the key's base
+// value (or deletion) is among the compaction inputs or if deeper levels have
+// no data for the key. Otherwise, the entries are copied to the output as is.
+// On return, "input" is positioned after the last entry consumed.
+// REQUIRES: the merge operand is not visible to any snapshot but the newest.
+Status DBImpl::CompactMergeOperands(CompactionState* compact, Iterator* input) {
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(input->key(), &ikey)) {
+    return Status::Corruption("Corrupted merge operand");
+  }
+  const SequenceNumber newest_seq = ikey.sequence;
+  const std::string user_key = ikey.user_key.ToString();
+  const RangeDelSet* range_dels = compact->compaction->range_dels();
+  const SequenceNumber floor =
+      range_dels != NULL
+          ? range_dels->MaxCoveringSeq(user_key, compact->smallest_snapshot)
+          : 0;
+  MergeContext merge(options_.merge_operator);
+  std::vector<std::pair<std::string, std::string> > entries;
+  std::string base;
+  bool has_base = false;
+  bool resolved = false;  // Whether a base value or a deletion is found
+  for (; input->Valid(); input->Next()) {
+    if (!ParseInternalKey(input->key(), &ikey) ||
+        user_comparator()->Compare(ikey.user_key, user_key) != 0) {
+      break;
+    }
+    if (ikey.sequence < floor) {
+      resolved = true;  // Older entries are removed by a range deletion
+      break;
+    }
+    entries.push_back(
+        std::make_pair(input->key().ToString(), input->value().ToString()));
+    if (ikey.type == kTypeMerge) {
+      merge.Add(input->value());
+    } else {
+      if (ikey.type == kTypeValue) {
+        base = entries.back().second;
+        has_base = true;
+      }
+      resolved = true;
+      input->Next();
+      break;
+    }
+  }
+
+  Status status;
+  const bool is_base_level =
+      compact->compaction->IsBaseLevelForKey(user_key);
+  if (!resolved && !is_base_level) {
+    for (size_t i = 0; i < entries.size() && status.ok(); i++) {
+      status = AddCompactionOutput(compact, input, entries[i].first,
+                                   entries[i].second);
+    }
+    return status;
+  }
+
+  Slice base_value(base);
+  std::string value;
+  bool found = false;
+  status = merge.Fold(user_key, has_base ? &base_value : NULL, &value, &found);
+  if (status.ok()) {
+    std::string key;
+    if (found) {
+      AppendInternalKey(&key,
+                        ParsedInternalKey(user_key, newest_seq, kTypeValue));
+      status = AddCompactionOutput(compact, input, key, value);
+    } else if (!is_base_level) {
+      // Hide older data in deeper levels
+      AppendInternalKey(&key,
+                        ParsedInternalKey(user_key, newest_seq, kTypeDeletion));
+      status = AddCompactionOutput(compact, input, key, Slice());
+    }
+  }
+  return status;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -1048,7 +1633,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   Log(options_.info_log, 4, "Compacting %d@%d + %d@%d files ...",
       compact->compaction->num_input_files(0), compact->compaction->level(),
       compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
+      compact->compaction->output_level());
 #endif
   assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
   assert(compact->builder == NULL);
@@ -1063,6 +1648,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   mutex_.Unlock();
 
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  const RangeDelSet* range_dels = compact->compaction->range_dels();
   input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
@@ -1074,9 +1660,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     if (has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = CurrentMicros();
       mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+      if (has_imm_.NoBarrier_Load() != NULL) {
+        CompactMemTable();  // Wakes up MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
       imm_micros += (CurrentMicros() - imm_start);
@@ -1124,6 +1709,12 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       if (last_sequence_for_key <= compact->smallest_snapshot) {
         // Hidden by an newer entry for same user key
         drop = true;  // (A)
+      } else if (range_dels != NULL &&
+                 ikey.sequence <
+                     range_dels->MaxCoveringSeq(ikey.user_key,
+                                                compact->smallest_snapshot)) {
+        // Removed by a range deletion visible to all snapshots
+        drop = true;
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
                  compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
@@ -1138,6 +1729,16 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       }
 
       last_sequence_for_key = ikey.sequence;
+      if (!drop && ikey.type == kTypeMerge &&
+          ikey.sequence <= compact->smallest_snapshot &&
+          options_.merge_operator != NULL) {
+        // Older entries of this key are either folded or copied below.
+        status = CompactMergeOperands(compact, input);
+        if (!status.ok()) {
+          break;
+        }
+        continue;
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -1150,23 +1751,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 #endif
 
     if (!drop) {
-      // Open output file if necessary
-      if (compact->builder == NULL) {
-        status = OpenCompactionOutputFile(compact);
-        if (!status.ok()) {
-          break;
-        }
-      }
-
-      compact->builder->Add(key, input->value());
-
-      // Close output file if it is big enough
-      if (compact->builder->FileSize() >=
-          compact->compaction->MaxOutputFileSize()) {
-        status = FinishCompactionOutputFile(compact, input);
-        if (!status.ok()) {
-          break;
-        }
+      status = AddCompactionOutput(compact, input, key, input->value());
+      if (!status.ok()) {
+        break;
       }
     }
 
@@ -1201,7 +1788,10 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   stats.n = 1;
 
   mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+  stats_[compact->compaction->output_level()].Add(stats);
+  if (status.ok()) {
+    RecordBackgroundWrite(stats.bytes_written, stats.micros);
+  }
 
   if (status.ok()) {
     status = InstallCompactionResults(compact);
@@ -1212,25 +1802,76 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 #if VERBOSE >= 1
   VersionSet::LevelSummaryStorage tmp;
   Log(options_.info_log, 1, "Compaction done: L%d->L%d, db => %s",
-      compact->compaction->level(), compact->compaction->level() + 1,
+      compact->compaction->level(), compact->compaction->output_level(),
       versions_->LevelSummary(&tmp));
 #endif
   return status;
 }
 
 namespace {
+bool GetFromImms(const std::vector<MemTable*>& imms, const LookupKey& lkey,
+                 Buffer* value, size_t limit, Status* s, MergeContext* merge,
+                 SequenceNumber floor) {
+  for (size_t i = 0; i < imms.size(); i++) {
+    if (imms[i]->Get(lkey, value, limit, s, merge, floor)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Add the indexed range deletions of the given memtables, if any, to *sets.
+// Each added set is Ref()'d and must later be released by UnrefAll().
+// REQUIRES: the db mutex is held.
+void RefRangeDeletions(MemTable* mem, const std::vector<MemTable*>* imms,
+                       std::vector<RangeDelSet*>* sets) {
+  RangeDelSet* s;
+  if (mem != NULL && (s = mem->RangeDeletions()) != NULL) {
+    sets->push_back(s);
+  }
+  for (size_t i = 0; imms != NULL && i < imms->size(); i++) {
+    if ((s = (*imms)[i]->RangeDeletions()) != NULL) {
+      sets->push_back(s);
+    }
+  }
+}
+
+// REQUIRES: the db mutex is held.
+void UnrefAll(const std::vector<RangeDelSet*>& sets) {
+  for (size_t i = 0; i < sets.size(); i++) {
+    sets[i]->Unref();
+  }
+}
+
+// Return the sequence number below which entries of the looked up key have
+// been removed by range deletions, or 0 if no range deletion covers the key.
+SequenceNumber RangeDelFloor(const std::vector<RangeDelSet*>& mem_dels,
+                             Version* current, const LookupKey& lkey) {
+  const Slice user_key = lkey.user_key();
+  const SequenceNumber snapshot = lkey.sequence();
+  SequenceNumber floor = current->MaxCoveringSeq(user_key, snapshot);
+  for (size_t i = 0; i < mem_dels.size(); i++) {
+    floor = std::max(floor, mem_dels[i]->MaxCoveringSeq(user_key, snapshot));
+  }
+  return floor;
+}
+
 struct IterState {
   port::Mutex* mu;
   Version* version;
   MemTable* mem;
-  MemTable* imm;
+  std::vector<MemTable*> imms;
+  std::vector<RangeDelSet*> mem_dels;
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
   state->mu->Lock();
+  UnrefAll(state->mem_dels);
   if (state->mem != NULL) state->mem->Unref();
-  if (state->imm != NULL) state->imm->Unref();
+  for (size_t i = 0; i < state->imms.size(); i++) {
+    state->imms[i]->Unref();
+  }
   state->version->Unref();
   state->mu->Unlock();
   delete state;
@@ -1251,8 +1892,11 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     mem_->Ref();
   }
   if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+    cleanup->imms = imm_->mems;
+    for (size_t i = 0; i < cleanup->imms.size(); i++) {
+      list.push_back(cleanup->imms[i]->NewIterator());
+      cleanup->imms[i]->Ref();
+    }
   }
   versions_->current()->AddIterators(options, &list);
   Iterator* internal_iter =
@@ -1261,10 +1905,27 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
 
   cleanup->mu = &mutex_;
   cleanup->mem = mem_;
-  cleanup->imm = imm_;
   cleanup->version = versions_->current();
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
 
+  // Hide entries removed by range deletions. The memtables' sets are kept
+  // alive by the cleanup above and the version's by the version.
+  RefRangeDeletions(mem_, &cleanup->imms, &cleanup->mem_dels);
+  std::vector<const RangeDelSet*> sets(cleanup->mem_dels.begin(),
+                                       cleanup->mem_dels.end());
+  const RangeDelSet* version_dels = versions_->current()->range_dels();
+  if (version_dels != NULL) {
+    sets.push_back(version_dels);
+  }
+  if (!sets.empty()) {
+    internal_iter = NewRangeDelIterator(
+        internal_iter,
+        options.snapshot != NULL
+            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
+            : *latest_snapshot,
+        sets);
+  }
+
   *seed = ++seed_;
   mutex_.Unlock();
   return internal_iter;
@@ -1283,48 +1944,80 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 
 Status DBImpl::Get(const ReadOptions& options, const LookupKey& lkey,
                    Buffer* value) {
+  // Foreground latency feeds the rate limiter's auto-tuning, if any
+  const uint64_t start_micros =
+      options_.rate_limiter != NULL ? CurrentMicros() : 0;
   Status s;
-  MutexLock l(&mutex_);
+  mutex_.Lock();
   MemTable* mem = mem_;
-  MemTable* imm = imm_;
+  ImmList* imm = imm_;
   Version* current = versions_->current();
   if (mem != NULL) mem->Ref();
   if (imm != NULL) imm->Ref();
   current->Ref();
+  std::vector<RangeDelSet*> mem_dels;
+  RefRangeDeletions(mem, imm != NULL ? &imm->mems : NULL, &mem_dels);
 
   bool have_stat_update = false;
   Version::GetStats stats;
+  // Profile the read using a private context so it can be merged into
+  // the db-wide read stats without synchronizing the read path.
+  ReadStats rstats;
+  ReadOptions opts = options;
+  opts.stats = &rstats;
+  rstats.gets++;
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
+    // First look in the memtable, then in the immutable memtables (if any)
+    // from newest to oldest.
+    MergeContext merge(options_.merge_operator);
+    const SequenceNumber floor = RangeDelFloor(mem_dels, current, lkey);
+    if (mem != NULL &&
+        mem->Get(lkey, value, options.limit, &s, &merge, floor)) {
+      rstats.mem_hits++;
+    } else if (imm != NULL && GetFromImms(imm->mems, lkey, value, options.limit,
+                                          &s, &merge, floor)) {
+      rstats.imm_hits++;
     } else {
-      current->Get(options, lkey, value, &s, &stats);
+      current->Get(opts, lkey, value, &s, &stats, &merge, floor);
       have_stat_update = true;
     }
     mutex_.Lock();
   }
 
+  read_stats_.Merge(rstats);
+  if (options.stats != NULL) {
+    options.stats->Merge(rstats);
+  }
+
   if (have_stat_update && current->UpdateStats(stats)) {
     if (!options_.disable_seek_compaction) {
       MaybeScheduleCompaction();
     }
   }
+  UnrefAll(mem_dels);
   if (mem != NULL) mem->Unref();
   if (imm != NULL) imm->Unref();
   current->Unref();
+  mutex_.Unlock();
+  // Reported without holding the mutex as the rate limiter has locks of its
+  // own
+  if (options_.rate_limiter != NULL) {
+    options_.rate_limiter->ReportForegroundLatency(CurrentMicros() -
+                                                   start_micros);
+  }
   return s;
 }
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    Buffer* value) {
+  // Foreground latency feeds the rate limiter's auto-tuning, if any
+  const uint64_t start_micros =
+      options_.rate_limiter != NULL ? CurrentMicros() : 0;
   Status s;
-  MutexLock l(&mutex_);
+  mutex_.Lock();
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
@@ -1333,39 +2026,65 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   }
 
   MemTable* mem = mem_;
-  MemTable* imm = imm_;
+  ImmList* imm = imm_;
   Version* current = versions_->current();
   if (mem != NULL) mem->Ref();
   if (imm != NULL) imm->Ref();
   current->Ref();
+  std::vector<RangeDelSet*> mem_dels;
+  RefRangeDeletions(mem, imm != NULL ? &imm->mems : NULL, &mem_dels);
 
   bool have_stat_update = false;
   Version::GetStats stats;
+  // Profile the read using a private context so it can be merged into
+  // the db-wide read stats without synchronizing the read path.
+  ReadStats rstats;
+  ReadOptions opts = options;
+  opts.stats = &rstats;
+  rstats.gets++;
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
+    // First look in the memtable, then in the immutable memtables (if any)
+    // from newest to oldest.
     LookupKey lkey(key, snapshot);
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
+    MergeContext merge(options_.merge_operator);
+    const SequenceNumber floor = RangeDelFloor(mem_dels, current, lkey);
+    if (mem != NULL &&
+        mem->Get(lkey, value, options.limit, &s, &merge, floor)) {
+      rstats.mem_hits++;
+    } else if (imm != NULL && GetFromImms(imm->mems, lkey, value, options.limit,
+                                          &s, &merge, floor)) {
+      rstats.imm_hits++;
     } else {
-      current->Get(options, lkey, value, &s, &stats);
+      current->Get(opts, lkey, value, &s, &stats, &merge, floor);
       have_stat_update = true;
     }
     mutex_.Lock();
   }
 
+  read_stats_.Merge(rstats);
+  if (options.stats != NULL) {
+    options.stats->Merge(rstats);
+  }
+
   if (have_stat_update && current->UpdateStats(stats)) {
     if (!options_.disable_seek_compaction) {
       MaybeScheduleCompaction();
     }
   }
+  UnrefAll(mem_dels);
   if (mem != NULL) mem->Unref();
   if (imm != NULL) imm->Unref();
   current->Unref();
+  mutex_.Unlock();
+  // Reported without holding the mutex as the rate limiter has locks of its
+  // own
+  if (options_.rate_limiter != NULL) {
+    options_.rate_limiter->ReportForegroundLatency(CurrentMicros() -
+                                                   start_micros);
+  }
   return s;
 }
 
@@ -1394,7 +2113,7 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   uint32_t seed;
   Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
   return NewDBIterator(
-      this, user_comparator(), iter,
+      this, user_comparator(), options_.merge_operator, iter,
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
@@ -1429,6 +2148,24 @@ Status DBImpl::Delete(const WriteOptions& o, const Slice& key) {
   return DB::Delete(o, key);
 }
 
+Status DBImpl::Merge(const WriteOptions& o, const Slice& key,
+                     const Slice& val) {
+  if (options_.merge_operator == NULL) {
+    return Status::NotSupported("No merge operator");
+  } else {
+    return DB::Merge(o, key, val);
+  }
+}
+
+Status DBImpl::DeleteRange(const WriteOptions& o, const Slice& begin,
+                           const Slice& end) {
+  if (user_comparator()->Compare(begin, end) >= 0) {
+    return Status::OK();  // Empty range
+  } else {
+    return DB::DeleteRange(o, begin, end);
+  }
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   if (my_batch == NULL) {
     // NULL batch is for memtable compaction
@@ -1465,6 +2202,25 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       // for insertion. For regular batches, we try adding more writes into the
       // current batch. If we do so we will update last_writer accordingly.
       WriteBatch* const final_batch = BuildBatchGroup(&last_writer);
+      if (write_controller_.IsThrottled()) {
+        // We are getting close to hitting a hard limit on the number of L0
+        // files. Rather than delaying a single write by several seconds when
+        // we hit the hard limit, pace the entire write group at a rate
+        // background compaction can keep up with. This reduces latency
+        // variance and hands over some CPU to the compaction thread in case
+        // it is sharing the same core as the writer.
+        const uint64_t delay = write_controller_.GetDelay(
+            CurrentMicros(), WriteBatchInternal::ByteSize(final_batch));
+        if (delay != 0) {
+#if VERBOSE >= 5
+          Log(options_.info_log, 5, "Too many L0 files; slowing down...");
+#endif
+          mutex_.Unlock();
+          SleepForMicroseconds(delay);
+          mutex_.Lock();
+          l0_soft_limits_++;
+        }
+      }
       uint64_t last_sequence = versions_->LastSequence();
       WriteBatchInternal::SetSequence(final_batch, last_sequence + 1);
       last_sequence += WriteBatchInternal::Count(final_batch);
@@ -1502,12 +2258,14 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         // batch of writes. We start by temporarily blocking background
         // compactions.
         bg_compaction_paused_++;
-        while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+        while (bg_compaction_in_progress_ || bg_flushes_in_progress_ != 0 ||
+               bulk_insert_in_progress_) {
           bg_cv_.Wait();
         }
 
         bulk_insert_in_progress_ = true;
-        MemTable* const mem = new MemTable(internal_comparator_);
+        MemTable* const mem =
+            new MemTable(internal_comparator_, options_.memtable_hash_buckets);
         mem->Ref();
         status = WriteBatchInternal::InsertInto(final_batch, mem);
         if (status.ok()) {
@@ -1515,7 +2273,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           status = DumpMemTable(mem, &edit, NULL);
           if (status.ok()) {
             versions_->SetLastSequence(last_sequence);
-            status = versions_->LogAndApply(&edit, &mutex_);
+            status = ApplyEdit(&edit);
           } else {
             RecordBackgroundError(status);
           }
@@ -1631,38 +2389,27 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
 Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
-  bool allow_delay = !force;
   Status s;
   while (true) {
     if (!bg_error_.ok()) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (!options_.disable_compaction && allow_delay &&
-               versions_->NumLevelFiles(0) >= options_.l0_soft_limit) {
-      // We are getting close to hitting a hard limit on the number of L0 files.
-      // Rather than delaying a single write by several seconds when we hit the
-      // hard limit, start delaying each individual write by 1ms to reduce
-      // latency variance. Also, this delay hands over some CPU to the
-      // compaction thread in case it is sharing the same core as the writer.
-      mutex_.Unlock();
-#if VERBOSE >= 5
-      Log(options_.info_log, 5, "Too many L0 files; slowing down...");
-#endif
-      SleepForMicroseconds(1000);
-      allow_delay = false;  // Do not delay a single write more than once
-      mutex_.Lock();
-      l0_soft_limits_++;
     } else if (!force && mem_ != NULL &&
-               mem_->ApproximateMemoryUsage() <= options_.write_buffer_size) {
+               (options_.disable_auto_flush ||
+                mem_->ApproximateMemoryUsage() <= WriteBufferSize())) {
       // There is room in current memtable
       break;
-    } else if (imm_ != NULL) {
-      // We have filled up the current memtable, but the previous
-      // one is still being compacted, so we wait.
+    } else if (imms_.size() + 1 >=
+               static_cast<size_t>(options_.max_write_buffer_number)) {
+      // We have filled up the current memtable, but all previous
+      // ones are still being compacted, so we wait.
 #if VERBOSE >= 5
       Log(options_.info_log, 5, "Current memtable full; waiting...");
 #endif
+      if (options_.memory_budget != NULL) {
+        options_.memory_budget->RecordStall();
+      }
       bg_cv_.Wait();
       l0_waits_++;
     } else if (!options_.disable_compaction &&
@@ -1698,12 +2445,12 @@ Status DBImpl::MakeRoomForWrite(bool force) {
 
       // Attempt to switch to a new memtable and
       // trigger compaction of old
-      imm_ = mem_;
-      has_imm_.Release_Store(imm_);
-      mem_ = new MemTable(internal_comparator_);
-      mem_->Ref();
+      FreezeMemTable();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
+      if (options_.memory_budget != NULL) {
+        options_.memory_budget->Rebalance();
+      }
     } else {
       break;
     }
@@ -1711,6 +2458,54 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   return s;
 }
 
+size_t DBImpl::WriteBufferSize() const {
+  if (options_.memory_budget != NULL) {
+    return options_.memory_budget->write_buffer_size();
+  }
+  return options_.write_buffer_size;
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::UpdateWriteRate() {
+  mutex_.AssertHeld();
+  const int n0 = versions_->NumLevelFiles(0);
+  if (options_.disable_compaction || n0 < options_.l0_soft_limit) {
+    write_controller_.SetRate(0);
+    return;
+  }
+  // Start from the rate background compaction has been able to sustain and
+  // lower it linearly as level-0 approaches the hard limit.
+  double rate = (bg_write_rate_ != 0) ? bg_write_rate_
+                                      : options_.delayed_write_rate;
+  const int room = std::max(options_.l0_hard_limit - n0, 1);
+  rate *= room / (options_.l0_hard_limit - options_.l0_soft_limit + 1.0);
+  // Further leave background compaction the bandwidth to drain the bytes
+  // already waiting to be compacted: the admitted rate is divided by one
+  // plus the seconds of estimated backlog, so it halves at one second of
+  // backlog and drops to a third at two.
+  const int64_t pending = versions_->PendingCompactionBytes();
+  if (pending > 0 && bg_write_rate_ != 0) {
+    rate /= 1.0 + static_cast<double>(pending) / bg_write_rate_;
+  }
+  static const double kMinWriteRate = 16 << 10;
+  write_controller_.SetRate(
+      static_cast<uint64_t>(std::max(rate, kMinWriteRate)));
+}
+
+// REQUIRES: mutex_ has been locked.
+void DBImpl::RecordBackgroundWrite(int64_t bytes, int64_t micros) {
+  mutex_.AssertHeld();
+  if (bytes <= 0 || micros <= 0) {
+    return;
+  }
+  const uint64_t rate = static_cast<uint64_t>(bytes * 1e6 / micros);
+  if (bg_write_rate_ == 0) {
+    bg_write_rate_ = rate;
+  } else {  // Weigh the latest job by 1/4
+    bg_write_rate_ = (3 * bg_write_rate_ + rate) / 4;
+  }
+}
+
 Status DBImpl::BulkInsert(Iterator* iter) {
   Status s;
   SequenceNumber min_seq;
@@ -1719,7 +2514,8 @@ Status DBImpl::BulkInsert(Iterator* iter) {
   MutexLock l(&mutex_);
   // Temporarily block any background compaction
   bg_compaction_paused_++;
-  while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+  while (bg_compaction_in_progress_ || bg_flushes_in_progress_ != 0 ||
+         bulk_insert_in_progress_) {
     bg_cv_.Wait();
   }
 
@@ -1730,7 +2526,7 @@ Status DBImpl::BulkInsert(Iterator* iter) {
     if (max_seq > versions_->LastSequence()) {
       versions_->SetLastSequence(max_seq);
     }
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = ApplyEdit(&edit);
   }
 
   if (!s.ok()) {
@@ -1813,6 +2609,67 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "read-stats") {
+    *value = read_stats_.ToString();
+    return true;
+  } else if (in == "write-controller") {
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Rate(B/s) Debt(B) BgRate(B/s) Delays DelayTime(ms)\n"
+             "%-9llu %-7llu %-11llu %-6llu %-.3f\n",
+             static_cast<unsigned long long>(write_controller_.rate()),
+             static_cast<unsigned long long>(
+                 write_controller_.Debt(CurrentMicros())),
+             static_cast<unsigned long long>(bg_write_rate_),
+             static_cast<unsigned long long>(write_controller_.total_delays()),
+             write_controller_.total_delay_micros() / 1000.0);
+    value->append(buf);
+    return true;
+  } else if (in == "num-immutable-mem-table") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%d", static_cast<int>(imms_.size()));
+    *value = buf;
+    return true;
+  } else if (in == "write-buffer-full") {
+    const bool full =
+        mem_ != NULL && mem_->ApproximateMemoryUsage() > WriteBufferSize();
+    *value = full ? "1" : "0";
+    return true;
+  } else if (in == "memtable-usage") {
+    size_t usage = 0;
+    if (mem_ != NULL) usage += mem_->ApproximateMemoryUsage();
+    for (size_t i = 0; i < imms_.size(); i++) {
+      usage += imms_[i]->mem->ApproximateMemoryUsage();
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(usage));
+    *value = buf;
+    return true;
+  } else if (in == "write-amplification") {
+    int64_t bytes_written = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      bytes_written += stats_[level].bytes_written;
+    }
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%.2f",
+             bytes_flushed_ != 0
+                 ? static_cast<double>(bytes_written) / bytes_flushed_
+                 : 0.0);
+    *value = buf;
+    return true;
+  } else if (in == "num-range-deletions") {
+    const RangeDelSet* range_dels = versions_->current()->range_dels();
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%d",
+             range_dels != NULL ? static_cast<int>(range_dels->size()) : 0);
+    *value = buf;
+    return true;
+  } else if (in == "open-micros") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(open_micros_));
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -2044,7 +2901,7 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
       edit.AddFile(level, insert->files[i].number, insert->files[i].file_size,
                    off, insert->files[i].smallest, insert->files[i].largest);
     }
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = ApplyEdit(&edit);
     if (s.ok()) {
       versions_->SetLastSequence(
           std::max(next, insert->options->suggested_max_seq));
@@ -2077,7 +2934,8 @@ Status DBImpl::AddL0Tables(const InsertOptions& options,
     MutexLock l(&mutex_);
     // Temporarily block any background compaction
     bg_compaction_paused_++;
-    while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+    while (bg_compaction_in_progress_ || bg_flushes_in_progress_ != 0 ||
+           bulk_insert_in_progress_) {
       bg_cv_.Wait();
     }
 
@@ -2160,6 +3018,10 @@ Status DBImpl::Dump(const DumpOptions& options, const Range& r,
                 *max_seq = std::max(*max_seq, ikey.sequence);
               }
               break;
+            case kTypeMerge:
+              // Dumped tables must hold final values only
+              s = Status::NotSupported("Cannot dump unmerged keys");
+              break;
           }
         }
       }
@@ -2201,6 +3063,7 @@ Status DBImpl::Dump(const DumpOptions& options, const Range& r,
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   *dbptr = NULL;
 
+  const uint64_t start_micros = CurrentMicros();
   DBImpl* impl = new DBImpl(options, dbname);
 #if VERBOSE >= 1
   Log(options.info_log, 1, "Opening db at %s ...", dbname.c_str());
@@ -2223,13 +3086,17 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
       }
     }
     if (s.ok()) {
-      s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
+      s = impl->ApplyEdit(&edit);
     }
     if (s.ok()) {
       impl->DeleteObsoleteFiles();
+      if (impl->options_.load_tables_on_open) {
+        impl->LoadTables();
+      }
       impl->MaybeScheduleCompaction();
     }
   }
+  impl->open_micros_ = CurrentMicros() - start_micros;
   impl->mutex_.Unlock();
   if (s.ok()) {
     *dbptr = impl;
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "write_batch_internal.h"
+#include "write_controller.h"
 
 #include "pdlfs-common/leveldb/db.h"
 #include "pdlfs-common/leveldb/internal_types.h"
@@ -34,7 +35,8 @@ namespace pdlfs {
 // equal to raw_options.info_log. The caller should also delete
 // result.block_cache if it is not equal to raw_options.block_cache. Finally,
 // the caller should delete result.table_cache if it is not equal to
-// raw_options.table_cache.
+// raw_options.table_cache. Caches taken from raw_options.memory_budget are
+// owned by the budget and must not be deleted.
 extern DBOptions SanitizeOptions(const std::string& dbname,
                                  const InternalKeyComparator* icmp,
                                  const InternalFilterPolicy* ipolicy,
@@ -56,6 +58,10 @@ class DBImpl : public DB {
   virtual Status FlushMemTable(const FlushOptions&);
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status Merge(const WriteOptions&, const Slice& key,
+                       const Slice& value);
+  virtual Status DeleteRange(const WriteOptions&, const Slice& begin,
+                             const Slice& end);
   virtual Status Write(const WriteOptions&, WriteBatch* updates);
   virtual Status Get(const ReadOptions&, const Slice& key, std::string* value);
   virtual Status Get(const ReadOptions&, const Slice& key, Slice* value,
@@ -101,6 +107,8 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct InsertionState;
+  struct LogReplay;
+  struct TableLoader;
   struct Writer;
 
   Status Get(const ReadOptions&, const Slice& key, Buffer* buf);
@@ -125,26 +133,68 @@ class DBImpl : public DB {
   // Delete any unneeded files and stale in-memory entries.
   void DeleteObsoleteFiles();
 
-  // Compact the in-memory write buffer to disk.  Switches to a new
-  // log-file/memtable and writes a new descriptor iff successful.
-  // Errors are recorded in bg_error_.
+  // Compact the oldest immutable memtable not yet claimed by another thread
+  // to disk. The resulting table is installed only after all older memtables
+  // have been installed. Errors are recorded in bg_error_.
   void CompactMemTable();
+  // Freeze the current memtable and queue it for compaction.
+  void FreezeMemTable();
+  // Update the reader-visible view of the immutable memtables.
+  void UpdateImmList();
   Status RecoverLogFile(uint64_t log_number, VersionEdit* edit,
                         SequenceNumber* max_sequence);
-
+  // Replay logs on options_.open_pool and write them out in log order.
+  Status RecoverLogFilesInParallel(const std::vector<uint64_t>& logs,
+                                   VersionEdit* edit,
+                                   SequenceNumber* max_sequence);
+  static void ReplayLogWork(void* arg);
+  // Size at which a memtable is considered full: options_.write_buffer_size,
+  // or the size currently set by options_.memory_budget if there is one.
+  size_t WriteBufferSize() const;
+  // Read a log into memtables, none of which is much larger than
+  // WriteBufferSize(), handing each over to ReplayedMemTable() once full.
+  // Requires mutex_ iff the replay is sequential.
+  Status ReplayLogFile(LogReplay* r);
+  // Dump a memtable filled by a sequential replay, or queue it for the
+  // thread writing out a parallel replay.
+  Status ReplayedMemTable(LogReplay* r, MemTable* mem);
+
+  // Load all tables of the current version into table cache. Wait for the
+  // loading to finish unless options_.load_tables_in_background is set.
+  void LoadTables();
+  static void LoadTablesWork(void* arg);
+  void LoadTablesLoop(TableLoader* loader);
+
+  void AddRangeDeletions(MemTable* mem, VersionEdit* edit);
   Status DumpMemTable(MemTable* mem, VersionEdit* edit, Version* base);
   Status WriteLevel0Table(Iterator* iter, VersionEdit* edit, Version* base,
                           SequenceNumber* min_seq, SequenceNumber* max_seq);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */);
+  // Recompute the rate at which writes are admitted. Called whenever the
+  // shape of the LSM tree or the measured compaction throughput changes.
+  void UpdateWriteRate();
+  // Fold the throughput of a finished background job into bg_write_rate_.
+  void RecordBackgroundWrite(int64_t bytes, int64_t micros);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
 
   void RecordBackgroundError(const Status& s);
 
+  // VersionSet::LogAndApply() must not be called concurrently. Because
+  // memtable compactions may run in parallel with each other and with
+  // table compactions, callers must acquire the MANIFEST first.
+  // REQUIRES: mutex_ has been locked.
+  void AcquireManifest();
+  void ReleaseManifest();
+  Status ApplyEdit(VersionEdit* edit);
+
   bool HasCompaction();
   void MaybeScheduleCompaction();
   static void BGWork(void* db);
   void BackgroundCall();
+  void MaybeScheduleFlush();
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   void BackgroundCompactionWrapper();
   void BackgroundCompaction();
   void CleanupCompaction(CompactionState* compact);
@@ -152,6 +202,9 @@ class DBImpl : public DB {
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
+  Status AddCompactionOutput(CompactionState* compact, Iterator* input,
+                             const Slice& key, const Slice& value);
+  Status CompactMergeOperands(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact);
 
   Status LoadLevel0Table(InsertionState* insert);
@@ -179,8 +232,14 @@ class DBImpl : public DB {
   port::AtomicPointer shutting_down_;
   port::CondVar bg_cv_;  // Signalled when background work finishes
   MemTable* mem_;
-  MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+  // Immutable memtables waiting to be compacted, oldest first
+  struct ImmTable;
+  std::deque<ImmTable*> imms_;
+  // Snapshot of imms_ referenced by readers. NULL if imms_ is empty
+  struct ImmList;
+  ImmList* imm_;
+  // So bg thread can detect an immutable memtable not yet being compacted
+  port::AtomicPointer has_imm_;
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
@@ -198,6 +257,15 @@ class DBImpl : public DB {
   uint64_t l0_hard_limits_;
   uint64_t l0_waits_;
 
+  // Paces writers once level-0 reaches options_.l0_soft_limit
+  WriteController write_controller_;
+  // Moving average of the bytes per second background jobs have written to
+  // tables, for both memtable and table compactions. 0 until the first job
+  // finishes
+  uint64_t bg_write_rate_;
+  // Total bytes written to tables built from memtables
+  uint64_t bytes_flushed_;
+
   SnapshotList snapshots_;
 
   // Set of table files to protect from deletion because they are
@@ -217,6 +285,16 @@ class DBImpl : public DB {
   bool bg_compaction_in_progress_;
   // Is there an active foreground bulk insertion job?
   bool bulk_insert_in_progress_;
+  // Number of background flush jobs scheduled and not yet started
+  int bg_flushes_scheduled_;
+  // Number of threads writing immutable memtables out
+  int bg_flushes_in_progress_;
+  // Is a thread applying a version edit to the MANIFEST?
+  bool manifest_busy_;
+  // Number of table loading jobs scheduled and not yet finished
+  int table_load_jobs_;
+  // Time spent in DB::Open
+  uint64_t open_micros_;
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -268,6 +346,8 @@ class DBImpl : public DB {
     }
   };
   CompactionStats stats_[config::kNumLevels];
+  // Aggregated read-path stats of all point lookups
+  ReadStats read_stats_;
 
   // No copying allowed
   void operator=(const DBImpl&);
@@ -16,6 +16,7 @@
  */
 #include "db_iter.h"
 #include "db_impl.h"
+#include "merge_context.h"
 
 #include "pdlfs-common/leveldb/filenames.h"
 #include "pdlfs-common/leveldb/internal_types.h"
@@ -56,15 +57,21 @@ class DBIter : public Iterator {
   //     the exact entry that yields this->key(), this->value()
   // (2) When moving backwards, the internal iterator is positioned
   //     just before all entries whose user key == this->key().
+  // (3) When moving forward and this->key() has merge operands, the
+  //     internal iterator is positioned just after the entries that were
+  //     folded into this->value(). The key and the folded value are
+  //     saved in saved_key_ and saved_value_.
   enum Direction { kForward, kReverse };
 
-  DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+  DBIter(DBImpl* db, const Comparator* cmp, const MergeOperator* merge_op,
+         Iterator* iter, SequenceNumber s, uint32_t seed)
       : db_(db),
         user_comparator_(cmp),
+        merge_operator_(merge_op),
         iter_(iter),
         sequence_(s),
         direction_(kForward),
+        merged_(false),
         valid_(false),
         rnd_(seed),
         bytes_counter_(RandomPeriod()) {}
@@ -72,11 +79,13 @@ class DBIter : public Iterator {
   virtual bool Valid() const { return valid_; }
   virtual Slice key() const {
     assert(valid_);
-    return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
+    return (direction_ == kForward && !merged_) ? ExtractUserKey(iter_->key())
+                                                : saved_key_;
   }
   virtual Slice value() const {
     assert(valid_);
-    return (direction_ == kForward) ? iter_->value() : saved_value_;
+    return (direction_ == kForward && !merged_) ? iter_->value()
+                                                : saved_value_;
   }
   virtual Status status() const {
     if (status_.ok()) {
@@ -95,6 +104,7 @@ class DBIter : public Iterator {
  private:
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
+  bool MergeForward(const ParsedInternalKey& ikey);
   bool ParseKey(ParsedInternalKey* key);
 
   inline void SaveKey(const Slice& k, std::string* dst) {
@@ -115,6 +125,7 @@ class DBIter : public Iterator {
 
   DBImpl* db_;
   const Comparator* const user_comparator_;
+  const MergeOperator* const merge_operator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
 
@@ -122,6 +133,7 @@ class DBIter : public Iterator {
   std::string saved_key_;    // == current key when direction_==kReverse
   std::string saved_value_;  // == current raw value when direction_==kReverse
   Direction direction_;
+  bool merged_;  // Current entry is a folded value; see (3) above
   bool valid_;
 
   Random rnd_;
@@ -169,6 +181,16 @@ void DBIter::Next() {
       return;
     }
     // saved_key_ already contains the key to skip past.
+  } else if (merged_) {
+    // iter_ is already past the entries folded into the current entry and
+    // saved_key_ contains the key to skip past.
+    merged_ = false;
+    if (!iter_->Valid()) {
+      valid_ = false;
+      saved_key_.clear();
+      ClearSavedValue();
+      return;
+    }
   } else {
     // Store in saved_key_ the current key so we skip it below.
     SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
@@ -177,6 +199,43 @@ void DBIter::Next() {
   FindNextUserEntry(true, &saved_key_);
 }
 
+// Fold the merge operand at iter_ together with all older entries of the same
+// user key. On return, iter_ is positioned after the last entry folded.
+// Return true if the key has a value after the merge, which is saved in
+// saved_value_. Return false otherwise.
+bool DBIter::MergeForward(const ParsedInternalKey& ikey) {
+  SaveKey(ikey.user_key, &saved_key_);
+  MergeContext merge(merge_operator_);
+  merge.Add(iter_->value());
+  std::string base;
+  bool has_base = false;
+  for (iter_->Next(); iter_->Valid(); iter_->Next()) {
+    ParsedInternalKey older;
+    if (!ParseKey(&older)) {
+      return false;
+    } else if (user_comparator_->Compare(older.user_key, saved_key_) != 0) {
+      break;
+    }
+    if (older.type == kTypeMerge) {
+      merge.Add(iter_->value());
+    } else {
+      if (older.type == kTypeValue) {
+        Slice v = iter_->value();
+        base.assign(v.data(), v.size());
+        has_base = true;
+      }
+      iter_->Next();
+      break;
+    }
+  }
+  Slice base_value(base);
+  bool found = false;
+  ClearSavedValue();
+  status_ = merge.Fold(saved_key_, has_base ? &base_value : NULL,
+                       &saved_value_, &found);
+  return status_.ok() && found;
+}
+
 void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
@@ -201,6 +260,31 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
             return;
           }
           break;
+        case kTypeMerge:
+          if (skipping &&
+              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
+            // Entry hidden
+          } else if (MergeForward(ikey)) {
+            valid_ = true;
+            merged_ = true;
+            return;
+          } else if (!status_.ok()) {
+            saved_key_.clear();
+            valid_ = false;
+            return;
+          } else {
+            // The key has no value after the merge. Skip its remaining
+            // entries, which are already saved in skip.
+            skip->swap(saved_key_);
+            skipping = true;
+            if (!iter_->Valid()) {
+              saved_key_.clear();
+              valid_ = false;
+              return;
+            }
+            continue;  // iter_ already points to the next entry
+          }
+          break;
       }
     }
     iter_->Next();
@@ -215,8 +299,21 @@ void DBIter::Prev() {
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
-    assert(iter_->Valid());  // Otherwise valid_ would have been false
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    if (merged_) {
+      // iter_ is just past the entries of the current entry and saved_key_
+      // already contains the current key. Step back onto the last of those
+      // entries so the loop below works the same as in the non-merged case.
+      merged_ = false;
+      if (!iter_->Valid()) {
+        iter_->SeekToLast();
+      } else {
+        iter_->Prev();
+      }
+      assert(iter_->Valid());
+    } else {
+      assert(iter_->Valid());  // Otherwise valid_ would have been false
+      SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    }
     while (true) {
       iter_->Prev();
       if (!iter_->Valid()) {
@@ -249,6 +346,32 @@ void DBIter::FindPrevUserEntry() {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
+        if (ikey.type == kTypeMerge) {
+          // Entries of the same key are visited from older to newer, so
+          // the operand can be applied to the value saved so far.
+          MergeContext merge(merge_operator_);
+          merge.Add(iter_->value());
+          std::string result;
+          Slice existing(saved_value_);
+          bool found = false;
+          status_ = merge.Fold(ikey.user_key,
+                               value_type == kTypeDeletion ? NULL : &existing,
+                               &result, &found);
+          if (!status_.ok()) {
+            value_type = kTypeDeletion;
+            break;
+          } else if (!found) {
+            value_type = kTypeDeletion;
+            saved_key_.clear();
+            ClearSavedValue();
+          } else {
+            value_type = kTypeValue;
+            SaveKey(ikey.user_key, &saved_key_);
+            saved_value_.swap(result);
+          }
+          iter_->Prev();
+          continue;
+        }
         value_type = ikey.type;
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
@@ -280,6 +403,7 @@ void DBIter::FindPrevUserEntry() {
 
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
   saved_key_.clear();
   AppendInternalKey(&saved_key_,
@@ -294,6 +418,7 @@ void DBIter::Seek(const Slice& target) {
 
 void DBIter::SeekToFirst() {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
@@ -305,6 +430,7 @@ void DBIter::SeekToFirst() {
 
 void DBIter::SeekToLast() {
   direction_ = kReverse;
+  merged_ = false;
   ClearSavedValue();
   iter_->SeekToLast();
   FindPrevUserEntry();
@@ -317,10 +443,12 @@ void DBIter::SeekToLast() {
 Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
+    const MergeOperator* merge_operator,
     Iterator* internal_iter,
     SequenceNumber sequence,
     uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+  return new DBIter(db, user_key_comparator, merge_operator, internal_iter,
+                    sequence, seed);
 }
 
 /* clang-format on */
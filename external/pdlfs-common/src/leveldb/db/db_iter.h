@@ -24,12 +24,14 @@
 namespace pdlfs {
 
 class DBImpl;
+class MergeOperator;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number into
-// appropriate user keys.
+// appropriate user keys. Merge operands are folded using "merge_operator".
 extern Iterator* NewDBIterator(  ///
-    DBImpl* db, const Comparator* user_key_comparator, Iterator* internal_iter,
+    DBImpl* db, const Comparator* user_key_comparator,
+    const MergeOperator* merge_operator, Iterator* internal_iter,
     SequenceNumber sequence, uint32_t seed);
 
 }  // namespace pdlfs
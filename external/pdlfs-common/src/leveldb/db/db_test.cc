@@ -23,11 +23,14 @@
 #include "pdlfs-common/leveldb/db.h"
 #include "pdlfs-common/leveldb/filenames.h"
 #include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/memory_budget.h"
+#include "pdlfs-common/leveldb/merge_operator.h"
 #include "pdlfs-common/leveldb/table.h"
 
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/log_writer.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/strutil.h"
 #include "pdlfs-common/testharness.h"
@@ -208,7 +211,7 @@ class DBTest {
   const FilterPolicy* filter_policy_;
 
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kFilter, kUncompressed, kEnd };
+  enum OptionConfig { kDefault, kFilter, kUncompressed, kHashIndex, kEnd };
   int option_config_;
 
  public:
@@ -255,6 +258,9 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kHashIndex:
+        options.memtable_hash_buckets = 16;  // Force collisions
+        break;
       default:
         break;
     }
@@ -392,6 +398,9 @@ class DBTest {
             case kTypeDeletion:
               result += "DEL";
               break;
+            case kTypeMerge:
+              result += "MRG(" + iter->value().ToString() + ")";
+              break;
           }
         }
         iter->Next();
@@ -590,6 +599,45 @@ TEST(DBTest, GetFromImmutableLayer) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetFromMultipleImmutableLayers) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3);
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.compaction_pool = pool;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.max_write_buffer_number = 4;
+  Reopen(&options);
+
+  env_->delay_data_sync_.Release_Store(env_);  // Block memtable compactions
+  for (int i = 0; i < 3; i++) {
+    char key[10];
+    snprintf(key, sizeof(key), "k%d", i);
+    ASSERT_OK(Put(key, key));
+    ASSERT_OK(Put("big", std::string(100000, 'a' + i)));  // Fill memtable
+  }
+  ASSERT_OK(Put("k3", "k3"));  // Freeze the last memtable; must not block
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-immutable-mem-table", &property));
+  ASSERT_EQ("3", property);
+  ASSERT_EQ("k0", Get("k0"));
+  ASSERT_EQ("k1", Get("k1"));
+  ASSERT_EQ("k2", Get("k2"));
+  ASSERT_EQ("k3", Get("k3"));
+  ASSERT_EQ(std::string(100000, 'c'), Get("big"));  // From the newest one
+  env_->delay_data_sync_.Release_Store(NULL);  // Release sync calls
+
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-immutable-mem-table", &property));
+  ASSERT_EQ("0", property);
+  ASSERT_EQ("k0", Get("k0"));
+  ASSERT_EQ(std::string(100000, 'c'), Get("big"));
+  Reopen(&options);
+  ASSERT_EQ("k3", Get("k3"));
+  ASSERT_EQ(std::string(100000, 'c'), Get("big"));
+  Close();
+  delete pool;
+}
+
 TEST(DBTest, GetFromVersions) {
   do {
     ASSERT_OK(Put("foo", "v1"));
@@ -598,6 +646,244 @@ TEST(DBTest, GetFromVersions) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, ReadStats) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("c", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("b", "v2"));
+  ReadStats stats;
+  ReadOptions ro;
+  ro.stats = &stats;
+  std::string value;
+  ASSERT_OK(db_->Get(ro, "b", &value));
+  ASSERT_EQ(stats.gets, 1);
+  ASSERT_EQ(stats.mem_hits, 1);
+  ASSERT_EQ(stats.table_probes, 0);
+  ASSERT_OK(db_->Get(ro, "a", &value));
+  ASSERT_EQ(stats.table_probes, 1);
+  ASSERT_EQ(stats.filter_checks, 1);
+  ASSERT_EQ(stats.filter_negatives, 0);
+  ASSERT_EQ(stats.block_reads, stats.block_cache_misses);
+  ASSERT_OK(db_->Get(ro, "a", &value));
+  ASSERT_EQ(stats.block_cache_hits + stats.block_cache_misses, 2);
+  ASSERT_TRUE(db_->Get(ro, "bb", &value).IsNotFound());
+  ASSERT_EQ(stats.table_probes, 3);
+  ASSERT_EQ(stats.filter_checks, 3);
+  ASSERT_EQ(stats.filter_negatives, 1);
+  ASSERT_EQ(stats.gets, 4);
+  std::string prop;
+  ASSERT_TRUE(db_->GetProperty("leveldb.read-stats", &prop));
+  ASSERT_TRUE(prop.find("Gets: 4 ") != std::string::npos);
+  Close();
+  delete options.filter_policy;
+}
+
+TEST(DBTest, DataBlockHashIndex) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.block_restart_interval = 4;
+  options.data_block_hash_index = true;
+  DestroyAndReopen(&options);
+  char key[20];
+  for (int i = 0; i < 2000; i += 2) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    ASSERT_OK(Put(key, "v1"));
+  }
+  const Snapshot* snap = db_->GetSnapshot();
+  for (int i = 0; i < 2000; i += 10) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    ASSERT_OK(Put(key, "v2"));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ReadStats stats;
+  ReadOptions ro;
+  ro.stats = &stats;
+  std::string value;
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    if (i % 2 != 0) {
+      ASSERT_TRUE(db_->Get(ro, key, &value).IsNotFound());
+    } else {
+      ASSERT_OK(db_->Get(ro, key, &value));
+      ASSERT_EQ(value, i % 10 == 0 ? "v2" : "v1");
+      ASSERT_EQ(Get(key, snap), "v1");
+    }
+  }
+  ASSERT_EQ(stats.hash_checks, 1999);  // k1999 sorts after the whole table
+  ASSERT_GT(stats.hash_negatives, 0);
+  ASSERT_LE(stats.hash_negatives, 1000);
+  db_->ReleaseSnapshot(snap);
+
+  // Tables written with and without the index are read alike
+  options.data_block_hash_index = false;
+  Reopen(&options);
+  for (int i = 1; i < 2000; i += 2) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    ASSERT_OK(Put(key, "v3"));
+  }
+  dbfull()->TEST_CompactMemTable();
+  stats.Clear();
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    ASSERT_EQ(Get(key), i % 2 != 0 ? "v3" : (i % 10 == 0 ? "v2" : "v1"));
+  }
+  snprintf(key, sizeof(key), "k%04d", 1);
+  ASSERT_OK(db_->Get(ro, key, &value));
+  ASSERT_EQ(stats.hash_checks, 0);
+  Close();
+}
+
+TEST(DBTest, ReadaheadScan) {
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  char key[20];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "k%04d", i);
+    ASSERT_OK(Put(key, std::string(100, 'v')));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ReadStats stats;
+  ReadOptions ro;
+  ro.stats = &stats;
+  ro.fill_cache = false;
+  ro.readahead_size = 4096;
+  Iterator* iter = db_->NewIterator(ro);
+  int n = 0;
+  for (iter->Seek("k0500"); iter->Valid(); iter->Next()) n++;
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(n, 1500);
+  ASSERT_GT(stats.block_reads, 0);
+  Close();
+}
+
+namespace {
+// Appends operands to the existing value using "," as the separator.
+// An operand of "!" removes the key.
+class AppendOperator : public MergeOperator {
+ public:
+  virtual bool Merge(const Slice& key, const Slice* existing_value,
+                     const Slice& operand, std::string* new_value) const {
+    if (operand == "!") {
+      return false;
+    } else if (existing_value != NULL) {
+      new_value->assign(existing_value->data(), existing_value->size());
+      new_value->push_back(',');
+    }
+    new_value->append(operand.data(), operand.size());
+    return true;
+  }
+
+  virtual const char* Name() const { return "test.AppendOperator"; }
+};
+}  // namespace
+
+TEST(DBTest, MergeWithoutOperator) {
+  ASSERT_TRUE(db_->Merge(WriteOptions(), "a", "x").IsNotSupported());
+}
+
+TEST(DBTest, Merge) {
+  AppendOperator op;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &op;
+  DestroyAndReopen(&options);
+  ASSERT_OK(Put("a", "x"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "a", "y"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "b", "p"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "a", "z"));
+  ASSERT_EQ("x,y,z", Get("a"));
+  ASSERT_EQ("p", Get("b"));
+  ASSERT_EQ("(a->x,y,z)(b->p)", Contents());
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("x,y,z", Get("a"));
+  ASSERT_EQ("p", Get("b"));
+  const Snapshot* snap = db_->GetSnapshot();
+  ASSERT_OK(db_->Merge(WriteOptions(), "a", "w"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "c", "q"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "c", "!"));
+  ASSERT_OK(Delete("b"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "b", "r"));
+  ASSERT_EQ("x,y,z,w", Get("a"));
+  ASSERT_EQ("x,y,z", Get("a", snap));
+  ASSERT_EQ("r", Get("b"));
+  ASSERT_EQ("NOT_FOUND", Get("c"));
+  ASSERT_EQ("(a->x,y,z,w)(b->r)", Contents());
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("a");
+  ASSERT_EQ(IterStatus(iter), "a->x,y,z,w");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->r");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "a->x,y,z,w");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+  // Only operands hidden from the snapshot may be folded
+  dbfull()->TEST_CompactMemTable();
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("[ MRG(w), x,y,z ]", AllEntriesFor("a"));
+  ASSERT_EQ("x,y,z,w", Get("a"));
+  ASSERT_EQ("x,y,z", Get("a", snap));
+  db_->ReleaseSnapshot(snap);
+  ASSERT_OK(db_->Merge(WriteOptions(), "a", "v"));
+  dbfull()->TEST_CompactMemTable();
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("[ x,y,z,w,v ]", AllEntriesFor("a"));
+  ASSERT_EQ("(a->x,y,z,w,v)(b->r)", Contents());
+  Close();
+}
+
+TEST(DBTest, HashIndexedMemTable) {
+  AppendOperator op;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.merge_operator = &op;
+  options.memtable_hash_buckets = 4;
+  DestroyAndReopen(&options);
+  std::map<std::string, std::string> model;
+  char k[10];
+  Random rnd(301);
+  for (int i = 0; i < 2000; i++) {
+    snprintf(k, sizeof(k), "k%03d", rnd.Uniform(100));
+    const std::string v = RandomString(&rnd, 5);
+    switch (rnd.Uniform(4)) {
+      case 0:
+        ASSERT_OK(Delete(k));
+        model.erase(k);
+        break;
+      case 1:
+        ASSERT_OK(db_->Merge(WriteOptions(), k, v));
+        model[k] = model.count(k) ? model[k] + "," + v : v;
+        break;
+      default:
+        ASSERT_OK(Put(k, v));
+        model[k] = v;
+        break;
+    }
+  }
+  const Snapshot* snap = db_->GetSnapshot();
+  const std::map<std::string, std::string> snap_model = model;
+  for (int i = 0; i < 100; i++) {
+    snprintf(k, sizeof(k), "k%03d", i);
+    ASSERT_OK(Put(k, "new"));
+  }
+  for (int i = 0; i < 100; i++) {
+    snprintf(k, sizeof(k), "k%03d", i);
+    std::map<std::string, std::string>::const_iterator it = snap_model.find(k);
+    ASSERT_EQ(it != snap_model.end() ? it->second : "NOT_FOUND", Get(k, snap));
+    ASSERT_EQ("new", Get(k));
+  }
+  ASSERT_EQ("NOT_FOUND", Get("missing"));
+  db_->ReleaseSnapshot(snap);
+  Close();
+}
+
 TEST(DBTest, GetSnapshot) {
   do {
     // Try with both a short key and a long key
@@ -999,6 +1285,115 @@ TEST(DBTest, RecoverWithLargeLog) {
   ASSERT_GT(NumTableFilesAtLevel(0), 1);
 }
 
+TEST(DBTest, ParallelRecovery) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4);
+  Options options = CurrentOptions();
+  options.open_pool = pool;
+  options.load_tables_on_open = true;
+  options.disable_compaction = true;
+  Reopen(&options);
+  ASSERT_OK(Put("foo", "v0"));
+  ASSERT_OK(Put("bar", "v0"));
+  Close();
+
+  // Add logs as if the previous incarnation had switched logs several times
+  // before it crashed. Later logs overwrite keys written by earlier ones.
+  std::vector<std::string> files;
+  ASSERT_OK(env_->GetChildren(dbname_.c_str(), &files));
+  uint64_t log_number = 0;
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (ParseFileName(files[i], &number, &type) && type == kLogFile) {
+      log_number = std::max(log_number, number);
+    }
+  }
+  ASSERT_GT(log_number, 0);
+  for (int i = 1; i <= 3; i++) {
+    WriteBatch batch;
+    batch.Put("foo", "v" + NumberToString(i));
+    batch.Put(Key(i), "x");
+    WriteBatchInternal::SetSequence(&batch, 1000 * i);
+    const std::string fname = LogFileName(dbname_, log_number + i);
+    WritableFile* file;
+    ASSERT_OK(env_->NewWritableFile(fname.c_str(), &file));
+    log::Writer writer(file);
+    ASSERT_OK(writer.AddRecord(WriteBatchInternal::Contents(&batch)));
+    ASSERT_OK(file->Close());
+    delete file;
+  }
+
+  Reopen(&options);
+  ASSERT_EQ("v3", Get("foo"));
+  ASSERT_EQ("v0", Get("bar"));
+  for (int i = 1; i <= 3; i++) {
+    ASSERT_EQ("x", Get(Key(i)));
+  }
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.open-micros", &property));
+  // Tables were loaded while the db was being opened
+  ReadOptions read_options;
+  ReadStats stats;
+  read_options.stats = &stats;
+  std::string value;
+  ASSERT_OK(db_->Get(read_options, "bar", &value));
+  ASSERT_EQ(stats.table_opens, 0);
+  // New writes are sequenced after all recovered ones
+  ASSERT_OK(Put("foo", "v4"));
+  options.load_tables_in_background = true;
+  Reopen(&options);
+  ASSERT_EQ("v4", Get("foo"));
+  ASSERT_EQ("v0", Get("bar"));
+  Close();
+  delete pool;
+}
+
+TEST(DBTest, ParallelRecoveryWithLargeLogs) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2);
+  Options options = CurrentOptions();
+  options.disable_compaction = true;
+  Reopen(&options);
+  Close();
+
+  // Each log holds more memtables than a replay may queue and the pool has
+  // fewer threads than there are logs.
+  std::vector<std::string> files;
+  ASSERT_OK(env_->GetChildren(dbname_.c_str(), &files));
+  uint64_t log_number = 0;
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (ParseFileName(files[i], &number, &type) && type == kLogFile) {
+      log_number = std::max(log_number, number);
+    }
+  }
+  ASSERT_GT(log_number, 0);
+  for (int i = 1; i <= 4; i++) {
+    const std::string fname = LogFileName(dbname_, log_number + i);
+    WritableFile* file;
+    ASSERT_OK(env_->NewWritableFile(fname.c_str(), &file));
+    log::Writer writer(file);
+    for (int j = 0; j < 5; j++) {
+      WriteBatch batch;
+      batch.Put(Key(j), std::string(100000, '0' + i));
+      WriteBatchInternal::SetSequence(&batch, 1000 * i + j);
+      ASSERT_OK(writer.AddRecord(WriteBatchInternal::Contents(&batch)));
+    }
+    ASSERT_OK(file->Close());
+    delete file;
+  }
+
+  options.write_buffer_size = 50000;
+  options.open_pool = pool;
+  Reopen(&options);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 20);
+  for (int j = 0; j < 5; j++) {
+    ASSERT_EQ(std::string(100000, '4'), Get(Key(j)));
+  }
+  Close();
+  delete pool;
+}
+
 TEST(DBTest, NoMemTable) {
   Options options = CurrentOptions();
   options.no_memtable = true;
@@ -1069,6 +1464,74 @@ TEST(DBTest, NoLogWithoutDataLoss) {
   ASSERT_EQ("v5", Get("baz"));
 }
 
+TEST(DBTest, NoAutoFlush) {
+  Options options = CurrentOptions();
+  options.disable_write_ahead_log = true;
+  options.disable_auto_flush = true;
+  options.write_buffer_size = 10000;  // Small write buffer
+  Reopen(&options);
+
+  ASSERT_OK(Put("foo", "v1"));
+  ASSERT_OK(dbfull()->FlushMemTable(FlushOptions()));
+  const int files = TotalTableFiles();
+  std::string full;
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-buffer-full", &full));
+  ASSERT_EQ(full, "0");
+  Random rnd(301);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1000)));
+  }
+  ASSERT_OK(Put("foo", "v2"));
+  ASSERT_EQ(TotalTableFiles(), files);  // Nothing flushed on its own
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-buffer-full", &full));
+  ASSERT_EQ(full, "1");
+  ASSERT_EQ("v2", Get("foo"));
+
+  Reopen(&options);  // Reopens at the last flush
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("NOT_FOUND", Get(Key(0)));
+  ASSERT_OK(Put("foo", "v3"));
+  ASSERT_OK(dbfull()->FlushMemTable(FlushOptions()));
+  Reopen(&options);
+  ASSERT_EQ("v3", Get("foo"));
+
+  // Waiting for an earlier flush does not switch out the current memtable
+  ASSERT_OK(Put("foo", "v4"));
+  FlushOptions fo;
+  fo.wait = false;
+  ASSERT_OK(dbfull()->FlushMemTable(fo));
+  ASSERT_OK(Put("foo", "v5"));
+  fo.wait_only = true;
+  ASSERT_OK(dbfull()->FlushMemTable(fo));
+  Reopen(&options);
+  ASSERT_EQ("v4", Get("foo"));
+}
+
+TEST(DBTest, MemoryBudget) {
+  MemoryBudget budget(4 << 20);
+  Options options = CurrentOptions();
+  options.memory_budget = &budget;
+  options.max_write_buffer_number = 2;
+  Reopen(&options);
+  // 1/4 of the budget is split between the two write buffers
+  ASSERT_EQ(budget.write_buffer_size(), 512 << 10);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 3000; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_GT(TotalTableFiles(), 1);
+  for (int i = 0; i < 3000; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  // Open tables and data blocks are charged against the budget's cache
+  ASSERT_GT(budget.cache()->TotalCharge(), 0);
+  ASSERT_LE(budget.cache()->TotalCharge(), budget.cache_share());
+  Close();  // Must go before the budget
+}
+
 TEST(DBTest, NoCompaction) {
   Options options = CurrentOptions();
   options.disable_compaction = true;
@@ -1428,6 +1891,79 @@ TEST(DBTest, DeletionMarkers1) {
   ASSERT_EQ(AllEntriesFor("foo"), "[ v2 ]");
 }
 
+TEST(DBTest, DeleteRange) {
+  do {
+    Put("a", "va");
+    Put("b1", "vb1");
+    Put("b2", "vb2");
+    Put("c", "vc");
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "c"));
+    Put("b2", "vb2x");
+    for (int i = 0; i < 3; i++) {
+      ASSERT_EQ("va", Get("a"));
+      ASSERT_EQ("NOT_FOUND", Get("b1"));
+      ASSERT_EQ("vb2x", Get("b2"));
+      ASSERT_EQ("vc", Get("c"));
+      ASSERT_EQ("(a->va)(b2->vb2x)(c->vc)", Contents());
+      if (i == 0) {
+        ASSERT_EQ("vb1", Get("b1", snapshot));
+        ASSERT_EQ("vb2", Get("b2", snapshot));
+        db_->ReleaseSnapshot(snapshot);
+        Reopen();  // Recover the range deletion from the log
+      } else if (i == 1) {
+        ASSERT_OK(dbfull()->TEST_CompactMemTable());
+        Reopen();  // Recover the range deletion from the manifest
+      }
+    }
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, DeleteRangeAfterRead) {
+  Put("a", "va");
+  Put("b", "vb");
+  Put("c", "vc");
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "a", "b"));
+  ASSERT_EQ("NOT_FOUND", Get("a"));
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  // Range deletions added after a read are seen by later reads only
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "c"));
+  ASSERT_EQ("NOT_FOUND", Get("b"));
+  ASSERT_EQ("(c->vc)", Contents());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  delete iter;
+}
+
+TEST(DBTest, DeleteRangeCompaction) {
+  for (int i = 0; i < 100; i++) {
+    char key[10];
+    snprintf(key, sizeof(key), "b%03d", i);
+    Put(key, "v");
+  }
+  Put("a", "va");
+  Put("c", "vc");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), "b", "c"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-range-deletions", &property));
+  ASSERT_EQ("1", property);
+  ASSERT_EQ("(a->va)(c->vc)", Contents());
+  ASSERT_EQ("[ ]", AllEntriesFor("b050"));
+
+  // Covered entries are dropped and the range deletion is retired
+  const int last = last_options_.max_mem_compact_level;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+  dbfull()->TEST_CompactRange(last, NULL, NULL);
+  ASSERT_TRUE(db_->GetProperty("leveldb.num-range-deletions", &property));
+  ASSERT_EQ("0", property);
+  ASSERT_EQ("(a->va)(c->vc)", Contents());
+  Reopen();
+  ASSERT_EQ("(a->va)(c->vc)", Contents());
+  ASSERT_LT(Size("b", "c"), 100);
+}
+
 TEST(DBTest, DeletionMarkers2) {
   Put("foo", "v1");
   ASSERT_OK(dbfull()->TEST_CompactMemTable());
@@ -1497,6 +2033,151 @@ TEST(DBTest, OverlapInLevel0) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, WriteRateLimitedByL0Files) {
+  Options options = CurrentOptions();
+  options.l0_soft_limit = 2;
+  options.l0_hard_limit = 100;
+  options.delayed_write_rate = 1 << 20;
+  Reopen(&options);
+  ASSERT_OK(dbfull()->FreezeDbCompaction());
+  std::string property;
+  unsigned long long rate = 1;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(db_->GetProperty("leveldb.write-controller", &property));
+    ASSERT_EQ(sscanf(property.c_str(), "%*[^\n]\n%llu", &rate), 1);
+    ASSERT_EQ(rate, 0);  // Not throttled until L0 reaches the soft limit
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("z", "vz"));
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(NumTableFilesAtLevel(0), 2);
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-controller", &property));
+  ASSERT_EQ(sscanf(property.c_str(), "%*[^\n]\n%llu", &rate), 1);
+  ASSERT_GT(rate, 0);
+  ASSERT_LE(rate, 1 << 20);
+  ASSERT_OK(Put("foo", std::string(1000, 'x')));  // Paced, not blocked
+  ASSERT_OK(Put("foo", std::string(1000, 'y')));
+  ASSERT_EQ(std::string(1000, 'y'), Get("foo"));
+  ASSERT_OK(dbfull()->ResumeDbCompaction());
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_TRUE(db_->GetProperty("leveldb.write-controller", &property));
+  ASSERT_EQ(sscanf(property.c_str(), "%*[^\n]\n%llu", &rate), 1);
+  ASSERT_EQ(rate, 0);
+}
+
+TEST(DBTest, TieredCompaction) {
+  double write_amp[2];
+  for (int i = 0; i < 2; i++) {
+    Options options = CurrentOptions();
+    options.compaction_style =
+        (i == 0) ? kCompactionStyleLeveled : kCompactionStyleTiered;
+    options.write_buffer_size = 64 << 10;
+    options.table_file_size = 64 << 10;
+    options.l1_compaction_trigger = 2;
+    options.max_mem_compact_level = 0;
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+    // Mostly creates in random order, with occasional overwrites
+    Random rnd(301);
+    const int kNumKeys = 100000;
+    std::vector<int> keys(kNumKeys);
+    for (int k = 0; k < kNumKeys; k++) {
+      keys[k] = k;
+    }
+    for (int k = kNumKeys - 1; k > 0; k--) {
+      std::swap(keys[k], keys[rnd.Uniform(k + 1)]);
+    }
+    std::vector<std::string> values(kNumKeys);
+    for (int j = 0; j < kNumKeys; j++) {
+      int k = keys[j];
+      if (j % 10 == 9) k = keys[rnd.Uniform(j)];
+      values[k] = RandomString(&rnd, 100);
+      ASSERT_OK(Put(Key(k), values[k]));
+      if (j % 1000 == 0) {  // Reads see the newest run while runs reshape
+        ASSERT_EQ(values[k], Get(Key(k)));
+      }
+    }
+    ASSERT_OK(dbfull()->DrainCompactions());
+    for (int k = 0; k < kNumKeys; k++) {
+      ASSERT_EQ(values[k].empty() ? "NOT_FOUND" : values[k], Get(Key(k)));
+    }
+    std::string property;
+    ASSERT_TRUE(db_->GetProperty("leveldb.write-amplification", &property));
+    write_amp[i] = atof(property.c_str());
+    fprintf(stderr, "%s compaction write amplification: %.2f\n",
+            i == 0 ? "Leveled" : "Tiered", write_amp[i]);
+    ASSERT_GE(write_amp[i], 1.0);
+    // Level-0 is drained and overwritten values are compacted away, leaving
+    // about 10MB of live data in 64KB tables
+    ASSERT_LT(NumTableFilesAtLevel(0), options.l0_compaction_trigger);
+    ASSERT_GE(TotalTableFiles(), 120);
+    ASSERT_LE(TotalTableFiles(), 200);
+    const int last = config::kNumLevels - 1;
+    if (i == 0) {
+      // Leveled compaction fills levels top-down as each reaches its size
+      // target, so 10MB never reaches the last level
+      ASSERT_EQ(NumTableFilesAtLevel(last), 0);
+    } else {
+      // Tiered compaction moves runs down to empty levels, so the oldest
+      // run sits at the last level and newer runs stack right above it
+      // without gaps
+      ASSERT_GT(NumTableFilesAtLevel(last), 0);
+      int top = last;
+      while (top > 1 && NumTableFilesAtLevel(top - 1) > 0) {
+        top--;
+      }
+      for (int level = 1; level < top; level++) {
+        ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+      }
+    }
+  }
+  // Both styles compacted the same keys down to the same shape of live
+  // data, so tiered compaction must have rewritten fewer bytes
+  ASSERT_LT(write_amp[1], write_amp[0]);
+}
+
+TEST(DBTest, GroupAlignedCompactionOutputs) {
+  int misaligned[2];
+  for (int i = 0; i < 2; i++) {
+    Options options = CurrentOptions();
+    options.write_buffer_size = 8 << 20;
+    options.table_file_size = 20 << 10;
+    options.table_split_prefix_length = (i == 0) ? 0 : 4;
+    options.max_mem_compact_level = 0;
+    options.compression = kNoCompression;
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+    // Groups of 1 to 40 keys, each no larger than 1/4 of a table
+    Random rnd(301);
+    char tmp[20];
+    for (int g = 0; g < 300; g++) {
+      const int n = 1 + rnd.Uniform(40);
+      for (int k = 0; k < n; k++) {
+        snprintf(tmp, sizeof(tmp), "g%03d/k%03d", g, k);
+        ASSERT_OK(Put(tmp, RandomString(&rnd, 100)));
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+    ASSERT_GT(NumTableFilesAtLevel(1), 10);
+    // Count level-1 tables not starting at the first key of a group
+    std::string property;
+    ASSERT_TRUE(db_->GetProperty("leveldb.sstables", &property));
+    misaligned[i] = 0;
+    size_t pos = 0;
+    while ((pos = property.find("['", pos)) != std::string::npos) {
+      pos += 2;
+      if (property.compare(pos + 4, 5, "/k000") != 0) {
+        misaligned[i]++;
+      }
+    }
+  }
+  ASSERT_GT(misaligned[0], 0);
+  ASSERT_EQ(misaligned[1], 0);
+}
+
 TEST(DBTest, L0_CompactionBug_Issue44_a) {
   Reopen();
   ASSERT_OK(Put("b", "v"));
@@ -2042,6 +2723,9 @@ class ModelDB : public EmptyDB {
         (*map_)[key.ToString()] = value.ToString();
       }
       virtual void Delete(const Slice& key) { map_->erase(key.ToString()); }
+      virtual void Merge(const Slice& key, const Slice& value) {
+        // Not exercised by the model
+      }
     };
     Handler handler;
     handler.map_ = &map_;
@@ -15,11 +15,15 @@
  * found at https://github.com/google/leveldb.
  */
 #include "memtable.h"
+#include "merge_context.h"
+#include "range_del.h"
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/hash.h"
 
 #include <algorithm>
+#include <new>
 
 namespace pdlfs {
 
@@ -30,10 +34,31 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
-MemTable::MemTable(const InternalKeyComparator& cmp)
-    : comparator_(cmp), refs_(0), table_(comparator_, &arena_) {}
+MemTable::MemTable(const InternalKeyComparator& cmp, size_t hash_buckets)
+    : comparator_(cmp),
+      refs_(0),
+      table_(comparator_, &arena_),
+      range_dels_(NULL),
+      range_del_set_(NULL),
+      range_del_set_head_(NULL),
+      index_(NULL),
+      index_size_(hash_buckets) {
+  if (index_size_ != 0) {
+    char* const mem =
+        arena_.AllocateAligned(sizeof(port::AtomicPointer) * index_size_);
+    index_ = reinterpret_cast<port::AtomicPointer*>(mem);
+    for (size_t i = 0; i < index_size_; i++) {
+      new (&index_[i]) port::AtomicPointer(NULL);
+    }
+  }
+}
 
-MemTable::~MemTable() { assert(refs_ == 0); }
+MemTable::~MemTable() {
+  assert(refs_ == 0);
+  if (range_del_set_ != NULL) {
+    range_del_set_->Unref();
+  }
+}
 
 size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
 
@@ -107,13 +132,151 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   memcpy(p, value.data(), val_size);
   assert((p + val_size) - buf == encoded_len);
   table_.Insert(buf);
+  if (index_ != NULL) {
+    UpdateIndex(key, buf);
+  }
+}
+
+// Entries are added in sequence order, so a later entry for a key always
+// supersedes the one in the index.
+void MemTable::UpdateIndex(const Slice& user_key, const char* entry) {
+  port::AtomicPointer* const bucket =
+      &index_[Hash(user_key.data(), user_key.size(), 0) % index_size_];
+  IndexNode* head = reinterpret_cast<IndexNode*>(bucket->NoBarrier_Load());
+  for (IndexNode* n = head; n != NULL; n = n->next) {
+    const char* e = reinterpret_cast<const char*>(n->entry.NoBarrier_Load());
+    if (ExtractUserKey(GetLengthPrefixedSlice(e)) == user_key) {
+      n->entry.Release_Store(const_cast<char*>(entry));
+      return;
+    }
+  }
+  IndexNode* const n = new (arena_.AllocateAligned(sizeof(IndexNode)))
+      IndexNode;
+  n->entry.NoBarrier_Store(const_cast<char*>(entry));
+  n->next = head;
+  // Publish only after the node is fully initialized
+  bucket->Release_Store(n);
 }
 
-bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
+const char* MemTable::FindInIndex(const Slice& user_key) const {
+  const port::AtomicPointer* const bucket =
+      &index_[Hash(user_key.data(), user_key.size(), 0) % index_size_];
+  const IndexNode* n = reinterpret_cast<IndexNode*>(bucket->Acquire_Load());
+  for (; n != NULL; n = n->next) {
+    const char* e = reinterpret_cast<const char*>(n->entry.Acquire_Load());
+    if (ExtractUserKey(GetLengthPrefixedSlice(e)) == user_key) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+void MemTable::AddRangeDeletion(SequenceNumber seq, const Slice& begin,
+                                const Slice& end) {
+  char* buf =
+      arena_.AllocateAligned(sizeof(RangeDel) + begin.size() + end.size());
+  char* keys = buf + sizeof(RangeDel);
+  memcpy(keys, begin.data(), begin.size());
+  memcpy(keys + begin.size(), end.data(), end.size());
+  RangeDel* const d = new (buf) RangeDel;
+  d->seq = seq;
+  d->begin = Slice(keys, begin.size());
+  d->end = Slice(keys + begin.size(), end.size());
+  d->next = reinterpret_cast<RangeDel*>(range_dels_.NoBarrier_Load());
+  // Publish only after the deletion is fully initialized
+  range_dels_.Release_Store(d);
+}
+
+RangeDelSet* MemTable::RangeDeletions() {
+  const RangeDel* const head =
+      reinterpret_cast<RangeDel*>(range_dels_.Acquire_Load());
+  if (head == NULL) {
+    return NULL;
+  }
+  if (head != range_del_set_head_) {  // Range deletions added since built
+    std::vector<RangeTombstone> tombstones;
+    for (const RangeDel* d = head; d != NULL; d = d->next) {
+      tombstones.push_back(RangeTombstone(d->begin, d->end, d->seq));
+    }
+    if (range_del_set_ != NULL) {
+      range_del_set_->Unref();
+    }
+    range_del_set_ = new RangeDelSet(comparator_.comparator.user_comparator(),
+                                     &tombstones);
+    range_del_set_->Ref();
+    range_del_set_head_ = head;
+  }
+  range_del_set_->Ref();
+  return range_del_set_;
+}
+
+void MemTable::GetRangeDeletions(std::vector<RangeTombstone>* result) const {
+  const RangeDel* d = reinterpret_cast<RangeDel*>(range_dels_.Acquire_Load());
+  for (; d != NULL; d = d->next) {
+    result->push_back(RangeTombstone(d->begin, d->end, d->seq));
+  }
+}
+
+// Process an entry for the key being looked up. Return true if the lookup
+// is resolved. Return false if the entry is a merge operand and older
+// entries must be consulted.
+static bool SaveEntry(const char* key_ptr, uint32_t key_length,
+                      const LookupKey& key, Buffer* buf, size_t limit,
+                      Status* s, MergeContext* merge, SequenceNumber floor) {
+  const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+  ValueType type = static_cast<ValueType>(tag & 0xff);
+  if ((tag >> 8) < floor) {
+    type = kTypeDeletion;  // Removed by a newer range deletion
+  }
+  switch (type) {
+    case kTypeValue: {
+      Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+      if (merge != NULL && !merge->empty()) {
+        *s = merge->FoldInto(key.user_key(), &v, buf, limit);
+        return true;
+      }
+      buf->Fill(v.data(), std::min(v.size(), limit));
+      return true;
+    }
+    case kTypeDeletion:
+      if (merge != NULL && !merge->empty()) {
+        *s = merge->FoldInto(key.user_key(), NULL, buf, limit);
+        return true;
+      }
+      *s = Status::NotFound(Slice());
+      return true;
+    case kTypeMerge:
+      if (merge == NULL) {
+        *s = Status::NotSupported("Merge operands found");
+        return true;
+      }
+      merge->Add(GetLengthPrefixedSlice(key_ptr + key_length));
+      return false;
+  }
+  return false;
+}
+
+bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s,
+                   MergeContext* merge, SequenceNumber floor) {
+  if (index_ != NULL) {
+    const char* const entry = FindInIndex(key.user_key());
+    if (entry == NULL) {
+      return false;  // Key not in memtable
+    }
+    // The newest entry answers the lookup unless it is invisible to the
+    // lookup's snapshot or is a merge operand
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    if ((tag >> 8) <= key.sequence() &&
+        static_cast<ValueType>(tag & 0xff) != kTypeMerge) {
+      return SaveEntry(key_ptr, key_length, key, buf, limit, s, merge, floor);
+    }
+  }
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
   iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  for (; iter.Valid(); iter.Next()) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -130,18 +293,12 @@ bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
     const Comparator* ucmp = comparator_.comparator.user_comparator();
     if (ucmp->Compare(Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
       // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          buf->Fill(v.data(), std::min(v.size(), limit));
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+      if (SaveEntry(key_ptr, key_length, key, buf, limit, s, merge, floor)) {
+        return true;
       }
+      continue;  // Keep looking for older entries
     }
+    break;
   }
   return false;
 }
@@ -21,19 +21,27 @@
 #include "pdlfs-common/arena.h"
 #include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/port.h"
 
 #include <string>
+#include <vector>
 
 namespace pdlfs {
 
 class InternalKeyComparator;
 class MemTableIterator;
+class MergeContext;
+class RangeDelSet;
+struct RangeTombstone;
 
 class MemTable {
  public:
   // MemTables are reference counted.  The initial reference count
-  // is zero and the caller must call Ref() at least once.
-  explicit MemTable(const InternalKeyComparator& comparator);
+  // is zero and the caller must call Ref() at least once. If hash_buckets
+  // is not 0, point lookups are additionally served by a hash index with
+  // that many buckets.
+  explicit MemTable(const InternalKeyComparator& comparator,
+                    size_t hash_buckets = 0);
 
   // Increase reference count.
   void Ref() { ++refs_; }
@@ -68,11 +76,33 @@ class MemTable {
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
            const Slice& value);
 
+  // Add a range deletion that removes every key in [begin, end) written
+  // before the specified sequence number. Concurrent readers may proceed
+  // without synchronization.
+  void AddRangeDeletion(SequenceNumber seq, const Slice& begin,
+                        const Slice& end);
+
+  // Return the range deletions in the memtable as a set indexed for point
+  // lookups, or NULL if there is none. The set is built on first use and
+  // reused until more range deletions are added. The caller must Unref()
+  // the result when done.
+  // REQUIRES: external synchronization, which also covers Ref() and Unref()
+  // of the returned set.
+  RangeDelSet* RangeDeletions();
+
+  // Append all range deletions in the memtable to *result.
+  void GetRangeDeletions(std::vector<RangeTombstone>* result) const;
+
   // If memtable contains a value for key, store a prefix of it in *value
   // and return true. If memtable contains a deletion for key,
   // store a NotFound() error in *status and return true.
-  // Else, return false.
-  bool Get(const LookupKey& key, Buffer* value, size_t limit, Status* s);
+  // Else, return false. Merge operands found on the way are added to
+  // *merge and folded into the value once a value or a deletion is found.
+  // If only merge operands are found, return false. Entries whose
+  // sequence numbers are below floor have been removed by a range
+  // deletion and are treated as deletions.
+  bool Get(const LookupKey& key, Buffer* value, size_t limit, Status* s,
+           MergeContext* merge = NULL, SequenceNumber floor = 0);
 
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
@@ -86,10 +116,36 @@ class MemTable {
 
   typedef SkipList<const char*, KeyComparator> Table;
 
+  // Range deletions are kept in an arena-allocated list, newest first.
+  // There are normally few of them per memtable.
+  struct RangeDel {
+    SequenceNumber seq;
+    Slice begin;
+    Slice end;
+    RangeDel* next;
+  };
+
+  // Hash index entries map a user key to its newest entry in table_. Nodes
+  // are arena-allocated and never removed. Readers proceed without
+  // synchronization, like they do for table_.
+  struct IndexNode {
+    port::AtomicPointer entry;  // Newest table_ entry for the key
+    IndexNode* next;
+  };
+
+  void UpdateIndex(const Slice& user_key, const char* entry);
+  // Return the newest entry for user_key, or NULL if there is none.
+  const char* FindInIndex(const Slice& user_key) const;
+
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
   Table table_;
+  port::AtomicPointer range_dels_;  // Head of the range deletion list
+  RangeDelSet* range_del_set_;      // Indexed range deletions, if built
+  const RangeDel* range_del_set_head_;  // Newest deletion in range_del_set_
+  port::AtomicPointer* index_;      // Hash index buckets; NULL if disabled
+  size_t index_size_;
 
   // No copying allowed
   MemTable(const MemTable&);
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "merge_context.h"
+
+#include "pdlfs-common/leveldb/merge_operator.h"
+#include "pdlfs-common/leveldb/types.h"
+
+#include <algorithm>
+
+namespace pdlfs {
+
+Status MergeContext::Fold(const Slice& key, const Slice* existing_value,
+                          std::string* result, bool* found) const {
+  if (op_ == NULL) {
+    return Status::NotSupported("No merge operator");
+  }
+  std::string tmp;
+  Slice base;
+  bool has_base = (existing_value != NULL);
+  if (has_base) {
+    base = *existing_value;
+  }
+  std::vector<std::string>::const_reverse_iterator it = operands_.rbegin();
+  for (; it != operands_.rend(); ++it) {
+    tmp.clear();
+    has_base = op_->Merge(key, has_base ? &base : NULL, *it, &tmp);
+    if (has_base) {
+      result->swap(tmp);
+      base = *result;
+    }
+  }
+  if (has_base && base.data() != result->data()) {
+    // No operands applied; return the existing value as is.
+    result->assign(base.data(), base.size());
+  }
+  *found = has_base;
+  return Status::OK();
+}
+
+Status MergeContext::FoldInto(const Slice& key, const Slice* existing_value,
+                              Buffer* buf, size_t limit) const {
+  std::string result;
+  bool found = false;
+  Status s = Fold(key, existing_value, &result, &found);
+  if (s.ok()) {
+    if (found) {
+      buf->Fill(result.data(), std::min(result.size(), limit));
+    } else {
+      s = Status::NotFound(Slice());
+    }
+  }
+  return s;
+}
+
+}  // namespace pdlfs
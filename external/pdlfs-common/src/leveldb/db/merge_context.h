@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/status.h"
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+
+class Buffer;
+class MergeOperator;
+
+// Merge operands collected for a single key while searching the DB from
+// newer entries to older entries. Operands are folded once the key's base
+// value (or the absence of it) has been determined.
+class MergeContext {
+ public:
+  explicit MergeContext(const MergeOperator* op) : op_(op) {}
+
+  bool empty() const { return operands_.empty(); }
+  void Add(const Slice& operand) {
+    operands_.push_back(std::string(operand.data(), operand.size()));
+  }
+  void Clear() { operands_.clear(); }
+
+  // Apply all collected operands, oldest first, on top of "existing_value"
+  // (NULL if the key does not have a base value). On success, set *found to
+  // false if the key has no value after the merge, or store the merged
+  // value in *result and set *found to true. Return NotSupported if the DB
+  // has no merge operator.
+  Status Fold(const Slice& key, const Slice* existing_value,
+              std::string* result, bool* found) const;
+
+  // Same as Fold(), but store a prefix of at most "limit" bytes of the
+  // merged value in *buf. Return NotFound if the key has no value after
+  // the merge.
+  Status FoldInto(const Slice& key, const Slice* existing_value, Buffer* buf,
+                  size_t limit) const;
+
+ private:
+  const MergeOperator* const op_;
+  std::vector<std::string> operands_;  // Newest first
+
+  // No copying allowed
+  void operator=(const MergeContext&);
+  MergeContext(const MergeContext&);
+};
+
+}  // namespace pdlfs
@@ -19,10 +19,13 @@
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/filenames.h"
 #include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/memory_budget.h"
 
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/env.h"
 
+#include <stdio.h>
+
 namespace pdlfs {
 
 DBOptions::DBOptions()
@@ -34,11 +37,19 @@ DBOptions::DBOptions()
       env(Env::Default()),
       info_log(NULL),
       compaction_pool(NULL),
+      open_pool(NULL),
+      load_tables_on_open(false),
+      load_tables_in_background(false),
+      rate_limiter(NULL),
       write_buffer_size(4 * 1048576),
+      max_write_buffer_number(2),
+      memtable_hash_buckets(0),
       table_cache(NULL),
       block_cache(NULL),
+      memory_budget(NULL),
       block_size(4 * 1024),
       block_restart_interval(16),
+      data_block_hash_index(false),
       index_block_restart_interval(1),
       compression(kSnappyCompression),
       filter_policy(NULL),
@@ -48,28 +59,99 @@ DBOptions::DBOptions()
       rotating_manifest(false),
       sync_log_on_close(false),
       disable_write_ahead_log(false),
+      disable_auto_flush(false),
       disable_compaction(false),
       disable_seek_compaction(false),
       table_builder_skip_verification(false),
       prefetch_compaction_input(false),
       table_bulk_read_size(256 * 1024),
       table_file_size(2 * 1048576),
+      table_split_prefix_length(0),
       max_mem_compact_level(2),
       level_factor(10),
+      compaction_style(kCompactionStyleLeveled),
+      tiered_size_ratio(2),
       l1_compaction_trigger(5),
       l0_compaction_trigger(4),
       l0_soft_limit(8),
-      l0_hard_limit(12) {}
+      l0_hard_limit(12),
+      delayed_write_rate(16 << 20),
+      merge_operator(NULL) {}
 
 ReadOptions::ReadOptions()
     : verify_checksums(false),
       fill_cache(true),
+      readahead_size(0),
       limit(1 << 30),
-      snapshot(NULL) {}
+      snapshot(NULL),
+      stats(NULL) {}
+
+ReadStats::ReadStats() { Clear(); }
+
+void ReadStats::Clear() {
+  gets = 0;
+  mem_hits = 0;
+  imm_hits = 0;
+  table_probes = 0;
+  l0_table_probes = 0;
+  table_opens = 0;
+  filter_checks = 0;
+  filter_negatives = 0;
+  hash_checks = 0;
+  hash_negatives = 0;
+  block_cache_hits = 0;
+  block_cache_misses = 0;
+  block_reads = 0;
+  block_read_bytes = 0;
+}
+
+void ReadStats::Merge(const ReadStats& other) {
+  gets += other.gets;
+  mem_hits += other.mem_hits;
+  imm_hits += other.imm_hits;
+  table_probes += other.table_probes;
+  l0_table_probes += other.l0_table_probes;
+  table_opens += other.table_opens;
+  filter_checks += other.filter_checks;
+  filter_negatives += other.filter_negatives;
+  hash_checks += other.hash_checks;
+  hash_negatives += other.hash_negatives;
+  block_cache_hits += other.block_cache_hits;
+  block_cache_misses += other.block_cache_misses;
+  block_reads += other.block_reads;
+  block_read_bytes += other.block_read_bytes;
+}
+
+std::string ReadStats::ToString() const {
+  char buf[500];
+  snprintf(buf, sizeof(buf),
+           "Gets: %llu (memtable: %llu, immutable memtable: %llu)\n"
+           "Tables probed: %llu (level-0: %llu, opened: %llu)\n"
+           "Filter checks: %llu (negatives: %llu)\n"
+           "Hash index checks: %llu (negatives: %llu)\n"
+           "Block cache hits: %llu (misses: %llu)\n"
+           "Blocks read: %llu (%llu bytes)\n",
+           static_cast<unsigned long long>(gets),
+           static_cast<unsigned long long>(mem_hits),
+           static_cast<unsigned long long>(imm_hits),
+           static_cast<unsigned long long>(table_probes),
+           static_cast<unsigned long long>(l0_table_probes),
+           static_cast<unsigned long long>(table_opens),
+           static_cast<unsigned long long>(filter_checks),
+           static_cast<unsigned long long>(filter_negatives),
+           static_cast<unsigned long long>(hash_checks),
+           static_cast<unsigned long long>(hash_negatives),
+           static_cast<unsigned long long>(block_cache_hits),
+           static_cast<unsigned long long>(block_cache_misses),
+           static_cast<unsigned long long>(block_reads),
+           static_cast<unsigned long long>(block_read_bytes));
+  return buf;
+}
 
 WriteOptions::WriteOptions() : sync(false) {}
 
-FlushOptions::FlushOptions() : force_flush_l0(false), wait(true) {}
+FlushOptions::FlushOptions()
+    : force_flush_l0(false), wait(true), wait_only(false) {}
 
 InsertOptions::InsertOptions(InsertMethod method)
     : no_seq_adjustment(false),
@@ -106,6 +188,8 @@ DBOptions SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.block_restart_interval, 1, 1024);
   ClipToRange(&result.index_block_restart_interval, 1, 1024);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
+  ClipToRange(&result.max_write_buffer_number, 2, 64);
+  ClipToRange(&result.tiered_size_ratio, 1, 100);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
   if (create_infolog && result.info_log == NULL) {
     // Open a log file in the same directory as the db
@@ -122,6 +206,11 @@ DBOptions SanitizeOptions(const std::string& dbname,
   if (result.disable_compaction) {
     result.disable_seek_compaction = true;
   }
+  if (result.memory_budget != NULL) {
+    Cache* const cache = result.memory_budget->cache();
+    if (result.block_cache == NULL) result.block_cache = cache;
+    if (result.table_cache == NULL) result.table_cache = cache;
+  }
   if (result.block_cache == NULL) {
     result.block_cache = NewLRUCache(8 << 20);
   }
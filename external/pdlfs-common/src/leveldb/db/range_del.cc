@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "range_del.h"
+
+#include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/leveldb/iterator.h"
+
+#include <algorithm>
+
+namespace pdlfs {
+
+namespace {
+struct BeginLess {
+  const Comparator* ucmp;
+  explicit BeginLess(const Comparator* c) : ucmp(c) {}
+  bool operator()(const RangeTombstone& a, const RangeTombstone& b) const {
+    return ucmp->Compare(a.begin, b.begin) < 0;
+  }
+};
+}  // namespace
+
+RangeDelSet::RangeDelSet(const Comparator* ucmp,
+                         std::vector<RangeTombstone>* tombstones)
+    : ucmp_(ucmp), refs_(0) {
+  tombstones_.swap(*tombstones);
+  std::stable_sort(tombstones_.begin(), tombstones_.end(), BeginLess(ucmp_));
+  max_end_.resize(tombstones_.size());
+  for (size_t i = 0; i < tombstones_.size(); i++) {
+    max_end_[i] = i;
+    if (i != 0 && ucmp_->Compare(tombstones_[max_end_[i - 1]].end,
+                                 tombstones_[i].end) > 0) {
+      max_end_[i] = max_end_[i - 1];
+    }
+  }
+}
+
+SequenceNumber RangeDelSet::MaxCoveringSeq(const Slice& user_key,
+                                           SequenceNumber snapshot) const {
+  // Find the first tombstone that begins after user_key
+  size_t left = 0;
+  size_t right = tombstones_.size();
+  while (left < right) {
+    size_t mid = (left + right) / 2;
+    if (ucmp_->Compare(tombstones_[mid].begin, user_key) <= 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  SequenceNumber result = 0;
+  // Walk back through tombstones that begin at or before user_key until
+  // none of the remaining ones can extend past it
+  size_t i = left;
+  while (i > 0) {
+    i--;
+    if (ucmp_->Compare(tombstones_[max_end_[i]].end, user_key) <= 0) {
+      break;
+    }
+    const RangeTombstone& t = tombstones_[i];
+    if (t.seq <= snapshot && t.seq > result &&
+        ucmp_->Compare(t.end, user_key) > 0) {
+      result = t.seq;
+    }
+  }
+  return result;
+}
+
+bool RangeDelSet::Overlaps(const Slice& smallest, const Slice& largest) const {
+  for (size_t i = 0; i < tombstones_.size(); i++) {
+    const RangeTombstone& t = tombstones_[i];
+    if (ucmp_->Compare(t.begin, largest) > 0) {
+      break;  // All remaining tombstones begin even later
+    }
+    if (ucmp_->Compare(t.end, smallest) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+namespace {
+class RangeDelIterator : public Iterator {
+ public:
+  RangeDelIterator(Iterator* iter, SequenceNumber snapshot,
+                   const std::vector<const RangeDelSet*>& sets)
+      : iter_(iter), snapshot_(snapshot), sets_(sets) {}
+
+  virtual ~RangeDelIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual Slice key() const { return iter_->key(); }
+  virtual Slice value() const { return iter_->value(); }
+  virtual Status status() const { return iter_->status(); }
+
+  virtual void Seek(const Slice& target) {
+    iter_->Seek(target);
+    SkipForward();
+  }
+
+  virtual void SeekToFirst() {
+    iter_->SeekToFirst();
+    SkipForward();
+  }
+
+  virtual void SeekToLast() {
+    iter_->SeekToLast();
+    SkipBackward();
+  }
+
+  virtual void Next() {
+    iter_->Next();
+    SkipForward();
+  }
+
+  virtual void Prev() {
+    iter_->Prev();
+    SkipBackward();
+  }
+
+ private:
+  bool Covered() const {
+    ParsedInternalKey ikey;
+    if (!ParseInternalKey(iter_->key(), &ikey)) {
+      return false;  // Let the caller see and report the corruption
+    }
+    SequenceNumber floor = 0;
+    for (size_t i = 0; i < sets_.size(); i++) {
+      floor = std::max(floor,
+                       sets_[i]->MaxCoveringSeq(ikey.user_key, snapshot_));
+    }
+    return ikey.sequence < floor;
+  }
+
+  void SkipForward() {
+    while (iter_->Valid() && Covered()) {
+      iter_->Next();
+    }
+  }
+
+  void SkipBackward() {
+    while (iter_->Valid() && Covered()) {
+      iter_->Prev();
+    }
+  }
+
+  Iterator* const iter_;
+  const SequenceNumber snapshot_;
+  const std::vector<const RangeDelSet*> sets_;
+};
+}  // namespace
+
+Iterator* NewRangeDelIterator(Iterator* iter, SequenceNumber snapshot,
+                              const std::vector<const RangeDelSet*>& sets) {
+  return new RangeDelIterator(iter, snapshot, sets);
+}
+
+}  // namespace pdlfs
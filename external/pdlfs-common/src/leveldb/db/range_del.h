@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/leveldb/internal_types.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+
+class Comparator;
+class Iterator;
+
+// A range deletion removes every key in [begin, end) written before it,
+// that is, every entry whose sequence number is less than seq.
+struct RangeTombstone {
+  RangeTombstone() : seq(0), floor(0) {}
+  RangeTombstone(const Slice& b, const Slice& e, SequenceNumber s)
+      : begin(b.ToString()), end(e.ToString()), seq(s), floor(0) {}
+
+  std::string begin;
+  std::string end;
+  SequenceNumber seq;
+  // Only tables numbered below floor may hold entries covered by this
+  // tombstone. Set when the tombstone is installed in a version and raised
+  // whenever a compaction rewrites covered entries it could not yet drop.
+  uint64_t floor;
+};
+
+// An immutable set of range tombstones indexed for point lookups.
+// Reference counted; callers must synchronize Ref() and Unref().
+class RangeDelSet {
+ public:
+  // Take the contents of *tombstones, leaving it empty.
+  RangeDelSet(const Comparator* ucmp, std::vector<RangeTombstone>* tombstones);
+
+  void Ref() { ++refs_; }
+  void Unref() {
+    assert(refs_ > 0);
+    if (--refs_ <= 0) {
+      delete this;
+    }
+  }
+
+  bool empty() const { return tombstones_.empty(); }
+  size_t size() const { return tombstones_.size(); }
+  // Tombstones are ordered by their begin keys.
+  const RangeTombstone& tombstone(size_t i) const { return tombstones_[i]; }
+
+  // Return the largest sequence number among the tombstones that cover
+  // user_key and are no newer than snapshot. Return 0 if there is none.
+  SequenceNumber MaxCoveringSeq(const Slice& user_key,
+                                SequenceNumber snapshot) const;
+
+  // Return true iff some tombstone overlaps [smallest, largest].
+  bool Overlaps(const Slice& smallest, const Slice& largest) const;
+
+ private:
+  ~RangeDelSet() {}
+
+  const Comparator* const ucmp_;
+  std::vector<RangeTombstone> tombstones_;
+  // max_end_[i] is the index of the tombstone with the largest end key
+  // among tombstones_[0..i]. Lets a lookup stop as soon as no earlier
+  // tombstone can reach the key.
+  std::vector<size_t> max_end_;
+  int refs_;
+
+  // No copying allowed
+  void operator=(const RangeDelSet&);
+  RangeDelSet(const RangeDelSet&);
+};
+
+// Return an iterator over the entries of iter, an internal iterator, that
+// are not removed by any tombstone in the given sets visible at the given
+// snapshot. The returned iterator owns iter. The sets must remain live
+// while the returned iterator is live.
+extern Iterator* NewRangeDelIterator(
+    Iterator* iter, SequenceNumber snapshot,
+    const std::vector<const RangeDelSet*>& sets);
+
+}  // namespace pdlfs
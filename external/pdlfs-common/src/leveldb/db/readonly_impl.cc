@@ -13,6 +13,8 @@
 
 #include "db_impl.h"
 #include "db_iter.h"
+#include "merge_context.h"
+#include "range_del.h"
 #include "table_cache.h"
 #include "version_set.h"
 
@@ -35,8 +37,10 @@ ReadonlyDBImpl::ReadonlyDBImpl(const Options& raw_options,
       internal_filter_policy_(raw_options.filter_policy),
       options_(SanitizeOptions(dbname, &internal_comparator_,
                                &internal_filter_policy_, raw_options, false)),
-      owns_cache_(options_.block_cache != raw_options.block_cache),
-      owns_table_cache_(options_.table_cache != raw_options.table_cache),
+      owns_cache_(options_.block_cache != raw_options.block_cache &&
+                  raw_options.memory_budget == NULL),
+      owns_table_cache_(options_.table_cache != raw_options.table_cache &&
+                        raw_options.memory_budget == NULL),
       dbname_(dbname),
       logfile_(NULL),
       log_(NULL) {
@@ -155,7 +159,9 @@ Status ReadonlyDBImpl::InternalGet(const ReadOptions& options, const Slice& key,
     mutex_.Unlock();
     LookupKey lkey(key, snapshot);
     Version::GetStats ignored;
-    current->Get(options, lkey, value, &s, &ignored);
+    MergeContext merge(options_.merge_operator);
+    current->Get(options, lkey, value, &s, &ignored, &merge,
+                 current->MaxCoveringSeq(key, snapshot));
     mutex_.Lock();
   }
 
@@ -215,6 +221,17 @@ Iterator* ReadonlyDBImpl::NewInternalIterator(
   cleanup->version = versions_->current();
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
 
+  // Hide entries removed by range deletions
+  const RangeDelSet* range_dels = versions_->current()->range_dels();
+  if (range_dels != NULL) {
+    internal_iter = NewRangeDelIterator(
+        internal_iter,
+        options.snapshot != NULL
+            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
+            : *lastest_snapshot,
+        std::vector<const RangeDelSet*>(1, range_dels));
+  }
+
   mutex_.Unlock();
   return internal_iter;
 }
@@ -223,7 +240,7 @@ Iterator* ReadonlyDBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   Iterator* iter = NewInternalIterator(options, &latest_snapshot);
   return NewDBIterator(
-      NULL, user_comparator(), iter,
+      NULL, user_comparator(), options_.merge_operator, iter,
       (options.snapshot != NULL
            ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
            : latest_snapshot),
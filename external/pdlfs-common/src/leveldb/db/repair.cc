@@ -65,8 +65,10 @@ class Repairer {
         ipolicy_(options.filter_policy),
         options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, options, true)),
         owns_info_log_(options_.info_log != options.info_log),
-        owns_cache_(options_.block_cache != options.block_cache),
-        owns_table_cache_(options_.table_cache != options.table_cache),
+        owns_cache_(options_.block_cache != options.block_cache &&
+                    options.memory_budget == NULL),
+        owns_table_cache_(options_.table_cache != options.table_cache &&
+                          options.memory_budget == NULL),
         next_file_number_(4) {
     table_cache_ = new TableCache(dbname_, &options_, options_.table_cache);
     if (options_.info_log == Logger::Default()) {
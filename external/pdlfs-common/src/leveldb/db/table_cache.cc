@@ -101,7 +101,8 @@ void DeleteEntry(const Slice& key, void* value) {
 }  // namespace
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             SequenceOff seq_off, Cache::Handle** handle) {
+                             SequenceOff seq_off, Cache::Handle** handle,
+                             ReadStats* stats) {
   Status s;
   char buf[16];
   EncodeFixed64(buf, id_);
@@ -111,6 +112,9 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
   *handle = cache_->Lookup(key);
   if (*handle == NULL) {
     // Load table from storage
+    if (stats != NULL) {
+      stats->table_opens++;
+    }
     RandomAccessFile* file = NULL;
     Table* table = NULL;
     s = OpenTable(file_number, file_size, &table, &file, false);
@@ -120,7 +124,13 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       tf->file = file;
       tf->table = table;
 
-      *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
+      // Open tables are charged by their memory when sharing a memory
+      // budget, and by their number otherwise
+      const size_t charge =
+          options_->memory_budget != NULL
+              ? sizeof(TableAndFile) + table->ApproximateMemoryUsage()
+              : 1;
+      *handle = cache_->Insert(key, tf, charge, &DeleteEntry);
     }
   } else {
     // Fetch table from cache
@@ -246,7 +256,8 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number, uint64_t file_size,
                                   SequenceOff seq_off, Table** tableptr) {
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, seq_off, &handle);
+  Status s =
+      FindTable(file_number, file_size, seq_off, &handle, options.stats);
   if (!s.ok()) {
     if (tableptr != NULL) {
       *tableptr = NULL;
@@ -347,7 +358,7 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
                        uint64_t fsize, SequenceOff off, const Slice& key,
                        void* arg, Saver saver) {
   Cache::Handle* handle;
-  Status s = FindTable(fnum, fsize, off, &handle);
+  Status s = FindTable(fnum, fsize, off, &handle, options.stats);
   if (!s.ok()) {
     return s;
   }
@@ -403,6 +414,15 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
   return s;
 }
 
+Status TableCache::Load(uint64_t fnum, uint64_t fsize, SequenceOff off) {
+  Cache::Handle* handle;
+  Status s = FindTable(fnum, fsize, off, &handle, NULL);
+  if (s.ok()) {
+    cache_->Release(handle);
+  }
+  return s;
+}
+
 void TableCache::Evict(uint64_t fnum) {
   char buf[16];
   EncodeFixed64(buf, id_);
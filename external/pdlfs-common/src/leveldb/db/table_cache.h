@@ -29,6 +29,7 @@
 namespace pdlfs {
 
 class Env;
+struct ReadStats;
 
 // Thread-safe (provides internal synchronization)
 class TableCache {
@@ -60,6 +61,10 @@ class TableCache {
              uint64_t file_size, SequenceOff seq_off, const Slice& k, void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Load the table for the specified file number into cache without reading
+  // any of its data blocks.
+  Status Load(uint64_t file_number, uint64_t file_size, SequenceOff seq_off);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
@@ -72,9 +77,9 @@ class TableCache {
 
   // Find the table for the specified file number from cache. If table is not
   // yet cached, it will be loaded from storage and assigned the given sequence
-  // offset.
+  // offset. Table cache misses are counted in *stats if stats is not NULL.
   Status FindTable(uint64_t file_number, uint64_t file_size,
-                   SequenceOff seq_off, Cache::Handle**);
+                   SequenceOff seq_off, Cache::Handle**, ReadStats* stats);
 
   // No copying allowed
   TableCache(const TableCache&);
@@ -18,6 +18,7 @@
 #include "version_set.h"
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/strutil.h"
 
 namespace pdlfs {
 
@@ -32,7 +33,9 @@ enum Tag {
   kDeletedFile = 6,
   kNewFile = 7,
   // 8 was used for large value refs
-  kPrevLogNumber = 9
+  kPrevLogNumber = 9,
+  kRangeDeletion = 10,
+  kDeletedRangeDeletion = 11
 };
 
 void VersionEdit::Clear() {
@@ -48,6 +51,8 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  deleted_range_dels_.clear();
+  new_range_dels_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -95,6 +100,22 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
   }
+
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_dels_.begin();
+       iter != deleted_range_dels_.end(); ++iter) {
+    PutVarint32(dst, kDeletedRangeDeletion);
+    PutVarint64(dst, *iter);  // sequence number
+  }
+
+  for (size_t i = 0; i < new_range_dels_.size(); i++) {
+    const RangeTombstone& t = new_range_dels_[i];
+    PutVarint32(dst, kRangeDeletion);
+    PutLengthPrefixedSlice(dst, t.begin);
+    PutLengthPrefixedSlice(dst, t.end);
+    PutVarint64(dst, t.seq);
+    PutVarint64(dst, t.floor);
+  }
 }
 
 static bool GetInternalKey(Slice* input, InternalKey* dst) {
@@ -128,7 +149,9 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   uint64_t number;
   uint64_t off;
   FileMetaData f;
+  RangeTombstone t;
   Slice str;
+  Slice str2;
   InternalKey key;
 
   while (msg == NULL && GetVarint32(&input, &tag)) {
@@ -202,6 +225,26 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kRangeDeletion:
+        if (GetLengthPrefixedSlice(&input, &str) &&
+            GetLengthPrefixedSlice(&input, &str2) &&
+            GetVarint64(&input, &t.seq) && GetVarint64(&input, &t.floor)) {
+          t.begin = str.ToString();
+          t.end = str2.ToString();
+          new_range_dels_.push_back(t);
+        } else {
+          msg = "range deletion";
+        }
+        break;
+
+      case kDeletedRangeDeletion:
+        if (GetVarint64(&input, &number)) {
+          deleted_range_dels_.insert(number);
+        } else {
+          msg = "deleted range deletion";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -270,6 +313,24 @@ std::string VersionEdit::DebugString() const {
     r.append(" .. ");
     r.append(f.largest.DebugString());
   }
+  for (std::set<SequenceNumber>::const_iterator iter =
+           deleted_range_dels_.begin();
+       iter != deleted_range_dels_.end(); ++iter) {
+    r.append("\n  DeleteRangeDeletion: ");
+    AppendNumberTo(&r, *iter);
+  }
+  for (size_t i = 0; i < new_range_dels_.size(); i++) {
+    const RangeTombstone& t = new_range_dels_[i];
+    r.append("\n  AddRangeDeletion: ");
+    AppendNumberTo(&r, t.seq);
+    r.append(" ");
+    AppendNumberTo(&r, t.floor);
+    r.append(" '");
+    r.append(EscapeString(t.begin));
+    r.append("' .. '");
+    r.append(EscapeString(t.end));
+    r.append("'");
+  }
   r.append("\n}\n");
   return r;
 }
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "builder.h"
+#include "range_del.h"
 
 #include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/status.h"
@@ -79,6 +80,21 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Add the specified range deletion, replacing any existing one with
+  // the same sequence number.
+  void AddRangeDeletion(const RangeTombstone& t) {
+    new_range_dels_.push_back(t);
+  }
+
+  // Remove the range deletion with the specified sequence number.
+  void DeleteRangeDeletion(SequenceNumber seq) {
+    deleted_range_dels_.insert(seq);
+  }
+
+  bool HasRangeDeletionChanges() const {
+    return !new_range_dels_.empty() || !deleted_range_dels_.empty();
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -103,6 +119,8 @@ class VersionEdit {
   std::vector<std::pair<int, InternalKey> > compact_pointers_;
   DeletedFileSet deleted_files_;
   std::vector<std::pair<int, FileMetaData> > new_files_;
+  std::set<SequenceNumber> deleted_range_dels_;
+  std::vector<RangeTombstone> new_range_dels_;
 };
 
 }  // namespace pdlfs
@@ -43,6 +43,10 @@ TEST(VersionEditTest, EncodeDecode) {
                  InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
     edit.DeleteFile(4, kBig + 700 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
+    RangeTombstone t("bar", "baz", kBig + 800 + i);
+    t.floor = kBig + 850 + i;
+    edit.AddRangeDeletion(t);
+    edit.DeleteRangeDeletion(kBig + 750 + i);
   }
 
   edit.SetComparatorName("foo");
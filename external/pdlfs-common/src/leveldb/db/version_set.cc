@@ -16,6 +16,7 @@
  */
 #include "version_set.h"
 
+#include "merge_context.h"
 #include "table_cache.h"
 
 #include "../merger.h"
@@ -95,6 +96,10 @@ Version::~Version() {
       }
     }
   }
+
+  if (range_dels_ != NULL) {
+    range_dels_->Unref();
+  }
 }
 
 int FindFile(const InternalKeyComparator& icmp,
@@ -277,7 +282,7 @@ void Version::AddIterators(const ReadOptions& options,
 
 // Callback from TableCache::Get()
 namespace {
-enum SaverState { kNotFound, kFound, kDeleted, kCorrupt };
+enum SaverState { kNotFound, kFound, kDeleted, kMerged, kCorrupt };
 
 struct Saver {
   SaverState state;
@@ -285,6 +290,10 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   Buffer* buf;
+  MergeContext* merge;
+  SequenceNumber seq;    // Sequence of the last merge operand seen
+  SequenceNumber floor;  // Entries below it are removed by range deletions
+  Status status;         // Result of folding merge operands
 };
 }  // namespace
 
@@ -295,10 +304,30 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
-        assert(parsed_key.sequence <= kMaxSequenceNumber);
-        s->buf->Fill(v.data(), std::min(v.size(), s->options->limit));
+      if (parsed_key.sequence < s->floor) {
+        parsed_key.type = kTypeDeletion;  // Removed by a range deletion
+      }
+      switch (parsed_key.type) {
+        case kTypeValue:
+          s->state = kFound;
+          assert(parsed_key.sequence <= kMaxSequenceNumber);
+          if (s->merge != NULL && !s->merge->empty()) {
+            s->status = s->merge->FoldInto(s->user_key, &v, s->buf,
+                                           s->options->limit);
+          } else {
+            s->buf->Fill(v.data(), std::min(v.size(), s->options->limit));
+          }
+          break;
+        case kTypeDeletion:
+          s->state = kDeleted;
+          break;
+        case kTypeMerge:
+          s->state = kMerged;
+          s->seq = parsed_key.sequence;
+          if (s->merge != NULL) {
+            s->merge->Add(v);
+          }
+          break;
       }
     }
   }
@@ -353,7 +382,8 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
 }
 
 bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
-                  Status* s, GetStats* stats) {
+                  Status* s, GetStats* stats, MergeContext* merge,
+                  SequenceNumber floor) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -419,6 +449,12 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
       FileMetaData* f = files[i];
       last_file_read = f;
       last_file_read_level = level;
+      if (options.stats != NULL) {
+        options.stats->table_probes++;
+        if (level == 0) {
+          options.stats->l0_table_probes++;
+        }
+      }
 
       Saver saver;
       saver.state = kNotFound;
@@ -426,8 +462,25 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.buf = buf;
+      saver.merge = merge;
+      saver.seq = 0;
+      saver.floor = floor;
       *s = vset_->table_cache_->Get(options, f->number, f->file_size,
                                     f->seq_off, ikey, &saver, SaveValue);
+      // A merge operand only reveals the newest entry of the key in this
+      // file. Probe the file again for older entries of the same key.
+      while (s->ok() && saver.state == kMerged && merge != NULL) {
+        assert(saver.seq >= f->seq_off);
+        const SequenceNumber raw_seq = saver.seq - f->seq_off;
+        saver.state = kNotFound;
+        if (raw_seq == 0) {
+          break;
+        }
+        LookupKey older(user_key, raw_seq - 1);
+        *s = vset_->table_cache_->Get(options, f->number, f->file_size,
+                                      f->seq_off, older.internal_key(), &saver,
+                                      SaveValue);
+      }
       if (!s->ok()) {
         return true;  // Read error
       }
@@ -435,9 +488,17 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
         case kNotFound:
           break;  // Keep searching in other files
         case kFound:
+          *s = saver.status;
           return true;  // Found
         case kDeleted:
-          *s = Status::NotFound(Slice());
+          if (merge != NULL && !merge->empty()) {
+            *s = merge->FoldInto(user_key, NULL, buf, options.limit);
+          } else {
+            *s = Status::NotFound(Slice());
+          }
+          return true;
+        case kMerged:
+          *s = Status::NotSupported("Merge operands found");
           return true;
         case kCorrupt:
           *s = Status::Corruption("Corrupted key for ", user_key);
@@ -446,6 +507,12 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
     }
   }
 
+  if (merge != NULL && !merge->empty()) {
+    // Reached the bottom of the tree without finding a base value
+    *s = merge->FoldInto(user_key, NULL, buf, options.limit);
+    return true;
+  }
+
   *s = Status::NotFound(Slice());
   return false;
 }
@@ -639,13 +706,19 @@ class VersionSet::Builder {
     FileSet* added_files;
   };
 
+  typedef std::map<SequenceNumber, RangeTombstone> RangeDelMap;
+
   VersionSet* vset_;
   Version* base_;
   LevelState levels_[config::kNumLevels];
+  // Range deletions of the resulting version. NULL until an edit changes
+  // them, in which case they are copied from base_.
+  RangeDelMap* range_dels_;
 
  public:
   // Initialize a builder with the files from *base and other info from *vset
-  Builder(VersionSet* vset, Version* base) : vset_(vset), base_(base) {
+  Builder(VersionSet* vset, Version* base)
+      : vset_(vset), base_(base), range_dels_(NULL) {
     base_->Ref();
     BySmallestKey cmp;
     cmp.internal_comparator = &vset_->icmp_;
@@ -672,6 +745,7 @@ class VersionSet::Builder {
         }
       }
     }
+    delete range_dels_;
     base_->Unref();
   }
 
@@ -718,6 +792,27 @@ class VersionSet::Builder {
       levels_[level].deleted_files.erase(f->number);
       levels_[level].added_files->insert(f);
     }
+
+    // Update range deletions
+    if (edit->HasRangeDeletionChanges()) {
+      if (range_dels_ == NULL) {
+        range_dels_ = new RangeDelMap;
+        const RangeDelSet* base_dels = base_->range_dels_;
+        for (size_t i = 0; base_dels != NULL && i < base_dels->size(); i++) {
+          const RangeTombstone& t = base_dels->tombstone(i);
+          range_dels_->insert(std::make_pair(t.seq, t));
+        }
+      }
+      const std::set<SequenceNumber>& del = edit->deleted_range_dels_;
+      for (std::set<SequenceNumber>::const_iterator iter = del.begin();
+           iter != del.end(); ++iter) {
+        range_dels_->erase(*iter);
+      }
+      for (size_t i = 0; i < edit->new_range_dels_.size(); i++) {
+        const RangeTombstone& t = edit->new_range_dels_[i];
+        (*range_dels_)[t.seq] = t;
+      }
+    }
   }
 
   // Save the current state in *v.
@@ -765,6 +860,22 @@ class VersionSet::Builder {
       }
 #endif
     }
+
+    if (range_dels_ == NULL) {
+      v->range_dels_ = base_->range_dels_;  // Unchanged
+    } else if (!range_dels_->empty()) {
+      std::vector<RangeTombstone> tombstones;
+      tombstones.reserve(range_dels_->size());
+      for (RangeDelMap::const_iterator it = range_dels_->begin();
+           it != range_dels_->end(); ++it) {
+        tombstones.push_back(it->second);
+      }
+      v->range_dels_ =
+          new RangeDelSet(vset_->icmp_.user_comparator(), &tombstones);
+    }
+    if (v->range_dels_ != NULL) {
+      v->range_dels_->Ref();
+    }
   }
 
   void MaybeAddFile(Version* v, int level, FileMetaData* f) {
@@ -894,6 +1005,14 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   edit->SetNextFile(next_file_number_);
   edit->SetLastSequence(last_sequence_);
 
+  // Tables numbered from now on are written after the new range deletions
+  // are installed and cannot hold entries they remove.
+  for (size_t i = 0; i < edit->new_range_dels_.size(); i++) {
+    if (edit->new_range_dels_[i].floor == 0) {
+      edit->new_range_dels_[i].floor = next_file_number_;
+    }
+  }
+
   Version* v = new Version(this);
   {
     Builder builder(this, current_);
@@ -1220,6 +1339,10 @@ void VersionSet::Finalize(Version* v) {
       // overwrites/deletions).
       score = v->files_[level].size() /
               static_cast<double>(options_->l0_compaction_trigger);
+    } else if (options_->compaction_style == kCompactionStyleTiered) {
+      // Runs below level-0 are only reshaped to make room for new runs
+      // formed out of level-0 files. See PickTieredCompaction().
+      score = 0;
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t bytes = TotalFileSize(v->files_[level]);
@@ -1262,6 +1385,12 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     }
   }
 
+  // Save range deletions
+  const RangeDelSet* range_dels = current_->range_dels_;
+  for (size_t i = 0; range_dels != NULL && i < range_dels->size(); i++) {
+    edit.AddRangeDeletion(range_dels->tombstone(i));
+  }
+
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
@@ -1335,6 +1464,25 @@ int64_t VersionSet::NumLevelBytes(int level) const {
   return TotalFileSize(current_->files_[level]);
 }
 
+int64_t VersionSet::PendingCompactionBytes() const {
+  int64_t result = 0;
+  if (current_->files_[0].size() >=
+      static_cast<size_t>(options_->l0_compaction_trigger)) {
+    result += TotalFileSize(current_->files_[0]);
+  }
+  if (options_->compaction_style == kCompactionStyleTiered) {
+    return result;  // Levels are never out of budget under tiered compaction
+  }
+  for (int level = 1; level < config::kNumLevels - 1; level++) {
+    const double excess = TotalFileSize(current_->files_[level]) -
+                          MaxBytesForLevel(options_, level);
+    if (excess > 0) {
+      result += static_cast<int64_t>(excess);
+    }
+  }
+  return result;
+}
+
 int64_t VersionSet::MaxNextLevelOverlappingBytes() {
   int64_t result = 0;
   std::vector<FileMetaData*> overlaps;
@@ -1352,6 +1500,63 @@ int64_t VersionSet::MaxNextLevelOverlappingBytes() {
   return result;
 }
 
+void VersionSet::UpdateRangeDeletions(Compaction* c,
+                                      SequenceNumber smallest_snapshot) {
+  const RangeDelSet* dels = current_->range_dels_;
+  if (dels == NULL) {
+    return;
+  }
+  const Comparator* ucmp = icmp_.user_comparator();
+  std::set<uint64_t> inputs;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      inputs.insert(c->inputs_[which][i]->number);
+    }
+  }
+  // Range deletions the compaction applied as it dropped entries
+  std::set<SequenceNumber> applied;
+  const RangeDelSet* input_dels = c->range_dels();
+  for (size_t i = 0; input_dels != NULL && i < input_dels->size(); i++) {
+    if (input_dels->tombstone(i).seq <= smallest_snapshot) {
+      applied.insert(input_dels->tombstone(i).seq);
+    }
+  }
+  InternalKey smallest, largest;
+  GetRange2(c->inputs_[0], c->inputs_[1], &smallest, &largest);
+  std::vector<FileMetaData*> overlaps;
+  for (size_t i = 0; i < dels->size(); i++) {
+    const RangeTombstone& t = dels->tombstone(i);
+    if (ucmp->Compare(t.begin, largest.user_key()) <= 0 &&
+        ucmp->Compare(t.end, smallest.user_key()) > 0 &&
+        applied.count(t.seq) == 0) {
+      // Outputs may hold entries removed by t
+      if (t.floor < next_file_number_) {
+        RangeTombstone raised = t;
+        raised.floor = next_file_number_;
+        c->edit()->AddRangeDeletion(raised);
+      }
+    } else if (t.seq <= smallest_snapshot) {
+      // Retire t if no remaining table can hold entries removed by it
+      InternalKey begin(t.begin, kMaxSequenceNumber, kValueTypeForSeek);
+      InternalKey end(t.end, kMaxSequenceNumber, kValueTypeForSeek);
+      bool in_use = false;
+      for (int level = 0; level < config::kNumLevels && !in_use; level++) {
+        current_->GetOverlappingInputs(level, &begin, &end, &overlaps);
+        for (size_t j = 0; j < overlaps.size(); j++) {
+          if (overlaps[j]->number < t.floor &&
+              inputs.count(overlaps[j]->number) == 0) {
+            in_use = true;
+            break;
+          }
+        }
+      }
+      if (!in_use) {
+        c->edit()->DeleteRangeDeletion(t.seq);
+      }
+    }
+  }
+}
+
 // Stores the minimal range that covers all entries in inputs in
 // *smallest, *largest.
 // REQUIRES: inputs is not empty
@@ -1393,14 +1598,17 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   options.fill_cache = false;
 
   // Level-0 files have to be merged together. For other levels, we will make a
-  // concatenating iterator per level.
+  // concatenating iterator per level. Files from several levels are merged
+  // the same way as level-0 files.
   // XXX: use concatenating iterator for level-0 if there is no overlap
-  const int space = (c->level() == 0 ? c->inputs_[0].size() + 1 : 2);
+  const bool overlapping =
+      c->level() == 0 || c->output_level() > c->level() + 1;
+  const int space = (overlapping ? c->inputs_[0].size() + 1 : 2);
   Iterator** list = new Iterator*[space];
   int num = 0;
   for (int which = 0; which < 2; which++) {
     if (!c->inputs_[which].empty()) {
-      if (c->level() + which == 0) {
+      if (which == 0 && overlapping) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
           if (!options_->prefetch_compaction_input) {
@@ -1440,7 +1648,10 @@ Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
   // the compactions triggered by seeks.
   const bool size_compaction = (current_->compaction_score_ >= 1);
   const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
+  if (size_compaction &&
+      options_->compaction_style == kCompactionStyleTiered) {
+    return PickTieredCompaction();
+  } else if (size_compaction) {
     level = current_->compaction_level_;
     assert(level >= 0);
     assert(level + 1 < config::kNumLevels);
@@ -1486,12 +1697,93 @@ Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
   return c;
 }
 
+// Under tiered compaction, each level >= 1 holds at most one sorted run and
+// that run is newer than all runs at larger levels. Once there are enough
+// level-0 files, they are merged into a new run right above the newest
+// existing run. If there is no room for the new run, room is made by moving
+// runs down to empty levels. Only when all levels are taken are runs merged:
+// the longest span of consecutive runs whose sizes are similar is merged
+// into the oldest of them, or, if no two neighboring runs are similar, the
+// two that are closest in size. Since every compaction either merges
+// consecutive runs into the oldest of them or moves a run to an empty level,
+// the order of runs, and therefore the result of reads, never changes, and
+// each byte is only rewritten when its run is merged with runs that are not
+// much larger than it.
+Compaction* VersionSet::PickTieredCompaction() {
+  Version* const v = current_;
+  int first = 1;  // Level of the newest run other than level-0
+  while (first < config::kNumLevels && v->files_[first].empty()) {
+    first++;
+  }
+  int empty = first + 1;  // Level of the first gap below that run
+  while (empty < config::kNumLevels && !v->files_[empty].empty()) {
+    empty++;
+  }
+  int level;
+  int output_level;
+  if (first > 1) {
+    level = 0;
+    output_level = first - 1;
+  } else if (empty < config::kNumLevels) {
+    level = empty - 1;
+    output_level = empty;
+  } else {
+    std::vector<double> bytes(config::kNumLevels);
+    for (int i = 0; i < config::kNumLevels; i++) {
+      bytes[i] = TotalFileSize(v->files_[i]);
+    }
+    level = -1;
+    output_level = -1;
+    int best_runs = 1;
+    for (int start = 0; start + 1 < config::kNumLevels; start++) {
+      int end = start;
+      while (end + 1 < config::kNumLevels &&
+             bytes[end + 1] <= bytes[end] * options_->tiered_size_ratio) {
+        end++;
+      }
+      if (end - start + 1 > best_runs) {
+        best_runs = end - start + 1;
+        level = start;
+        output_level = end;
+      }
+    }
+    if (level == -1) {
+      double best_ratio = 0;
+      for (int i = 0; i + 1 < config::kNumLevels; i++) {
+        const double ratio = std::max(bytes[i], bytes[i + 1]) /
+                             std::max(1.0, std::min(bytes[i], bytes[i + 1]));
+        if (level == -1 || ratio < best_ratio) {
+          best_ratio = ratio;
+          level = i;
+          output_level = i + 1;
+        }
+      }
+    }
+  }
+
+  Compaction* const c = new Compaction(options_, level);
+  c->output_level_ = output_level;
+  c->whole_level_ = true;
+  for (int i = level; i < output_level; i++) {
+    c->inputs_[0].insert(c->inputs_[0].end(), v->files_[i].begin(),
+                         v->files_[i].end());
+  }
+  assert(!c->inputs_[0].empty());
+  c->input_version_ = v;
+  c->input_version_->Ref();
+
+  SetupOtherInputs(c);
+
+  return c;
+}
+
 void VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
+  const int output_level = c->output_level();
   InternalKey smallest, largest;
   GetRange(c->inputs_[0], &smallest, &largest);
 
-  current_->GetOverlappingInputs(level + 1, &smallest, &largest,
+  current_->GetOverlappingInputs(output_level, &smallest, &largest,
                                  &c->inputs_[1]);
 
   // Get entire range covered by compaction
@@ -1500,7 +1792,7 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
 
   // See if we can grow the number of inputs in "level" without
   // changing the number of "level+1" files we pick up.
-  if (!c->inputs_[1].empty()) {
+  if (!c->inputs_[1].empty() && !c->whole_level_) {
     std::vector<FileMetaData*> expanded0;
     current_->GetOverlappingInputs(level, &all_start, &all_limit, &expanded0);
     const int64_t inputs0_size = TotalFileSize(c->inputs_[0]);
@@ -1535,9 +1827,9 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   }
 
   // Compute the set of grandparent files that overlap this compaction
-  // (parent == level+1; grandparent == level+2)
-  if (level + 2 < config::kNumLevels) {
-    current_->GetOverlappingInputs(level + 2, &all_start, &all_limit,
+  // (parent == output_level; grandparent == output_level+1)
+  if (output_level + 1 < config::kNumLevels) {
+    current_->GetOverlappingInputs(output_level + 1, &all_start, &all_limit,
                                    &c->grandparents_);
   }
 
@@ -1584,6 +1876,8 @@ Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
 
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
+      output_level_(level + 1),
+      whole_level_(false),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       max_grand_parent_overlap_bytes_(MaxGrandParentOverlapBytes(options)),
       input_version_(NULL),
@@ -1602,6 +1896,11 @@ Compaction::~Compaction() {
 }
 
 bool Compaction::IsTrivialMove() const {
+  // Tables at a level other than level-0 do not overlap each other, so an
+  // entire level can be moved to an empty level as is.
+  if (whole_level_ && level_ > 0) {
+    return output_level_ == level_ + 1 && num_input_files(1) == 0;
+  }
   // Avoid a move if there is lots of overlapping grandparent data.
   // Otherwise, the move could create a parent file that will require
   // a very expensive merge later on.
@@ -1610,17 +1909,28 @@ bool Compaction::IsTrivialMove() const {
 }
 
 void Compaction::AddInputDeletions(VersionEdit* edit) {
-  for (int which = 0; which < 2; which++) {
-    for (size_t i = 0; i < inputs_[which].size(); i++) {
-      edit->DeleteFile(level_ + which, inputs_[which][i]->number);
+  if (output_level_ > level_ + 1) {
+    assert(whole_level_);
+    for (int lvl = level_; lvl < output_level_; lvl++) {
+      const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
+      for (size_t i = 0; i < files.size(); i++) {
+        edit->DeleteFile(lvl, files[i]->number);
+      }
     }
+  } else {
+    for (size_t i = 0; i < inputs_[0].size(); i++) {
+      edit->DeleteFile(level_, inputs_[0][i]->number);
+    }
+  }
+  for (size_t i = 0; i < inputs_[1].size(); i++) {
+    edit->DeleteFile(output_level_, inputs_[1][i]->number);
   }
 }
 
 bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
-  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
+  for (int lvl = output_level_ + 1; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
     for (; level_ptrs_[lvl] < files.size();) {
       FileMetaData* f = files[level_ptrs_[lvl]];
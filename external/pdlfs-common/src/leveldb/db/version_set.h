@@ -44,6 +44,7 @@ class Writer;
 class Compaction;
 class Iterator;
 class MemTable;
+class MergeContext;
 class TableBuilder;
 class TableCache;
 class Version;
@@ -76,7 +77,11 @@ class Version {
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
   // Lookup the value for key.  Return true if either the value or a tombstone
-  // is found or false otherwise.  Also fills *s and *stats.
+  // is found or false otherwise.  Also fills *s and *stats.  Merge operands
+  // are added to *merge and folded into the value once the key's base value
+  // (or the absence of it) has been determined.
+  // Entries whose sequence numbers are below floor have been removed by a
+  // range deletion and are treated as deletions.
   // REQUIRES: both s and stats are not NULL
   // REQUIRES: lock is not held
   struct GetStats {
@@ -84,7 +89,21 @@ class Version {
     int seek_file_level;
   };
   bool Get(const ReadOptions& options, const LookupKey& key, Buffer* val,
-           Status* s, GetStats* stats);
+           Status* s, GetStats* stats, MergeContext* merge = NULL,
+           SequenceNumber floor = 0);
+
+  // Return the largest sequence number among the range deletions of this
+  // Version that cover user_key and are no newer than snapshot, or 0 if
+  // there is none.
+  SequenceNumber MaxCoveringSeq(const Slice& user_key,
+                                SequenceNumber snapshot) const {
+    return range_dels_ != NULL ? range_dels_->MaxCoveringSeq(user_key, snapshot)
+                               : 0;
+  }
+
+  // Return the range deletions of this Version, or NULL if there is none.
+  // The result remains valid while this Version is live.
+  const RangeDelSet* range_dels() const { return range_dels_; }
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -121,6 +140,9 @@ class Version {
                                  const Slice& largest_user_key);
 
   int NumFiles(int level) const { return files_[level].size(); }
+  const std::vector<FileMetaData*>& files(int level) const {
+    return files_[level];
+  }
 
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
@@ -148,6 +170,10 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Range deletions not yet fully applied by compactions. Shared with
+  // other versions until an edit changes them. NULL if there is none.
+  RangeDelSet* range_dels_;
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -163,6 +189,7 @@ class Version {
         next_(this),
         prev_(this),
         refs_(0),
+        range_dels_(NULL),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
@@ -228,6 +255,10 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  // Return an estimate of the number of bytes compactions must rewrite to
+  // bring every level back under its size limit.
+  int64_t PendingCompactionBytes() const;
+
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
@@ -264,6 +295,14 @@ class VersionSet {
   // file at a level >= 1.
   int64_t MaxNextLevelOverlappingBytes();
 
+  // Record in the edit of "*c" the changes to range deletions implied by
+  // the compaction: range deletions no longer removing anything are retired,
+  // and those whose covered entries were copied rather than dropped have
+  // their floors raised past the compaction outputs. "smallest_snapshot" is
+  // the sequence number of the oldest snapshot seen by the compaction.
+  // REQUIRES: *c is about to be installed.
+  void UpdateRangeDeletions(Compaction* c, SequenceNumber smallest_snapshot);
+
   // Create an iterator that reads over the compaction inputs for "*c".
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
@@ -308,6 +347,8 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
+  Compaction* PickTieredCompaction();
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
@@ -350,6 +391,13 @@ class Compaction {
   // and "level+1" will be merged to produce a set of "level+1" files.
   int level() const { return level_; }
 
+  // Return the level to which compaction outputs are written. This is
+  // "level+1" except for tiered compactions, which may merge the runs at
+  // several consecutive levels into the last of these levels. In that case,
+  // input(0, i) are the files at all levels from "level" to
+  // "output_level-1".
+  int output_level() const { return output_level_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   VersionEdit* edit() { return &edit_; }
@@ -357,14 +405,15 @@ class Compaction {
   // "which" must be either 0 or 1
   int num_input_files(int which) const { return inputs_[which].size(); }
 
-  // Return the ith input file at "level()+which" ("which" must be 0 or 1).
+  // Return the ith input file at "level()+which" ("which" must be 0 or 1),
+  // or at "output_level()" if "which" is 1.
   FileMetaData* input(int which, int i) const { return inputs_[which][i]; }
 
   // Maximum size of files to build during this compaction.
   uint64_t MaxOutputFileSize() const { return max_output_file_size_; }
 
   // Is this a trivial compaction that can be implemented by just
-  // moving a single input file to the next level (no merging or splitting)
+  // moving its input files to the next level (no merging or splitting)
   bool IsTrivialMove() const;
 
   // Add all inputs to this compaction as delete operations to *edit.
@@ -379,6 +428,10 @@ class Compaction {
   // before processing "internal_key".
   bool ShouldStopBefore(const Slice& internal_key);
 
+  // Return the range deletions in effect when the compaction was picked,
+  // or NULL if there is none.
+  const RangeDelSet* range_dels() const { return input_version_->range_dels(); }
+
   // Release the input version for the compaction, once the compaction
   // is successful.
   void ReleaseInputs();
@@ -390,16 +443,18 @@ class Compaction {
   explicit Compaction(const Options* options, int level);
 
   int level_;
+  int output_level_;
+  bool whole_level_;  // Inputs are entire levels
   uint64_t max_output_file_size_;
   int64_t max_grand_parent_overlap_bytes_;
   Version* input_version_;
   VersionEdit edit_;
 
-  // Each compaction reads inputs from "level_" and "level_+1"
+  // Each compaction reads inputs from "level_" and "output_level_"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
 
   // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // (parent == output_level_, grandparent == output_level_ + 1)
   std::vector<FileMetaData*> grandparents_;
   size_t grandparent_index_;  // Index in grandparent_starts_
   bool seen_key_;             // Some output key has been seen
@@ -411,7 +466,7 @@ class Compaction {
   // level_ptrs_ holds indices into input_version_->levels_: our state
   // is that we are positioned at one of the file ranges for each
   // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
+  // all L >= output_level_ + 1).
   size_t level_ptrs_[config::kNumLevels];
 };
 
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "write_controller.h"
+
+#include <algorithm>
+
+namespace pdlfs {
+
+// Max amount of credit idle writers may accumulate
+static const uint64_t kRefillMicros = 1000;
+// Max time a single write may be delayed
+static const uint64_t kMaxDelayMicros = 100000;
+
+WriteController::WriteController()
+    : rate_(0), paid_micros_(0), total_delays_(0), total_delay_micros_(0) {}
+
+void WriteController::SetRate(uint64_t bytes_per_sec) {
+  if (bytes_per_sec == 0) {
+    paid_micros_ = 0;
+  }
+  rate_ = bytes_per_sec;
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros, uint64_t bytes) {
+  if (rate_ == 0) {
+    return 0;
+  }
+  if (paid_micros_ + kRefillMicros < now_micros) {
+    paid_micros_ = now_micros - kRefillMicros;
+  }
+  // Cost of the write in microseconds at the current rate, rounded up
+  paid_micros_ += (bytes * 1000000 + rate_ - 1) / rate_;
+  if (paid_micros_ <= now_micros) {
+    return 0;
+  }
+  const uint64_t delay = std::min(paid_micros_ - now_micros, kMaxDelayMicros);
+  total_delays_++;
+  total_delay_micros_ += delay;
+  return delay;
+}
+
+uint64_t WriteController::Debt(uint64_t now_micros) const {
+  if (rate_ == 0 || paid_micros_ <= now_micros) {
+    return 0;
+  }
+  return (paid_micros_ - now_micros) * rate_ / 1000000;
+}
+
+}  // namespace pdlfs
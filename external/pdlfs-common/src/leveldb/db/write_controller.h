@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include <stdint.h>
+
+namespace pdlfs {
+
+// A token bucket pacing foreground writes when background compaction falls
+// behind. While throttled, writes are admitted at a target rate. A write
+// group charged more bytes than the bucket currently holds is asked to
+// delay for the time it takes the bucket to earn them back, but never for
+// more than 100ms at a time: the rest is carried as debt and paid back by
+// later writes. Idle time earns at most one refill interval worth of credit
+// so that a burst after a pause is not admitted all at once.
+//
+// Not thread-safe. REQUIRES: external synchronization (the DB mutex).
+class WriteController {
+ public:
+  WriteController();
+
+  // Set the admitted write rate in bytes per second. A rate of 0 stops
+  // throttling and forgives any outstanding debt.
+  void SetRate(uint64_t bytes_per_sec);
+  bool IsThrottled() const { return rate_ != 0; }
+  uint64_t rate() const { return rate_; }
+
+  // Charge "bytes" against the bucket at time "now_micros". Return the number
+  // of microseconds the caller must wait before its write is admitted, which
+  // is capped at 100ms.
+  uint64_t GetDelay(uint64_t now_micros, uint64_t bytes);
+
+  // Return the number of bytes admitted ahead of the current rate as of
+  // "now_micros". These bytes are paid back by future delays.
+  uint64_t Debt(uint64_t now_micros) const;
+
+  // Total number of delays imposed and microseconds spent delaying.
+  uint64_t total_delays() const { return total_delays_; }
+  uint64_t total_delay_micros() const { return total_delay_micros_; }
+
+ private:
+  uint64_t rate_;  // Bytes per second; 0 if not throttled
+  // Time at which all bytes admitted so far have been paid for
+  uint64_t paid_micros_;
+  uint64_t total_delays_;
+  uint64_t total_delay_micros_;
+
+  // No copying allowed
+  void operator=(const WriteController&);
+  WriteController(const WriteController&);
+};
+
+}  // namespace pdlfs
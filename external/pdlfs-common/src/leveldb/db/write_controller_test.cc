@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "write_controller.h"
+
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class WriteControllerTest {};
+
+TEST(WriteControllerTest, NotThrottled) {
+  WriteController wc;
+  ASSERT_FALSE(wc.IsThrottled());
+  ASSERT_EQ(wc.GetDelay(1000000, 1 << 20), 0);
+  ASSERT_EQ(wc.Debt(1000000), 0);
+  ASSERT_EQ(wc.total_delays(), 0);
+}
+
+TEST(WriteControllerTest, PacesWrites) {
+  WriteController wc;
+  wc.SetRate(1000000);  // 1 byte per micro
+  uint64_t now = 1000000;
+  // The first write drains the credit earned while idle
+  ASSERT_EQ(wc.GetDelay(now, 1000), 0);
+  // Subsequent writes at the same instant are delayed by their cost
+  ASSERT_EQ(wc.GetDelay(now, 500), 500);
+  ASSERT_EQ(wc.GetDelay(now, 500), 1000);
+  ASSERT_EQ(wc.Debt(now), 1000);
+  // Time pays back the debt
+  now += 1000;
+  ASSERT_EQ(wc.Debt(now), 0);
+  ASSERT_EQ(wc.GetDelay(now, 10), 10);
+  ASSERT_EQ(wc.total_delays(), 3);
+  ASSERT_EQ(wc.total_delay_micros(), 1510);
+}
+
+TEST(WriteControllerTest, IdleCreditIsBounded) {
+  WriteController wc;
+  wc.SetRate(1000000);
+  ASSERT_EQ(wc.GetDelay(1000000, 0), 0);
+  // A long pause only earns one refill interval worth of credit
+  ASSERT_EQ(wc.GetDelay(9000000, 3000), 2000);
+}
+
+TEST(WriteControllerTest, DelayIsCapped) {
+  WriteController wc;
+  wc.SetRate(16 << 10);
+  uint64_t now = 1000000;
+  // A large write at a low rate sleeps 100ms and owes the rest
+  ASSERT_EQ(wc.GetDelay(now, 1 << 20), 100000);
+  ASSERT_GT(wc.Debt(now + 100000), 1000000);
+  // Later writes keep paying the debt back
+  now += 100000;
+  ASSERT_EQ(wc.GetDelay(now, 0), 100000);
+  ASSERT_EQ(wc.total_delay_micros(), 200000);
+}
+
+TEST(WriteControllerTest, Reset) {
+  WriteController wc;
+  wc.SetRate(1000);
+  ASSERT_GT(wc.GetDelay(1000000, 1000), 0);
+  ASSERT_GT(wc.Debt(1000000), 0);
+  wc.SetRate(0);
+  ASSERT_EQ(wc.Debt(1000000), 0);
+  ASSERT_EQ(wc.GetDelay(1000000, 1000), 0);
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/leveldb/memory_budget.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <assert.h>
+
+namespace pdlfs {
+
+// The usable budget is split in kParts units
+static const int kParts = 16;
+static const int kInitialWriteParts = 4;
+static const int kMinWriteParts = 2;
+static const int kMaxWriteParts = 12;
+
+// Fewer lookups than this say too little about the cache's hit rate
+static const uint64_t kMinLookups = 100;
+
+// Same floor as the one applied to DBOptions::write_buffer_size
+static const size_t kMinWriteBufferSize = 64 << 10;
+
+MemoryBudget::MemoryBudget(size_t budget)
+    : budget_(budget),
+      cache_(NewLRUCache(0)),
+      reserved_(0),
+      write_buffers_(0),
+      write_parts_(kInitialWriteParts),
+      write_buffer_size_(NULL),
+      stalls_(0),
+      last_stalls_(0),
+      last_lookups_(0),
+      last_hits_(0) {
+  MutexLock l(&mu_);
+  Apply();
+}
+
+MemoryBudget::~MemoryBudget() {
+  assert(write_buffers_ == 0);  // All dbs must have been closed
+  delete cache_;
+}
+
+size_t MemoryBudget::Usable() const {
+  mu_.AssertHeld();
+  return budget_ > reserved_ ? budget_ - reserved_ : 0;
+}
+
+// REQUIRES: mu_ has been locked.
+void MemoryBudget::Apply() {
+  mu_.AssertHeld();
+  const size_t usable = Usable();
+  const size_t w = usable / kParts * write_parts_;
+  size_t size = w / (write_buffers_ > 0 ? write_buffers_ : 1);
+  if (size < kMinWriteBufferSize) {
+    size = kMinWriteBufferSize;
+  }
+  write_buffer_size_.Release_Store(reinterpret_cast<void*>(size));
+  cache_->SetCapacity(usable - w);
+}
+
+void MemoryBudget::Reserve(size_t bytes) {
+  MutexLock l(&mu_);
+  reserved_ += bytes;
+  Apply();
+}
+
+void MemoryBudget::Release(size_t bytes) {
+  MutexLock l(&mu_);
+  assert(reserved_ >= bytes);
+  reserved_ -= bytes;
+  Apply();
+}
+
+void MemoryBudget::AddWriteBuffers(int n) {
+  MutexLock l(&mu_);
+  write_buffers_ += n;
+  Apply();
+}
+
+void MemoryBudget::RemoveWriteBuffers(int n) {
+  MutexLock l(&mu_);
+  assert(write_buffers_ >= n);
+  write_buffers_ -= n;
+  Apply();
+}
+
+size_t MemoryBudget::write_share() const {
+  MutexLock l(&mu_);
+  return Usable() / kParts * write_parts_;
+}
+
+size_t MemoryBudget::cache_share() const {
+  MutexLock l(&mu_);
+  return Usable() - Usable() / kParts * write_parts_;
+}
+
+void MemoryBudget::RecordStall() {
+  MutexLock l(&mu_);
+  stalls_++;
+}
+
+void MemoryBudget::Rebalance() {
+  uint64_t lookups, hits;
+  cache_->GetHitStats(&lookups, &hits);
+  MutexLock l(&mu_);
+  const uint64_t stalls = stalls_ - last_stalls_;
+  const uint64_t n = lookups - last_lookups_;
+  const uint64_t misses = n - (hits - last_hits_);
+  last_stalls_ = stalls_;
+  last_lookups_ = lookups;
+  last_hits_ = hits;
+  // The cache is under pressure when it misses more than 1/4 of its lookups
+  const bool cache_pressure = n >= kMinLookups && misses * 4 > n;
+  int parts = write_parts_;
+  if (stalls != 0 && !cache_pressure) {
+    parts++;
+  } else if (stalls == 0 && cache_pressure) {
+    parts--;
+  }
+  if (parts < kMinWriteParts) parts = kMinWriteParts;
+  if (parts > kMaxWriteParts) parts = kMaxWriteParts;
+  if (parts != write_parts_) {
+    write_parts_ = parts;
+    Apply();
+  }
+}
+
+}  // namespace pdlfs
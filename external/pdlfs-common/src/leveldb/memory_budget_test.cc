@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/leveldb/memory_budget.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class MemoryBudgetTest {
+ public:
+  static void Deleter(const Slice& key, void* value) {}
+
+  MemoryBudgetTest() : budget_(16 << 20) {}
+
+  // Insert n entries of the given charge into the budget's cache.
+  void Fill(int n, size_t charge) {
+    Cache* const cache = budget_.cache();
+    for (int i = 0; i < n; i++) {
+      char buf[8];
+      EncodeFixed64(buf, next_key_++);
+      cache->Release(cache->Insert(Slice(buf, 8), NULL, charge, &Deleter));
+    }
+  }
+
+  // Perform n lookups, h of which hit.
+  void Lookup(int n, int h) {
+    Cache* const cache = budget_.cache();
+    Fill(1, 1);
+    char buf[8];
+    EncodeFixed64(buf, next_key_ - 1);
+    for (int i = 0; i < n; i++) {  // Misses look up a shorter key
+      Cache::Handle* handle = cache->Lookup(Slice(buf, i < h ? 8 : 7));
+      if (handle != NULL) cache->Release(handle);
+    }
+  }
+
+  static uint64_t next_key_;
+  MemoryBudget budget_;
+};
+
+uint64_t MemoryBudgetTest::next_key_ = 1;
+
+TEST(MemoryBudgetTest, Split) {
+  ASSERT_EQ(budget_.write_share(), 4 << 20);
+  ASSERT_EQ(budget_.cache_share(), 12 << 20);
+  budget_.AddWriteBuffers(2);
+  ASSERT_EQ(budget_.write_buffer_size(), 2 << 20);
+  budget_.AddWriteBuffers(2);
+  ASSERT_EQ(budget_.write_buffer_size(), 1 << 20);
+  budget_.RemoveWriteBuffers(2);
+  ASSERT_EQ(budget_.write_buffer_size(), 2 << 20);
+  Fill(512, 64 << 10);  // 32MB
+  ASSERT_LE(budget_.cache()->TotalCharge(), 12 << 20);
+  ASSERT_GE(budget_.cache()->TotalCharge(), 8 << 20);
+  budget_.RemoveWriteBuffers(2);
+}
+
+TEST(MemoryBudgetTest, Reserve) {
+  budget_.AddWriteBuffers(2);
+  Fill(512, 64 << 10);  // 32MB
+  budget_.Reserve(8 << 20);
+  ASSERT_EQ(budget_.write_share(), 2 << 20);
+  ASSERT_EQ(budget_.write_buffer_size(), 1 << 20);
+  ASSERT_LE(budget_.cache()->TotalCharge(), 6 << 20);
+  budget_.Release(8 << 20);
+  ASSERT_EQ(budget_.write_buffer_size(), 2 << 20);
+  budget_.RemoveWriteBuffers(2);
+}
+
+TEST(MemoryBudgetTest, StallsGrowWrites) {
+  budget_.AddWriteBuffers(2);
+  budget_.RecordStall();
+  Lookup(1000, 900);
+  budget_.Rebalance();
+  ASSERT_EQ(budget_.write_share(), 5 << 20);
+  // No change without new stalls
+  budget_.Rebalance();
+  ASSERT_EQ(budget_.write_share(), 5 << 20);
+  for (int i = 0; i < 20; i++) {
+    budget_.RecordStall();
+    budget_.Rebalance();
+  }
+  ASSERT_EQ(budget_.write_share(), 12 << 20);
+  ASSERT_EQ(budget_.cache_share(), 4 << 20);
+  budget_.RemoveWriteBuffers(2);
+}
+
+TEST(MemoryBudgetTest, MissesGrowCache) {
+  budget_.AddWriteBuffers(2);
+  Fill(512, 64 << 10);  // 32MB
+  Lookup(1000, 100);
+  budget_.Rebalance();
+  ASSERT_EQ(budget_.write_share(), 3 << 20);
+  // Stalls while the cache misses leave the split as is
+  budget_.RecordStall();
+  Lookup(1000, 100);
+  budget_.Rebalance();
+  ASSERT_EQ(budget_.write_share(), 3 << 20);
+  for (int i = 0; i < 20; i++) {
+    Lookup(1000, 100);
+    budget_.Rebalance();
+  }
+  ASSERT_EQ(budget_.write_share(), 2 << 20);
+  ASSERT_EQ(budget_.write_buffer_size(), 1 << 20);
+  // Too few lookups say nothing about the cache
+  budget_.RecordStall();
+  Lookup(10, 0);
+  budget_.Rebalance();
+  ASSERT_EQ(budget_.write_share(), 3 << 20);
+  budget_.RemoveWriteBuffers(2);
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
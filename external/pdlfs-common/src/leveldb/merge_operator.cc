@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/leveldb/merge_operator.h"
+
+namespace pdlfs {
+
+MergeOperator::~MergeOperator() {
+  // Empty
+}
+
+}  // namespace pdlfs
@@ -22,6 +22,7 @@
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/filter_policy.h"
 #include "pdlfs-common/leveldb/format.h"
+#include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/table.h"
@@ -31,15 +32,21 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 namespace pdlfs {
 
 struct Table::Rep {
   Options options;
   Status status;
   RandomAccessFile* file;
+  uint64_t file_size;
   uint64_t cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  size_t filter_size;  // Bytes of filter_data; 0 if filter_data is NULL
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   IndexBlockReader* index_block;
@@ -89,10 +96,12 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     Rep* rep = new Table::Rep;
     rep->options = options;
     rep->file = file;
+    rep->file_size = size;
     rep->metaindex_handle = footer.metaindex_handle();
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->index_block = new IndexBlockReader(contents);
     rep->filter_data = NULL;
+    rep->filter_size = 0;
     rep->filter = NULL;
     rep->props_valid = false;
 
@@ -159,6 +168,7 @@ void Table::ReadFilter(const Slice& handle_value) {
   r->filter = new FilterBlockReader(r->options.filter_policy, block.data);
   if (block.heap_allocated) {
     r->filter_data = block.data.data();  // Will need to delete later
+    r->filter_size = block.data.size();
   }
 }
 
@@ -206,7 +216,109 @@ static void ReleaseBlock(void* arg, void* h) {
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Cache* block_cache = table->rep_->options.block_cache;
+  return table->BlockReader(table->rep_->file, options, index_value, NULL);
+}
+
+namespace {
+// Upper bound on the readahead amount of a scan
+static const size_t kMaxReadaheadSize = 1 << 20;
+
+// Reads to a table file on behalf of a single iterator. A read missing the
+// buffer refills it from the read offset with at least "readahead" bytes,
+// but never past the end of the file, which some files treat as an error.
+// The amount doubles each time the refill picks up where the previous
+// buffer ended, and drops back to its initial value otherwise. Not safe for
+// concurrent use.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  ReadaheadFile(RandomAccessFile* base, uint64_t size, size_t readahead)
+      : base_(base),
+        size_(size),
+        initial_(readahead),
+        max_(std::max(readahead, kMaxReadaheadSize)),
+        readahead_(readahead),
+        offset_(0),
+        space_(NULL),
+        space_size_(0) {}
+
+  virtual ~ReadaheadFile() { delete[] space_; }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    const uint64_t end = offset_ + buffered_.size();
+    if (offset < offset_ || offset + n > end) {
+      if (!buffered_.empty() && offset >= offset_ && offset <= end) {
+        readahead_ = std::min(2 * readahead_, max_);
+      } else {
+        readahead_ = initial_;
+      }
+      size_t m = std::max(n, readahead_);
+      if (offset + m > size_ && offset + n <= size_) {
+        m = static_cast<size_t>(size_ - offset);
+      }
+      Status s = Fill(offset, m);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    const size_t off = static_cast<size_t>(offset - offset_);
+    n = std::min(n, buffered_.size() - off);
+    memcpy(scratch, buffered_.data() + off, n);
+    *result = Slice(scratch, n);
+    return Status::OK();
+  }
+
+ private:
+  Status Fill(uint64_t offset, size_t n) const {
+    if (space_size_ < n) {
+      delete[] space_;
+      space_ = new char[n];
+      space_size_ = n;
+    }
+    offset_ = offset;
+    Status s = base_->Read(offset, n, &buffered_, space_);
+    if (!s.ok()) {
+      buffered_ = Slice();
+    }
+    return s;
+  }
+
+  RandomAccessFile* const base_;
+  const uint64_t size_;
+  const size_t initial_;
+  const size_t max_;
+  mutable size_t readahead_;
+  // buffered_ holds file contents starting at offset_
+  mutable uint64_t offset_;
+  mutable Slice buffered_;
+  mutable char* space_;
+  mutable size_t space_size_;
+};
+
+struct TableReadahead {
+  TableReadahead(const Table* t, RandomAccessFile* f, uint64_t size,
+                 size_t readahead)
+      : table(t), file(f, size, readahead) {}
+  const Table* const table;
+  ReadaheadFile file;
+};
+}  // namespace
+
+static void DeleteReadahead(void* arg, void* ignored) {
+  delete reinterpret_cast<TableReadahead*>(arg);
+}
+
+Iterator* Table::ReadaheadBlockReader(void* arg, const ReadOptions& options,
+                                      const Slice& index_value) {
+  TableReadahead* const ra = reinterpret_cast<TableReadahead*>(arg);
+  return ra->table->BlockReader(&ra->file, options, index_value, NULL);
+}
+
+Iterator* Table::BlockReader(RandomAccessFile* file,
+                             const ReadOptions& options,
+                             const Slice& index_value,
+                             const Slice* hash_key) const {
+  Cache* block_cache = rep_->options.block_cache;
   Block* block = NULL;
   Cache::Handle* cache_handle = NULL;
 
@@ -220,15 +332,25 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
     BlockContents contents;
     if (block_cache != NULL) {
       char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
+      EncodeFixed64(cache_key_buffer, rep_->cache_id);
       EncodeFixed64(cache_key_buffer + 8, handle.offset());
       Slice key(cache_key_buffer, sizeof(cache_key_buffer));
       cache_handle = block_cache->Lookup(key);
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
+        if (options.stats != NULL) {
+          options.stats->block_cache_hits++;
+        }
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        if (options.stats != NULL) {
+          options.stats->block_cache_misses++;
+        }
+        s = ReadBlock(file, options, handle, &contents);
         if (s.ok()) {
+          if (options.stats != NULL) {
+            options.stats->block_reads++;
+            options.stats->block_read_bytes += handle.size();
+          }
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
             cache_handle = block_cache->Insert(key, block, block->size(),
@@ -237,8 +359,12 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = ReadBlock(file, options, handle, &contents);
       if (s.ok()) {
+        if (options.stats != NULL) {
+          options.stats->block_reads++;
+          options.stats->block_read_bytes += handle.size();
+        }
         block = new Block(contents);
       }
     }
@@ -246,7 +372,21 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 
   Iterator* iter;
   if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    uint32_t restart_index = Block::kUnknownInterval;
+    if (hash_key != NULL) {
+      restart_index = block->HashLookup(*hash_key);
+      if (options.stats != NULL) {
+        options.stats->hash_checks++;
+        if (restart_index == Block::kNotInBlock) {
+          options.stats->hash_negatives++;
+        }
+      }
+    }
+    if (restart_index == Block::kNotInBlock) {
+      iter = NewEmptyIterator();
+    } else {
+      iter = block->NewIterator(rep_->options.comparator, restart_index);
+    }
     if (cache_handle == NULL) {
       iter->RegisterCleanup(&DeleteBlock, block, NULL);
     } else {
@@ -259,6 +399,16 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 }
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
+  if (options.readahead_size != 0) {
+    TableReadahead* const ra =
+        new TableReadahead(this, rep_->file, rep_->file_size,
+                           options.readahead_size);
+    Iterator* const iter = NewTwoLevelIterator(
+        rep_->index_block->NewIterator(rep_->options.comparator),
+        &Table::ReadaheadBlockReader, ra, options);
+    iter->RegisterCleanup(&DeleteReadahead, ra, NULL);
+    return iter;
+  }
   return NewTwoLevelIterator(
       rep_->index_block->NewIterator(rep_->options.comparator),
       &Table::BlockReader, const_cast<Table*>(this), options);
@@ -273,11 +423,27 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
     Slice handle_value = iiter->value();
     FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
-    if (filter != NULL && handle.DecodeFrom(&handle_value).ok() &&
-        !filter->KeyMayMatch(handle.offset(), k)) {
+    bool may_match = true;
+    if (filter != NULL && handle.DecodeFrom(&handle_value).ok()) {
+      may_match = filter->KeyMayMatch(handle.offset(), k);
+      if (options.stats != NULL) {
+        options.stats->filter_checks++;
+        if (!may_match) {
+          options.stats->filter_negatives++;
+        }
+      }
+    }
+    if (!may_match) {
       // Not found
     } else {
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
+      Slice user_key;
+      const Slice* hash_key = NULL;
+      if (rep_->props_valid && rep_->props.data_block_hash_index()) {
+        user_key = ExtractUserKey(k);
+        hash_key = &user_key;
+      }
+      Iterator* block_iter =
+          BlockReader(rep_->file, options, iiter->value(), hash_key);
       block_iter->Seek(k);
       if (block_iter->Valid()) {
         Slice v = (options.limit != 0) ? block_iter->value() : Slice();
@@ -323,6 +489,12 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
 
 Table::~Table() { delete rep_; }
 
+size_t Table::ApproximateMemoryUsage() const {
+  Rep* r = rep_;
+  return sizeof(Table) + sizeof(Rep) +
+         r->index_block->ApproximateMemoryUsage() + r->filter_size;
+}
+
 const TableProperties* Table::GetProperties() const {
   Rep* r = rep_;
   if (r->props_valid) {
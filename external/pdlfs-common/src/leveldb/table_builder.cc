@@ -76,6 +76,14 @@ struct TableBuilder::Rep {
                          : NULL),
         pending_index_entry(false) {
     assert(options.comparator != NULL);
+    // Point lookups hash user keys so the index only works for tables
+    // of internal keys
+    if (options.data_block_hash_index &&
+        dynamic_cast<const InternalKeyComparator*>(options.comparator) !=
+            NULL) {
+      data_block.EnableHashIndex(8);
+      props_.SetDataBlockHashIndex(true);
+    }
   }
 };
 
@@ -111,6 +119,10 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.data_block_hash_index != rep_->options.data_block_hash_index) {
+    return Status::InvalidArgument(
+        "changing data block hash index while building table");
+  }
 
   rep_->options = options;
   rep_->data_block.ChangeRestartInterval(rep_->options.block_restart_interval);
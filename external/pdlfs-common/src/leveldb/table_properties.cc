@@ -23,6 +23,7 @@ void TableProperties::Clear() {
   max_seq_ = 0;
   first_key_.clear();
   last_key_.clear();
+  flags_ = 0;
 }
 
 void TableProperties::EncodeTo(std::string* dst) const {
@@ -30,6 +31,7 @@ void TableProperties::EncodeTo(std::string* dst) const {
   PutVarint64(dst, max_seq_);
   PutLengthPrefixedSlice(dst, first_key_);
   PutLengthPrefixedSlice(dst, last_key_);
+  PutVarint32(dst, flags_);
 }
 
 Status TableProperties::DecodeFrom(const Slice& src) {
@@ -42,6 +44,9 @@ Status TableProperties::DecodeFrom(const Slice& src) {
       !GetLengthPrefixedSlice(&input, &last_key)) {
     return Status::Corruption(Slice());
   }
+  if (!input.empty() && !GetVarint32(&input, &flags_)) {
+    return Status::Corruption(Slice());
+  }
   SetFirstKey(first_key);
   SetLastKey(last_key);
   return Status::OK();
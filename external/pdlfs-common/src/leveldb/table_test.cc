@@ -11,6 +11,7 @@
 #include "pdlfs-common/leveldb/table.h"
 #include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/table_builder.h"
 #include "pdlfs-common/leveldb/table_properties.h"
@@ -57,14 +58,17 @@ class StringSink : public WritableFile {
 class StringSource : public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {}
+      : contents_(contents.data(), contents.size()), reads_(0) {}
 
   virtual ~StringSource() {}
 
   uint64_t Size() const { return contents_.size(); }
 
+  int reads() const { return reads_; }
+
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const {
+    reads_++;
     if (offset > contents_.size()) {
       return Status::InvalidArgument(Slice());
     }
@@ -78,6 +82,7 @@ class StringSource : public RandomAccessFile {
 
  private:
   std::string contents_;
+  mutable int reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -141,6 +146,13 @@ class TableReader {
 
   ~TableReader() { delete table_; }
 
+  Iterator* NewIterator(const ReadOptions& options) {
+    return table_->NewIterator(options);
+  }
+
+  // Number of reads issued to the underlying table file
+  int FileReads() const { return file_.reads(); }
+
   Slice SmallestKey() {
     const TableProperties* const props = table_->GetProperties();
     ASSERT_TRUE(props != NULL);
@@ -213,6 +225,42 @@ TEST(TableTest, ReadWrite) {
   ASSERT_EQ(reader.MaxSeq(), kMinSequenceNumber + kNumEntries - 1);
 }
 
+TEST(TableTest, Readahead) {
+  Options options;
+  options.block_size = 1024;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  TableReader reader(options, contents);
+  int n = 0;
+  ReadStats stats;
+  ReadOptions ro;
+  ro.stats = &stats;
+  int reads = reader.FileReads();
+  Iterator* iter = reader.NewIterator(ro);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) n++;
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(n, kNumEntries);
+  ASSERT_EQ(reader.FileReads() - reads, stats.block_reads);
+  ASSERT_GT(stats.block_reads, 8);
+
+  ro.readahead_size = 4096;
+  stats.Clear();
+  n = 0;
+  reads = reader.FileReads();
+  iter = reader.NewIterator(ro);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) n++;
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(n, kNumEntries);
+  // Readahead doubles as the scan goes: 4KB, 8KB, 16KB, ...
+  ASSERT_LE(reader.FileReads() - reads, 4);
+  // Seeking backwards starts over from the initial readahead
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key(), writer.SmallestKey());
+  delete iter;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -0,0 +1,538 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+// Microbenchmarks for the primitives on the hot paths of the fs and the db.
+//
+// Each benchmark is run a few times and the best run is reported as one JSON
+// object per line:
+//
+//   {"name": "crc32c_sw_4k", "ops": 100000, "ns_per_op": 812.44}
+//
+// Usage: microbench [--benchmarks=a,b,...] [--reps=N] [--baseline=FILE]
+//                   [--tolerance=F]
+//
+// With --baseline, each result is compared with the result of the same name
+// in FILE, a previous output of this program, and the program exits with 1
+// if any benchmark became more than F times slower (default 0.25, i.e. 25%).
+// A baseline is only meaningful on the machine it was recorded on. The one
+// in microbench_baseline.jsonl should be refreshed whenever the machine used
+// for regression runs changes:
+//
+//   microbench > microbench_baseline.jsonl
+#include "crc32c/crc32c_internal.h"
+#include "leveldb/skiplist.h"
+
+#include "pdlfs-common/arena.h"
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/fsdbbase.h"
+#include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/leveldb/block.h"
+#include "pdlfs-common/leveldb/block_builder.h"
+#include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/format.h"
+#include "pdlfs-common/leveldb/iterator.h"
+#include "pdlfs-common/murmur.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/spooky.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace {
+
+const char* FLAGS_benchmarks = NULL;  // NULL for all
+int FLAGS_reps = 3;
+const char* FLAGS_baseline = NULL;
+double FLAGS_tolerance = 0.25;
+
+// Results are folded into this so that the compiler cannot drop the work
+// being measured.
+volatile uint64_t sink;
+
+const int kNumNames = 1024;
+
+// Short names as found in a typical dir.
+std::vector<std::string> MakeNames() {
+  std::vector<std::string> names;
+  Random rnd(301);
+  char tmp[32];
+  for (int i = 0; i < kNumNames; i++) {
+    snprintf(tmp, sizeof(tmp), "file%08u.dat", rnd.Next() % 100000000);
+    names.push_back(tmp);
+  }
+  return names;
+}
+
+// A benchmark runs "ops" operations each time it is called and returns the
+// number of operations done, which may differ from "ops".
+typedef uint64_t (*BenchmarkFunc)(uint64_t ops);
+
+uint64_t BM_KeySetSuffix(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    Key key(i, kDirEntType);
+    key.SetSuffix(names[i % kNumNames]);
+    x += key.size();
+  }
+  sink += x;
+  return ops;
+}
+
+Stat MakeStat(uint64_t i) {
+  Stat stat;
+  stat.SetInodeNo(i);
+  stat.SetFileSize(i * 4096);
+  stat.SetFileMode(0100644);
+  stat.SetUserId(1000);
+  stat.SetGroupId(1000);
+  stat.SetModifyTime(1500000000000000ull + i);
+  stat.SetChangeTime(1500000000000000ull + i);
+  stat.AssertAllSet();
+  return stat;
+}
+
+uint64_t BM_StatEncode(uint64_t ops) {
+  const Stat stat = MakeStat(12345);
+  char scratch[Stat::kMaxEncodedLength];
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    x += stat.EncodeTo(scratch).size();
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_StatDecode(uint64_t ops) {
+  const Stat stat = MakeStat(12345);
+  char scratch[Stat::kMaxEncodedLength];
+  const Slice encoding = stat.EncodeTo(scratch);
+  uint64_t x = 0;
+  Stat result;
+  for (uint64_t i = 0; i < ops; i++) {
+    if (result.DecodeFrom(encoding)) {
+      x += result.InodeNo();
+    }
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Hash(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    x += Hash(name.data(), name.size(), 0);
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Xxhash32(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    x += xxhash32(name.data(), name.size(), 0);
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Xxhash64(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    x += xxhash64(name.data(), name.size(), 0);
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Murmur32(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  uint32_t h;
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    murmur_x86_32(name.data(), static_cast<int>(name.size()), 0, &h);
+    x += h;
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Murmur128(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  uint64_t h[2];
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    murmur_x64_128(name.data(), static_cast<int>(name.size()), 0, h);
+    x += h[0];
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_Spooky128(uint64_t ops) {
+  const std::vector<std::string> names = MakeNames();
+  uint64_t x = 0;
+  uint64_t h[2];
+  for (uint64_t i = 0; i < ops; i++) {
+    const std::string& name = names[i % kNumNames];
+    Spooky128(name.data(), name.size(), 0, 0, h);
+    x += h[0];
+  }
+  sink += x;
+  return ops;
+}
+
+void NoopDeleter(const Slice& key, void* value) {}
+
+// Threads share a cache holding half of the keys they access. 9 in 10 ops
+// are lookups; a miss inserts the key. Time per op is the wall time divided
+// by the ops done by all threads.
+struct CacheState {
+  CacheState(int n, uint64_t ops)
+      : cache(NewLRUCache(kNumKeys / 2)),
+        cv(&mu),
+        num_threads(n),
+        num_ready(0),
+        num_done(0),
+        start(false),
+        ops_per_thread(ops / n) {}
+  ~CacheState() { delete cache; }
+  enum { kNumKeys = 1 << 16 };
+  Cache* const cache;
+  port::Mutex mu;
+  port::CondVar cv;
+  const int num_threads;
+  int num_ready;
+  int num_done;
+  bool start;
+  const uint64_t ops_per_thread;
+};
+
+void CacheThreadBody(void* arg) {
+  CacheState* const state = static_cast<CacheState*>(arg);
+  Random rnd(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&rnd)));
+  {
+    MutexLock ml(&state->mu);
+    state->num_ready++;
+    state->cv.SignalAll();
+    while (!state->start) {
+      state->cv.Wait();
+    }
+  }
+  Cache* const cache = state->cache;
+  char buf[8];
+  for (uint64_t i = 0; i < state->ops_per_thread; i++) {
+    EncodeFixed64(buf, rnd.Uniform(CacheState::kNumKeys));
+    const Slice key(buf, sizeof(buf));
+    Cache::Handle* h = NULL;
+    if (i % 10 != 0) h = cache->Lookup(key);
+    if (h == NULL) h = cache->Insert(key, NULL, 1, NoopDeleter);
+    cache->Release(h);
+  }
+  MutexLock ml(&state->mu);
+  state->num_done++;
+  state->cv.SignalAll();
+}
+
+uint64_t RunCacheThreads(int n, uint64_t ops) {
+  CacheState state(n, ops);
+  for (int i = 0; i < n; i++) {
+    Env::Default()->StartThread(CacheThreadBody, &state);
+  }
+  MutexLock ml(&state.mu);
+  while (state.num_ready < n) {
+    state.cv.Wait();
+  }
+  state.start = true;
+  state.cv.SignalAll();
+  while (state.num_done < n) {
+    state.cv.Wait();
+  }
+  return state.ops_per_thread * n;
+}
+
+uint64_t BM_LRUCache1(uint64_t ops) { return RunCacheThreads(1, ops); }
+uint64_t BM_LRUCache4(uint64_t ops) { return RunCacheThreads(4, ops); }
+
+struct U64Comparator {
+  int operator()(const uint64_t& a, const uint64_t& b) const {
+    if (a < b) {
+      return -1;
+    } else if (a > b) {
+      return +1;
+    } else {
+      return 0;
+    }
+  }
+};
+
+typedef SkipList<uint64_t, U64Comparator> U64SkipList;
+
+uint64_t BM_SkipListInsert(uint64_t ops) {
+  Arena arena;
+  U64SkipList list(U64Comparator(), &arena);
+  Random rnd(301);
+  for (uint64_t i = 0; i < ops; i++) {
+    list.Insert((static_cast<uint64_t>(rnd.Next()) << 32) | i);
+  }
+  return ops;
+}
+
+uint64_t BM_SkipListSeek(uint64_t ops) {
+  const int kNumEntries = 100000;
+  Arena arena;
+  U64SkipList list(U64Comparator(), &arena);
+  Random rnd(301);
+  for (int i = 0; i < kNumEntries; i++) {
+    list.Insert((static_cast<uint64_t>(rnd.Next()) << 32) | i);
+  }
+  uint64_t x = 0;
+  U64SkipList::Iterator iter(&list);
+  for (uint64_t i = 0; i < ops; i++) {
+    iter.Seek(static_cast<uint64_t>(rnd.Next()) << 32);
+    if (iter.Valid()) x += iter.key();
+  }
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_BlockSeek(uint64_t ops) {
+  // A 4KB block of fs keys
+  BlockBuilder builder(16, BytewiseComparator());
+  std::vector<std::string> keys;
+  const std::string value(64, 'x');
+  for (int i = 0; builder.CurrentSizeEstimate() < 4096; i++) {
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "file%08d.dat", i);
+    Key key(1, kDirEntType);
+    key.SetSuffix(tmp);
+    keys.push_back(key.Encode().ToString());
+    builder.Add(keys.back(), value);
+  }
+  BlockContents contents;
+  contents.data = builder.Finish();
+  contents.cachable = false;
+  contents.heap_allocated = false;
+  Block block(contents);
+  Iterator* const iter = block.NewIterator(BytewiseComparator());
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    iter->Seek(keys[i % keys.size()]);
+    if (iter->Valid()) x += iter->value().size();
+  }
+  delete iter;
+  sink += x;
+  return ops;
+}
+
+uint64_t BM_BloomProbe(uint64_t ops) {
+  const FilterPolicy* const policy = NewBloomFilterPolicy(10);
+  const std::vector<std::string> names = MakeNames();
+  std::vector<Slice> keys;
+  for (int i = 0; i < kNumNames; i += 2) {  // Only even names are added
+    keys.push_back(names[i]);
+  }
+  std::string filter;
+  policy->CreateFilter(&keys[0], static_cast<int>(keys.size()), &filter);
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    x += policy->KeyMayMatch(names[i % kNumNames], filter);
+  }
+  delete policy;
+  sink += x;
+  return ops;
+}
+
+const size_t kCrcDataSize = 4096;
+
+uint64_t BM_Crc32cSW(uint64_t ops) {
+  const std::string data(kCrcDataSize, 'x');
+  uint32_t crc = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    crc = crc32c::ExtendSW(crc, data.data(), data.size());
+  }
+  sink += crc;
+  return ops;
+}
+
+uint64_t BM_Crc32cHW(uint64_t ops) {
+  if (!crc32c::CanAccelerateCrc32c()) {
+    return 0;  // Not supported
+  }
+  const std::string data(kCrcDataSize, 'x');
+  uint32_t crc = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    crc = crc32c::ExtendHW(crc, data.data(), data.size());
+  }
+  sink += crc;
+  return ops;
+}
+
+uint64_t BM_ArenaAllocate(uint64_t ops) {
+  Arena* arena = new Arena;
+  uint64_t x = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    if (i % 100000 == 0) {  // Bound the memory used
+      delete arena;
+      arena = new Arena;
+    }
+    x += reinterpret_cast<uintptr_t>(arena->Allocate(16 + (i & 63)));
+  }
+  delete arena;
+  sink += x;
+  return ops;
+}
+
+struct Benchmark {
+  const char* name;
+  BenchmarkFunc func;
+  uint64_t ops;
+};
+
+const Benchmark kBenchmarks[] = {
+    {"key_set_suffix", BM_KeySetSuffix, 5000000},
+    {"stat_encode", BM_StatEncode, 5000000},
+    {"stat_decode", BM_StatDecode, 5000000},
+    {"hash_short", BM_Hash, 10000000},
+    {"xxhash32_short", BM_Xxhash32, 10000000},
+    {"xxhash64_short", BM_Xxhash64, 10000000},
+    {"murmur32_short", BM_Murmur32, 10000000},
+    {"murmur128_short", BM_Murmur128, 10000000},
+    {"spooky128_short", BM_Spooky128, 10000000},
+    {"lru_cache_1thread", BM_LRUCache1, 2000000},
+    {"lru_cache_4threads", BM_LRUCache4, 2000000},
+    {"skiplist_insert", BM_SkipListInsert, 500000},
+    {"skiplist_seek", BM_SkipListSeek, 1000000},
+    {"block_seek", BM_BlockSeek, 2000000},
+    {"bloom_probe", BM_BloomProbe, 5000000},
+    {"crc32c_sw_4k", BM_Crc32cSW, 100000},
+    {"crc32c_hw_4k", BM_Crc32cHW, 100000},
+    {"arena_allocate", BM_ArenaAllocate, 10000000},
+};
+
+bool Selected(const char* name) {
+  if (FLAGS_benchmarks == NULL) return true;
+  Slice list(FLAGS_benchmarks);
+  const size_t n = strlen(name);
+  while (!list.empty()) {
+    const char* comma = strchr(list.data(), ',');
+    const size_t len = comma ? comma - list.data() : list.size();
+    if (len == n && memcmp(list.data(), name, n) == 0) return true;
+    list.remove_prefix(comma ? len + 1 : len);
+  }
+  return false;
+}
+
+// Read a previous output of this program. Return false if the file cannot
+// be read.
+bool LoadBaseline(const char* fname, std::map<std::string, double>* result) {
+  FILE* const f = fopen(fname, "r");
+  if (!f) return false;
+  char line[256];
+  char name[64];
+  unsigned long long ops;
+  double ns;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line,
+               "{\"name\": \"%63[^\"]\", \"ops\": %llu, \"ns_per_op\": %lf",
+               name, &ops, &ns) == 3) {
+      (*result)[name] = ns;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+int Run() {
+  std::map<std::string, double> baseline;
+  if (FLAGS_baseline && !LoadBaseline(FLAGS_baseline, &baseline)) {
+    fprintf(stderr, "Cannot read baseline %s\n", FLAGS_baseline);
+    return 1;
+  }
+  int regressions = 0;
+  for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); i++) {
+    const Benchmark& bm = kBenchmarks[i];
+    if (!Selected(bm.name)) continue;
+    double best = 0;
+    uint64_t ops = 0;
+    for (int r = 0; r < FLAGS_reps; r++) {
+      const uint64_t start = CurrentMicros();
+      ops = bm.func(bm.ops);
+      const uint64_t micros = CurrentMicros() - start;
+      if (ops == 0) break;  // Not supported on this machine
+      const double ns = micros * 1000.0 / ops;
+      if (r == 0 || ns < best) best = ns;
+    }
+    if (ops == 0) continue;
+    fprintf(stdout, "{\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f",
+            bm.name, static_cast<unsigned long long>(ops), best);
+    std::map<std::string, double>::const_iterator it =
+        baseline.find(bm.name);
+    if (it != baseline.end()) {
+      const bool regressed = best > it->second * (1 + FLAGS_tolerance);
+      fprintf(stdout, ", \"baseline_ns_per_op\": %.2f, \"regressed\": %s",
+              it->second, regressed ? "true" : "false");
+      if (regressed) regressions++;
+    }
+    fprintf(stdout, "}\n");
+    fflush(stdout);
+  }
+  if (regressions != 0) {
+    fprintf(stderr, "%d benchmark(s) regressed\n", regressions);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    char junk;
+    if (pdlfs::Slice(argv[i]).starts_with("--benchmarks=")) {
+      pdlfs::FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
+    } else if (sscanf(argv[i], "--reps=%d%c", &n, &junk) == 1 && n > 0) {
+      pdlfs::FLAGS_reps = n;
+    } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+      pdlfs::FLAGS_baseline = argv[i] + 11;
+    } else if (sscanf(argv[i], "--tolerance=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      pdlfs::FLAGS_tolerance = d;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+  return pdlfs::Run();
+}
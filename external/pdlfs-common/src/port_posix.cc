@@ -88,6 +88,48 @@ void Mutex::Unlock() {
   PthreadCall("pthread_mutex_unlock", pthread_mutex_unlock(&mu_));
 }
 
+// Built on a mutex and a condition variable rather than pthread_rwlock_t, as
+// the latter prefers readers on most platforms.
+RWLock::RWLock() : cv_(&mu_), readers_(0), writers_(0), writing_(false) {}
+
+RWLock::~RWLock() {}
+
+void RWLock::ReadLock() {
+  mu_.Lock();
+  while (writers_ != 0) {
+    cv_.Wait();
+  }
+  readers_++;
+  mu_.Unlock();
+}
+
+void RWLock::ReadUnlock() {
+  mu_.Lock();
+  readers_--;
+  if (readers_ == 0 && writers_ != 0) {
+    cv_.SignalAll();
+  }
+  mu_.Unlock();
+}
+
+void RWLock::WriteLock() {
+  mu_.Lock();
+  writers_++;
+  while (readers_ != 0 || writing_) {
+    cv_.Wait();
+  }
+  writing_ = true;
+  mu_.Unlock();
+}
+
+void RWLock::WriteUnlock() {
+  mu_.Lock();
+  writing_ = false;
+  writers_--;
+  cv_.SignalAll();
+  mu_.Unlock();
+}
+
 CondVar::CondVar(Mutex* mu) : mu_(mu) {
   PthreadCall("pthread_cond_init", pthread_cond_init(&cv_, NULL));
 }
@@ -11,6 +11,7 @@
 #include "posix_bgrun.h"
 
 #include <stdio.h>
+#include <unistd.h>
 
 namespace pdlfs {
 
@@ -114,4 +115,204 @@ ThreadPool* ThreadPool::NewFixed(int num_threads, bool eager_init, void* attr) {
   return new PosixThreadPool(num_threads, eager_init, attr);
 }
 
+PosixWorkStealingPool::PosixWorkStealingPool(int num_threads, bool pin_threads)
+    : pin_threads_(pin_threads),
+      bg_cv_(&mu_),
+      num_pool_threads_(0),
+      num_sleeping_(0),
+      has_sleeping_(NULL),
+      paused_(NULL),
+      shutting_down_(NULL) {
+  port::PthreadCall("pthread_key_create", pthread_key_create(&self_key_, NULL));
+  for (int i = 0; i < num_threads; i++) {
+    Worker* const w = new Worker;
+    w->pool = this;
+    w->id = i;
+    w->runs = w->steals = w->idles = 0;
+    workers_.push_back(w);
+  }
+  MutexLock ml(&mu_);
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Pthread(BGWrapper, workers_[i], NULL);
+    num_pool_threads_++;
+  }
+}
+
+PosixWorkStealingPool::~PosixWorkStealingPool() {
+  mu_.Lock();
+  shutting_down_.Release_Store(this);  // Any non-NULL value is ok
+  bg_cv_.SignalAll();
+  while (num_pool_threads_ != 0) {
+    bg_cv_.Wait();
+  }
+  mu_.Unlock();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    delete workers_[i];
+  }
+  pthread_key_delete(self_key_);
+}
+
+std::string PosixWorkStealingPool::ToDebugString() {
+  uint64_t runs = 0, steals = 0, idles = 0;
+  int sleeping;
+  {
+    MutexLock ml(&mu_);
+    sleeping = num_sleeping_;
+    for (size_t i = 0; i < workers_.size(); i++) {
+      Worker* const w = workers_[i];
+      MutexLock l(&w->mu);
+      runs += w->runs;
+      steals += w->steals;
+      idles += w->idles;
+    }
+  }
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "Tpool: work_stealing threads=%d busy=%d idle=%d runs=%llu "
+           "steals=%llu sleeps=%llu",
+           static_cast<int>(workers_.size()),
+           static_cast<int>(workers_.size()) - sleeping, sleeping,
+           static_cast<unsigned long long>(runs),
+           static_cast<unsigned long long>(steals),
+           static_cast<unsigned long long>(idles));
+  return tmp;
+}
+
+void PosixWorkStealingPool::Schedule(void (*function)(void*), void* arg) {
+  ScheduleWithPriority(function, arg, kNormal);
+}
+
+void PosixWorkStealingPool::ScheduleWithPriority(void (*function)(void*),
+                                                 void* arg, Priority pri) {
+  if (workers_.empty()) return;
+  Worker* w = reinterpret_cast<Worker*>(pthread_getspecific(self_key_));
+  if (w == NULL) {
+    // Spread callers outside the pool over threads by their ids
+    const uint64_t h = port::PthreadId() * 0x9E3779B97F4A7C15ull;
+    w = workers_[(h >> 32) % workers_.size()];
+  }
+  {
+    MutexLock l(&w->mu);
+    w->q[pri].push_back(BGItem());
+    w->q[pri].back().function = function;
+    w->q[pri].back().arg = arg;
+  }
+  // A thread going to sleep checks all queues after announcing itself, so
+  // either it sees the task we just queued or we see it sleeping
+  if (has_sleeping_.Acquire_Load() != NULL) {
+    MutexLock ml(&mu_);
+    bg_cv_.Signal();
+  }
+}
+
+bool PosixWorkStealingPool::TakeTask(Worker* w, BGItem* item) {
+  if (paused_.Acquire_Load() != NULL || shutting_down_.Acquire_Load() != NULL) {
+    return false;
+  }
+  const size_t n = workers_.size();
+  for (int pri = 0; pri < kNumPriorities; pri++) {
+    {
+      MutexLock l(&w->mu);
+      if (!w->q[pri].empty()) {  // Our own oldest task
+        *item = w->q[pri].front();
+        w->q[pri].pop_front();
+        w->runs++;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < n; i++) {
+      Worker* const victim = workers_[(w->id + i) % n];
+      bool stolen = false;
+      {
+        MutexLock l(&victim->mu);
+        if (!victim->q[pri].empty()) {  // The newest task of a peer
+          *item = victim->q[pri].back();
+          victim->q[pri].pop_back();
+          stolen = true;
+        }
+      }
+      if (stolen) {
+        MutexLock l(&w->mu);
+        w->runs++;
+        w->steals++;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool PosixWorkStealingPool::HasTasks() {
+  mu_.AssertHeld();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker* const w = workers_[i];
+    MutexLock l(&w->mu);
+    for (int pri = 0; pri < kNumPriorities; pri++) {
+      if (!w->q[pri].empty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void PosixWorkStealingPool::BGThread(Worker* w) {
+  pthread_setspecific(self_key_, w);
+#if defined(PDLFS_OS_LINUX)
+  if (pin_threads_) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(w->id % cpus, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+  }
+#endif
+
+  while (true) {
+    BGItem item;
+    if (TakeTask(w, &item)) {
+      assert(item.function != NULL);
+      item.function(item.arg);
+      continue;
+    }
+
+    MutexLock l(&mu_);
+    if (num_sleeping_++ == 0) {
+      has_sleeping_.Release_Store(this);  // Any non-NULL value is ok
+    }
+    // Wait until there is a task that is ready to run
+    while (shutting_down_.NoBarrier_Load() == NULL &&
+           (paused_.NoBarrier_Load() != NULL || !HasTasks())) {
+      w->idles++;
+      bg_cv_.Wait();
+    }
+    if (--num_sleeping_ == 0) {
+      has_sleeping_.Release_Store(NULL);
+    }
+    if (shutting_down_.NoBarrier_Load() != NULL) {
+      assert(num_pool_threads_ > 0);
+      num_pool_threads_--;
+      bg_cv_.SignalAll();
+      return;
+    }
+  }
+}
+
+void PosixWorkStealingPool::Resume() {
+  MutexLock ml(&mu_);
+  paused_.Release_Store(NULL);
+  bg_cv_.SignalAll();
+}
+
+void PosixWorkStealingPool::Pause() {
+  MutexLock ml(&mu_);
+  paused_.Release_Store(this);  // Any non-NULL value is ok
+}
+
+ThreadPool* ThreadPool::NewWorkStealing(int num_threads, bool pin_threads) {
+  return new PosixWorkStealingPool(num_threads, pin_threads);
+}
+
 }  // namespace pdlfs
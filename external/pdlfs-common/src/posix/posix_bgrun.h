@@ -21,6 +21,8 @@
 #include "pdlfs-common/port.h"
 
 #include <deque>
+#include <pthread.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -88,4 +90,73 @@ class PosixThreadPool : public ThreadPool {
   }
 };
 
+// A thread pool in which each thread owns a queue of tasks for each
+// priority. A task scheduled by a pool thread goes to that thread's own
+// queue. A task scheduled by any other thread goes to the queue of a
+// thread picked by hashing the caller's thread id. Threads run tasks from
+// their own queues first, oldest first, and steal the newest tasks of their
+// peers when their own queues run dry. Each queue has its own lock, so busy
+// threads never contend on a pool-wide lock. Threads only take the
+// pool-wide lock to go to sleep, and tasks only take it to wake up a
+// sleeping thread.
+class PosixWorkStealingPool : public ThreadPool {
+ public:
+  PosixWorkStealingPool(int num_threads, bool pin_threads);
+
+  virtual ~PosixWorkStealingPool();
+  virtual void Schedule(void (*function)(void*), void* arg);
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri);
+  virtual std::string ToDebugString();
+  virtual void Resume();
+  virtual void Pause();
+
+ private:
+  struct BGItem {
+    void* arg;
+    void (*function)(void*);
+  };
+  typedef std::deque<BGItem> BGQueue;
+  enum { kNumPriorities = 2 };
+
+  struct Worker {
+    PosixWorkStealingPool* pool;
+    int id;
+    port::Mutex mu;
+    BGQueue q[kNumPriorities];  // Protected by mu
+    // Stats protected by mu, except for idles, which is protected by the
+    // pool's mu_
+    uint64_t runs;    // Tasks run
+    uint64_t steals;  // Tasks run that were taken from peers
+    uint64_t idles;   // Number of times the worker went to sleep
+  };
+
+  // BGThread() is the body of the background thread
+  void BGThread(Worker* w);
+  static void* BGWrapper(void* arg) {
+    Worker* const w = reinterpret_cast<Worker*>(arg);
+    w->pool->BGThread(w);
+    return NULL;
+  }
+
+  // Take the next task for *w. Return false if there is none.
+  bool TakeTask(Worker* w, BGItem* item);
+  // REQUIRES: mu_ has been locked.
+  bool HasTasks();
+
+  std::vector<Worker*> workers_;
+  pthread_key_t self_key_;  // Worker run by the calling thread if any
+  const bool pin_threads_;
+
+  port::Mutex mu_;
+  port::CondVar bg_cv_;
+  int num_pool_threads_;
+  int num_sleeping_;
+  // Flags written with mu_ held. Read without mu_ by threads taking tasks
+  // and, for has_sleeping_, by callers deciding whether to wake up a thread.
+  port::AtomicPointer has_sleeping_;  // Non-NULL iff num_sleeping_ != 0
+  port::AtomicPointer paused_;
+  port::AtomicPointer shutting_down_;
+};
+
 }  // namespace pdlfs
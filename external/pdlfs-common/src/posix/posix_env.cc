@@ -311,6 +311,20 @@ class PosixMmapIoEnvWrapper : public EnvWrapper {
   MmapLimiter mmap_limit_;
 };
 
+class ThreadPoolEnvWrapper : public EnvWrapper {
+ public:
+  ThreadPoolEnvWrapper(Env* base, ThreadPool* pool)
+      : EnvWrapper(base), pool_(pool) {}
+  virtual ~ThreadPoolEnvWrapper() {}
+
+  virtual void Schedule(void (*function)(void*), void* arg) OVERRIDE {
+    pool_->Schedule(function, arg);
+  }
+
+ private:
+  ThreadPool* const pool_;
+};
+
 Env* Env::NewBufferedIoEnvWrapper(Env* const base) {
   return new PosixLibcBufferedIoEnvWrapper(base);
 }
@@ -319,6 +333,10 @@ Env* Env::NewMmapIoEnvWrapper(Env* const base) {
   return new PosixMmapIoEnvWrapper(base);
 }
 
+Env* Env::NewThreadPoolEnvWrapper(Env* const base, ThreadPool* const pool) {
+  return new ThreadPoolEnvWrapper(base, pool);
+}
+
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 
 static Env* posix_env_wrapped;
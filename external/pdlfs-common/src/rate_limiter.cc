@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/rate_limiter.h"
+
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace pdlfs {
+
+RateLimiter::~RateLimiter() {}
+
+namespace {
+
+// Auto-tuning adjusts the rate at most once per this many micros
+static const uint64_t kTuneMicros = 100000;
+
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(uint64_t bytes_per_sec, uint64_t target_latency_micros,
+                     uint64_t refill_period_micros)
+      : cv_(&mu_),
+        refill_micros_(std::max<uint64_t>(refill_period_micros, 1)),
+        max_rate_(bytes_per_sec),
+        target_latency_(target_latency_micros),
+        available_(0),
+        next_refill_micros_(0),
+        leader_(false),
+        latency_sum_(0),
+        latency_samples_(0),
+        next_tune_micros_(0) {
+    for (int i = 0; i < kNumIOPriorities; i++) {
+      total_bytes_[i] = 0;
+    }
+    SetRate(bytes_per_sec);
+  }
+
+  virtual void SetBytesPerSecond(uint64_t bytes_per_sec) {
+    MutexLock l(&mu_);
+    max_rate_ = bytes_per_sec;
+    SetRate(bytes_per_sec);
+  }
+
+  virtual uint64_t GetBytesPerSecond() {
+    MutexLock l(&mu_);
+    return rate_;
+  }
+
+  virtual size_t GetSingleBurstBytes() {
+    MutexLock l(&mu_);
+    if (rate_ == 0) {
+      return ~static_cast<size_t>(0);  // Not limited
+    }
+    return refill_bytes_;
+  }
+
+  virtual void Request(size_t bytes, IOPriority pri) {
+    MutexLock l(&mu_);
+    total_bytes_[pri] += bytes;
+    if (rate_ == 0) {
+      return;  // Not limited
+    }
+    bytes = std::min<size_t>(bytes, refill_bytes_);
+    MaybeRefill(CurrentMicros());
+    if (available_ >= bytes && NoPendingRequests()) {
+      available_ -= bytes;
+      return;
+    }
+
+    Req r(bytes);
+    queues_[pri].push_back(&r);
+    while (!r.granted) {
+      if (leader_) {
+        cv_.Wait();
+        continue;
+      }
+      // Become the leader, which waits for the next refill and then grants
+      // pending requests in priority order on behalf of all waiters.
+      leader_ = true;
+      const uint64_t now = CurrentMicros();
+      if (now < next_refill_micros_) {
+        cv_.TimedWait(next_refill_micros_ - now);
+      }
+      MaybeRefill(CurrentMicros());
+      GrantRequests();
+      leader_ = false;
+      cv_.SignalAll();
+    }
+  }
+
+  virtual void ReportForegroundLatency(uint64_t micros) {
+    if (target_latency_ == 0) {
+      return;  // Auto-tuning disabled
+    }
+    MutexLock l(&mu_);
+    latency_sum_ += micros;
+    latency_samples_++;
+    const uint64_t now = CurrentMicros();
+    if (now < next_tune_micros_) {
+      return;
+    }
+    next_tune_micros_ = now + kTuneMicros;
+    const uint64_t avg = latency_sum_ / latency_samples_;
+    latency_sum_ = latency_samples_ = 0;
+    if (max_rate_ == 0) {
+      return;  // Not limited
+    }
+    const uint64_t min_rate = std::max<uint64_t>(max_rate_ / 20, 1);
+    if (avg > target_latency_) {  // Back off quickly
+      SetRate(std::max(min_rate, rate_ - rate_ / 4));
+    } else {  // Recover slowly
+      SetRate(std::min(max_rate_, rate_ + std::max<uint64_t>(rate_ / 20, 1)));
+    }
+  }
+
+  virtual uint64_t GetTotalBytesThrough(IOPriority pri) {
+    MutexLock l(&mu_);
+    return total_bytes_[pri];
+  }
+
+ private:
+  struct Req {
+    explicit Req(size_t b) : bytes(b), granted(false) {}
+    size_t bytes;
+    bool granted;
+  };
+
+  // REQUIRES: mu_ has been locked.
+  void SetRate(uint64_t bytes_per_sec) {
+    rate_ = bytes_per_sec;
+    refill_bytes_ = std::max<uint64_t>(rate_ * refill_micros_ / 1000000, 1);
+    available_ = std::min(available_, refill_bytes_);
+    if (rate_ == 0) {  // Release all waiters
+      for (int i = 0; i < kNumIOPriorities; i++) {
+        while (!queues_[i].empty()) {
+          queues_[i].front()->granted = true;
+          queues_[i].pop_front();
+        }
+      }
+      cv_.SignalAll();
+    } else {
+      // Requests are clamped to a single refill when queued. Re-clamp those
+      // still waiting, as a request larger than a refill is never granted.
+      for (int i = 0; i < kNumIOPriorities; i++) {
+        for (size_t j = 0; j < queues_[i].size(); j++) {
+          Req* const r = queues_[i][j];
+          r->bytes = std::min<uint64_t>(r->bytes, refill_bytes_);
+        }
+      }
+    }
+  }
+
+  // Tokens not used by the end of a period are not carried over so that
+  // background I/O never bursts above the configured rate.
+  // REQUIRES: mu_ has been locked.
+  void MaybeRefill(uint64_t now) {
+    if (now >= next_refill_micros_) {
+      available_ = refill_bytes_;
+      next_refill_micros_ = now + refill_micros_;
+    }
+  }
+
+  // Grant pending requests, higher priorities first. A request that cannot be
+  // granted blocks all requests behind it, including those at lower
+  // priorities.
+  // REQUIRES: mu_ has been locked.
+  void GrantRequests() {
+    for (int i = kNumIOPriorities - 1; i >= 0; i--) {
+      std::deque<Req*>* const q = &queues_[i];
+      while (!q->empty()) {
+        Req* const r = q->front();
+        if (r->bytes > available_) {
+          return;
+        }
+        available_ -= r->bytes;
+        r->granted = true;
+        q->pop_front();
+      }
+    }
+  }
+
+  // REQUIRES: mu_ has been locked.
+  bool NoPendingRequests() const {
+    for (int i = 0; i < kNumIOPriorities; i++) {
+      if (!queues_[i].empty()) return false;
+    }
+    return true;
+  }
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  const uint64_t refill_micros_;
+  uint64_t max_rate_;  // Configured rate; rate_ may be lower if auto-tuned
+  const uint64_t target_latency_;
+  uint64_t rate_;
+  uint64_t refill_bytes_;  // Bytes admitted per refill period
+  uint64_t available_;
+  uint64_t next_refill_micros_;
+  bool leader_;  // Is a waiter refilling tokens for others?
+  std::deque<Req*> queues_[kNumIOPriorities];
+  uint64_t total_bytes_[kNumIOPriorities];
+  uint64_t latency_sum_;
+  uint64_t latency_samples_;
+  uint64_t next_tune_micros_;
+};
+
+}  // namespace
+
+RateLimiter* NewGenericRateLimiter(uint64_t bytes_per_sec,
+                                   uint64_t target_latency_micros,
+                                   uint64_t refill_period_micros) {
+  return new GenericRateLimiter(bytes_per_sec, target_latency_micros,
+                                refill_period_micros);
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/rate_limiter.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/testharness.h"
+
+namespace pdlfs {
+
+class RateLimiterTest {};
+
+TEST(RateLimiterTest, Unlimited) {
+  RateLimiter* limiter = NewGenericRateLimiter(0);
+  for (int i = 0; i < 1000; i++) {
+    limiter->Request(1 << 20, kIOPriorityLow);
+  }
+  ASSERT_EQ(limiter->GetTotalBytesThrough(kIOPriorityLow), 1000 << 20);
+  ASSERT_EQ(limiter->GetTotalBytesThrough(kIOPriorityHigh), 0);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, Rate) {
+  // 10KB per 1ms refill period
+  RateLimiter* limiter = NewGenericRateLimiter(10 << 20, 0, 1000);
+  const size_t burst = limiter->GetSingleBurstBytes();
+  ASSERT_GT(burst, 0);
+  const uint64_t start = CurrentMicros();
+  for (int i = 0; i < 50; i++) {
+    limiter->Request(burst, kIOPriorityHigh);
+  }
+  // The first request is granted immediately. Each of the rest waits for
+  // a refill
+  ASSERT_GE(CurrentMicros() - start, 49 * 1000);
+  ASSERT_EQ(limiter->GetTotalBytesThrough(kIOPriorityHigh), 50 * burst);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, AutoTune) {
+  RateLimiter* limiter = NewGenericRateLimiter(10 << 20, 100);
+  ASSERT_EQ(limiter->GetBytesPerSecond(), 10 << 20);
+  limiter->ReportForegroundLatency(1000);  // Over target
+  ASSERT_LT(limiter->GetBytesPerSecond(), 10 << 20);
+  limiter->SetBytesPerSecond(1 << 20);
+  ASSERT_EQ(limiter->GetBytesPerSecond(), 1 << 20);
+  delete limiter;
+}
+
+namespace {
+struct BurstRequest {
+  RateLimiter* limiter;
+  size_t bytes;
+  port::AtomicPointer done;
+};
+
+void RequestBurst(void* arg) {
+  BurstRequest* const r = reinterpret_cast<BurstRequest*>(arg);
+  r->limiter->Request(r->bytes, kIOPriorityLow);
+  r->done.Release_Store(r);
+}
+}  // namespace
+
+TEST(RateLimiterTest, AutoTuneWhileQueued) {
+  // 100KB per 10ms refill period
+  RateLimiter* limiter = NewGenericRateLimiter(10 << 20, 100, 10000);
+  const size_t burst = limiter->GetSingleBurstBytes();
+  limiter->Request(burst, kIOPriorityHigh);  // Drain the current period
+  BurstRequest r;
+  r.limiter = limiter;
+  r.bytes = burst;
+  r.done.Release_Store(NULL);
+  Env::Default()->StartThread(RequestBurst, &r);
+  SleepForMicroseconds(2000);  // Let the request queue up
+  // Shrink the refill below the size of the queued request
+  limiter->ReportForegroundLatency(1000);
+  ASSERT_LT(limiter->GetSingleBurstBytes(), burst);
+  for (int i = 0; i < 1000 && r.done.Acquire_Load() == NULL; i++) {
+    SleepForMicroseconds(1000);
+  }
+  ASSERT_TRUE(r.done.Acquire_Load() != NULL);
+  delete limiter;
+}
+
+namespace {
+class CountingFile : public WritableFileWrapper {
+ public:
+  CountingFile() : appends(0), bytes(0) {}
+  virtual Status Append(const Slice& data) {
+    appends++;
+    bytes += data.size();
+    return Status::OK();
+  }
+  int appends;
+  size_t bytes;
+};
+}  // namespace
+
+TEST(RateLimiterTest, WritableFile) {
+  RateLimiter* limiter = NewGenericRateLimiter(10 << 20, 0, 1000);
+  const size_t burst = limiter->GetSingleBurstBytes();
+  CountingFile* base = new CountingFile;
+  WritableFile* file =
+      new RateLimitedWritableFile(base, limiter, kIOPriorityLow);
+  std::string data(2 * burst + 1, 'x');
+  ASSERT_OK(file->Append(data));
+  ASSERT_EQ(base->appends, 3);
+  ASSERT_EQ(base->bytes, data.size());
+  ASSERT_EQ(limiter->GetTotalBytesThrough(kIOPriorityLow), data.size());
+  delete file;
+  delete limiter;
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
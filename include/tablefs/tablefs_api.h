@@ -34,8 +34,11 @@
 #pragma once
 
 #include <dirent.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,12 +48,64 @@ struct tablefs; /* Opaque handle to a filesystem instance */
 typedef struct tablefs tablefs_t;
 tablefs_t* tablefs_newfshdl();
 int tablefs_set_readonly(tablefs_t* h, int flg);
+/* Write attribute updates without first checking the existence, type, and
+ * ownership of their targets. Updates to missing files are silently dropped.
+ * Must be called before the fs is opened. */
+int tablefs_set_blind_setattr(tablefs_t* h, int flg);
+/* Files no larger than max_size bytes have their contents stored inline in the
+ * fs image. Larger files are stored as separate objects. Must be called before
+ * the fs is opened and must not change across reopens. */
+int tablefs_set_inline_data_size(tablefs_t* h, size_t max_size);
+/* Enable per-op stats. If dump_secs is not 0, stats are also periodically
+ * written to the default logger. Must be called before the fs is opened. */
+int tablefs_set_stats(tablefs_t* h, int flg, int dump_secs);
+/* Cap background db writes at bytes_per_sec (0 for no cap). If target_us is
+ * not 0, the cap is auto-tuned down whenever the average db lookup latency
+ * exceeds target_us microseconds. Must be called before the fs is opened. */
+int tablefs_set_bg_io_limit(tablefs_t* h, uint64_t bytes_per_sec,
+                            uint64_t target_us);
+/* Only make updates durable when an epoch is sealed. Epochs are sealed every
+ * interval_secs seconds (0 for never), on tablefs_sync_epoch, and when the
+ * fs is closed. After a crash the fs reopens as of the last sealed epoch.
+ * Must be called before the fs is opened. */
+int tablefs_set_epoch_durability(tablefs_t* h, int flg, int interval_secs);
+/* Cap the memory held by db memtables, tables, and caches, along with the
+ * lookup cache, at budget bytes in total (0 for no cap). Must be called
+ * before the fs is opened. */
+int tablefs_set_memory_budget(tablefs_t* h, size_t budget);
+/* Record every call made through the handle, along with its result and
+ * latency, into a trace file at fname. Traces can be replayed by the
+ * tablefs_replay tool. Must be called before the fs is opened. */
+int tablefs_set_trace(tablefs_t* h, const char* fname);
+/* Write a human-readable snapshot of per-op stats into buf. Fail with
+ * ENOBUFS if buf is too small or ENOSYS if stats are not enabled. */
+int tablefs_get_stats(tablefs_t* h, char* buf, size_t buf_size);
 /* Open a filesystem image at a given location */
 int tablefs_openfs(tablefs_t* h, const char* fsloc);
+/* Seal an epoch, making all updates made so far durable */
+int tablefs_sync_epoch(tablefs_t* h);
 /* Close a filesystem image and delete its handle */
 int tablefs_closefs(tablefs_t* h);
 /* Retrieve file status */
 int tablefs_lstat(tablefs_t* h, const char* path, struct stat* stat);
+/* Update file attributes. File change times are set to the current time */
+int tablefs_chmod(tablefs_t* h, const char* path, uint32_t mode);
+int tablefs_chown(tablefs_t* h, const char* path, uid_t uid, gid_t gid);
+/* Only the modification time (times[1]) is kept. If times is NULL, the
+ * modification time is set to the current time */
+int tablefs_utimes(tablefs_t* h, const char* path,
+                   const struct timeval times[2]);
+int tablefs_truncate(tablefs_t* h, const char* path, off_t length);
+/* Read or write file contents. Return the number of bytes read or written.
+ * tablefs_read and tablefs_write start from the beginning of a file. In
+ * addition, tablefs_write replaces the previous contents of the file */
+ssize_t tablefs_pread(tablefs_t* h, const char* path, void* buf, size_t n,
+                      off_t off);
+ssize_t tablefs_pwrite(tablefs_t* h, const char* path, const void* buf,
+                       size_t n, off_t off);
+ssize_t tablefs_read(tablefs_t* h, const char* path, void* buf, size_t n);
+ssize_t tablefs_write(tablefs_t* h, const char* path, const void* buf,
+                      size_t n);
 /* Create a regular file at a specified path */
 int tablefs_mkfile(tablefs_t* h, const char* path, uint32_t mode);
 int tablefs_unlink(tablefs_t* h, const char* path); /* delete a file */
@@ -61,7 +116,18 @@ typedef struct tablefs_dir tablefs_dir_t;
 tablefs_dir_t* tablefs_opendir(tablefs_t* h, const char* path);
 struct dirent* tablefs_readdir(tablefs_dir_t* dh);
 int tablefs_closedir(tablefs_dir_t* dh);
+/* Same as their non-at counterparts, but relative paths are resolved from an
+ * opened directory instead of the root. Absolute paths are resolved from the
+ * root as usual. The directory is pinned at the time it is opened, so later
+ * removals or permission changes of the directory are not detected */
+int tablefs_lstatat(tablefs_dir_t* dh, const char* path, struct stat* stat);
+int tablefs_mkfileat(tablefs_dir_t* dh, const char* path, uint32_t mode);
+int tablefs_unlinkat(tablefs_dir_t* dh, const char* path);
+int tablefs_mkdirat(tablefs_dir_t* dh, const char* path, uint32_t mode);
 int tablefs_rmdir(tablefs_t* h, const char* path);
+/* Remove a directory along with all of its contents. Each directory in the
+ * tree is cleared as a whole instead of name by name */
+int tablefs_rmtree(tablefs_t* h, const char* path);
 
 #ifdef __cplusplus
 }
@@ -35,19 +35,262 @@
 
 #include "fsdb.h"
 
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/lru.h"
 #include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/ofs.h"
+#include "pdlfs-common/osd.h"
 
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace pdlfs {
 
 // Lookup cache for speeding up pathname resolutions.
 struct FilesystemLookupCache {
   explicit FilesystemLookupCache(size_t cap) : lru_(cap) {}
   typedef LRUEntry<Stat> Handle;
+  // Approximate memory held by an entry: the entry itself with its 12-byte
+  // key, the stat it points to, and its hash table slot.
+  static size_t EntrySize() {
+    return sizeof(Handle) + 12 + sizeof(Stat) + sizeof(void*);
+  }
+  LRUCache<Handle> lru_;
+  port::Mutex mu_;
+};
+
+// Hashes of the names inside a dir. A hash is kept once for every name
+// sharing it, so removing a name never hides another one. Slots are probed
+// linearly; 0 marks an empty slot.
+class FilesystemDirNames {
+ public:
+  FilesystemDirNames() : slots_(16, 0), size_(0) {}
+  size_t size() const { return size_; }
+
+  bool Contains(uint32_t hash) const {
+    hash = Fix(hash);
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; slots_[i] != 0; i = (i + 1) & mask) {
+      if (slots_[i] == hash) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Add(uint32_t hash) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      std::vector<uint32_t> old(slots_.size() * 2, 0);
+      old.swap(slots_);
+      for (size_t i = 0; i < old.size(); i++) {
+        if (old[i] != 0) Place(old[i]);
+      }
+    }
+    Place(Fix(hash));
+    size_++;
+  }
+
+  void Remove(uint32_t hash) {
+    hash = Fix(hash);
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i] != hash) {
+      if (slots_[i] == 0) return;  // Not found
+      i = (i + 1) & mask;
+    }
+    // Shift later members of the probe sequence back so that no lookup
+    // stops early at the freed slot
+    for (size_t j = (i + 1) & mask; slots_[j] != 0; j = (j + 1) & mask) {
+      const size_t home = slots_[j] & mask;
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+    slots_[i] = 0;
+    size_--;
+  }
+
+ private:
+  static uint32_t Fix(uint32_t hash) { return hash != 0 ? hash : 1; }
+
+  void Place(uint32_t hash) {
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i] != 0) i = (i + 1) & mask;
+    slots_[i] = hash;
+  }
+
+  std::vector<uint32_t> slots_;  // Size is always a power of 2
+  size_t size_;
+};
+
+// Names inside dirs created since the fs was opened. Such a dir started out
+// empty and every name that later went into it went through Put, so a name
+// missing from its set is also missing from db. Callers must hold the stripe
+// mutex of a name while checking or updating it. Names sharing a hash also
+// share a stripe, so a check cannot race with an update affecting its result.
+// A name that is not confirmed to have been removed is left in the set; it
+// only costs a db read when it is created again.
+struct FilesystemNameCache {
+  FilesystemNameCache(size_t cap, size_t max_names)
+      : lru_(cap), max_names_(max_names) {}
+  typedef LRUEntry<FilesystemDirNames> Handle;
   LRUCache<Handle> lru_;
+  const size_t max_names_;
   port::Mutex mu_;
+
+  // Start tracking an empty dir. This must be done before the dir becomes
+  // reachable so that no names can be inserted into it untracked.
+  void AddDir(const DirId& dir) {
+    char tmp[8];
+    Slice key = DirKey(tmp, dir);
+    MutexLock cl(&mu_);
+    Handle* h = lru_.Insert(key, Hash0(key), new FilesystemDirNames, 1,
+                            DeleteNames);
+    lru_.Release(h);
+  }
+
+  void RemoveDir(const DirId& dir) {
+    char tmp[8];
+    Slice key = DirKey(tmp, dir);
+    MutexLock cl(&mu_);
+    lru_.Erase(key, Hash0(key));
+  }
+
+  // Return true iff name is known to be absent from dir.
+  bool IsAbsent(const DirId& dir, const Slice& name) {
+    char tmp[8];
+    Slice key = DirKey(tmp, dir);
+    MutexLock cl(&mu_);
+    Handle* h = lru_.Lookup(key, Hash0(key));
+    if (!h) return false;
+    const bool r = !h->value->Contains(Hash0(name));
+    lru_.Release(h);
+    return r;
+  }
+
+  void AddName(const DirId& dir, const Slice& name) {
+    char tmp[8];
+    Slice key = DirKey(tmp, dir);
+    const uint32_t hash = Hash0(key);
+    MutexLock cl(&mu_);
+    Handle* h = lru_.Lookup(key, hash);
+    if (!h) return;
+    h->value->Add(Hash0(name));
+    const bool too_large = h->value->size() > max_names_;
+    lru_.Release(h);
+    if (too_large) {
+      lru_.Erase(key, hash);
+    }
+  }
+
+  // REQUIRES: name is confirmed to have been removed from dir.
+  void RemoveName(const DirId& dir, const Slice& name) {
+    char tmp[8];
+    Slice key = DirKey(tmp, dir);
+    MutexLock cl(&mu_);
+    Handle* h = lru_.Lookup(key, Hash0(key));
+    if (!h) return;
+    h->value->Remove(Hash0(name));
+    lru_.Release(h);
+  }
+
+ private:
+  static Slice DirKey(char* dst, const DirId& dir) {
+    EncodeFixed64(dst, dir.ino);
+    return Slice(dst, 8);
+  }
+
+  static uint32_t Hash0(const Slice& s) { return Hash(s.data(), s.size(), 0); }
+
+  static void DeleteNames(const Slice& key, FilesystemDirNames* names) {
+    delete names;
+  }
+};
+
+// Dirs reached by full path prefixes. An entry keeps every dir along its
+// path so that lookup permissions are still checked on each of them, along
+// with the generation number each parent dir had when the next name was
+// looked up in it. Any change to a name that may affect path resolution
+// (rmdir, rmtree, and setattr) bumps the generation number of the name's
+// parent dir once the change is written, which invalidates every entry
+// whose path goes through the name. Generation numbers are kept in a fixed
+// table indexed by inode no.; dirs sharing a slot only cause extra misses.
+struct FilesystemPathCache {
+  explicit FilesystemPathCache(size_t cap) : lru_(cap) {
+    for (int i = 0; i < kGenSlots; i++) {
+      gens_[i].NoBarrier_Store(NULL);
+    }
+  }
+  struct Step {
+    Stat dir;  // Dir reached by the step
+    uint32_t slot;  // Generation slot of the dir the step started from
+    uintptr_t gen;
+  };
+  typedef std::vector<Step> Path;
+  typedef LRUEntry<Path> Handle;
+  LRUCache<Handle> lru_;
+  port::Mutex mu_;
+
+  enum { kGenSlots = 4096 };  // Must be a power of 2
+  static uint32_t Slot(uint64_t ino) {
+    return static_cast<uint32_t>(ino & (kGenSlots - 1));
+  }
+
+  uintptr_t Gen(uint32_t slot) const {
+    return reinterpret_cast<uintptr_t>(gens_[slot].Acquire_Load());
+  }
+
+  // Concurrent bumps of a slot may be lost but never leave the slot
+  // unchanged, which is all that invalidation needs.
+  void Bump(uint64_t ino) {
+    const uint32_t slot = Slot(ino);
+    gens_[slot].Release_Store(reinterpret_cast<void*>(Gen(slot) + 1));
+  }
+
+  static void DeletePath(const Slice& key, Path* path) { delete path; }
+
+ private:
+  port::AtomicPointer gens_[kGenSlots];
+};
+
+// Dirs whose listings returned many names. Each dir is remembered in the
+// slot picked by its inode no. and is forgotten when a dir sharing that slot
+// is added. A dir that shrank after being added only loses block caching
+// for its listings.
+struct FilesystemLargeDirs {
+  enum { kSlots = 1024 };
+  FilesystemLargeDirs() { memset(slots_, 0, sizeof(slots_)); }
+
+  bool Contains(const DirId& dir) {
+    MutexLock l(&mu_);
+    return slots_[dir.ino % kSlots] == dir.ino + 1;
+  }
+
+  void Add(const DirId& dir) {
+    MutexLock l(&mu_);
+    slots_[dir.ino % kSlots] = dir.ino + 1;
+  }
+
+ private:
+  port::Mutex mu_;
+  uint64_t slots_[kSlots];  // Inode no. plus 1, or 0 if empty
+};
+
+// An opened filesystem directory. The db iterator for listing the directory
+// is created on the first Readdir so that a handle only used for relative
+// path resolution does not pin db resources.
+struct FilesystemDir {
+  explicit FilesystemDir(const Stat& s) : stat(s), dir(NULL), n(0) {}
+  Stat stat;  // Stat of the directory at the time it was opened
+  FilesystemDb::Dir* dir;
+  uint64_t n;  // Number of names returned so far
 };
 
 // Root information of a filesystem image.
@@ -55,18 +298,324 @@ struct FilesystemRoot {
   FilesystemRoot() {}  // Intentionally not initialized for performance
   // Inode num for the next file or directory
   uint64_t inoseq_;
+  // Inode nums below this are reserved by a root already written to db. This
+  // is not part of the root's encoding.
+  uint64_t inolimit_;
+  // Number of the last sealed epoch
+  uint64_t epoch_;
   // Stat of the root directory
   Stat rstat_;
 };
 
+// Op stats privately owned by a single thread. The mutex is only contended
+// when a snapshot is being taken by another thread.
+struct FilesystemOpStatsSlot {
+  port::Mutex mu;
+  FilesystemOpStats stats;
+};
+
+// Registry of per-thread op stats.
+struct FilesystemOpStatsHub {
+  FilesystemOpStatsHub();
+  ~FilesystemOpStatsHub();
+  // Return the calling thread's slot, creating it on first use.
+  FilesystemOpStatsSlot* ThreadSlot();
+  void Snapshot(FilesystemOpStats* result);
+  void RecordFirstOp();
+
+  pthread_key_t key;
+  // Set once the first op has finished
+  port::AtomicPointer first_op_done;
+  port::Mutex mu;
+  // State below is protected by mu
+  port::CondVar cv;
+  std::vector<FilesystemOpStatsSlot*> slots;
+  bool shutting_down;
+  bool dumper_running;
+  uint64_t open_start;
+  uint64_t open_micros;
+  uint64_t first_op_micros;
+};
+
+FilesystemOpStatsHub::FilesystemOpStatsHub()
+    : first_op_done(NULL),
+      cv(&mu),
+      shutting_down(false),
+      dumper_running(false),
+      open_start(0),
+      open_micros(0),
+      first_op_micros(0) {
+  port::PthreadCall("pthread_key_create", pthread_key_create(&key, NULL));
+}
+
+FilesystemOpStatsHub::~FilesystemOpStatsHub() {
+  pthread_key_delete(key);
+  for (size_t i = 0; i < slots.size(); i++) {
+    delete slots[i];
+  }
+}
+
+FilesystemOpStatsSlot* FilesystemOpStatsHub::ThreadSlot() {
+  FilesystemOpStatsSlot* slot =
+      static_cast<FilesystemOpStatsSlot*>(pthread_getspecific(key));
+  if (!slot) {
+    slot = new FilesystemOpStatsSlot;
+    pthread_setspecific(key, slot);
+    // Slots outlive their threads so stats of exited threads are kept.
+    MutexLock ml(&mu);
+    slots.push_back(slot);
+  }
+  return slot;
+}
+
+void FilesystemOpStatsHub::Snapshot(FilesystemOpStats* result) {
+  result->Clear();
+  MutexLock ml(&mu);
+  for (size_t i = 0; i < slots.size(); i++) {
+    MutexLock sl(&slots[i]->mu);
+    result->Merge(slots[i]->stats);
+  }
+  result->open_micros = open_micros;
+  result->first_op_micros = first_op_micros;
+}
+
+void FilesystemOpStatsHub::RecordFirstOp() {
+  MutexLock ml(&mu);
+  if (!first_op_done.NoBarrier_Load()) {
+    first_op_micros = CurrentMicros() - open_start;
+    first_op_done.Release_Store(this);  // Any non-NULL value is ok
+  }
+}
+
+namespace {
+void MergeDbStats(FilesystemDbStats* dst, const FilesystemDbStats& src) {
+  dst->putkeybytes += src.putkeybytes;
+  dst->putbytes += src.putbytes;
+  dst->puts += src.puts;
+  dst->getkeybytes += src.getkeybytes;
+  dst->getbytes += src.getbytes;
+  dst->gets += src.gets;
+  dst->dels += src.dels;
+  dst->getmicros += src.getmicros;
+  dst->putmicros += src.putmicros;
+  dst->delmicros += src.delmicros;
+  dst->lookups += src.lookups;
+  dst->lookupcachehits += src.lookupcachehits;
+  dst->lookupcachemisses += src.lookupcachemisses;
+  dst->namecachehits += src.namecachehits;
+  dst->pathcachehits += src.pathcachehits;
+  dst->locks += src.locks;
+  dst->lockwaitmicros += src.lockwaitmicros;
+  dst->updates += src.updates;
+}
+}  // namespace
+
+// Times a filesystem operation and accounts it to the calling thread's op
+// stats. When op stats are enabled, the db stats produced by the operation are
+// redirected to a private buffer. The buffer is merged into both the thread's
+// op stats and the caller's stats (if any) when the operation finishes.
+class Filesystem::OpTimer {
+ public:
+  OpTimer(Filesystem* fs, FilesystemOpType op, FilesystemDbStats** stats,
+          const Status* status)
+      : hub_(fs->hub_), op_(op), status_(status), caller_stats_(NULL) {
+    if (hub_) {
+      caller_stats_ = *stats;
+      *stats = &tmp_;
+      start_ = CurrentMicros();
+    }
+  }
+
+  ~OpTimer() {
+    if (hub_) {
+      Finish();
+    }
+  }
+
+ private:
+  void Finish() {
+    const uint64_t micros = CurrentMicros() - start_;
+    if (!hub_->first_op_done.Acquire_Load()) {
+      hub_->RecordFirstOp();
+    }
+    FilesystemOpStatsSlot* const slot = hub_->ThreadSlot();
+    {
+      MutexLock ml(&slot->mu);
+      FilesystemOpStats* const s = &slot->stats;
+      s->ops[op_]++;
+      // Reaching the end of a directory is not an error
+      if (!status_->ok() && !(op_ == kFsReaddir && status_->IsNotFound()))
+        s->errs[op_]++;
+      s->op_micros[op_].Add(micros);
+      if (op_ != kFsReaddir) s->resolv_depth.Add(tmp_.lookups);
+      s->lookup_cache_hits += tmp_.lookupcachehits;
+      s->lookup_cache_misses += tmp_.lookupcachemisses;
+      s->name_cache_hits += tmp_.namecachehits;
+      s->path_cache_hits += tmp_.pathcachehits;
+      if (tmp_.locks) s->lock_wait_micros.Add(tmp_.lockwaitmicros);
+      if (tmp_.gets) s->db_get_micros.Add(tmp_.getmicros);
+      if (tmp_.puts || tmp_.updates) s->db_put_micros.Add(tmp_.putmicros);
+      if (tmp_.dels) s->db_del_micros.Add(tmp_.delmicros);
+      s->db_gets += tmp_.gets;
+      s->db_getbytes += tmp_.getbytes;
+      s->db_puts += tmp_.puts;
+      s->db_putbytes += tmp_.putbytes;
+      s->db_dels += tmp_.dels;
+      s->db_updates += tmp_.updates;
+    }
+    if (caller_stats_) {
+      MergeDbStats(caller_stats_, tmp_);
+    }
+  }
+
+  FilesystemOpStatsHub* const hub_;
+  const FilesystemOpType op_;
+  const Status* const status_;
+  FilesystemDbStats* caller_stats_;
+  FilesystemDbStats tmp_;
+  uint64_t start_;
+
+  // No copying allowed
+  void operator=(const OpTimer&);
+  OpTimer(const OpTimer&);
+};
+
+void Filesystem::LockStripe(port::Mutex* const mu,
+                            FilesystemDbStats* const stats) {
+  if (stats) {
+    const uint64_t start = CurrentMicros();
+    mu->Lock();
+    stats->lockwaitmicros += CurrentMicros() - start;
+    stats->locks++;
+  } else {
+    mu->Lock();
+  }
+}
+
+namespace {
+// Db access wrappers additionally timing each db call when stats are
+// requested by the caller.
+inline Status DbGet(FilesystemDb* db, const DirId& pdir, const Slice& name,
+                    Stat* stat, FilesystemDbStats* stats) {
+  if (!stats) return db->Get(pdir, name, stat, stats);
+  const uint64_t start = CurrentMicros();
+  Status s = db->Get(pdir, name, stat, stats);
+  stats->getmicros += CurrentMicros() - start;
+  return s;
+}
+
+inline Status DbPut(FilesystemDb* db, const DirId& pdir, const Slice& name,
+                    const Stat& stat, FilesystemDbStats* stats) {
+  if (!stats) return db->Put(pdir, name, stat, stats);
+  const uint64_t start = CurrentMicros();
+  Status s = db->Put(pdir, name, stat, stats);
+  stats->putmicros += CurrentMicros() - start;
+  return s;
+}
+
+inline Status DbDelete(FilesystemDb* db, const DirId& pdir, const Slice& name,
+                       FilesystemDbStats* stats) {
+  if (!stats) return db->Delete(pdir, name);
+  const uint64_t start = CurrentMicros();
+  Status s = db->Delete(pdir, name);
+  stats->delmicros += CurrentMicros() - start;
+  stats->dels++;
+  return s;
+}
+
+inline Status DbDeleteDir(FilesystemDb* db, const DirId& dir,
+                          FilesystemDbStats* stats) {
+  if (!stats) return db->DeleteDir(dir);
+  const uint64_t start = CurrentMicros();
+  Status s = db->DeleteDir(dir);
+  stats->delmicros += CurrentMicros() - start;
+  stats->dels++;
+  return s;
+}
+
+// Large files are stored in ofs as chunks of this many bytes
+static const uint64_t kChunkSize = 256 << 10;
+
+// Inode nos are reserved this many at a time
+static const uint64_t kInodeBatchSize = 4096;
+
+// Files may not grow past this many bytes
+static const uint64_t kMaxFileSize = static_cast<uint64_t>(1) << 40;
+
+// Return the name of the ofs file holding a chunk of a large file.
+inline std::string ChunkName(const Stat& stat, uint64_t chunk) {
+  char tmp[50];
+  snprintf(tmp, sizeof(tmp), "/data/%016llx.%llx",
+           static_cast<unsigned long long>(stat.InodeNo()),
+           static_cast<unsigned long long>(chunk));
+  return tmp;
+}
+
+inline Status DbUpdate(FilesystemDb* db, const DirId& pdir, const Slice& name,
+                       const FilesystemDbStatUpdate& update,
+                       FilesystemDbStats* stats) {
+  if (!stats) return db->Update(pdir, name, update, stats);
+  const uint64_t start = CurrentMicros();
+  Status s = db->Update(pdir, name, update, stats);
+  stats->putmicros += CurrentMicros() - start;
+  return s;
+}
+}  // namespace
+
+const Stat& Filesystem::StartDir(  ///
+    const FilesystemDir* const at, const char* const pathname) const {
+  if (!at || pathname[0] == '/') {
+    return r_->rstat_;
+  } else {
+    return at->stat;
+  }
+}
+
+// Held by every update for the duration of the update. An epoch may be sealed
+// once the update is done.
+class Filesystem::UpdateLock {
+ public:
+  // Without epoch durability updates are made durable one by one, so
+  // there is no cut for them to straddle.
+  explicit UpdateLock(Filesystem* fs)
+      : fs_(fs), locked_(fs->options_.epoch_durability) {
+    if (locked_) {
+      fs_->elk_.ReadLock();
+    }
+  }
+
+  ~UpdateLock() {
+    if (locked_) {
+      fs_->elk_.ReadUnlock();
+      fs_->MaybeSealEpoch();
+    }
+  }
+
+ private:
+  // No copying allowed
+  UpdateLock(const UpdateLock&);
+  void operator=(const UpdateLock&);
+
+  Filesystem* const fs_;
+  const bool locked_;
+};
+
 Status Filesystem::Lstat(  ///
     const User& who, const char* const pathname, Stat* const stat,
-    FilesystemDbStats* const stats) {
+    FilesystemDbStats* stats) {
+  return Lstatat(who, NULL, pathname, stat, stats);
+}
+
+Status Filesystem::Lstatat(  ///
+    const User& who, FilesystemDir* const at, const char* const pathname,
+    Stat* const stat, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsLstat, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, StartDir(at, pathname), pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   }
@@ -75,8 +624,8 @@ Status Filesystem::Lstat(  ///
     const uint32_t mode =
         has_tailing_slashes ? S_IFDIR : 0;  // Target must be a dir
     status = Fetch(who, parent_dir, tgt, mode, stat, stats);
-  } else {  // Special case in which path is a root
-    *stat = r_->rstat_;
+  } else {  // Special case in which path is a root or the starting dir
+    *stat = parent_dir;
   }
 
   return status;
@@ -84,12 +633,14 @@ Status Filesystem::Lstat(  ///
 
 Status Filesystem::Opendir(  ///
     const User& who, const char* const pathname, FilesystemDir** const dir,
-    FilesystemDbStats* const stats) {
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsOpendir, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   }
@@ -101,28 +652,42 @@ Status Filesystem::Opendir(  ///
 
 Status Filesystem::Readdir(  ///
     FilesystemDir* dir, Stat* stat, std::string* name) {
-  FilesystemDb::Dir* d = reinterpret_cast<FilesystemDb::Dir*>(dir);
-  return db_->Readdir(d, stat, name);
+  FilesystemDbStats* stats = NULL;
+  Status status;
+  OpTimer timer(this, kFsReaddir, &stats, &status);
+  if (!dir->dir) {
+    const DirId id(dir->stat);
+    dir->dir = db_->Opendir(id, ldirs_ && ldirs_->Contains(id));
+  }
+  status = db_->Readdir(dir->dir, stat, name);
+  if (status.ok() && ++dir->n == options_.large_dir_threshold && ldirs_) {
+    ldirs_->Add(DirId(dir->stat));
+  }
+  return status;
 }
 
 Status Filesystem::Closdir(FilesystemDir* dir) {
-  FilesystemDb::Dir* d = reinterpret_cast<FilesystemDb::Dir*>(dir);
-  db_->Closedir(d);
+  if (dir->dir) {
+    db_->Closedir(dir->dir);
+  }
+  delete dir;
   return Status::OK();
 }
 
 Status Filesystem::Rmdir(  ///
-    const User& who, const char* const pathname,
-    FilesystemDbStats* const stats) {
+    const User& who, const char* const pathname, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsRmdir, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   } else if (tgt.empty()) {  // Special case in which path is a root
-    return Status::AssertionFailed(Slice());
+    status = Status::AssertionFailed(Slice());
+    return status;
   }
 
   Stat stat;
@@ -131,18 +696,48 @@ Status Filesystem::Rmdir(  ///
   return status;
 }
 
+Status Filesystem::RemoveTree(  ///
+    const User& who, const char* const pathname, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsRmtree, &stats, &status);
+  bool has_tailing_slashes(false);
+  Stat parent_dir;
+  Slice tgt;
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (tgt.empty()) {  // Special case in which path is a root
+    status = Status::AssertionFailed(Slice());
+    return status;
+  }
+
+  status = RemoveSubtree(who, parent_dir, tgt, stats);
+
+  return status;
+}
+
 Status Filesystem::Mkdir(  ///
     const User& who, const char* const pathname, uint32_t mode,
-    FilesystemDbStats* const stats) {
+    FilesystemDbStats* stats) {
+  return Mkdirat(who, NULL, pathname, mode, stats);
+}
+
+Status Filesystem::Mkdirat(  ///
+    const User& who, FilesystemDir* const at, const char* const pathname,
+    uint32_t mode, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsMkdir, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, StartDir(at, pathname), pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   } else if (tgt.empty()) {  // Special case in which path is a root
-    return Status::AlreadyExists(Slice());
+    status = Status::AlreadyExists(Slice());
+    return status;
   }
 
   mode = S_IFDIR | (ALLPERMS & mode);
@@ -153,18 +748,28 @@ Status Filesystem::Mkdir(  ///
 }
 
 Status Filesystem::Unlnk(  ///
-    const User& who, const char* pathname, FilesystemDbStats* const stats) {
+    const User& who, const char* pathname, FilesystemDbStats* stats) {
+  return Unlnkat(who, NULL, pathname, stats);
+}
+
+Status Filesystem::Unlnkat(  ///
+    const User& who, FilesystemDir* const at, const char* const pathname,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsUnlnk, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, StartDir(at, pathname), pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   } else if (tgt.empty()) {  // Special case in which path is a root
-    return Status::FileExpected(Slice());
+    status = Status::FileExpected(Slice());
+    return status;
   } else if (has_tailing_slashes) {  // Path is a dir
-    return Status::FileExpected(Slice());
+    status = Status::FileExpected(Slice());
+    return status;
   }
 
   Stat stat;
@@ -175,18 +780,28 @@ Status Filesystem::Unlnk(  ///
 
 Status Filesystem::Creat(  ///
     const User& who, const char* pathname, uint32_t mode,
-    FilesystemDbStats* const stats) {
+    FilesystemDbStats* stats) {
+  return Creatat(who, NULL, pathname, mode, stats);
+}
+
+Status Filesystem::Creatat(  ///
+    const User& who, FilesystemDir* const at, const char* const pathname,
+    uint32_t mode, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsCreat, &stats, &status);
   bool has_tailing_slashes(false);
   Stat parent_dir;
   Slice tgt;
-  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
-                         &has_tailing_slashes, stats);
+  status = Resolu(who, StartDir(at, pathname), pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
   if (!status.ok()) {
     return status;
   } else if (tgt.empty()) {  // Special case in which path is a root
-    return Status::AlreadyExists(Slice());
+    status = Status::AlreadyExists(Slice());
+    return status;
   } else if (has_tailing_slashes) {  // Path is a dir
-    return Status::FileExpected(Slice());
+    status = Status::FileExpected(Slice());
+    return status;
   }
 
   mode = S_IFREG | (ALLPERMS & mode);
@@ -196,6 +811,136 @@ Status Filesystem::Creat(  ///
   return status;
 }
 
+Status Filesystem::Chmod(  ///
+    const User& who, const char* const pathname, uint32_t mode,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsChmod, &stats, &status);
+  FilesystemDbStatUpdate update;
+  update.mask = FilesystemDbStatUpdate::kMode;
+  update.mode = ALLPERMS & mode;
+  status = Setattr(who, pathname, kFsChmod, update, stats);
+
+  return status;
+}
+
+Status Filesystem::Chown(  ///
+    const User& who, const char* const pathname, uint32_t uid, uint32_t gid,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsChown, &stats, &status);
+  FilesystemDbStatUpdate update;
+  update.mask = FilesystemDbStatUpdate::kOwner;
+  update.uid = uid;
+  update.gid = gid;
+  status = Setattr(who, pathname, kFsChown, update, stats);
+
+  return status;
+}
+
+Status Filesystem::Utimes(  ///
+    const User& who, const char* const pathname, uint64_t mtime,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsUtimes, &stats, &status);
+  FilesystemDbStatUpdate update;
+  update.mask = FilesystemDbStatUpdate::kModifyTime;
+  update.mtime = mtime;
+  status = Setattr(who, pathname, kFsUtimes, update, stats);
+
+  return status;
+}
+
+Status Filesystem::Truncate(  ///
+    const User& who, const char* const pathname, uint64_t size,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsTruncate, &stats, &status);
+  FilesystemDbStatUpdate update;
+  update.mask = FilesystemDbStatUpdate::kSize |  ///
+                FilesystemDbStatUpdate::kModifyTime;
+  update.size = size;
+  update.mtime = CurrentMicros();
+  status = Setattr(who, pathname, kFsTruncate, update, stats);
+
+  return status;
+}
+
+Status Filesystem::Pread(  ///
+    const User& who, const char* const pathname, uint64_t off, size_t n,
+    Slice* result, char* scratch, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsRead, &stats, &status);
+  bool has_tailing_slashes(false);
+  Stat parent_dir;
+  Slice tgt;
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (tgt.empty()) {  // Special case in which path is a root
+    status = Status::FileExpected(Slice());
+    return status;
+  } else if (has_tailing_slashes) {  // Path is a dir
+    status = Status::FileExpected(Slice());
+    return status;
+  }
+
+  status = ReadAt(who, parent_dir, tgt, off, n, result, scratch, stats);
+
+  return status;
+}
+
+Status Filesystem::Pwrite(  ///
+    const User& who, const char* const pathname, uint64_t off,
+    const Slice& data, FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsWrite, &stats, &status);
+  bool has_tailing_slashes(false);
+  Stat parent_dir;
+  Slice tgt;
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (tgt.empty()) {  // Special case in which path is a root
+    status = Status::FileExpected(Slice());
+    return status;
+  } else if (has_tailing_slashes) {  // Path is a dir
+    status = Status::FileExpected(Slice());
+    return status;
+  }
+
+  status = WriteAt(who, parent_dir, tgt, off, data, false, stats);
+
+  return status;
+}
+
+Status Filesystem::Write(  ///
+    const User& who, const char* const pathname, const Slice& data,
+    FilesystemDbStats* stats) {
+  Status status;
+  OpTimer timer(this, kFsWrite, &stats, &status);
+  bool has_tailing_slashes(false);
+  Stat parent_dir;
+  Slice tgt;
+  status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                  &has_tailing_slashes, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (tgt.empty()) {  // Special case in which path is a root
+    status = Status::FileExpected(Slice());
+    return status;
+  } else if (has_tailing_slashes) {  // Path is a dir
+    status = Status::FileExpected(Slice());
+    return status;
+  }
+
+  status = WriteAt(who, parent_dir, tgt, 0, data, true, stats);
+
+  return status;
+}
+
 Status Filesystem::Resolu(  ///
     const User& who, const Stat& at, const char* const pathname,
     Stat* parent_dir, Slice* last_component,  ///
@@ -276,6 +1021,23 @@ bool IsDirWriteOk(const FilesystemOptions& options, const Stat& dir,
   }
 }
 
+// Only the owner may change access modes or times, only root may change
+// ownership, and truncation requires write access to the file.
+bool IsSetattrOk(const FilesystemOptions& options, const Stat& stat,
+                 const User& who, FilesystemOpType op) {
+  if (options.skip_perm_checks) {
+    return true;
+  } else if (who.uid == 0) {
+    return true;
+  } else if (op == kFsChown) {
+    return false;
+  } else if (op == kFsTruncate) {
+    return IsDirWriteOk(options, stat, who);
+  } else {
+    return who.uid == uid(stat);
+  }
+}
+
 bool IsLookupOk(const FilesystemOptions& options, const Stat& dir,
                 const User& who) {
   const uint32_t mode = dir.FileMode();
@@ -295,25 +1057,108 @@ bool IsLookupOk(const FilesystemOptions& options, const Stat& dir,
 }
 }  // namespace
 
+namespace {
+// Append the names of all but the last component of a path to *prefix, each
+// followed by a slash, and set *last to the last component. Return the number
+// of names appended. Names are split the same way as in Resolv.
+size_t SplitPath(const char* pathname, std::string* prefix, Slice* last) {
+  const char* b = pathname;
+  const char* q;
+  size_t n = 0;
+  while (true) {
+    for (q = b; q[0]; q++) {
+      if (q[0] == '/') {
+        break;
+      }
+    }
+    if (!q[0]) {
+      break;
+    } else if (q - b == 0) {
+      b = q + 1;
+      continue;
+    }
+    const char* c = q + 1;
+    for (; c[0]; c++) {
+      if (c[0] != '/') {
+        break;
+      }
+    }
+    if (!c[0]) {
+      break;
+    }
+    prefix->append(b, q - b);
+    prefix->push_back('/');
+    b = c;
+    n++;
+  }
+  *last = Slice(b, q - b);
+  return n;
+}
+}  // namespace
+
+bool Filesystem::ProbePathCache(  ///
+    const User& who, const Stat& at, const Slice& key, Stat* const dir) {
+  FilesystemPathCache* const c = pcache_;
+  MutexLock cl(&c->mu_);
+  FilesystemPathCache::Handle* const h =
+      c->lru_.Lookup(key, Hash(key.data(), key.size(), 0));
+  if (!h) {
+    return false;
+  }
+  const FilesystemPathCache::Path& path = *h->value;
+  bool ok = IsLookupOk(options_, at, who);
+  for (size_t i = 0; ok && i < path.size(); i++) {
+    if (c->Gen(path[i].slot) != path[i].gen) {
+      ok = false;
+    } else if (i + 1 < path.size()) {
+      ok = IsLookupOk(options_, path[i].dir, who);
+    }
+  }
+  if (ok) {
+    *dir = path.back().dir;
+  }
+  c->lru_.Release(h);
+  return ok;
+}
+
 Status Filesystem::Resolv(  ///
     const User& who, const Stat& relative_root, const char* const pathname,
     Stat* const parent_dir, Slice* const last_component,
     const char** const remaining_path,  ///
     FilesystemDbStats* const stats) {
   assert(pathname);
-  const char* p = pathname;
-  const char* q;
-  assert(p[0] == '/');
+  // Relative paths are resolved the same way as absolute paths. The
+  // leading slash of an absolute path is skipped the same way repeated
+  // slashes are.
+  const char* b = pathname;  // Beginning of the current name
+  const char* q;             // End of the current name
   Stat tmp;
   Status status;
+  // With the path cache enabled, the dir prefix of the path is first looked
+  // up as a whole. On a miss, the dirs walked are recorded so that the prefix
+  // can be cached once the walk succeeds.
+  std::string key;
+  FilesystemPathCache::Path path;
+  if (pcache_) {
+    char ino[8];
+    EncodeFixed64(ino, relative_root.InodeNo());
+    key.assign(ino, sizeof(ino));
+    Slice last;
+    if (SplitPath(pathname, &key, &last) != 0 &&
+        ProbePathCache(who, relative_root, key, parent_dir)) {
+      if (stats) stats->pathcachehits++;
+      *last_component = last;
+      return status;
+    }
+  }
   const Stat* current_parent = &relative_root;
   Slice current_name;
   while (true) {
     // Jump forward to the next path splitter.
-    // E.g., "/", "/a/b", "/aa/bb/cc/dd".
-    //        ||     | |         |  |
-    //        pq     p q         p  q
-    for (q = p + 1; q[0]; q++) {
+    // E.g., "/a/b", "/aa/bb/cc/dd", "aa/bb".
+    //           ||          | |      | |
+    //           bq          b q      b q
+    for (q = b; q[0]; q++) {
       if (q[0] == '/') {
         break;
       }
@@ -323,19 +1168,19 @@ Status Filesystem::Resolv(  ///
     }
     // This skips empty names in the beginning of a path.
     // E.g., "///", "//a", "/////a/b/c".
-    //         ||    ||        ||
-    //         pq    pq        pq
-    if (q - p - 1 == 0) {
-      p = q;  // I.e., p++
+    //         |      |       |
+    //         b      b       b
+    if (q - b == 0) {
+      b = q + 1;
       continue;
     }
     // Look ahead and skip repeated slashes. E.g., "//a//b", "/a/bb////cc".
-    //                                               | | |      |  |   |
-    //                                               p q c      p  q   c
+    //                                                || |       | |   |
+    //                                                bq c       b q   c
     // This also gets rid of potential tailing slashes.
     // E.g., "/a/b/", "/a/b/c/////".
-    //          | ||       | |    |
-    //          p qc       p q    c
+    //           |||        ||    |
+    //           bqc        bq    c
     const char* c = q + 1;
     for (; c[0]; c++) {
       if (c[0] != '/') {
@@ -345,24 +1190,42 @@ Status Filesystem::Resolv(  ///
     if (!c[0]) {  // End of path
       break;
     }
-    current_name = Slice(p + 1, q - p - 1);
-    p = c - 1;
+    current_name = Slice(b, q - b);
+    b = c;
     // If caching is enabled, result may be read (copied) from the cache instead
     // of the filesystem's DB instance. No cache handle or reference counting
     // stuff is exposed to us (the caller) keeping semantics simple
+    if (stats) stats->lookups++;
+    FilesystemPathCache::Step step;
+    if (pcache_) {
+      step.slot = FilesystemPathCache::Slot(current_parent->InodeNo());
+      step.gen = pcache_->Gen(step.slot);
+    }
     status = LookupWithCache(cache_, who, *current_parent, current_name, &tmp,
                              stats);
     if (status.ok()) {
       current_parent = &tmp;
+      if (pcache_) {
+        step.dir = tmp;
+        path.push_back(step);
+      }
     } else {
       break;
     }
   }
   if (status.ok()) {
-    *last_component = Slice(p + 1, q - p - 1);
+    *last_component = Slice(b, q - b);
+    if (pcache_ && !path.empty()) {
+      MutexLock cl(&pcache_->mu_);
+      FilesystemPathCache::Handle* const h = pcache_->lru_.Insert(
+          key, Hash(key.data(), key.size(), 0),
+          new FilesystemPathCache::Path(path), 1,
+          FilesystemPathCache::DeletePath);
+      pcache_->lru_.Release(h);
+    }
   } else {
     *last_component = current_name;
-    *remaining_path = p;
+    *remaining_path = b - 1;  // Points to the slash following current_name
   }
 
   *parent_dir = *current_parent;
@@ -406,13 +1269,20 @@ Status Filesystem::LookupWithCache(  ///
     // the group of a cache lookup operation, a db fetch operation, and a cache
     // insertion operation go as a single atomic operation.
     mu = &mus_[hash & (kWay - 1)];
-    mu->Lock();
+    LockStripe(mu, stats);
     MutexLock cl(&c->mu_);
     h = c->lru_.Lookup(key, hash);
     if (h) {  // Key is in cache; use it!
       *stat = *h->value;
       c->lru_.Release(h);
     }
+    if (stats) {
+      if (h) {
+        stats->lookupcachehits++;
+      } else {
+        stats->lookupcachemisses++;
+      }
+    }
   }
   if (!h) {  // Either cache is disabled or key is not in cache
     status = Fetch(who, parent_dir, name, S_IFDIR, stat, stats);
@@ -437,7 +1307,7 @@ Status Filesystem::Fetch(  ///
   if (!IsLookupOk(options_, parent_dir, who)) {
     return Status::AccessDenied(Slice());
   }
-  Status status = db_->Get(DirId(parent_dir), name, stat, stats);
+  Status status = DbGet(db_, DirId(parent_dir), name, stat, stats);
   if (!status.ok()) {
     return status;
   } else if ((stat->FileMode() & mode) != mode) {
@@ -453,14 +1323,17 @@ Status Filesystem::RemoveDir(  ///
   if (!IsDirWriteOk(options_, parent_dir, who)) {
     return Status::AccessDenied(Slice());
   }
+  UpdateLock ul(this);
   const DirId pdir(parent_dir);
   Status status;
   const bool use_mu = !options_.skip_deletion_checks;
+  bool found = false;  // Whether the dir is confirmed to exist
   if (use_mu) {
     for (int i = 0; i < kWay; i++) {
-      mus_[i].Lock();
+      LockStripe(&mus_[i], stats);
     }
-    status = db_->Get(pdir, name, stat, stats);
+    status = DbGet(db_, pdir, name, stat, stats);
+    found = status.ok();
     if (status.ok() && (stat->FileMode() & S_IFDIR) != S_IFDIR) {
       status = Status::DirExpected(Slice());
     }
@@ -479,7 +1352,7 @@ Status Filesystem::RemoveDir(  ///
   }
 
   if (status.ok()) {
-    status = db_->Delete(pdir, name);
+    status = DbDelete(db_, pdir, name, stats);
     FilesystemLookupCache* const c = cache_;
     if (c && status.ok()) {
       char tmp[30];
@@ -488,6 +1361,13 @@ Status Filesystem::RemoveDir(  ///
       MutexLock cl(&c->mu_);
       c->lru_.Erase(key, hash);
     }
+    if (ncache_ && found && status.ok()) {
+      ncache_->RemoveName(pdir, name);
+      ncache_->RemoveDir(DirId(*stat));
+    }
+    if (pcache_ && status.ok()) {
+      pcache_->Bump(pdir.ino);
+    }
   }
 
   if (use_mu) {
@@ -499,33 +1379,163 @@ Status Filesystem::RemoveDir(  ///
   return status;
 }
 
+Status Filesystem::WalkSubtree(  ///
+    const User* who, const Stat& top, std::vector<Stat>* dirs,
+    std::vector<std::string>* keys, std::vector<Stat>* files) {
+  Status status;
+  dirs->push_back(top);
+  for (size_t i = 0; status.ok() && i < dirs->size(); i++) {
+    const Stat dir = (*dirs)[i];  // dirs may be resized below
+    if (who && (!IsDirReadOk(options_, dir, *who) ||
+                !IsDirWriteOk(options_, dir, *who))) {
+      status = Status::AccessDenied(Slice());
+      break;
+    }
+    const DirId id(dir);
+    FilesystemDb::Dir* const d = db_->Opendir(id);
+    std::string tmpname;
+    Stat tmp;
+    while (true) {
+      status = db_->Readdir(d, &tmp, &tmpname);
+      if (!status.ok()) {
+        break;
+      } else if ((tmp.FileMode() & S_IFDIR) == S_IFDIR) {
+        dirs->push_back(tmp);
+        if (keys) {
+          char buf[30];
+          keys->push_back(LookupKey(buf, id, tmpname).ToString());
+        }
+      } else if (files && ofs_ &&
+                 tmp.FileSize() > options_.max_inline_data_size) {
+        files->push_back(tmp);
+      }
+    }
+    db_->Closedir(d);
+    if (status.IsNotFound()) {  // End of listing
+      status = Status::OK();
+    }
+  }
+  return status;
+}
+
+Status Filesystem::RemoveSubtree(  ///
+    const User& who, const Stat& parent_dir, const Slice& name,
+    FilesystemDbStats* const stats) {
+  if (!IsDirWriteOk(options_, parent_dir, who)) {
+    return Status::AccessDenied(Slice());
+  }
+  UpdateLock ul(this);
+  const DirId pdir(parent_dir);
+  Stat stat;
+  Status status = DbGet(db_, pdir, name, &stat, stats);
+  if (status.ok() && (stat.FileMode() & S_IFDIR) != S_IFDIR) {
+    status = Status::DirExpected(Slice());
+  }
+  // Check that the user may remove every dir in the tree before anything is
+  // removed.
+  if (status.ok()) {
+    std::vector<Stat> dirs;
+    status = WalkSubtree(&who, stat, &dirs, NULL, NULL);
+  }
+
+  // Unlink the tree before its contents are listed for removal. Paths can
+  // no longer reach it afterwards, so the listing below finds every name
+  // created through a path. Names created later through a handle pinned on
+  // a dir in the tree (see Creatat) are not found and stay in db.
+  if (status.ok()) {
+    const bool use_mu = !options_.skip_deletion_checks;
+    if (use_mu) {
+      for (int i = 0; i < kWay; i++) {
+        LockStripe(&mus_[i], stats);
+      }
+    }
+    status = DbDelete(db_, pdir, name, stats);
+    if (cache_ && status.ok()) {
+      char tmp[30];
+      Slice key = LookupKey(tmp, pdir, name);
+      uint32_t hash = Hash0(key);
+      MutexLock cl(&cache_->mu_);
+      cache_->lru_.Erase(key, hash);
+    }
+    if (pcache_ && status.ok()) {
+      pcache_->Bump(pdir.ino);
+    }
+    if (use_mu) {
+      for (int i = kWay - 1; i >= 0; i--) {
+        mus_[i].Unlock();
+      }
+    }
+  }
+
+  // Names are not removed one by one; each dir is cleared as a whole. Cached
+  // lookups and paths through a removed dir must not outlive it.
+  std::vector<Stat> dirs;
+  std::vector<std::string> keys;  // Lookup keys of dirs beneath the top dir
+  std::vector<Stat> files;  // Large files whose contents are held in ofs
+  if (status.ok()) {
+    status = WalkSubtree(NULL, stat, &dirs, &keys, &files);
+  }
+  for (size_t i = 0; status.ok() && i < dirs.size(); i++) {
+    status = DbDeleteDir(db_, DirId(dirs[i]), stats);
+    if (ncache_ && status.ok()) {
+      ncache_->RemoveDir(DirId(dirs[i]));
+    }
+    if (pcache_ && status.ok()) {
+      pcache_->Bump(dirs[i].InodeNo());
+    }
+  }
+  for (size_t i = 0; cache_ && status.ok() && i < keys.size(); i++) {
+    const Slice key = keys[i];
+    MutexLock cl(&cache_->mu_);
+    cache_->lru_.Erase(key, Hash0(key));
+  }
+  for (size_t i = 0; status.ok() && i < files.size(); i++) {
+    status = DropChunks(files[i], 0);
+  }
+
+  return status;
+}
+
 Status Filesystem::Delete(  ///
     const User& who, const Stat& parent_dir, const Slice& name,
     Stat* const stat, FilesystemDbStats* const stats) {
   if (!IsDirWriteOk(options_, parent_dir, who)) {
     return Status::AccessDenied(Slice());
   }
+  UpdateLock ul(this);
   const DirId pdir(parent_dir);
   Status status;
   char tmp[30];
   port::Mutex* mu = NULL;
   uint32_t hash;
   Slice key;
+  bool has_stat = !options_.skip_deletion_checks;
   if (!options_.skip_deletion_checks) {
     key = LookupKey(tmp, pdir, name);
     hash = Hash0(key);
     // Mutex locking is needed when name existence must be checked prior to
     // deletion.
     mu = &mus_[hash & (kWay - 1)];
-    mu->Lock();
-    status = db_->Get(pdir, name, stat, stats);
+    LockStripe(mu, stats);
+    status = DbGet(db_, pdir, name, stat, stats);
     if (status.ok() && (stat->FileMode() & S_IFREG) != S_IFREG) {
       status = Status::FileExpected(Slice());
     }
+  } else {
+    // The name is deleted blindly, but its stat is still read so that the
+    // chunks of a large file are not left behind in ofs.
+    has_stat = DbGet(db_, pdir, name, stat, stats).ok() &&
+               (stat->FileMode() & S_IFREG) == S_IFREG;
   }
 
   if (status.ok()) {
-    status = db_->Delete(pdir, name);
+    status = DbDelete(db_, pdir, name, stats);
+    if (ncache_ && mu && status.ok()) {
+      ncache_->RemoveName(pdir, name);
+    }
+    if (status.ok()) {
+      status = DropData(pdir, name, has_stat ? stat : NULL, stats);
+    }
   }
 
   if (mu) {
@@ -535,12 +1545,323 @@ Status Filesystem::Delete(  ///
   return status;
 }
 
+Status Filesystem::ReadAt(  ///
+    const User& who, const Stat& parent_dir, const Slice& name, uint64_t off,
+    size_t n, Slice* result, char* scratch, FilesystemDbStats* const stats) {
+  Stat stat;
+  Status status = Fetch(who, parent_dir, name, S_IFREG, &stat, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (!IsDirReadOk(options_, stat, who)) {
+    return Status::AccessDenied(Slice());
+  }
+
+  const uint64_t size = stat.FileSize();
+  size_t m = 0;  // Number of bytes to return
+  if (off < size) {
+    m = static_cast<size_t>(std::min<uint64_t>(n, size - off));
+  }
+  *result = Slice(scratch, m);
+  if (m == 0) {
+    return status;
+  }
+
+  const DirId pdir(parent_dir);
+  size_t k = 0;  // Number of bytes actually stored
+  std::string data;
+  status = db_->GetData(pdir, name, &data, stats);
+  if (status.ok()) {
+    if (off < data.size()) {
+      k = std::min<size_t>(m, data.size() - off);
+      memcpy(scratch, data.data() + off, k);
+    }
+  } else if (status.IsNotFound()) {
+    status = Status::OK();
+    if (ofs_) {
+      status = ReadChunks(stat, off, m, scratch);
+      k = m;
+    }
+  }
+  if (status.ok() && k < m) {  // The rest of the file reads as zeros
+    memset(scratch + k, 0, m - k);
+  }
+
+  return status;
+}
+
+Status Filesystem::WriteAt(  ///
+    const User& who, const Stat& parent_dir, const Slice& name, uint64_t off,
+    const Slice& data, bool trunc, FilesystemDbStats* const stats) {
+  UpdateLock ul(this);
+  const DirId pdir(parent_dir);
+  char tmp[30];
+  Slice key = LookupKey(tmp, pdir, name);
+  uint32_t hash = Hash0(key);
+  // Mutex locking is needed as a write reads, modifies, and then writes back
+  // the contents of the file.
+  port::Mutex* const mu = &mus_[hash & (kWay - 1)];
+  LockStripe(mu, stats);
+  Stat stat;
+  Status status = Fetch(who, parent_dir, name, S_IFREG, &stat, stats);
+  if (status.ok() && !IsDirWriteOk(options_, stat, who)) {
+    status = Status::AccessDenied(Slice());
+  }
+  if (status.ok() &&
+      (off > kMaxFileSize || data.size() > kMaxFileSize - off)) {
+    status = Status::Range("File too large");
+  }
+  uint64_t size = 0;  // File size after the write
+  if (status.ok()) {
+    const uint64_t end = off + data.size();
+    size = trunc ? end : std::max<uint64_t>(stat.FileSize(), end);
+    if (size > options_.max_inline_data_size && !ofs_) {
+      status = Status::Range("No ofs for large files");
+    }
+  }
+
+  if (status.ok() && size <= options_.max_inline_data_size) {
+    // Stored contents may be shorter than the file. The rest of the file, as
+    // well as any gap opened by the write, is filled with zeros.
+    std::string contents;
+    if (!trunc) {
+      status = LoadData(pdir, name, stat, static_cast<size_t>(size), &contents,
+                        stats);
+    }
+    if (status.ok()) {
+      contents.resize(static_cast<size_t>(size), 0);
+      if (!data.empty()) {
+        memcpy(&contents[static_cast<size_t>(off)], data.data(), data.size());
+      }
+      status = StoreData(pdir, name, stat, contents, stats);
+    }
+  } else if (status.ok()) {
+    if (trunc) {
+      status = DropData(pdir, name, &stat, stats);
+    } else {
+      // Contents still held in db move to the first chunks of the file
+      std::string contents;
+      status = db_->GetData(pdir, name, &contents, stats);
+      if (status.ok()) {
+        if (contents.size() > stat.FileSize()) {
+          contents.resize(static_cast<size_t>(stat.FileSize()));
+        }
+        status = WriteChunks(stat, 0, contents);
+        if (status.ok()) {
+          status = db_->DeleteData(pdir, name);
+        }
+      } else if (status.IsNotFound()) {
+        status = Status::OK();
+      }
+    }
+    if (status.ok()) {
+      status = WriteChunks(stat, off, data);
+    }
+  }
+
+  if (status.ok()) {
+    FilesystemDbStatUpdate update;
+    update.mask = FilesystemDbStatUpdate::kSize |
+                  FilesystemDbStatUpdate::kModifyTime |
+                  FilesystemDbStatUpdate::kChangeTime;
+    update.size = size;
+    update.mtime = update.ctime = CurrentMicros();
+    status = DbUpdate(db_, pdir, name, update, stats);
+  }
+
+  mu->Unlock();
+
+  return status;
+}
+
+Status Filesystem::LoadData(  ///
+    const DirId& pdir, const Slice& name, const Stat& stat, size_t n,
+    std::string* data, FilesystemDbStats* const stats) {
+  assert(n <= options_.max_inline_data_size);
+  data->clear();
+  // Contents past the end of the file are left over by an unchecked truncate
+  n = static_cast<size_t>(std::min<uint64_t>(n, stat.FileSize()));
+  if (n == 0) {
+    return Status::OK();
+  }
+  Status status = db_->GetData(pdir, name, data, stats);
+  if (status.ok()) {
+    if (data->size() > n) {
+      data->resize(n);
+    }
+  } else if (status.IsNotFound()) {
+    status = Status::OK();
+    if (ofs_) {
+      data->resize(n);
+      status = ReadChunks(stat, 0, n, &(*data)[0]);
+    }
+  }
+  return status;
+}
+
+Status Filesystem::StoreData(  ///
+    const DirId& pdir, const Slice& name, const Stat& stat, const Slice& data,
+    FilesystemDbStats* const stats) {
+  assert(data.size() <= options_.max_inline_data_size);
+  Status status;
+  if (!data.empty()) {
+    status = db_->PutData(pdir, name, data, stats);
+  } else if (stat.FileSize() != 0) {
+    status = db_->DeleteData(pdir, name);
+  }
+  if (status.ok() && ofs_ && stat.FileSize() != 0) {
+    status = DropChunks(stat, 0);
+  }
+  return status;
+}
+
+Status Filesystem::ReadChunks(  ///
+    const Stat& stat, uint64_t off, size_t n, char* scratch) {
+  memset(scratch, 0, n);
+  Status status;
+  while (status.ok() && n != 0) {
+    const uint64_t chunk = off / kChunkSize;
+    const uint64_t chunk_off = off % kChunkSize;
+    const size_t m = static_cast<size_t>(
+        std::min<uint64_t>(n, kChunkSize - chunk_off));
+    const std::string fname = ChunkName(stat, chunk);
+    uint64_t chunk_size = 0;
+    // Chunks may be shorter than the bytes they cover
+    if (ofs_->FileExists(fname.c_str())) {
+      status = ofs_->GetFileSize(fname.c_str(), &chunk_size);
+    }
+    if (status.ok() && chunk_size > chunk_off) {
+      RandomAccessFile* file;
+      status = ofs_->NewRandomAccessFile(fname.c_str(), &file);
+      if (status.ok()) {
+        Slice result;
+        status = file->Read(
+            chunk_off,
+            static_cast<size_t>(std::min<uint64_t>(m, chunk_size - chunk_off)),
+            &result, scratch);
+        if (status.ok() && result.data() != scratch) {
+          memmove(scratch, result.data(), result.size());
+        }
+        delete file;
+      }
+    }
+    off += m;
+    scratch += m;
+    n -= m;
+  }
+  return status;
+}
+
+Status Filesystem::WriteChunks(  ///
+    const Stat& stat, uint64_t off, const Slice& data) {
+  Slice input = data;
+  Status status;
+  while (status.ok() && !input.empty()) {
+    const uint64_t chunk = off / kChunkSize;
+    const size_t chunk_off = static_cast<size_t>(off % kChunkSize);
+    const size_t m = static_cast<size_t>(
+        std::min<uint64_t>(input.size(), kChunkSize - chunk_off));
+    const std::string fname = ChunkName(stat, chunk);
+    if (m == kChunkSize) {  // Whole chunk overwritten
+      status = ofs_->WriteStringToFile(fname.c_str(), Slice(input.data(), m));
+    } else {
+      std::string contents;
+      if (ofs_->FileExists(fname.c_str())) {
+        status = ofs_->ReadFileToString(fname.c_str(), &contents);
+      }
+      if (status.ok()) {
+        if (contents.size() < chunk_off + m) {
+          contents.resize(chunk_off + m, 0);
+        }
+        memcpy(&contents[chunk_off], input.data(), m);
+        status = ofs_->WriteStringToFile(fname.c_str(), contents);
+      }
+    }
+    input.remove_prefix(m);
+    off += m;
+  }
+  return status;
+}
+
+Status Filesystem::DropChunks(const Stat& stat, uint64_t off) {
+  const uint64_t end = (stat.FileSize() + kChunkSize - 1) / kChunkSize;
+  Status status;
+  for (uint64_t chunk = off / kChunkSize; status.ok() && chunk < end;
+       chunk++) {
+    const std::string fname = ChunkName(stat, chunk);
+    if (!ofs_->FileExists(fname.c_str())) {
+      continue;
+    }
+    const uint64_t keep = chunk * kChunkSize < off ? off % kChunkSize : 0;
+    if (keep == 0) {
+      status = ofs_->DeleteFile(fname.c_str());
+    } else {  // Cut the chunk holding the new end of the file
+      std::string contents;
+      status = ofs_->ReadFileToString(fname.c_str(), &contents);
+      if (status.ok() && contents.size() > keep) {
+        contents.resize(static_cast<size_t>(keep));
+        status = ofs_->WriteStringToFile(fname.c_str(), contents);
+      }
+    }
+  }
+  return status;
+}
+
+// Contents cut off by a truncate must not reappear if the file later grows
+// again. Growing a file needs no data changes.
+Status Filesystem::TrimData(  ///
+    const DirId& pdir, const Slice& name, const Stat& stat, uint64_t size,
+    FilesystemDbStats* const stats) {
+  Status status;
+  if (size >= stat.FileSize()) {
+    return status;
+  } else if (size <= options_.max_inline_data_size) {
+    std::string contents;
+    status =
+        LoadData(pdir, name, stat, static_cast<size_t>(size), &contents, stats);
+    if (status.ok()) {
+      status = StoreData(pdir, name, stat, contents, stats);
+    }
+  } else if (ofs_) {
+    status = DropChunks(stat, size);
+  }
+  return status;
+}
+
+// Inode nos of chunks are parsed back from the names given by ChunkName().
+Status Filesystem::PurgeChunks(uint64_t ino) {
+  std::vector<std::string> names;
+  Status status = ofs_->GetChildren("/data", &names);
+  for (size_t i = 0; status.ok() && i < names.size(); i++) {
+    unsigned long long chunk_ino;
+    unsigned long long chunk;
+    if (sscanf(names[i].c_str(), "%llx.%llx", &chunk_ino, &chunk) == 2 &&
+        chunk_ino >= ino) {
+      status = ofs_->DeleteFile(("/data/" + names[i]).c_str());
+    }
+  }
+  return status;
+}
+
+Status Filesystem::DropData(  ///
+    const DirId& pdir, const Slice& name, const Stat* const stat,
+    FilesystemDbStats* const stats) {
+  if (stat && stat->FileSize() == 0) {
+    return Status::OK();
+  }
+  Status status = db_->DeleteData(pdir, name);
+  if (status.ok() && stat && ofs_) {
+    status = DropChunks(*stat, 0);
+  }
+  return status;
+}
+
 Status Filesystem::Put(  ///
     const User& who, const Stat& parent_dir, const Slice& name, uint32_t mode,
     Stat* const stat, FilesystemDbStats* const stats) {
   if (!IsDirWriteOk(options_, parent_dir, who)) {
     return Status::AccessDenied(Slice());
   }
+  UpdateLock ul(this);
   const DirId pdir(parent_dir);
   Status status;
   char tmp[30];
@@ -551,20 +1872,32 @@ Status Filesystem::Put(  ///
     key = LookupKey(tmp, pdir, name);
     hash = Hash0(key);
     // Mutex locking is needed when we have to do a read before writing.
+    // Holding the stripe also keeps the create from slipping past the
+    // emptiness check of a concurrent rmdir, which holds every stripe.
     mu = &mus_[hash & (kWay - 1)];
-    mu->Lock();
-    status = db_->Get(pdir, name, stat, stats);
-    if (status.ok()) {
-      status = Status::AlreadyExists(Slice());
-    } else if (status.IsNotFound()) {
-      status = Status::OK();
+    LockStripe(mu, stats);
+    if (ncache_ && ncache_->IsAbsent(pdir, name)) {
+      if (stats) {
+        stats->namecachehits++;
+      }
+    } else {
+      status = DbGet(db_, pdir, name, stat, stats);
+      if (status.ok()) {
+        status = Status::AlreadyExists(Slice());
+      } else if (status.IsNotFound()) {
+        status = Status::OK();
+      }
     }
   }
 
+  // Inode nos are only taken once the name is known to be free, so failed
+  // creates do not use them up.
+  uint64_t ino;
+  if (status.ok()) {
+    status = NewInodeNo(&ino);
+  }
   if (status.ok()) {
-    rmu_.Lock();
-    stat->SetInodeNo(r_->inoseq_++);
-    rmu_.Unlock();
+    stat->SetInodeNo(ino);
     stat->SetFileSize(0);
     stat->SetFileMode(mode);
     stat->SetUserId(who.uid);
@@ -573,7 +1906,18 @@ Status Filesystem::Put(  ///
     stat->SetChangeTime(0);
     stat->AssertAllSet();
 
-    status = db_->Put(pdir, name, *stat, stats);
+    const bool is_dir = S_ISDIR(mode);
+    if (ncache_ && is_dir) {
+      ncache_->AddDir(DirId(*stat));
+    }
+    status = DbPut(db_, pdir, name, *stat, stats);
+    if (ncache_) {
+      if (status.ok()) {
+        ncache_->AddName(pdir, name);
+      } else if (is_dir) {
+        ncache_->RemoveDir(DirId(*stat));
+      }
+    }
   }
 
   if (mu) {
@@ -602,8 +1946,8 @@ Status Filesystem::SeekToDir(  ///
     hash = Hash0(key);
     // Mutex locking is needed when we need to perform two db reads.
     mu = &mus_[hash & (kWay - 1)];
-    mu->Lock();
-    status = db_->Get(pdir, name, &buf, stats);
+    LockStripe(mu, stats);
+    status = DbGet(db_, pdir, name, &buf, stats);
     if (!status.ok()) {
       // Empty
     } else if (!S_ISDIR(buf.FileMode())) {  // Must be a dir
@@ -615,7 +1959,7 @@ Status Filesystem::SeekToDir(  ///
 
   if (status.ok()) {
     if (IsDirReadOk(options_, *stat, who)) {
-      *dir = reinterpret_cast<FilesystemDir*>(db_->Opendir(DirId(*stat)));
+      *dir = new FilesystemDir(*stat);
     } else {
       status = Status::AccessDenied(Slice());
     }
@@ -628,18 +1972,108 @@ Status Filesystem::SeekToDir(  ///
   return status;
 }
 
+Status Filesystem::Setattr(  ///
+    const User& who, const char* const pathname, FilesystemOpType op,
+    const FilesystemDbStatUpdate& update, FilesystemDbStats* const stats) {
+  bool has_tailing_slashes(false);
+  Stat parent_dir;
+  Slice tgt;
+  Status status = Resolu(who, r_->rstat_, pathname, &parent_dir, &tgt,
+                         &has_tailing_slashes, stats);
+  if (!status.ok()) {
+    return status;
+  } else if (tgt.empty()) {  // Special case in which path is a root
+    return Status::AssertionFailed(Slice());
+  } else if (has_tailing_slashes && op == kFsTruncate) {  // Path is a dir
+    return Status::FileExpected(Slice());
+  }
+
+  UpdateLock ul(this);
+  const DirId pdir(parent_dir);
+  FilesystemLookupCache* const c = cache_;
+  char tmp[30];
+  port::Mutex* mu = NULL;
+  uint32_t hash;
+  Slice key;
+  if (c || op == kFsTruncate) {
+    key = LookupKey(tmp, pdir, tgt);
+    hash = Hash0(key);
+    // Mutex locking is needed so a concurrent lookup cannot put a stale
+    // stat back into the cache after we erase it, and so a truncate does not
+    // race with writes to the file's contents.
+    mu = &mus_[hash & (kWay - 1)];
+    LockStripe(mu, stats);
+  }
+
+  if (op == kFsTruncate && update.size > kMaxFileSize) {
+    status = Status::Range("File too large");
+  } else if (!options_.skip_setattr_checks) {
+    uint32_t mode = 0;
+    if (op == kFsTruncate) {
+      mode = S_IFREG;
+    } else if (has_tailing_slashes) {
+      mode = S_IFDIR;
+    }
+    Stat stat;
+    status = Fetch(who, parent_dir, tgt, mode, &stat, stats);
+    if (status.ok() && !IsSetattrOk(options_, stat, who, op)) {
+      status = Status::AccessDenied(Slice());
+    }
+    if (status.ok() && op == kFsTruncate) {
+      status = TrimData(pdir, tgt, stat, update.size, stats);
+    }
+  } else if (!IsLookupOk(options_, parent_dir, who)) {
+    status = Status::AccessDenied(Slice());
+  } else if (op == kFsTruncate) {
+    // Names that do not exist and non-files are left to the blind update.
+    Stat stat;
+    if (DbGet(db_, pdir, tgt, &stat, stats).ok() &&
+        (stat.FileMode() & S_IFREG) == S_IFREG) {
+      status = TrimData(pdir, tgt, stat, update.size, stats);
+    }
+  }
+
+  if (status.ok()) {
+    FilesystemDbStatUpdate myupdate = update;
+    myupdate.mask |= FilesystemDbStatUpdate::kChangeTime;
+    myupdate.ctime = CurrentMicros();
+    status = DbUpdate(db_, pdir, tgt, myupdate, stats);
+  }
+  if (c && status.ok()) {
+    MutexLock cl(&c->mu_);
+    c->lru_.Erase(key, hash);
+  }
+  if (pcache_ && status.ok()) {
+    pcache_->Bump(pdir.ino);
+  }
+
+  if (mu) {
+    mu->Unlock();
+  }
+
+  return status;
+}
+
 uint64_t Filesystem::TEST_GetCurrentInoseq() {
   MutexLock ml(&rmu_);
   return r_->inoseq_;
 }
 
+uint64_t Filesystem::TEST_GetLastEpoch() {
+  MutexLock ml(&rmu_);
+  return r_->epoch_;
+}
+
 namespace {
 // Recover information from a given encoding string.
 // Return True on success, False otherwise.
 bool DecodeFrom(FilesystemRoot* r, Slice* input) {
   if (!r->rstat_.DecodeFrom(input))  ///
     return false;
-  return GetVarint64(input, &r->inoseq_);
+  if (!GetVarint64(input, &r->inoseq_))  ///
+    return false;
+  r->epoch_ = 0;  // Images written before epochs were introduced
+  return input->empty() || GetVarint64(input, &r->epoch_);
 }
 
 bool DecodeFrom(FilesystemRoot* r, const Slice& encoding) {
@@ -651,23 +2085,323 @@ bool DecodeFrom(FilesystemRoot* r, const Slice& encoding) {
 Slice EncodeTo(FilesystemRoot* r, char* scratch) {
   Slice en = r->rstat_.EncodeTo(scratch);
   char* p = EncodeVarint64(scratch + en.size(), r->inoseq_);
+  p = EncodeVarint64(p, r->epoch_);
   Slice rv(scratch, p - scratch);
   return rv;
 }
 }  // namespace
 
+// Inode nos are handed out from batches reserved by writing db a root whose
+// inoseq is past the batch. As the root is written before any create using
+// the batch, no db state recovered after a crash holds a file numbered at or
+// past the recovered inoseq, and such a number is never handed out twice.
+Status Filesystem::NewInodeNo(uint64_t* ino) {
+  MutexLock ml(&rmu_);
+  if (r_->inoseq_ >= r_->inolimit_) {
+    char tmp[200];
+    FilesystemRoot next = *r_;
+    next.inoseq_ += kInodeBatchSize;
+    Slice encoding = EncodeTo(&next, tmp);
+    Status s = db_->SaveFsroot(encoding);
+    if (!s.ok()) {
+      return s;
+    }
+    r_->inolimit_ = next.inoseq_;
+    prev_r_ = encoding.ToString();
+  }
+  *ino = r_->inoseq_++;
+  return Status::OK();
+}
+
+// The root is saved and the memtable switched out while elk_ is held
+// exclusively so that no update, including one making several db writes, can
+// straddle the cut, and no create can take an inode no. past the saved
+// inoseq and still make it into the epoch. Updates resume while the old
+// memtable is flushed. The epoch no. is advanced along with the saved root,
+// so roots written by later creates carry it, and given back if the epoch
+// cannot be made durable.
+Status Filesystem::SyncEpoch(uint64_t* epoch) {
+  if (options_.rdonly) {
+    return Status::ReadOnly(Slice());
+  }
+  MutexLock sl(&smu_);
+  char tmp[200];
+  uint64_t next;
+  Status s;
+  {
+    WriteLock el(&elk_);
+    MutexLock ml(&rmu_);
+    FilesystemRoot root = *r_;
+    next = ++root.epoch_;
+    Slice encoding = EncodeTo(&root, tmp);
+    s = db_->SaveFsroot(encoding);
+    if (s.ok()) {
+      s = db_->StartFlush();
+    }
+    if (s.ok()) {
+      r_->epoch_ = next;
+      // The saved root gives back the rest of the current batch of inode
+      // nos, so the next create reserves a new one.
+      r_->inolimit_ = r_->inoseq_;
+      prev_r_ = encoding.ToString();
+    }
+  }
+  if (s.ok()) {
+    s = db_->WaitForFlush();
+    if (!s.ok()) {
+      MutexLock ml(&rmu_);
+      r_->epoch_ = next - 1;
+    }
+  }
+  if (s.ok()) {
+    *epoch = next;
+  }
+  return s;
+}
+
 FilesystemOptions::FilesystemOptions()
     : size_lookup_cache(0),
+      size_name_cache(0),
+      max_names_per_cached_dir(65536),
+      size_path_cache(0),
       skip_deletion_checks(false),
       skip_name_collision_checks(false),
       skip_perm_checks(false),
-      rdonly(false) {}
+      skip_setattr_checks(false),
+      rdonly(false),
+      max_inline_data_size(4096),
+      enable_op_stats(false),
+      op_stats_dump_interval(0),
+      bg_io_bytes_per_sec(0),
+      bg_io_target_latency(0),
+      dir_aligned_tables(false),
+      fixed_prefix_comparator(false),
+      data_block_hash_index(false),
+      memtable_hash_index(false),
+      large_dir_threshold(0),
+      open_threads(0),
+      preload_tables(false),
+      preload_tables_in_background(false),
+      epoch_durability(false),
+      epoch_interval(0),
+      memory_budget(0) {}
+
+FilesystemOpStats::FilesystemOpStats() { Clear(); }
+
+void FilesystemOpStats::Clear() {
+  for (int i = 0; i < kFsNumOps; i++) {
+    ops[i] = errs[i] = 0;
+    op_micros[i].Clear();
+  }
+  resolv_depth.Clear();
+  lookup_cache_hits = lookup_cache_misses = 0;
+  name_cache_hits = path_cache_hits = 0;
+  lock_wait_micros.Clear();
+  db_get_micros.Clear();
+  db_put_micros.Clear();
+  db_del_micros.Clear();
+  db_gets = db_getbytes = 0;
+  db_puts = db_putbytes = 0;
+  db_dels = db_updates = 0;
+  open_micros = first_op_micros = 0;
+}
+
+void FilesystemOpStats::Merge(const FilesystemOpStats& other) {
+  for (int i = 0; i < kFsNumOps; i++) {
+    ops[i] += other.ops[i];
+    errs[i] += other.errs[i];
+    op_micros[i].Merge(other.op_micros[i]);
+  }
+  resolv_depth.Merge(other.resolv_depth);
+  lookup_cache_hits += other.lookup_cache_hits;
+  lookup_cache_misses += other.lookup_cache_misses;
+  name_cache_hits += other.name_cache_hits;
+  path_cache_hits += other.path_cache_hits;
+  lock_wait_micros.Merge(other.lock_wait_micros);
+  db_get_micros.Merge(other.db_get_micros);
+  db_put_micros.Merge(other.db_put_micros);
+  db_del_micros.Merge(other.db_del_micros);
+  db_gets += other.db_gets;
+  db_getbytes += other.db_getbytes;
+  db_puts += other.db_puts;
+  db_putbytes += other.db_putbytes;
+  db_dels += other.db_dels;
+  db_updates += other.db_updates;
+  open_micros = std::max(open_micros, other.open_micros);
+  first_op_micros = std::max(first_op_micros, other.first_op_micros);
+}
+
+namespace {
+const char* const kOpNames[kFsNumOps] = {
+    "lstat",   "creat", "mkdir", "unlink", "rmdir",   "opendir",
+    "readdir", "chmod", "chown", "utimes", "truncate", "read", "write",
+    "rmtree"};
+
+void AppendHistogram(std::string* dst, const char* name, const Histogram& h) {
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "%s: avg=%.3f p50=%.3f p99=%.3f (micros)\n", name, h.Average(),
+           h.Median(), h.Percentile(99));
+  dst->append(tmp);
+}
+}  // namespace
+
+std::string FilesystemOpStats::ToString() const {
+  std::string result;
+  char tmp[200];
+  for (int i = 0; i < kFsNumOps; i++) {
+    if (ops[i] != 0) {
+      snprintf(tmp, sizeof(tmp), "%s: ops=%llu errs=%llu\n", kOpNames[i],
+               static_cast<unsigned long long>(ops[i]),
+               static_cast<unsigned long long>(errs[i]));
+      result.append(tmp);
+      AppendHistogram(&result, kOpNames[i], op_micros[i]);
+    }
+  }
+  snprintf(tmp, sizeof(tmp),
+           "resolv depth: avg=%.3f p99=%.3f\n"
+           "lookup cache: hits=%llu misses=%llu\n"
+           "name cache: hits=%llu\n"
+           "path cache: hits=%llu\n",
+           resolv_depth.Average(), resolv_depth.Percentile(99),
+           static_cast<unsigned long long>(lookup_cache_hits),
+           static_cast<unsigned long long>(lookup_cache_misses),
+           static_cast<unsigned long long>(name_cache_hits),
+           static_cast<unsigned long long>(path_cache_hits));
+  result.append(tmp);
+  AppendHistogram(&result, "lock wait", lock_wait_micros);
+  AppendHistogram(&result, "db get", db_get_micros);
+  AppendHistogram(&result, "db put", db_put_micros);
+  AppendHistogram(&result, "db del", db_del_micros);
+  snprintf(tmp, sizeof(tmp),
+           "db: gets=%llu (%llu bytes) puts=%llu (%llu bytes) dels=%llu "
+           "updates=%llu\n",
+           static_cast<unsigned long long>(db_gets),
+           static_cast<unsigned long long>(db_getbytes),
+           static_cast<unsigned long long>(db_puts),
+           static_cast<unsigned long long>(db_putbytes),
+           static_cast<unsigned long long>(db_dels),
+           static_cast<unsigned long long>(db_updates));
+  result.append(tmp);
+  snprintf(tmp, sizeof(tmp), "open: %llu micros (first op after %llu micros)\n",
+           static_cast<unsigned long long>(open_micros),
+           static_cast<unsigned long long>(first_op_micros));
+  result.append(tmp);
+  return result;
+}
+
+Status Filesystem::GetOpStats(FilesystemOpStats* const result) {
+  if (!hub_) {
+    return Status::NotSupported("Op stats disabled");
+  }
+  hub_->Snapshot(result);
+  return Status::OK();
+}
+
+void Filesystem::MaybeSealEpoch() {
+  if (options_.epoch_durability && db_->NeedsFlush()) {
+    MutexLock ml(&emu_);
+    if (!seal_requested_) {
+      seal_requested_ = true;
+      ecv_.SignalAll();
+    }
+  }
+}
+
+void Filesystem::SealEpochsWrapper(void* arg) {
+  reinterpret_cast<Filesystem*>(arg)->SealEpochs();
+}
+
+// Epochs are sealed at the configured interval, and whenever updates made
+// since the last seal fill the db's write buffer, as the db does not flush
+// its memtable on its own in epoch mode.
+void Filesystem::SealEpochs() {
+  const uint64_t interval =
+      static_cast<uint64_t>(options_.epoch_interval) * 1000 * 1000;
+  MutexLock ml(&emu_);
+  while (!shutting_down_) {
+    if (!seal_requested_) {
+      if (interval != 0) {
+        ecv_.TimedWait(interval);
+      } else {
+        ecv_.Wait();
+        continue;
+      }
+    }
+    if (!shutting_down_) {
+      seal_requested_ = false;
+      emu_.Unlock();
+      uint64_t epoch;
+      Status s = SyncEpoch(&epoch);
+      if (!s.ok()) {
+        Log(Logger::Default(), 0, "Cannot seal fs epoch: %s",
+            s.ToString().c_str());
+      }
+      emu_.Lock();
+    }
+  }
+  sealer_running_ = false;
+  ecv_.SignalAll();
+}
+
+void Filesystem::DumpOpStatsWrapper(void* arg) {
+  reinterpret_cast<Filesystem*>(arg)->DumpOpStats();
+}
+
+void Filesystem::DumpOpStats() {
+  const uint64_t interval =
+      static_cast<uint64_t>(options_.op_stats_dump_interval) * 1000 * 1000;
+  FilesystemOpStats stats;
+  MutexLock ml(&hub_->mu);
+  while (!hub_->shutting_down) {
+    hub_->cv.TimedWait(interval);
+    if (!hub_->shutting_down) {
+      hub_->mu.Unlock();
+      hub_->Snapshot(&stats);
+      Log(Logger::Default(), 0, "Filesystem op stats:\n%s",
+          stats.ToString().c_str());
+      hub_->mu.Lock();
+    }
+  }
+  hub_->dumper_running = false;
+  hub_->cv.SignalAll();
+}
 
 Filesystem::Filesystem(const FilesystemOptions& options)
-    : cache_(NULL), r_(NULL), options_(options), db_(NULL) {
+    : cache_(NULL),
+      ncache_(NULL),
+      pcache_(NULL),
+      ldirs_(NULL),
+      hub_(NULL),
+      ecv_(&emu_),
+      sealer_running_(false),
+      shutting_down_(false),
+      seal_requested_(false),
+      r_(NULL),
+      options_(options),
+      db_(NULL),
+      osd_(NULL),
+      ofs_(NULL) {
   if (options_.size_lookup_cache) {
     cache_ = new FilesystemLookupCache(options_.size_lookup_cache);
   }
+  if (options_.size_name_cache && !options_.skip_name_collision_checks) {
+    ncache_ = new FilesystemNameCache(options_.size_name_cache,
+                                      options_.max_names_per_cached_dir);
+  }
+  if (options_.size_path_cache) {
+    pcache_ = new FilesystemPathCache(options_.size_path_cache);
+  }
+  if (options_.large_dir_threshold) {
+    ldirs_ = new FilesystemLargeDirs;
+  }
+  if (options_.enable_op_stats) {
+    hub_ = new FilesystemOpStatsHub;
+    if (options_.op_stats_dump_interval > 0) {
+      hub_->dumper_running = true;
+      Env::Default()->StartThread(DumpOpStatsWrapper, this);
+    }
+  }
 }
 
 namespace {
@@ -684,14 +2418,27 @@ inline void FormatFilesystem(Stat* const root) {
 }  // namespace
 
 Status Filesystem::OpenFilesystem(const std::string& fsloc) {
+  const uint64_t start = CurrentMicros();
+  if (hub_) {
+    MutexLock ml(&hub_->mu);
+    hub_->open_start = start;
+  }
   db_ = new FilesystemDb(options_);
   Status s = db_->Open(fsloc);
+  if (s.ok() && cache_) {
+    db_->ReserveMemory(options_.size_lookup_cache *
+                       FilesystemLookupCache::EntrySize());
+  }
   if (s.ok()) {
     s = db_->LoadFsroot(&prev_r_);
     if (s.IsNotFound()) {  // This is a new fs image
       r_ = new FilesystemRoot;
       FormatFilesystem(&r_->rstat_);
       r_->inoseq_ = 1;
+      r_->epoch_ = 0;
+      if (ncache_) {  // The root of a new fs starts out empty
+        ncache_->AddDir(DirId(r_->rstat_));
+      }
       s = Status::OK();
     } else if (s.ok()) {
       r_ = new FilesystemRoot;
@@ -699,26 +2446,88 @@ Status Filesystem::OpenFilesystem(const std::string& fsloc) {
         s = Status::Corruption("Cannot recover fs root");
       }
     }
+    if (s.ok()) {
+      r_->inolimit_ = r_->inoseq_;
+    }
+  }
+  // Contents of large files are stored in a file set mounted at "/data". A
+  // readonly fs opens without it if the set does not exist.
+  if (s.ok()) {
+    osd_ = Osd::FromEnv((fsloc + "/data").c_str());
+    ofs_ = new Ofs(OfsOptions(), osd_);
+    MountOptions mntopts;
+    mntopts.read_only = options_.rdonly;
+    s = ofs_->MountFileSet(mntopts, "/data");
+    if (!s.ok() && options_.rdonly) {
+      delete ofs_;
+      ofs_ = NULL;
+      s = Status::OK();
+    } else if (s.ok() && !options_.rdonly) {
+      // Chunks of files lost to a crash would otherwise show through the
+      // files later reusing their inode nos.
+      s = PurgeChunks(r_->inoseq_);
+    }
+  }
+  if (s.ok() && options_.epoch_durability && !options_.rdonly) {
+    MutexLock ml(&emu_);
+    sealer_running_ = true;
+    Env::Default()->StartThread(SealEpochsWrapper, this);
   }
   // We indicate error by deleting db_ and r_ and setting them to NULL.
   if (!s.ok()) {
+    delete ofs_;
+    ofs_ = NULL;
+    delete osd_;
+    osd_ = NULL;
     delete db_;
     db_ = NULL;
     delete r_;
     r_ = NULL;
   }
+  if (hub_) {
+    MutexLock ml(&hub_->mu);
+    hub_->open_micros = CurrentMicros() - start;
+  }
   return s;
 }
 
 Filesystem::~Filesystem() {
+  {
+    MutexLock ml(&emu_);
+    shutting_down_ = true;
+    ecv_.SignalAll();
+    while (sealer_running_) {
+      ecv_.Wait();
+    }
+  }
   char tmp[200];
   if (!options_.rdonly && r_ && db_) {
+    if (options_.epoch_durability) {
+      r_->epoch_++;  // Closing seals a final epoch
+    }
     Slice encoding = EncodeTo(r_, tmp);
     if (encoding != prev_r_) {
       db_->SaveFsroot(encoding);
     }
     db_->Flush();
   }
+  if (hub_) {
+    MutexLock ml(&hub_->mu);
+    hub_->shutting_down = true;
+    hub_->cv.SignalAll();
+    while (hub_->dumper_running) {
+      hub_->cv.Wait();
+    }
+  }
+  if (ofs_) {
+    ofs_->UnmountFileSet(UnmountOptions(), "/data");
+  }
+  delete ofs_;
+  delete osd_;
+  delete hub_;
+  delete ldirs_;
+  delete pcache_;
+  delete ncache_;
   delete cache_;
   delete db_;
   delete r_;
@@ -36,27 +36,190 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/status.h"
 
 namespace pdlfs {
 
+struct DirId;
 struct FilesystemDbStats;
+struct FilesystemDbStatUpdate;
+struct FilesystemLargeDirs;
 struct FilesystemLookupCache;
+struct FilesystemNameCache;
+struct FilesystemOpStatsHub;
+struct FilesystemPathCache;
 struct FilesystemRoot;
 
 // Options for controlling the filesystem.
 struct FilesystemOptions {
   FilesystemOptions();
   size_t size_lookup_cache;  // Default: 0 (cache disabled)
+  // If not 0, remember the names inside up to this many dirs created since
+  // the fs was opened. Creating a name in such a dir then checks for a name
+  // collision in memory instead of reading db. Ignored when name collision
+  // checks are skipped. Default: 0 (cache disabled)
+  size_t size_name_cache;
+  // Dirs growing past this many names are dropped from the name cache.
+  // Default: 65536
+  size_t max_names_per_cached_dir;
+  // If not 0, cache the dirs reached by up to this many full path prefixes
+  // so that a path is resolved down to its last component with one cache
+  // probe instead of one lookup per component. Default: 0 (cache disabled)
+  size_t size_path_cache;
   bool skip_deletion_checks;
   bool skip_name_collision_checks;
   bool skip_perm_checks;
+  // Write attribute updates (chmod, chown, utimes, and truncate) to db without
+  // first checking the target's existence, type, and ownership. Updates to
+  // names that do not exist are then silently dropped. A truncate still reads
+  // the target so that the contents it cuts off are removed.
+  // Default: false
+  bool skip_setattr_checks;
   bool rdonly;
+  // Files no larger than this many bytes keep their contents in db, right
+  // next to their directory entries. Larger files are stored as fixed-size
+  // chunk objects in an ofs file set under the fs dir, so a write only
+  // rewrites the chunks it touches. Files cannot grow past 1TB. Must not
+  // change across fs reopens.
+  // Default: 4KB
+  size_t max_inline_data_size;
+  // Collect per-op counters and latency histograms. Default: false
+  bool enable_op_stats;
+  // If not 0, periodically dump op stats to the default logger at this
+  // interval (in seconds). Ignored when op stats are disabled. Default: 0
+  int op_stats_dump_interval;
+  // If not 0, cap the bandwidth of background db table writes at this many
+  // bytes per second, with memtable flushes served before compactions.
+  // Default: 0 (unlimited)
+  uint64_t bg_io_bytes_per_sec;
+  // If not 0, auto-tune the background write cap down when the average db
+  // lookup latency exceeds this many micros, and back up to
+  // bg_io_bytes_per_sec when it does not. Default: 0 (no auto-tuning)
+  uint64_t bg_io_target_latency;
+  // Have db compactions prefer to close output tables at directory
+  // boundaries, so listing a directory or checking it for emptiness touches
+  // as few tables as possible. Default: false
+  bool dir_aligned_tables;
+  // Have db compare the fixed-width prefix of its keys, which holds the
+  // parent dir's inode no. and the key type, as a single integer instead of
+  // byte by byte. Keys are ordered the same either way, so this may change
+  // across fs reopens. Default: false
+  bool fixed_prefix_comparator;
+  // Write db data blocks with a hash index so that the lookups behind lstat
+  // and name collision checks jump straight to the entry they want, or skip
+  // the block when the name is absent. Tables written either way remain
+  // readable, so this may change across fs reopens. Default: false
+  bool data_block_hash_index;
+  // Keep a hash index next to each db memtable so that the name collision
+  // checks preceding creates do not search the memtable's skiplist. The
+  // index is sized from the write buffer and takes about 1/32 of it.
+  // Default: false
+  bool memtable_hash_index;
+  // If not 0, dirs seen returning at least this many names in one listing
+  // are listed in scan mode from then on: db reads ahead of the listing and
+  // leaves the block cache untouched so that the blocks serving point
+  // lookups stay cached. Default: 0 (disabled)
+  uint64_t large_dir_threshold;
+  // If not 0, replay db logs and load db tables with this many threads when
+  // the fs is opened. Default: 0 (logs are replayed one at a time)
+  int open_threads;
+  // Load the indexes and filters of all db tables when the fs is opened so
+  // that the first ops do not pay for it. Default: false
+  bool preload_tables;
+  // Return from opening the fs without waiting for db tables to be loaded.
+  // Ignored unless preload_tables is set. Default: false
+  bool preload_tables_in_background;
+  // Write db without a write-ahead log and only make updates durable when
+  // an epoch is sealed, either by SyncEpoch() or by closing the fs. After a
+  // crash the fs reopens exactly as of the last sealed epoch. Updates made
+  // since then are held in memory. Contents of large files already stored
+  // in ofs are not rolled back, except that those of files lost to the crash
+  // are removed when the fs reopens. Db ports that cannot turn off their log
+  // reopen at least as of the last sealed epoch. Default: false
+  bool epoch_durability;
+  // If not 0, seal an epoch at this interval (in seconds). Ignored unless
+  // epoch durability is enabled. Regardless of this setting, an epoch is
+  // sealed whenever unsealed updates fill the db's write buffer, so that the
+  // memory they hold stays bounded. Default: 0
+  int epoch_interval;
+  // If not 0, cap the memory held by db memtables, open db tables, cached db
+  // blocks, and the lookup cache at this many bytes in total. Db memory is
+  // shifted between write buffering and read caching as the workload
+  // changes. The lookup cache keeps its configured size, which is set aside
+  // from the budget. Db ports without a memory budget ignore this option.
+  // Default: 0 (no budget)
+  size_t memory_budget;
 };
-struct FilesystemDir;  // Opaque filesystem dir handle.
+
+// Types of filesystem operations that are individually instrumented.
+enum FilesystemOpType {
+  kFsLstat,
+  kFsCreat,
+  kFsMkdir,
+  kFsUnlnk,
+  kFsRmdir,
+  kFsOpendir,
+  kFsReaddir,
+  kFsChmod,
+  kFsChown,
+  kFsUtimes,
+  kFsTruncate,
+  kFsRead,
+  kFsWrite,
+  kFsRmtree,
+  kFsNumOps  // Must be the last
+};
+
+// Performance stats collected by a filesystem across all of its operations.
+// Each thread accumulates stats into its own private copy. A caller obtains an
+// aggregated snapshot through Filesystem::GetOpStats().
+struct FilesystemOpStats {
+  FilesystemOpStats();
+  void Clear();
+  void Merge(const FilesystemOpStats& other);
+  std::string ToString() const;
+
+  // Total number of operations finished and failed, per op type.
+  uint64_t ops[kFsNumOps];
+  uint64_t errs[kFsNumOps];
+  // End-to-end latency in micros, per op type.
+  Histogram op_micros[kFsNumOps];
+  // Number of path components looked up per op during path resolution.
+  Histogram resolv_depth;
+  // Total number of lookup cache hits and misses.
+  uint64_t lookup_cache_hits;
+  uint64_t lookup_cache_misses;
+  // Total number of name collision checks answered by the name cache.
+  uint64_t name_cache_hits;
+  // Total number of paths resolved by the path cache.
+  uint64_t path_cache_hits;
+  // Micros spent waiting for fs-layer stripe mutexes, per op.
+  Histogram lock_wait_micros;
+  // Micros spent on db reads, writes, and deletes, per op.
+  Histogram db_get_micros;
+  Histogram db_put_micros;
+  Histogram db_del_micros;
+  // Total number of db operations and the bytes they moved.
+  uint64_t db_gets;
+  uint64_t db_getbytes;
+  uint64_t db_puts;
+  uint64_t db_putbytes;
+  uint64_t db_dels;
+  uint64_t db_updates;
+  // Micros spent opening the fs, and micros from the start of the open
+  // until the first op finished (0 if no op has finished yet).
+  uint64_t open_micros;
+  uint64_t first_op_micros;
+};
+// Opaque filesystem dir handle. In addition to listing, a dir handle can be
+// used as the starting point of relative path resolution (see Creatat). A
+// handle pins the stat of the dir as of the time the dir is opened.
+struct FilesystemDir;
 // User id information. Each user has a unique id distinguishing them
 // from others. In addition, each user can be listed in one or more user groups.
 struct User {
@@ -66,6 +229,8 @@ struct User {
 };
 
 class FilesystemDb;
+class Ofs;
+class Osd;
 // A prototype re-implementation of the TableFS published at USENIX ATC 2013
 // (https://www.usenix.org/node/174519). Implementation is thread-safe.
 class Filesystem {
@@ -81,17 +246,85 @@ class Filesystem {
   Status Mkdir(const User& who, const char* pathname, uint32_t mode,
                FilesystemDbStats* stats);
   Status Rmdir(const User& who, const char* pathname, FilesystemDbStats* stats);
+  // Remove a dir along with everything beneath it. Names are removed with one
+  // db range deletion per dir, so the number of db writes does not grow with
+  // the number of files in the tree.
+  Status RemoveTree(const User& who, const char* pathname,
+                    FilesystemDbStats* stats);
   Status Lstat(const User& who, const char* pathname, Stat* stat,
                FilesystemDbStats* stats);
+  // Same as above, but relative pathnames are resolved from the dir referred
+  // to by "at" instead of the root. Absolute pathnames are resolved from the
+  // root as usual. Resolution starts from the dir's pinned stat, so no lookups
+  // are spent on the dir's ancestors. Unlike an open dirfd, a pinned dir is
+  // not checked for removal or permission changes made after it was opened.
+  // Names created beneath a removed dir cannot be reached and are never
+  // removed from db.
+  Status Creatat(const User& who, FilesystemDir* at, const char* pathname,
+                 uint32_t mode, FilesystemDbStats* stats);
+  Status Unlnkat(const User& who, FilesystemDir* at, const char* pathname,
+                 FilesystemDbStats* stats);
+  Status Mkdirat(const User& who, FilesystemDir* at, const char* pathname,
+                 uint32_t mode, FilesystemDbStats* stats);
+  Status Lstatat(const User& who, FilesystemDir* at, const char* pathname,
+                 Stat* stat, FilesystemDbStats* stats);
+  // Attribute updates. These are written to db as blind updates that db
+  // merges into the target's stat at read time. The target's change time is
+  // set to the current time. Time values are in microseconds.
+  Status Chmod(const User& who, const char* pathname, uint32_t mode,
+               FilesystemDbStats* stats);
+  Status Chown(const User& who, const char* pathname, uint32_t uid,
+               uint32_t gid, FilesystemDbStats* stats);
+  Status Utimes(const User& who, const char* pathname, uint64_t mtime,
+                FilesystemDbStats* stats);
+  Status Truncate(const User& who, const char* pathname, uint64_t size,
+                  FilesystemDbStats* stats);
+
+  // File contents. Reads stop at the end of a file. Writes past the end of a
+  // file extend it and fill the gap with zeros. Writes to files stored in ofs
+  // rewrite only the chunks they touch. Writes and truncates that would grow
+  // a file past the max file size fail with a Range status.
+  Status Pread(const User& who, const char* pathname, uint64_t off, size_t n,
+               Slice* result, char* scratch, FilesystemDbStats* stats);
+  Status Pwrite(const User& who, const char* pathname, uint64_t off,
+                const Slice& data, FilesystemDbStats* stats);
+  // Replace the entire contents of a file.
+  Status Write(const User& who, const char* pathname, const Slice& data,
+               FilesystemDbStats* stats);
 
   Status Opendir(const User& who, const char* pathname, FilesystemDir** dir,
                  FilesystemDbStats* stats);
   Status Readdir(FilesystemDir* dir, Stat* stat, std::string* name);
   Status Closdir(FilesystemDir* dir);
 
+  // Store an aggregated snapshot of per-op stats in *result. Return
+  // NotSupported if op stats are disabled.
+  Status GetOpStats(FilesystemOpStats* result);
+
+  // Make all updates so far durable as a new epoch and return the epoch's
+  // number. Epochs are numbered from 1 and numbers persist across reopens.
+  // Updates wait while the epoch is cut, but not while it is written out.
+  Status SyncEpoch(uint64_t* epoch);
+
   uint64_t TEST_GetCurrentInoseq();
+  uint64_t TEST_GetLastEpoch();
 
  private:
+  class OpTimer;
+  class UpdateLock;
+  // Lock one of the stripe mutexes, accounting for time spent waiting.
+  void LockStripe(port::Mutex* mu, FilesystemDbStats* stats);
+  static void DumpOpStatsWrapper(void* arg);
+  void DumpOpStats();
+  // Wake the epoch sealer if updates have filled the db's write buffer.
+  void MaybeSealEpoch();
+  static void SealEpochsWrapper(void* arg);
+  void SealEpochs();
+
+  // Return the dir from which a given pathname is resolved. This is the root
+  // dir if "at" is NULL or if the pathname is absolute.
+  const Stat& StartDir(const FilesystemDir* at, const char* pathname) const;
+
   // Resolve a filesystem path down to the last component of the path. Return
   // the name of the last component and information of its parent directory on
   // success. In addition, return whether the specified path has tailing
@@ -113,6 +346,12 @@ class Filesystem {
                 const char* pathname, Stat* parent_dir, Slice* last_component,
                 const char** remaining_path, FilesystemDbStats* stats);
 
+  // Look up the dir reached by the dir prefix of a path in the path cache,
+  // where key encodes the prefix along with the dir it starts from. Return
+  // true and the dir on a valid hit the user is allowed to resolve.
+  bool ProbePathCache(const User& who, const Stat& at, const Slice& key,
+                      Stat* dir);
+
   // Retrieve information with the help of an in-mem cache. This function is a
   // wrapper function over "Fetch" which reads data from db. Information is
   // first attempted at the cache before the more costly "Fetch" operation is
@@ -129,6 +368,15 @@ class Filesystem {
 
   Status RemoveDir(const User& who, const Stat& parent_dir, const Slice& name,
                    Stat* stat, FilesystemDbStats* stats);
+  Status RemoveSubtree(const User& who, const Stat& parent_dir,
+                       const Slice& name, FilesystemDbStats* stats);
+  // List every dir in the tree rooted at a given dir, including the dir
+  // itself. Optionally, also return the lookup keys of the dirs beneath the
+  // top dir and the large files whose contents are held in ofs. Unless who
+  // is NULL, fail with AccessDenied if the user may not list or update one
+  // of the dirs.
+  Status WalkSubtree(const User* who, const Stat& top, std::vector<Stat>* dirs,
+                     std::vector<std::string>* keys, std::vector<Stat>* files);
 
   // Retrieve information of a name under a given parent directory. If mode is
   // specified, only names of a matching file type (e.g., S_IFDIR, S_IFREG) are
@@ -136,6 +384,52 @@ class Filesystem {
   Status Fetch(const User& who, const Stat& parent_dir, const Slice& name,
                uint32_t mode, Stat* stat, FilesystemDbStats* stats);
 
+  // Apply a partial update to the stat of an existing node. Unless setattr
+  // checks are skipped, check the node's existence, type, and access
+  // permissions before the update is written.
+  Status Setattr(const User& who, const char* pathname, FilesystemOpType op,
+                 const FilesystemDbStatUpdate& update,
+                 FilesystemDbStats* stats);
+
+  // Read up to n bytes of a file starting at a given offset.
+  Status ReadAt(const User& who, const Stat& parent_dir, const Slice& name,
+                uint64_t off, size_t n, Slice* result, char* scratch,
+                FilesystemDbStats* stats);
+  // Write data to a file at a given offset. Set trunc to true to discard the
+  // file's existing contents first.
+  Status WriteAt(const User& who, const Stat& parent_dir, const Slice& name,
+                 uint64_t off, const Slice& data, bool trunc,
+                 FilesystemDbStats* stats);
+
+  // Read the first n bytes of a file, where n is no larger than the inline
+  // data limit. Stored contents may be shorter than the file, in which case
+  // the rest of the file reads as zeros.
+  Status LoadData(const DirId& pdir, const Slice& name, const Stat& stat,
+                  size_t n, std::string* data, FilesystemDbStats* stats);
+  // Store the contents of a file no larger than the inline data limit in db,
+  // removing any chunks left from when the file was larger.
+  Status StoreData(const DirId& pdir, const Slice& name, const Stat& stat,
+                   const Slice& data, FilesystemDbStats* stats);
+  // Remove the contents of a file. Set stat to NULL if the file's stat is not
+  // known, in which case only contents stored in db are removed.
+  Status DropData(const DirId& pdir, const Slice& name, const Stat* stat,
+                  FilesystemDbStats* stats);
+  // Remove the contents of a file cut off by truncating it to a given size.
+  Status TrimData(const DirId& pdir, const Slice& name, const Stat& stat,
+                  uint64_t size, FilesystemDbStats* stats);
+
+  // Contents of large files, stored in ofs chunks. Chunks that do not exist
+  // read as zeros.
+  Status ReadChunks(const Stat& stat, uint64_t off, size_t n, char* scratch);
+  Status WriteChunks(const Stat& stat, uint64_t off, const Slice& data);
+  // Remove the chunk contents of a file at and past a given offset.
+  Status DropChunks(const Stat& stat, uint64_t off);
+  // Remove the chunks of all files numbered at or past a given inode no.
+  Status PurgeChunks(uint64_t ino);
+
+  // Assign an inode no. to a new file or directory.
+  Status NewInodeNo(uint64_t* ino);
+
   // Insert a new node beneath a given parent directory. Check name conflicts
   // and return OK and the stat of the newly created node on success.
   Status Put(const User& who, const Stat& parent_dir, const Slice& name,
@@ -155,6 +449,20 @@ class Filesystem {
   enum { kWay = 8 };  // Must be a power of 2
   port::Mutex mus_[kWay];
   FilesystemLookupCache* cache_;
+  FilesystemNameCache* ncache_;  // NULL if the name cache is disabled
+  FilesystemPathCache* pcache_;  // NULL if the path cache is disabled
+  FilesystemLargeDirs* ldirs_;   // NULL if scan mode listings are disabled
+  FilesystemOpStatsHub* hub_;  // NULL if op stats are disabled
+  // Periodic epoch sealing
+  port::Mutex emu_;
+  port::CondVar ecv_;
+  bool sealer_running_;  // Guarded by emu_
+  bool shutting_down_;   // Guarded by emu_
+  bool seal_requested_;  // Guarded by emu_
+  // Held shared by every update in epoch mode, and exclusively while an
+  // epoch is cut
+  port::RWLock elk_;
+  port::Mutex smu_;  // Serializes epoch seals
   port::Mutex rmu_;
   FilesystemRoot* r_;
   // Root encoding of fs at the time fs was opened. This prevents us from
@@ -166,6 +474,8 @@ class Filesystem {
   Filesystem(const Filesystem&);
   FilesystemOptions options_;
   FilesystemDb* db_;
+  Osd* osd_;
+  Ofs* ofs_;  // NULL if large files cannot be accessed
 };
 
 }  // namespace pdlfs
@@ -37,17 +37,53 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include "fsdb.h"
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/testharness.h"
 #include "port.h"
 
 namespace pdlfs {
 
+// Remove the file set holding the contents of large files. DestroyDb only
+// removes the files of the db.
+void DestroyData(const std::string& fsloc) {
+  Env* const env = Env::Default();
+  const std::string dir = fsloc + "/data";
+  std::vector<std::string> names;
+  env->GetChildren(dir.c_str(), &names);
+  for (size_t i = 0; i < names.size(); i++) {
+    env->DeleteFile((dir + "/" + names[i]).c_str());
+  }
+  env->DeleteDir(dir.c_str());
+}
+
+// Copy the files of an fs image as they are on storage at this moment. An fs
+// opened from the copy sees what an fs reopened after a crash would.
+void CopyImage(const std::string& src, const std::string& dst) {
+  Env* const env = Env::Default();
+  const char* const subdirs[] = {"", "/data"};
+  for (size_t i = 0; i < 2; i++) {
+    const std::string from = src + subdirs[i];
+    const std::string to = dst + subdirs[i];
+    env->CreateDir(to.c_str());
+    std::vector<std::string> names;
+    ASSERT_OK(env->GetChildren(from.c_str(), &names));
+    for (size_t j = 0; j < names.size(); j++) {
+      if (names[j] != "." && names[j] != ".." && names[j] != "data") {
+        ASSERT_OK(env->CopyFile((from + "/" + names[j]).c_str(),
+                                (to + "/" + names[j]).c_str()));
+      }
+    }
+  }
+}
+
 class FilesystemTest {
  public:
   FilesystemTest() : fs_(NULL) {
     fsloc_ = test::TmpDir() + "/filesystem_test";
+    DestroyData(fsloc_);
     DestroyDb(fsloc_);
     me.uid = 1;
     me.gid = 1;
@@ -86,6 +122,32 @@ class FilesystemTest {
 
   Status Rmdir(const char* path) { return fs_->Rmdir(me, path, &stats_); }
 
+  Status Chmod(const char* path, uint32_t mode) {
+    return fs_->Chmod(me, path, mode, &stats_);
+  }
+
+  Status Fstat(const char* path, Stat* stat) {
+    return fs_->Lstat(me, path, stat, &stats_);
+  }
+
+  Status Pwrite(const char* path, uint64_t off, const Slice& data) {
+    return fs_->Pwrite(me, path, off, data, &stats_);
+  }
+
+  std::string Read(const char* path, uint64_t off = 0, size_t n = 100) {
+    std::string scratch(n, 'x');
+    Slice result;
+    Status s = fs_->Pread(me, path, off, n, &result, &scratch[0], &stats_);
+    if (!s.ok()) return s.ToString();
+    return result.ToString();
+  }
+
+  uint64_t Fsize(const char* path) {
+    Stat stat;
+    ASSERT_OK(Fstat(path, &stat));
+    return stat.FileSize();
+  }
+
   ~FilesystemTest() {
     if (fs_) {
       delete fs_;
@@ -114,10 +176,61 @@ TEST(FilesystemTest, OpenAndReopen) {
   ASSERT_OK(Exist("/1"));
 }
 
+TEST(FilesystemTest, EpochDurability) {
+  const std::string crashloc = fsloc_ + "_crash";
+  DestroyData(crashloc);
+  DestroyDb(crashloc);
+  options_.epoch_durability = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/1"));
+  ASSERT_OK(Mkdir("/2"));
+  uint64_t epoch;
+  ASSERT_OK(fs_->SyncEpoch(&epoch));
+  ASSERT_EQ(epoch, 1);
+  ASSERT_OK(Creat("/2/3"));
+  ASSERT_OK(Unlnk("/1"));
+  CopyImage(fsloc_, crashloc);
+  // Closing seals another epoch
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_EQ(fs_->TEST_GetLastEpoch(), 2);
+  ASSERT_OK(Exist("/2/3"));
+  ASSERT_NOTFOUND(Exist("/1"));
+  // A crash loses what followed the last sealed epoch
+  delete fs_;
+  fs_ = NULL;
+  fsloc_ = crashloc;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_EQ(fs_->TEST_GetLastEpoch(), 1);
+  ASSERT_EQ(fs_->TEST_GetCurrentInoseq(), 3);
+  ASSERT_OK(Exist("/1"));
+  ASSERT_OK(Exist("/2"));
+  ASSERT_NOTFOUND(Exist("/2/3"));
+  ASSERT_OK(fs_->SyncEpoch(&epoch));
+  ASSERT_EQ(epoch, 2);
+}
+
+TEST(FilesystemTest, EpochDurability_FullWriteBuffer) {
+  options_.epoch_durability = true;
+  options_.memory_budget = 1 << 20;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  char path[20];
+  // Filling the write buffer seals an epoch without it being asked for
+  for (int i = 0; i < 5000; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Creat(path));
+  }
+  for (int i = 0; i < 100 && fs_->TEST_GetLastEpoch() == 0; i++) {
+    SleepForMicroseconds(10000);
+  }
+  ASSERT_TRUE(fs_->TEST_GetLastEpoch() != 0);
+}
+
 TEST(FilesystemTest, Files) {
   ASSERT_OK(OpenFilesystem());
   ASSERT_OK(Creat("/1"));
   ASSERT_CONFLICT(Creat("/1"));
+  ASSERT_EQ(fs_->TEST_GetCurrentInoseq(), 2);  // No inode no. used up
   ASSERT_OK(Exist("/1"));
   ASSERT_OK(Exist("//1"));
   ASSERT_OK(Exist("///1"));
@@ -127,6 +240,17 @@ TEST(FilesystemTest, Files) {
   ASSERT_OK(Creat("/2"));
 }
 
+TEST(FilesystemTest, Files_MemTableHashIndex) {
+  options_.memtable_hash_index = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/1"));
+  ASSERT_CONFLICT(Creat("/1"));
+  ASSERT_OK(Unlnk("/1"));
+  ASSERT_NOTFOUND(Exist("/1"));
+  ASSERT_OK(Creat("/1"));
+  ASSERT_OK(Exist("/1"));
+}
+
 TEST(FilesystemTest, Files_NoDupChecks) {
   options_.skip_name_collision_checks = true;
   ASSERT_OK(OpenFilesystem());
@@ -204,6 +328,51 @@ TEST(FilesystemTest, Dirs_Deletes_NoChecks) {
   ASSERT_OK(Rmdir("/4"));
 }
 
+TEST(FilesystemTest, RemoveTree) {
+  options_.size_lookup_cache = 128;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_OK(fs_->Write(me, "/1/a", "hello", &stats_));
+  ASSERT_OK(Mkdir("/1/b"));
+  ASSERT_OK(Creat("/1/b/c"));
+  ASSERT_OK(Mkdir("/1/b/d"));
+  ASSERT_OK(Creat("/1/b/d/e"));
+  ASSERT_OK(Creat("/2"));
+  ASSERT_TRUE(fs_->RemoveTree(me, "/2", &stats_).IsDirExpected());
+  ASSERT_NOTFOUND(fs_->RemoveTree(me, "/3", &stats_));
+  ASSERT_OK(fs_->RemoveTree(me, "/1", &stats_));
+  ASSERT_NOTFOUND(Exist("/1"));
+  ASSERT_NOTFOUND(Exist("/1/b/c"));
+  ASSERT_OK(Exist("/2"));
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Mkdir("/1/b"));
+  ASSERT_NOTFOUND(Exist("/1/a"));
+  ASSERT_NOTFOUND(Exist("/1/b/c"));
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Exist("/1/b"));
+  ASSERT_NOTFOUND(Exist("/1/b/d"));
+}
+
+TEST(FilesystemTest, RemoveTree_WithCache) {
+  options_.size_lookup_cache = 128;
+  options_.size_path_cache = 128;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Mkdir("/1/b"));
+  ASSERT_OK(Mkdir("/1/b/d"));
+  ASSERT_OK(Creat("/1/b/d/e"));
+  FilesystemDir* dir;
+  ASSERT_OK(fs_->Opendir(me, "/1/b", &dir, NULL));
+  ASSERT_OK(fs_->Creatat(me, dir, "d/f", 0660, &stats_));
+  ASSERT_OK(fs_->RemoveTree(me, "/1", &stats_));
+  // Cached lookups through the removed tree must not let names be created
+  // in dirs that are gone
+  ASSERT_NOTFOUND(fs_->Creatat(me, dir, "d/g", 0660, &stats_));
+  ASSERT_NOTFOUND(Exist("/1/b/d/e"));
+  ASSERT_OK(fs_->Closdir(dir));
+}
+
 TEST(FilesystemTest, Subdirs) {
   ASSERT_OK(OpenFilesystem());
   ASSERT_OK(Mkdir("/1"));
@@ -300,6 +469,48 @@ TEST(FilesystemTest, Resolv_WithCache) {
   ASSERT_EQ(stats_.gets, 1);
 }
 
+TEST(FilesystemTest, Resolv_WithPathCache) {
+  options_.size_path_cache = 128;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Mkdir("/1/2"));
+  ASSERT_OK(Mkdir("/1/2/3"));
+  ASSERT_OK(Mkdir("/1/2/3/4"));
+  ASSERT_OK(Mkdir("/1/2/3/4/5"));
+  ASSERT_OK(Creat("/1/2/3/4/5/6"));
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(Exist("/1/2/3/4/5/6"));
+  ASSERT_EQ(stats_.pathcachehits, 1);
+  ASSERT_EQ(stats_.lookups, 0);
+  ASSERT_EQ(stats_.gets, 1);
+  ASSERT_OK(Exist("//1/2//3/4/5///6"));
+  ASSERT_EQ(stats_.pathcachehits, 2);
+  // Removing a dir invalidates every path through it
+  ASSERT_NOTFOUND(Exist("/1/2/3/4/5/x/y"));
+  ASSERT_OK(Mkdir("/1/2/3/4/5/x"));
+  ASSERT_OK(Creat("/1/2/3/4/5/x/y"));
+  ASSERT_OK(Exist("/1/2/3/4/5/x/y"));
+  ASSERT_OK(Unlnk("/1/2/3/4/5/x/y"));
+  ASSERT_OK(Rmdir("/1/2/3/4/5/x"));
+  stats_ = FilesystemDbStats();
+  ASSERT_NOTFOUND(Exist("/1/2/3/4/5/x/y"));
+  ASSERT_EQ(stats_.pathcachehits, 0);
+  ASSERT_OK(Mkdir("/1/2/3/4/5/x"));
+  ASSERT_OK(Creat("/1/2/3/4/5/x/y"));
+  ASSERT_OK(Exist("/1/2/3/4/5/x/y"));
+  // Changing the permissions of a dir invalidates every path through it
+  ASSERT_OK(Chmod("/1/2", 0600));
+  ASSERT_TRUE(Exist("/1/2/3/4/5/6").IsAccessDenied());
+  ASSERT_OK(Chmod("/1/2", 0700));
+  ASSERT_OK(Exist("/1/2/3/4/5/6"));
+  // Lookup permissions are still checked on a hit
+  User other = me;
+  other.uid = 2;
+  other.gid = 2;
+  Stat stat;
+  ASSERT_TRUE(fs_->Lstat(other, "/1/2/3/4/5/6", &stat, NULL).IsAccessDenied());
+}
+
 TEST(FilesystemTest, Rmdir_WithCache) {
   options_.size_lookup_cache = 128;
   ASSERT_OK(OpenFilesystem());
@@ -315,6 +526,390 @@ TEST(FilesystemTest, Rmdir_WithCache) {
   ASSERT_OK(Exist("/1/a"));
 }
 
+TEST(FilesystemTest, NameCache) {
+  options_.size_name_cache = 16;
+  options_.max_names_per_cached_dir = 300;
+  ASSERT_OK(OpenFilesystem());
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_EQ(stats_.namecachehits, 2);
+  ASSERT_EQ(stats_.gets, 1);  // Resolving /1
+  ASSERT_CONFLICT(Creat("/1/a"));
+  ASSERT_CONFLICT(Mkdir("/1"));
+  ASSERT_EQ(stats_.namecachehits, 2);
+  char path[20];
+  for (int i = 0; i < 200; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Creat(path));
+  }
+  for (int i = 0; i < 200; i += 2) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Unlnk(path));
+  }
+  stats_ = FilesystemDbStats();
+  for (int i = 0; i < 200; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    if (i % 2 == 0) {
+      ASSERT_OK(Creat(path));
+    } else {
+      ASSERT_CONFLICT(Creat(path));
+    }
+  }
+  ASSERT_EQ(stats_.namecachehits, 100);
+  // Dirs growing too large are no longer cached
+  for (int i = 200; i < 400; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Creat(path));
+  }
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(Creat("/1/b"));
+  ASSERT_EQ(stats_.namecachehits, 0);
+  // Names do not survive removing their dir
+  ASSERT_OK(Mkdir("/2"));
+  ASSERT_OK(Creat("/2/a"));
+  ASSERT_OK(Unlnk("/2/a"));
+  ASSERT_OK(Rmdir("/2"));
+  ASSERT_OK(Mkdir("/2"));
+  ASSERT_OK(Creat("/2/a"));
+  ASSERT_CONFLICT(Creat("/2/a"));
+  // Dirs created before the fs was opened are not cached
+  ASSERT_OK(OpenFilesystem());
+  stats_ = FilesystemDbStats();
+  ASSERT_CONFLICT(Creat("/2/a"));
+  ASSERT_OK(Creat("/2/b"));
+  ASSERT_EQ(stats_.namecachehits, 0);
+}
+
+TEST(FilesystemTest, Atops) {
+  options_.size_lookup_cache = 0;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Mkdir("/1/2"));
+  ASSERT_OK(Mkdir("/1/2/3"));
+  FilesystemDir* dir;
+  ASSERT_OK(fs_->Opendir(me, "/1/2/3", &dir, NULL));
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(fs_->Creatat(me, dir, "a", 0660, &stats_));
+  ASSERT_OK(fs_->Mkdirat(me, dir, "b", 0770, &stats_));
+  ASSERT_OK(fs_->Creatat(me, dir, "b/c", 0660, &stats_));
+  // One get per dup check plus one for "b", none for the ancestors of dir
+  ASSERT_EQ(stats_.gets, 4);
+  Stat stat;
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(fs_->Lstatat(me, dir, "a", &stat, &stats_));
+  ASSERT_TRUE(S_ISREG(stat.FileMode()));
+  ASSERT_OK(fs_->Lstatat(me, dir, "b/", &stat, &stats_));
+  ASSERT_TRUE(S_ISDIR(stat.FileMode()));
+  ASSERT_OK(fs_->Lstatat(me, dir, "b//c", &stat, &stats_));
+  ASSERT_TRUE(S_ISREG(stat.FileMode()));
+  ASSERT_EQ(stats_.gets, 4);
+  ASSERT_TRUE(fs_->Lstatat(me, dir, "x", &stat, &stats_).IsNotFound());
+  ASSERT_TRUE(fs_->Creatat(me, dir, "a", 0660, &stats_).IsAlreadyExists());
+  // Absolute paths ignore the dir
+  ASSERT_OK(fs_->Creatat(me, dir, "/d", 0660, &stats_));
+  ASSERT_OK(Exist("/d"));
+  ASSERT_OK(Exist("/1/2/3/b/c"));
+  ASSERT_OK(fs_->Unlnkat(me, dir, "b/c", &stats_));
+  ASSERT_ERR(Exist("/1/2/3/b/c"));
+  std::set<std::string> set;
+  Listdir(dir, &set);
+  ASSERT_EQ(set.size(), 2);
+  ASSERT_TRUE(set.count("a") == 1);
+  ASSERT_TRUE(set.count("b") == 1);
+  ASSERT_OK(fs_->Closdir(dir));
+}
+
+TEST(FilesystemTest, Setattr) {
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(Chmod("/1/a", 0600));
+  User root;
+  root.uid = root.gid = 0;
+  ASSERT_OK(fs_->Chown(root, "/1/a", 1, 2, &stats_));
+  ASSERT_OK(fs_->Utimes(me, "/1/a", 12345, &stats_));
+  ASSERT_OK(fs_->Truncate(me, "/1/a", 100, &stats_));
+  ASSERT_EQ(stats_.puts, 0);
+  ASSERT_EQ(stats_.updates, 4);
+  Stat stat;
+  ASSERT_OK(Fstat("/1/a", &stat));
+  ASSERT_EQ(stat.FileMode(), S_IFREG | 0600);
+  ASSERT_EQ(stat.UserId(), 1);
+  ASSERT_EQ(stat.GroupId(), 2);
+  ASSERT_EQ(stat.FileSize(), 100);
+  ASSERT_TRUE(stat.ModifyTime() > 12345);  // Truncate updates mtime
+  ASSERT_TRUE(stat.ChangeTime() != 0);
+  ASSERT_OK(fs_->Utimes(me, "/1/a", 12345, &stats_));
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Fstat("/1/a", &stat));
+  ASSERT_EQ(stat.ModifyTime(), 12345);
+  ASSERT_EQ(stat.FileSize(), 100);
+  ASSERT_NOTFOUND(Chmod("/1/b", 0600));
+  ASSERT_ERR(fs_->Truncate(me, "/1", 0, &stats_));
+  ASSERT_ERR(Chmod("/", 0700));
+  me.uid = me.gid = 2;
+  ASSERT_ERR(Chmod("/1/a", 0666));
+  ASSERT_ERR(fs_->Chown(me, "/1/a", 2, 2, &stats_));
+}
+
+TEST(FilesystemTest, Setattr_NoChecks) {
+  options_.skip_setattr_checks = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  stats_ = FilesystemDbStats();
+  ASSERT_OK(Chmod("/1/a", 0640));
+  ASSERT_OK(Chmod("/1/b", 0640));  // Silently dropped
+  ASSERT_OK(fs_->Truncate(me, "/1", 100, &stats_));
+  ASSERT_EQ(stats_.gets, 3);  // Path resolution and the truncate target
+  Stat stat;
+  ASSERT_OK(Fstat("/1/a", &stat));
+  ASSERT_EQ(stat.FileMode(), S_IFREG | 0640);
+  ASSERT_NOTFOUND(Exist("/1/b"));
+  ASSERT_OK(Fstat("/1", &stat));
+  ASSERT_EQ(stat.FileSize(), 0);  // Size updates only apply to files
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Fstat("/1/a", &stat));
+  ASSERT_EQ(stat.FileMode(), S_IFREG | 0640);
+  ASSERT_NOTFOUND(Exist("/1/b"));
+}
+
+TEST(FilesystemTest, Setattr_WithCache) {
+  options_.size_lookup_cache = 128;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_OK(Chmod("/1", 0777));  // Must remove dir from cache
+  me.uid = me.gid = 2;
+  // If chmod didn't clean up the cache, the old modes will be used
+  ASSERT_OK(Exist("/1/a"));
+}
+
+TEST(FilesystemTest, MemoryBudget) {
+  options_.memory_budget = 1 << 20;
+  options_.size_lookup_cache = 128;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  char path[20];
+  for (int i = 0; i < 5000; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Creat(path));
+  }
+  ASSERT_OK(OpenFilesystem());
+  for (int i = 0; i < 5000; i++) {
+    snprintf(path, sizeof(path), "/1/%d", i);
+    ASSERT_OK(Exist(path));
+  }
+}
+
+TEST(FilesystemTest, Data) {
+  options_.max_inline_data_size = 16;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_EQ(Read("/1/a"), "");
+  ASSERT_OK(fs_->Write(me, "/1/a", "hello", &stats_));
+  stats_ = FilesystemDbStats();
+  ASSERT_EQ(Read("/1/a"), "hello");
+  ASSERT_EQ(stats_.gets, 3);  // Path resolution, stat, and data
+  ASSERT_OK(Pwrite("/1/a", 8, "world"));
+  ASSERT_EQ(Fsize("/1/a"), 13);
+  ASSERT_EQ(Read("/1/a"), std::string("hello\0\0\0world", 13));
+  ASSERT_EQ(Read("/1/a", 8, 3), "wor");
+  ASSERT_EQ(Read("/1/a", 20, 3), "");
+  // Grow the file past the inline limit
+  ASSERT_OK(Pwrite("/1/a", 13, "0123456789"));
+  ASSERT_EQ(Fsize("/1/a"), 23);
+  ASSERT_EQ(Read("/1/a", 10, 5), "rld01");
+  ASSERT_OK(Pwrite("/1/a", 0, "HELLO"));
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_EQ(Read("/1/a"), std::string("HELLO\0\0\0world0123456789", 23));
+  ASSERT_OK(fs_->Truncate(me, "/1/a", 5, &stats_));
+  ASSERT_EQ(Read("/1/a"), "HELLO");
+  // Contents cut off by a truncate must not come back
+  ASSERT_OK(fs_->Truncate(me, "/1/a", 7, &stats_));
+  ASSERT_EQ(Read("/1/a"), std::string("HELLO\0\0", 7));
+  ASSERT_OK(fs_->Write(me, "/1/a", "hi", &stats_));
+  ASSERT_EQ(Read("/1/a"), "hi");
+  ASSERT_OK(Unlnk("/1/a"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_OK(fs_->Truncate(me, "/1/a", 3, &stats_));
+  ASSERT_EQ(Read("/1/a"), std::string(3, '\0'));
+  ASSERT_TRUE(Pwrite("/1", 0, "x").IsFileExpected());
+  ASSERT_NOTFOUND(Pwrite("/1/b", 0, "x"));
+  // Contents are not listed as dir entries
+  FilesystemDir* dir;
+  ASSERT_OK(fs_->Opendir(me, "/1", &dir, NULL));
+  std::set<std::string> set;
+  Listdir(dir, &set);
+  ASSERT_EQ(set.size(), 1);
+  ASSERT_OK(fs_->Closdir(dir));
+}
+
+TEST(FilesystemTest, Data_LargeFiles) {
+  options_.max_inline_data_size = 16;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/a"));
+  ASSERT_OK(fs_->Write(me, "/a", "hello", &stats_));
+  // A sparse write far into the file only stores the chunks it touches
+  const uint64_t off = (uint64_t(1) << 30) - 2;
+  ASSERT_OK(Pwrite("/a", off, "world"));
+  ASSERT_EQ(Fsize("/a"), off + 5);
+  ASSERT_EQ(Read("/a", 0, 7), std::string("hello\0\0", 7));
+  ASSERT_EQ(Read("/a", off - 1, 100), std::string("\0world", 6));
+  ASSERT_EQ(Read("/a", 1 << 20, 3), std::string(3, '\0'));
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_EQ(Read("/a", off, 5), "world");
+  // Cut the file in the middle of the last write
+  ASSERT_OK(fs_->Truncate(me, "/a", off + 3, &stats_));
+  ASSERT_OK(fs_->Truncate(me, "/a", off + 5, &stats_));
+  ASSERT_EQ(Read("/a", off, 5), std::string("wor\0\0", 5));
+  ASSERT_OK(fs_->Truncate(me, "/a", 2, &stats_));
+  ASSERT_OK(fs_->Truncate(me, "/a", off + 5, &stats_));
+  ASSERT_EQ(Read("/a", 0, 3), std::string("he\0", 3));
+  ASSERT_EQ(Read("/a", off, 5), std::string(5, '\0'));
+  // Offsets and sizes past the max file size fail without side effects
+  ASSERT_TRUE(Pwrite("/a", uint64_t(1) << 41, "x").IsRange());
+  ASSERT_TRUE(Pwrite("/a", ~uint64_t(0), "x").IsRange());
+  ASSERT_TRUE(Pwrite("/a", ~uint64_t(0) - 1, "xyz").IsRange());
+  ASSERT_TRUE(fs_->Truncate(me, "/a", ~uint64_t(0), &stats_).IsRange());
+  ASSERT_EQ(Fsize("/a"), off + 5);
+  ASSERT_OK(Unlnk("/a"));
+}
+
+TEST(FilesystemTest, Data_LargeFiles_NoChecks) {
+  options_.max_inline_data_size = 16;
+  options_.skip_deletion_checks = true;
+  options_.skip_setattr_checks = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/a"));
+  ASSERT_OK(Pwrite("/a", 0, std::string(100, 'a')));
+  // Contents cut off by a truncate are still removed
+  ASSERT_OK(fs_->Truncate(me, "/a", 50, &stats_));
+  ASSERT_OK(fs_->Truncate(me, "/a", 100, &stats_));
+  ASSERT_EQ(Read("/a", 40, 20), std::string(10, 'a') + std::string(10, '\0'));
+  // So are those of an unlinked file
+  Stat stat;
+  ASSERT_OK(Fstat("/a", &stat));
+  char chunk[30];
+  snprintf(chunk, sizeof(chunk), "%016llx.",
+           static_cast<unsigned long long>(stat.InodeNo()));
+  ASSERT_OK(Unlnk("/a"));
+  std::vector<std::string> names;
+  ASSERT_OK(Env::Default()->GetChildren((fsloc_ + "/data").c_str(), &names));
+  for (size_t i = 0; i < names.size(); i++) {
+    ASSERT_TRUE(names[i].find(chunk) == std::string::npos);
+  }
+}
+
+TEST(FilesystemTest, Data_LargeFiles_Crash) {
+  const std::string crashloc = fsloc_ + "_crash";
+  DestroyData(crashloc);
+  DestroyDb(crashloc);
+  options_.max_inline_data_size = 16;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/a"));
+  ASSERT_OK(Pwrite("/a", 0, std::string(100, 'a')));
+  CopyImage(fsloc_, crashloc);
+  delete fs_;
+  fs_ = NULL;
+  fsloc_ = crashloc;
+  // Inode nos handed out before the crash are not handed out again
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_EQ(Read("/a", 0, 3), "aaa");
+  ASSERT_OK(Creat("/b"));
+  ASSERT_OK(fs_->Truncate(me, "/b", 100, &stats_));
+  ASSERT_EQ(Read("/b", 0, 3), std::string(3, '\0'));
+}
+
+TEST(FilesystemTest, Data_LargeFiles_EpochRollback) {
+  const std::string crashloc = fsloc_ + "_crash";
+  DestroyData(crashloc);
+  DestroyDb(crashloc);
+  options_.max_inline_data_size = 16;
+  options_.epoch_durability = true;
+  ASSERT_OK(OpenFilesystem());
+  uint64_t epoch;
+  ASSERT_OK(fs_->SyncEpoch(&epoch));
+  ASSERT_OK(Creat("/a"));
+  ASSERT_OK(Pwrite("/a", 0, std::string(100, 'a')));
+  CopyImage(fsloc_, crashloc);
+  delete fs_;
+  fs_ = NULL;
+  fsloc_ = crashloc;
+  // The file is lost, and so are its contents once its inode no. is reused
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_NOTFOUND(Exist("/a"));
+  ASSERT_OK(Creat("/b"));
+  ASSERT_OK(fs_->Truncate(me, "/b", 100, &stats_));
+  ASSERT_EQ(Read("/b", 0, 3), std::string(3, '\0'));
+}
+
+TEST(FilesystemTest, Data_AccessDenied) {
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Creat("/a"));
+  ASSERT_OK(fs_->Write(me, "/a", "hello", &stats_));
+  ASSERT_OK(Chmod("/a", 0600));
+  me.uid = me.gid = 2;
+  ASSERT_TRUE(Pwrite("/a", 0, "x").IsAccessDenied());
+  char tmp[10];
+  Slice result;
+  ASSERT_TRUE(fs_->Pread(me, "/a", 0, sizeof(tmp), &result, tmp, &stats_)
+                  .IsAccessDenied());
+}
+
+TEST(FilesystemTest, OpStats) {
+  options_.size_lookup_cache = 128;
+  options_.enable_op_stats = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Mkdir("/1/2"));
+  ASSERT_OK(Creat("/1/2/a"));
+  ASSERT_CONFLICT(Creat("/1/2/a"));
+  ASSERT_OK(Exist("/1/2/a"));
+  ASSERT_OK(Unlnk("/1/2/a"));
+  FilesystemOpStats stats;
+  ASSERT_OK(fs_->GetOpStats(&stats));
+  ASSERT_EQ(stats.ops[kFsMkdir], 2);
+  ASSERT_EQ(stats.ops[kFsCreat], 2);
+  ASSERT_EQ(stats.errs[kFsCreat], 1);
+  ASSERT_EQ(stats.ops[kFsLstat], 1);
+  ASSERT_EQ(stats.ops[kFsUnlnk], 1);
+  ASSERT_EQ(stats.errs[kFsUnlnk], 0);
+  ASSERT_EQ(stats.db_dels, 1);
+  // Only the first lookup of each dir misses the cache
+  ASSERT_EQ(stats.lookup_cache_misses, 2);
+  ASSERT_EQ(stats.lookup_cache_hits, 7);
+  // Caller stats are still updated
+  ASSERT_EQ(stats_.gets, stats.db_gets);
+  ASSERT_EQ(stats_.puts, stats.db_puts);
+}
+
+TEST(FilesystemTest, OpStats_TimeToFirstOp) {
+  options_.enable_op_stats = true;
+  options_.open_threads = 2;
+  options_.preload_tables = true;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  ASSERT_OK(Creat("/1/a"));
+  ASSERT_OK(OpenFilesystem());
+  FilesystemOpStats stats;
+  ASSERT_OK(fs_->GetOpStats(&stats));
+  ASSERT_EQ(stats.first_op_micros, 0);
+  ASSERT_OK(Exist("/1/a"));
+  ASSERT_OK(fs_->GetOpStats(&stats));
+  ASSERT_GT(stats.first_op_micros, 0);
+  ASSERT_GE(stats.first_op_micros, stats.open_micros);
+}
+
+TEST(FilesystemTest, OpStats_Disabled) {
+  ASSERT_OK(OpenFilesystem());
+  FilesystemOpStats stats;
+  ASSERT_TRUE(fs_->GetOpStats(&stats).IsNotSupported());
+}
+
 TEST(FilesystemTest, Listdir1) {
   ASSERT_OK(OpenFilesystem());
   ASSERT_OK(Creat("/1"));
@@ -354,6 +949,63 @@ TEST(FilesystemTest, Listdir2) {
   ASSERT_OK(fs_->Closdir(dir));
 }
 
+TEST(FilesystemTest, Listdir_LargeDir) {
+  options_.large_dir_threshold = 50;
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  char path[20];
+  for (int i = 0; i < 200; i++) {
+    snprintf(path, sizeof(path), "/1/%03d", i);
+    ASSERT_OK(Creat(path));
+  }
+  ASSERT_OK(OpenFilesystem());  // Move names into db tables
+  // The first listing finds the dir large and the second one scans it
+  for (int i = 0; i < 2; i++) {
+    FilesystemDir* dir;
+    ASSERT_OK(fs_->Opendir(me, "/1", &dir, NULL));
+    std::set<std::string> set;
+    Listdir(dir, &set);
+    ASSERT_EQ(set.size(), 200);
+    ASSERT_TRUE(set.count("000") == 1);
+    ASSERT_TRUE(set.count("199") == 1);
+    ASSERT_OK(fs_->Closdir(dir));
+  }
+}
+
+TEST(FilesystemTest, Listdir_Stats) {
+  ASSERT_OK(OpenFilesystem());
+  ASSERT_OK(Mkdir("/1"));
+  char path[20];
+  for (int i = 0; i < 100; i++) {
+    snprintf(path, sizeof(path), "/1/%03d", i);
+    ASSERT_OK(Creat(path));
+  }
+  ASSERT_OK(OpenFilesystem());
+  // Entries span more than one read-ahead batch
+  FilesystemDir* dir;
+  ASSERT_OK(fs_->Opendir(me, "/1", &dir, NULL));
+  std::string name;
+  Stat stat;
+  Stat expected;
+  int n = 0;
+  Status status;
+  while (true) {
+    status = fs_->Readdir(dir, &stat, &name);
+    if (!status.ok()) {
+      break;
+    }
+    snprintf(path, sizeof(path), "/1/%s", name.c_str());
+    ASSERT_OK(fs_->Lstat(me, path, &expected, &stats_));
+    ASSERT_EQ(stat.InodeNo(), expected.InodeNo());
+    ASSERT_EQ(stat.FileMode(), expected.FileMode());
+    ASSERT_EQ(stat.ModifyTime(), expected.ModifyTime());
+    n++;
+  }
+  ASSERT_TRUE(status.IsNotFound());
+  ASSERT_EQ(n, 100);
+  ASSERT_OK(fs_->Closdir(dir));
+}
+
 namespace {
 inline int GetIntegerOptionFromEnv(const char* key, int def) {
   const char* const env = getenv(key);
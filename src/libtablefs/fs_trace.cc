@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of CMU, TRIAD, Los Alamos National Laboratory, LANL, the
+ *    U.S. Government, nor the names of its contributors may be used to endorse
+ *    or promote products derived from this software without specific prior
+ *    written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "fs_trace.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/log_reader.h"
+#include "pdlfs-common/log_writer.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <string.h>
+
+namespace pdlfs {
+
+namespace {
+const char kTraceMagic[] = "tablefs-trace-v1";
+const size_t kTraceMagicSize = sizeof(kTraceMagic) - 1;
+
+const char* const kTraceOpNames[kMaxTraceOp + 1] = {
+    "?",     "lstat",  "mkfile", "mkdir", "unlink",   "rmdir", "rmtree",
+    "chmod", "chown",  "utimes", "truncate", "pread", "pwrite", "write",
+    "listdir"};
+}  // namespace
+
+const char* FilesystemTraceOpName(int op) {
+  if (op > 0 && op <= kMaxTraceOp) {
+    return kTraceOpNames[op];
+  } else {
+    return kTraceOpNames[0];
+  }
+}
+
+FilesystemTraceRecord::FilesystemTraceRecord()
+    : micros(0),
+      latency(0),
+      op(0),
+      uid(0),
+      gid(0),
+      arg0(0),
+      arg1(0),
+      err(0) {}
+
+void FilesystemTraceRecord::EncodeTo(std::string* dst) const {
+  PutVarint32(dst, op);
+  PutVarint64(dst, micros);
+  PutVarint64(dst, latency);
+  PutVarint32(dst, uid);
+  PutVarint32(dst, gid);
+  PutVarint64(dst, arg0);
+  PutVarint64(dst, arg1);
+  PutVarint32(dst, err);
+  PutLengthPrefixedSlice(dst, path);
+}
+
+bool FilesystemTraceRecord::DecodeFrom(const Slice& input) {
+  Slice in = input;
+  Slice p;
+  if (GetVarint32(&in, &op) && GetVarint64(&in, &micros) &&
+      GetVarint64(&in, &latency) && GetVarint32(&in, &uid) &&
+      GetVarint32(&in, &gid) && GetVarint64(&in, &arg0) &&
+      GetVarint64(&in, &arg1) && GetVarint32(&in, &err) &&
+      GetLengthPrefixedSlice(&in, &p)) {
+    path = p.ToString();
+    return true;
+  } else {
+    return false;
+  }
+}
+
+FilesystemTracer::FilesystemTracer()
+    : start_micros_(0), file_(NULL), log_(NULL) {}
+
+FilesystemTracer::~FilesystemTracer() {
+  delete log_;
+  delete file_;
+}
+
+Status FilesystemTracer::Open(const char* fname) {
+  Status s = Env::Default()->NewWritableFile(fname, &file_);
+  if (s.ok()) {
+    log_ = new log::Writer(file_);
+    start_micros_ = CurrentMicros();
+    std::string header(kTraceMagic, kTraceMagicSize);
+    PutFixed64(&header, start_micros_);
+    s = log_->AddRecord(header);
+  }
+  return s;
+}
+
+void FilesystemTracer::Record(uint64_t start, FilesystemTraceRecord* rec) {
+  rec->micros = start > start_micros_ ? start - start_micros_ : 0;
+  std::string encoding;
+  rec->EncodeTo(&encoding);
+  MutexLock ml(&mu_);
+  if (status_.ok()) {
+    status_ = log_->AddRecord(encoding);
+  }
+}
+
+Status FilesystemTracer::Close() {
+  MutexLock ml(&mu_);
+  if (file_ != NULL) {
+    if (status_.ok()) status_ = file_->Sync();
+    Status s = file_->Close();
+    if (status_.ok()) status_ = s;
+    delete log_;
+    log_ = NULL;
+    delete file_;
+    file_ = NULL;
+  }
+  return status_;
+}
+
+class FilesystemTraceReader::Reporter : public log::Reader::Reporter {
+ public:
+  explicit Reporter(Status* status) : status_(status) {}
+  virtual void Corruption(size_t bytes, const Status& s) {
+    if (status_->ok()) *status_ = s;
+  }
+
+ private:
+  Status* const status_;
+};
+
+FilesystemTraceReader::FilesystemTraceReader()
+    : reporter_(new Reporter(&status_)),
+      start_micros_(0),
+      file_(NULL),
+      log_(NULL) {}
+
+FilesystemTraceReader::~FilesystemTraceReader() {
+  delete log_;
+  delete file_;
+  delete reporter_;
+}
+
+Status FilesystemTraceReader::Open(const char* fname) {
+  status_ = Env::Default()->NewSequentialFile(fname, &file_);
+  if (status_.ok()) {
+    log_ = new log::Reader(file_, reporter_, true /* checksum */, 0);
+    Slice header;
+    if (!log_->ReadRecord(&header, &scratch_)) {
+      if (status_.ok()) {
+        status_ = Status::Corruption("Empty trace", fname);
+      }
+    } else if (header.size() != kTraceMagicSize + 8 ||
+               memcmp(header.data(), kTraceMagic, kTraceMagicSize) != 0) {
+      status_ = Status::Corruption("Not a trace file", fname);
+    } else {
+      start_micros_ = DecodeFixed64(header.data() + kTraceMagicSize);
+    }
+  }
+  return status_;
+}
+
+bool FilesystemTraceReader::Next(FilesystemTraceRecord* rec) {
+  Slice record;
+  if (!status_.ok() || log_ == NULL) {
+    return false;
+  } else if (!log_->ReadRecord(&record, &scratch_)) {
+    return false;  // Corruption is reported through status_
+  } else if (!rec->DecodeFrom(record)) {
+    status_ = Status::Corruption("Bad trace record");
+    return false;
+  } else {
+    return true;
+  }
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of CMU, TRIAD, Los Alamos National Laboratory, LANL, the
+ *    U.S. Government, nor the names of its contributors may be used to endorse
+ *    or promote products derived from this software without specific prior
+ *    written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
+namespace pdlfs {
+
+class SequentialFile;
+class WritableFile;
+namespace log {
+class Reader;
+class Writer;
+}  // namespace log
+
+// Operations captured in a trace. Values are written to trace files and
+// must not change.
+enum FilesystemTraceOp {
+  kTraceLstat = 1,
+  kTraceMkfile = 2,     // arg0: mode
+  kTraceMkdir = 3,      // arg0: mode
+  kTraceUnlink = 4,
+  kTraceRmdir = 5,
+  kTraceRmtree = 6,
+  kTraceChmod = 7,      // arg0: mode
+  kTraceChown = 8,      // arg0: uid, arg1: gid
+  kTraceUtimes = 9,     // arg0: mtime in micros (0 for the current time)
+  kTraceTruncate = 10,  // arg0: length
+  kTracePread = 11,     // arg0: bytes, arg1: offset
+  kTracePwrite = 12,    // arg0: bytes, arg1: offset
+  kTraceWrite = 13,     // arg0: bytes
+  kTraceListdir = 14,   // Recorded at opendir, replayed as a full listing
+  kMaxTraceOp = kTraceListdir
+};
+
+// Return a short name for a trace op, or "?" for an unknown op.
+extern const char* FilesystemTraceOpName(int op);
+
+// One traced call. Calls made through an opened dir are recorded with
+// their paths resolved against the path of the dir.
+struct FilesystemTraceRecord {
+  FilesystemTraceRecord();
+  uint64_t micros;   // Start time of the call relative to the trace's start
+  uint64_t latency;  // Micros spent in the call
+  uint32_t op;
+  uint32_t uid;  // Caller's identity
+  uint32_t gid;
+  uint64_t arg0;
+  uint64_t arg1;
+  uint32_t err;  // The errno set by the call, or 0 on success
+  std::string path;
+
+  void EncodeTo(std::string* dst) const;
+  bool DecodeFrom(const Slice& input);
+};
+
+// Append trace records to a file in the log format used by db write-ahead
+// logs. The first record of a trace is a header holding the wall-clock time
+// at which the trace was started. Thread-safe.
+class FilesystemTracer {
+ public:
+  FilesystemTracer();
+  ~FilesystemTracer();
+
+  Status Open(const char* fname);
+  uint64_t start_micros() const { return start_micros_; }
+
+  // Fill in the record's relative start time from "start", which is an
+  // absolute time obtained from CurrentMicros(), and append the record.
+  // Errors are sticky: once an append fails, later records are dropped and
+  // the error is returned by Close().
+  void Record(uint64_t start, FilesystemTraceRecord* rec);
+
+  // Flush and close the trace file. Return the first error encountered.
+  Status Close();
+
+ private:
+  port::Mutex mu_;
+  uint64_t start_micros_;
+  WritableFile* file_;
+  log::Writer* log_;
+  Status status_;
+
+  // No copying allowed
+  void operator=(const FilesystemTracer& other);
+  FilesystemTracer(const FilesystemTracer&);
+};
+
+// Read back the records of a trace file.
+class FilesystemTraceReader {
+ public:
+  FilesystemTraceReader();
+  ~FilesystemTraceReader();
+
+  // Open a trace file and read its header.
+  Status Open(const char* fname);
+  // Wall-clock time at which the trace was started.
+  uint64_t start_micros() const { return start_micros_; }
+
+  // Read the next record. Return false at the end of the trace or on an
+  // error, in which case status() is set.
+  bool Next(FilesystemTraceRecord* rec);
+  const Status& status() const { return status_; }
+
+ private:
+  class Reporter;
+  Reporter* reporter_;
+  uint64_t start_micros_;
+  SequentialFile* file_;
+  log::Reader* log_;
+  std::string scratch_;
+  Status status_;
+
+  // No copying allowed
+  void operator=(const FilesystemTraceReader& other);
+  FilesystemTraceReader(const FilesystemTraceReader&);
+};
+
+}  // namespace pdlfs
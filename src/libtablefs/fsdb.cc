@@ -33,6 +33,10 @@
  */
 #include "fsdb.h"
 
+#include "pdlfs-common/coding.h"
+
+#include <sys/stat.h>
+
 namespace pdlfs {
 
 FilesystemDbStats::FilesystemDbStats()
@@ -41,6 +45,62 @@ FilesystemDbStats::FilesystemDbStats()
       puts(0),
       getkeybytes(0),
       getbytes(0),
-      gets(0) {}
+      gets(0),
+      dels(0),
+      getmicros(0),
+      putmicros(0),
+      delmicros(0),
+      lookups(0),
+      lookupcachehits(0),
+      lookupcachemisses(0),
+      namecachehits(0),
+      pathcachehits(0),
+      locks(0),
+      lockwaitmicros(0),
+      updates(0) {}
+
+FilesystemDbStatUpdate::FilesystemDbStatUpdate()
+    : mask(0), mode(0), uid(0), gid(0), size(0), mtime(0), ctime(0) {}
+
+Slice FilesystemDbStatUpdate::EncodeTo(char* scratch) const {
+  char* p = scratch;
+  *p++ = static_cast<char>(mask);
+  if (mask & kMode) p = EncodeVarint32(p, mode);
+  if (mask & kOwner) {
+    p = EncodeVarint32(p, uid);
+    p = EncodeVarint32(p, gid);
+  }
+  if (mask & kSize) p = EncodeVarint64(p, size);
+  if (mask & kModifyTime) p = EncodeVarint64(p, mtime);
+  if (mask & kChangeTime) p = EncodeVarint64(p, ctime);
+  return Slice(scratch, p - scratch);
+}
+
+bool FilesystemDbStatUpdate::DecodeFrom(const Slice& encoding) {
+  Slice input = encoding;
+  if (input.empty()) return false;
+  mask = static_cast<unsigned char>(input[0]);
+  input.remove_prefix(1);
+  if ((mask & kMode) && !GetVarint32(&input, &mode)) return false;
+  if ((mask & kOwner) &&
+      (!GetVarint32(&input, &uid) || !GetVarint32(&input, &gid)))
+    return false;
+  if ((mask & kSize) && !GetVarint64(&input, &size)) return false;
+  if ((mask & kModifyTime) && !GetVarint64(&input, &mtime)) return false;
+  if ((mask & kChangeTime) && !GetVarint64(&input, &ctime)) return false;
+  return true;
+}
+
+void FilesystemDbStatUpdate::ApplyTo(Stat* stat) const {
+  if (mask & kMode)
+    stat->SetFileMode((stat->FileMode() & S_IFMT) | (mode & ~S_IFMT));
+  if (mask & kOwner) {
+    stat->SetUserId(uid);
+    stat->SetGroupId(gid);
+  }
+  if ((mask & kSize) && S_ISREG(stat->FileMode())) stat->SetFileSize(size);
+  if (mask & kModifyTime) stat->SetModifyTime(mtime);
+  if (mask & kChangeTime) stat->SetChangeTime(ctime);
+}
 
 }  // namespace pdlfs
@@ -56,6 +56,57 @@ struct FilesystemDbStats {
   uint64_t getbytes;
   // Total number of get operations.
   uint64_t gets;
+  // Total number of delete operations.
+  uint64_t dels;
+  // Total number of micros spent on db gets, puts, and deletes.
+  uint64_t getmicros;
+  uint64_t putmicros;
+  uint64_t delmicros;
+  // Total number of path components looked up during path resolution.
+  uint64_t lookups;
+  // Total number of lookups served by and missed by the lookup cache.
+  uint64_t lookupcachehits;
+  uint64_t lookupcachemisses;
+  // Total number of name collision checks answered by the name cache without
+  // reading db.
+  uint64_t namecachehits;
+  // Total number of paths resolved by the path cache without walking them.
+  uint64_t pathcachehits;
+  // Total number of fs-layer stripe mutex acquisitions and micros spent
+  // waiting for them.
+  uint64_t locks;
+  uint64_t lockwaitmicros;
+  // Total number of blind attribute updates.
+  uint64_t updates;
+};
+
+// A partial update to the attributes of a filesystem node. An update is
+// written to db without reading the node's current stat first. Db merges the
+// update into the node's stat when the node is read or compacted. An update
+// to a node that does not exist is ignored.
+struct FilesystemDbStatUpdate {
+  FilesystemDbStatUpdate();
+  enum {
+    kMode = 1,  // Access modes only; the file type is kept as is
+    kOwner = 2,
+    kSize = 4,  // Only applies to regular files
+    kModifyTime = 8,
+    kChangeTime = 16
+  };
+  uint32_t mask;  // Attributes to update
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ctime;
+
+  enum { kMaxEncodedLength = 50 };
+  // scratch[...] should at least have kMaxEncodedLength of bytes.
+  Slice EncodeTo(char* scratch) const;
+  // Return true if success, false otherwise.
+  bool DecodeFrom(const Slice& encoding);
+  void ApplyTo(Stat* stat) const;
 };
 
 class FilesystemDb {
@@ -67,15 +118,44 @@ class FilesystemDb {
   Status SaveFsroot(const Slice& root_encoding);
   Status LoadFsroot(std::string* tmp);
   Status Flush();
+  // Switch the db to a new memtable without waiting for the old one to be
+  // flushed. WaitForFlush() waits for memtables switched out so far.
+  Status StartFlush();
+  Status WaitForFlush();
+  // Return true if unflushed updates have filled the db's write buffer. Only
+  // meaningful when the db does not flush its memtable on its own.
+  bool NeedsFlush();
+  // Set aside part of the db's memory budget for memory held outside of db.
+  // No effect if the db has no memory budget.
+  void ReserveMemory(size_t bytes);
 
   Status Get(const DirId& parent, const Slice& name, Stat* stat,
              FilesystemDbStats* stats);
   Status Put(const DirId& parent, const Slice& name, const Stat& stat,
              FilesystemDbStats* stats);
   Status Delete(const DirId& parent, const Slice& name);
+  // Blindly apply a partial update to the stat of a given name.
+  Status Update(const DirId& parent, const Slice& name,
+                const FilesystemDbStatUpdate& update, FilesystemDbStats* stats);
+  // Contents of small files. File data is keyed by the same parent dir and
+  // name as the file's stat, but is stored under a separate key type so it
+  // is placed next to the dir's entries without showing up in listings.
+  Status GetData(const DirId& parent, const Slice& name, std::string* data,
+                 FilesystemDbStats* stats);
+  Status PutData(const DirId& parent, const Slice& name, const Slice& data,
+                 FilesystemDbStats* stats);
+  Status DeleteData(const DirId& parent, const Slice& name);
+  // Remove all names beneath a given dir along with the file contents stored
+  // with them. Dbs supporting range deletions do this with a single range
+  // deletion over the dir's key prefix, so the cost does not depend on the
+  // number of names removed. Names of subdirs are removed, but not their
+  // own contents.
+  Status DeleteDir(const DirId& dir);
 
   struct Dir;
-  Dir* Opendir(const DirId& dir_id);
+  // A dir opened in scan mode is read ahead of the listing without filling
+  // the db's block cache. Meant for dirs known to hold many names.
+  Dir* Opendir(const DirId& dir_id, bool scan = false);
   Status Readdir(Dir* dir, Stat* stat, std::string* name);
   void Closedir(Dir* dir);
 
@@ -36,10 +36,14 @@
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/fsdb0.h"
 #include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/leveldb/comparator.h"
 #include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/memory_budget.h"
+#include "pdlfs-common/leveldb/merge_operator.h"
 #include "pdlfs-common/leveldb/readonly.h"
 #include "pdlfs-common/leveldb/snapshot.h"
 #include "pdlfs-common/leveldb/write_batch.h"
+#include "pdlfs-common/rate_limiter.h"
 #include "pdlfs-common/status.h"
 
 namespace pdlfs {
@@ -54,14 +58,72 @@ struct FilesystemDb::Rep {
   Rep();
   port::MDB* mdb;
   DB* db;
+  RateLimiter* limiter;
+  ThreadPool* open_pool;
+  MemoryBudget* budget;
 };
 namespace {
+// Folds blind stat updates into stats stored in db. Updates to names that do
+// not exist are dropped. Updates that cannot be decoded are ignored.
+class StatMerger : public MergeOperator {
+ public:
+  virtual bool Merge(const Slice& key, const Slice* existing_value,
+                     const Slice& operand, std::string* new_value) const {
+    Stat stat;
+    if (!existing_value || !stat.DecodeFrom(*existing_value)) {
+      return false;
+    }
+    FilesystemDbStatUpdate update;
+    if (update.DecodeFrom(operand)) {
+      update.ApplyTo(&stat);
+    }
+    char tmp[Stat::kMaxEncodedLength];
+    Slice encoding = stat.EncodeTo(tmp);
+    new_value->assign(encoding.data(), encoding.size());
+    return true;
+  }
+
+  virtual const char* Name() const { return "tablefs.StatMerger"; }
+};
+
+const StatMerger stat_merger;
+
 Status OpenDb(const FilesystemOptions& options, const std::string& dbloc,
-              DB** db) {
+              RateLimiter* limiter, ThreadPool* open_pool,
+              MemoryBudget* budget, DB** db) {
   DBOptions dbopts;  // XXX: filter? block cache? table cache?
   dbopts.create_if_missing = !options.rdonly;
   dbopts.disable_seek_compaction = true;
   dbopts.skip_lock_file = true;
+  dbopts.merge_operator = &stat_merger;
+  dbopts.rate_limiter = limiter;
+  dbopts.open_pool = open_pool;
+  dbopts.memory_budget = budget;
+  dbopts.load_tables_on_open = options.preload_tables;
+  dbopts.load_tables_in_background = options.preload_tables_in_background;
+  if (options.memtable_hash_index) {
+    // Serve the name collision checks preceding creates from a memtable hash
+    // index instead of a skiplist search. One 8-byte bucket is set aside for
+    // every 256 bytes of write buffer, which roughly matches the space a
+    // dir entry takes in a memtable.
+    const size_t write_buffer_size =
+        budget ? budget->write_buffer_size() : dbopts.write_buffer_size;
+    dbopts.memtable_hash_buckets = write_buffer_size / 256 + 1;
+  }
+  dbopts.data_block_hash_index = options.data_block_hash_index;
+  if (options.dir_aligned_tables) {
+    // Keys beneath a dir share all prefix bytes but the last, which holds
+    // the key type
+    dbopts.table_split_prefix_length = Key(0, kDirEntType).prefix().size() - 1;
+  }
+  if (options.epoch_durability) {
+    // Memtables only reach tables when an epoch is sealed
+    dbopts.disable_write_ahead_log = true;
+    dbopts.disable_auto_flush = true;
+  }
+  if (options.fixed_prefix_comparator) {
+    dbopts.comparator = FixedPrefixComparator();
+  }
   if (options.rdonly) return ReadonlyDB::Open(dbopts, dbloc, db);
   return DB::Open(dbopts, dbloc, db);
 }
@@ -73,7 +135,18 @@ Tx* const NULLTX = NULL;
 }  // namespace
 
 Status FilesystemDb::Open(const std::string& dbloc) {
-  Status s = OpenDb(options_, dbloc, &rep_->db);
+  if (options_.bg_io_bytes_per_sec != 0 && !options_.rdonly) {
+    rep_->limiter = NewGenericRateLimiter(options_.bg_io_bytes_per_sec,
+                                          options_.bg_io_target_latency);
+  }
+  if (options_.open_threads > 0) {
+    rep_->open_pool = ThreadPool::NewFixed(options_.open_threads);
+  }
+  if (options_.memory_budget != 0) {
+    rep_->budget = new MemoryBudget(options_.memory_budget);
+  }
+  Status s = OpenDb(options_, dbloc, rep_->limiter, rep_->open_pool,
+                    rep_->budget, &rep_->db);
   if (s.ok()) {
     rep_->mdb = new port::MDB(rep_->db);
   }
@@ -90,6 +163,30 @@ Status FilesystemDb::LoadFsroot(std::string* tmp) {
 
 Status FilesystemDb::Flush() { return rep_->db->FlushMemTable(FlushOptions()); }
 
+Status FilesystemDb::StartFlush() {
+  FlushOptions options;
+  options.wait = false;
+  return rep_->db->FlushMemTable(options);
+}
+
+Status FilesystemDb::WaitForFlush() {
+  FlushOptions options;
+  options.wait_only = true;
+  return rep_->db->FlushMemTable(options);
+}
+
+bool FilesystemDb::NeedsFlush() {
+  std::string tmp;
+  return rep_->db->GetProperty("leveldb.write-buffer-full", &tmp) &&
+         tmp == "1";
+}
+
+void FilesystemDb::ReserveMemory(size_t bytes) {
+  if (rep_->budget) {
+    rep_->budget->Reserve(bytes);
+  }
+}
+
 Status FilesystemDb::Get(const DirId& id, const Slice& fname, Stat* stat,
                          FilesystemDbStats* stats) {
   ReadOptions myreadopts;
@@ -108,8 +205,71 @@ Status FilesystemDb::Delete(const DirId& id, const Slice& fname) {
   return rep_->mdb->DELETE<Key>(id, fname, &myopts, NULLTX);
 }
 
-FilesystemDb::Dir* FilesystemDb::Opendir(const DirId& dir_id) {
+Status FilesystemDb::Update(const DirId& id, const Slice& fname,
+                            const FilesystemDbStatUpdate& update,
+                            FilesystemDbStats* stats) {
+  Key key(id.ino, kDirEntType);
+  key.SetSuffix(fname);
+  char tmp[FilesystemDbStatUpdate::kMaxEncodedLength];
+  Slice value = update.EncodeTo(tmp);
+  Status s =
+      rep_->db->Merge(WriteOptions(), Slice(key.data(), key.size()), value);
+  if (s.ok() && stats) {
+    stats->putkeybytes += key.size();
+    stats->putbytes += value.size();
+    stats->updates++;
+  }
+  return s;
+}
+
+Status FilesystemDb::GetData(const DirId& id, const Slice& fname,
+                             std::string* data, FilesystemDbStats* stats) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  Status s =
+      rep_->db->Get(ReadOptions(), Slice(key.data(), key.size()), data);
+  if (s.ok() && stats) {
+    stats->getkeybytes += key.size();
+    stats->getbytes += data->size();
+    stats->gets++;
+  }
+  return s;
+}
+
+Status FilesystemDb::PutData(const DirId& id, const Slice& fname,
+                             const Slice& data, FilesystemDbStats* stats) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  Status s =
+      rep_->db->Put(WriteOptions(), Slice(key.data(), key.size()), data);
+  if (s.ok() && stats) {
+    stats->putkeybytes += key.size();
+    stats->putbytes += data.size();
+    stats->puts++;
+  }
+  return s;
+}
+
+Status FilesystemDb::DeleteData(const DirId& id, const Slice& fname) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  return rep_->db->Delete(WriteOptions(), Slice(key.data(), key.size()));
+}
+
+Status FilesystemDb::DeleteDir(const DirId& id) {
+  // Keys of all types beneath a dir share the dir's inode no. as their
+  // leading bytes and sort before the keys of the next inode no.
+  Key begin(id.ino, kDirEntType);
+  Key end(id.ino + 1, kDirEntType);
+  return rep_->db->DeleteRange(WriteOptions(), begin.prefix(), end.prefix());
+}
+
+FilesystemDb::Dir* FilesystemDb::Opendir(const DirId& dir_id, bool scan) {
   ReadOptions myreadopts;
+  if (scan) {
+    myreadopts.fill_cache = false;
+    myreadopts.readahead_size = 64 << 10;
+  }
   return reinterpret_cast<Dir*>(
       rep_->mdb->OPENDIR<Iterator, Key>(dir_id, &myreadopts, NULLTX));
 }
@@ -126,11 +286,15 @@ void FilesystemDb::Closedir(Dir* dir) {
 FilesystemDb::FilesystemDb(const FilesystemOptions& options)
     : options_(options), rep_(new Rep()) {}
 
-FilesystemDb::Rep::Rep() : mdb(NULL), db(NULL) {}
+FilesystemDb::Rep::Rep()
+    : mdb(NULL), db(NULL), limiter(NULL), open_pool(NULL), budget(NULL) {}
 
 FilesystemDb::~FilesystemDb() {
   delete rep_->mdb;
   delete rep_->db;
+  delete rep_->limiter;  // Must go after db
+  delete rep_->open_pool;
+  delete rep_->budget;  // Must go after db
   delete rep_;
 }
 
@@ -99,6 +99,14 @@ Status FilesystemDb::LoadFsroot(std::string* tmp) {
 
 Status FilesystemDb::Flush() { return Status::OK(); }
 
+Status FilesystemDb::StartFlush() { return Status::OK(); }
+
+Status FilesystemDb::WaitForFlush() { return Status::OK(); }
+
+bool FilesystemDb::NeedsFlush() { return false; }
+
+void FilesystemDb::ReserveMemory(size_t bytes) {}
+
 Status FilesystemDb::Get(const DirId& id, const Slice& fname, Stat* stat,
                          FilesystemDbStats* stats) {
   ::leveldb::ReadOptions myreadopts;
@@ -117,8 +125,106 @@ Status FilesystemDb::Delete(const DirId& id, const Slice& fname) {
   return rep_->mdb->DELETE<Key>(id, fname, &myopts, NULLTX);
 }
 
-FilesystemDb::Dir* FilesystemDb::Opendir(const DirId& dir_id) {
+// LevelDB has no merge support. Fall back to a read-modify-write, which is
+// not atomic with respect to concurrent updates to the same name.
+Status FilesystemDb::Update(const DirId& id, const Slice& fname,
+                            const FilesystemDbStatUpdate& update,
+                            FilesystemDbStats* stats) {
+  Stat stat;
+  Status s = Get(id, fname, &stat, stats);
+  if (s.ok()) {
+    update.ApplyTo(&stat);
+    s = Put(id, fname, stat, stats);
+    if (s.ok() && stats) {
+      stats->updates++;
+    }
+  } else if (s.IsNotFound()) {  // Updates to missing names are ignored
+    s = Status::OK();
+  }
+  return s;
+}
+
+Status FilesystemDb::GetData(const DirId& id, const Slice& fname,
+                             std::string* data, FilesystemDbStats* stats) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  ::leveldb::Status status = rep_->db->Get(
+      ::leveldb::ReadOptions(), ::leveldb::Slice(key.data(), key.size()), data);
+  if (status.IsNotFound()) {
+    return Status::NotFound(Slice());
+  } else if (!status.ok()) {
+    return Status::IOError(status.ToString());
+  }
+  if (stats) {
+    stats->getkeybytes += key.size();
+    stats->getbytes += data->size();
+    stats->gets++;
+  }
+  return Status::OK();
+}
+
+Status FilesystemDb::PutData(const DirId& id, const Slice& fname,
+                             const Slice& data, FilesystemDbStats* stats) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  ::leveldb::Status status =
+      rep_->db->Put(::leveldb::WriteOptions(),
+                    ::leveldb::Slice(key.data(), key.size()),
+                    ::leveldb::Slice(data.data(), data.size()));
+  if (!status.ok()) {
+    return Status::IOError(status.ToString());
+  }
+  if (stats) {
+    stats->putkeybytes += key.size();
+    stats->putbytes += data.size();
+    stats->puts++;
+  }
+  return Status::OK();
+}
+
+Status FilesystemDb::DeleteData(const DirId& id, const Slice& fname) {
+  Key key(id.ino, kDataBlockType);
+  key.SetSuffix(fname);
+  ::leveldb::Status status = rep_->db->Delete(
+      ::leveldb::WriteOptions(), ::leveldb::Slice(key.data(), key.size()));
+  if (!status.ok()) {
+    return Status::IOError(status.ToString());
+  } else {
+    return Status::OK();
+  }
+}
+
+Status FilesystemDb::DeleteDir(const DirId& id) {
+  // No range deletions. Delete every key beneath the dir in a single batch.
+  Key begin(id.ino, kDirEntType);
+  Key end(id.ino + 1, kDirEntType);
+  const Slice limit = end.prefix();
+  ::leveldb::WriteBatch batch;
+  ::leveldb::Iterator* const iter =
+      rep_->db->NewIterator(::leveldb::ReadOptions());
+  iter->Seek(::leveldb::Slice(begin.prefix().data(), begin.prefix().size()));
+  for (; iter->Valid(); iter->Next()) {
+    ::leveldb::Slice key = iter->key();
+    if (Slice(key.data(), key.size()).compare(limit) >= 0) {
+      break;
+    }
+    batch.Delete(key);
+  }
+  ::leveldb::Status status = iter->status();
+  delete iter;
+  if (status.ok()) {
+    status = rep_->db->Write(::leveldb::WriteOptions(), &batch);
+  }
+  if (!status.ok()) {
+    return Status::IOError(status.ToString());
+  } else {
+    return Status::OK();
+  }
+}
+
+FilesystemDb::Dir* FilesystemDb::Opendir(const DirId& dir_id, bool scan) {
   ::leveldb::ReadOptions myreadopts;
+  myreadopts.fill_cache = !scan;  // leveldb has no readahead option
   return reinterpret_cast<Dir*>(rep_->mdb->OPENDIR<::leveldb::Iterator, Key>(
       dir_id, &myreadopts, NULLTX));
 }
@@ -34,7 +34,9 @@
 #include "tablefs/tablefs_api.h"
 
 #include "fs.h"
+#include "fs_trace.h"
 
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/port.h"
 
 #include <errno.h>
@@ -52,39 +54,43 @@ inline pdlfs::Status BadArgs() {
   return pdlfs::Status::InvalidArgument(pdlfs::Slice());
 }
 
-void SetErrno(const pdlfs::Status& s) {
+int ErrnoOf(const pdlfs::Status& s) {
   if (s.ok()) {
-    errno = 0;
+    return 0;
   } else if (s.IsNotFound()) {
-    errno = ENOENT;
+    return ENOENT;
   } else if (s.IsAlreadyExists()) {
-    errno = EEXIST;
+    return EEXIST;
   } else if (s.IsFileExpected()) {
-    errno = EISDIR;
+    return EISDIR;
   } else if (s.IsDirExpected()) {
-    errno = ENOTDIR;
+    return ENOTDIR;
   } else if (s.IsDirNotEmpty()) {
-    errno = ENOTEMPTY;
+    return ENOTEMPTY;
   } else if (s.IsInvalidFileDescriptor()) {
-    errno = EBADF;
+    return EBADF;
   } else if (s.IsTooManyOpens()) {
-    errno = EMFILE;
+    return EMFILE;
   } else if (s.IsAccessDenied()) {
-    errno = EACCES;
+    return EACCES;
   } else if (s.IsAssertionFailed()) {
-    errno = EPERM;
+    return EPERM;
   } else if (s.IsReadOnly()) {
-    errno = EROFS;
+    return EROFS;
   } else if (s.IsNotSupported()) {
-    errno = ENOSYS;
+    return ENOSYS;
   } else if (s.IsInvalidArgument()) {
-    errno = EINVAL;
+    return EINVAL;
   } else if (s.IsBufferFull()) {
-    errno = ENOBUFS;
+    return ENOBUFS;
+  } else if (s.IsRange()) {
+    return EFBIG;
   } else {
-    errno = EIO;
+    return EIO;
   }
 }
+
+void SetErrno(const pdlfs::Status& s) { errno = ErrnoOf(s); }
 }  // namespace
 
 /*
@@ -93,6 +99,7 @@ void SetErrno(const pdlfs::Status& s) {
 struct tablefs {
   pdlfs::FilesystemOptions* fsopts;
   pdlfs::Filesystem* fs;
+  pdlfs::FilesystemTracer* tracer;  // NULL if tracing is off
   pdlfs::User me;
 };
 
@@ -102,6 +109,7 @@ struct tablefs {
 struct tablefs_dir {
   struct dirent buf;
   pdlfs::FilesystemDir* dir;
+  char* path;  // Only kept when tracing
   tablefs_t* h;
 };
 
@@ -118,6 +126,10 @@ inline void SetTimespec(struct timespec* const ts, uint64_t micros) {
     ts->tv_nsec = micros * 1000;
   }
 }
+inline uint64_t Micros(const struct timeval& tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 +
+         static_cast<uint64_t>(tv.tv_usec);
+}
 // XXX: h may be NULL
 int FilesystemError(tablefs_t* h, const pdlfs::Status& s) {
   SetErrno(s);
@@ -128,6 +140,62 @@ int DirError(tablefs_dir_t* dh, const pdlfs::Status& s) {
   SetErrno(s);
   return -1;
 }
+void CopyStat(const pdlfs::Stat& stat, struct stat* const buf) {
+  /// XXX: currently no atimes are maintained
+#ifdef PDLFS_OS_MACOSX
+  SetTimespec(&buf->st_atimespec, stat.ModifyTime());
+  SetTimespec(&buf->st_mtimespec, stat.ModifyTime());
+  SetTimespec(&buf->st_ctimespec, stat.ChangeTime());
+#else
+  SetTimespec(&buf->st_atim, stat.ModifyTime());
+  SetTimespec(&buf->st_mtim, stat.ModifyTime());
+  SetTimespec(&buf->st_ctim, stat.ChangeTime());
+#endif
+  buf->st_ino = stat.InodeNo();
+  buf->st_size = stat.FileSize();
+  buf->st_mode = stat.FileMode();
+  buf->st_uid = stat.UserId();
+  buf->st_gid = stat.GroupId();
+  buf->st_nlink = 1;
+}
+inline bool Tracing(tablefs_t* h) { return h && h->tracer; }
+inline bool Tracing(tablefs_dir_t* dh) { return dh && dh->path; }
+inline uint64_t TraceStart(tablefs_t* h) {
+  return Tracing(h) ? pdlfs::CurrentMicros() : 0;
+}
+inline uint64_t TraceStart(tablefs_dir_t* dh) {
+  return Tracing(dh) ? pdlfs::CurrentMicros() : 0;
+}
+// REQUIRES: Tracing(h) is true.
+void Trace(tablefs_t* h, uint64_t start, int op, const std::string& path,
+           uint64_t arg0, uint64_t arg1, const pdlfs::Status& s) {
+  pdlfs::FilesystemTraceRecord rec;
+  rec.latency = pdlfs::CurrentMicros() - start;
+  rec.op = op;
+  rec.uid = h->me.uid;
+  rec.gid = h->me.gid;
+  rec.arg0 = arg0;
+  rec.arg1 = arg1;
+  rec.err = ErrnoOf(s);
+  rec.path = path;
+  h->tracer->Record(start, &rec);
+}
+inline void Trace(tablefs_t* h, uint64_t start, int op, const char* path,
+                  uint64_t arg0, uint64_t arg1, const pdlfs::Status& s) {
+  Trace(h, start, op, std::string(path ? path : ""), arg0, arg1, s);
+}
+// Relative paths are recorded as resolved against the path of the dir.
+// REQUIRES: Tracing(dh) is true.
+void TraceAt(tablefs_dir_t* dh, uint64_t start, int op, const char* path,
+             uint64_t arg0, const pdlfs::Status& s) {
+  std::string p(path ? path : "");
+  if (p.empty() || p[0] != '/') {
+    std::string parent(dh->path);
+    if (parent.size() > 1) parent.push_back('/');
+    p = parent + p;
+  }
+  Trace(dh->h, start, op, p, arg0, 0, s);
+}
 }  // namespace
 
 extern "C" {
@@ -136,6 +204,7 @@ tablefs_t* tablefs_newfshdl() {
   tablefs_t* h = static_cast<tablefs_t*>(malloc(sizeof(struct tablefs)));
   h->fsopts = new pdlfs::FilesystemOptions;
   h->fs = NULL;
+  h->tracer = NULL;
   h->me.uid = getuid();
   h->me.gid = getgid();
   return h;
@@ -156,6 +225,152 @@ int tablefs_set_readonly(tablefs_t* h, int flg) {
   }
 }
 
+int tablefs_set_blind_setattr(tablefs_t* h, int flg) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else {
+    h->fsopts->skip_setattr_checks = flg;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_inline_data_size(tablefs_t* h, size_t max_size) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else {
+    h->fsopts->max_inline_data_size = max_size;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_stats(tablefs_t* h, int flg, int dump_secs) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else if (dump_secs < 0) {
+    status = BadArgs();
+  } else {
+    h->fsopts->enable_op_stats = flg;
+    h->fsopts->op_stats_dump_interval = dump_secs;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_bg_io_limit(tablefs_t* h, uint64_t bytes_per_sec,
+                            uint64_t target_us) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else {
+    h->fsopts->bg_io_bytes_per_sec = bytes_per_sec;
+    h->fsopts->bg_io_target_latency = target_us;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_epoch_durability(tablefs_t* h, int flg, int interval_secs) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else if (interval_secs < 0) {
+    status = BadArgs();
+  } else {
+    h->fsopts->epoch_durability = flg;
+    h->fsopts->epoch_interval = interval_secs;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_memory_budget(tablefs_t* h, size_t budget) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else {
+    h->fsopts->memory_budget = budget;
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_set_trace(tablefs_t* h, const char* fname) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else if (!fname || h->tracer) {
+    status = BadArgs();
+  } else {
+    h->tracer = new pdlfs::FilesystemTracer;
+    status = h->tracer->Open(fname);
+    if (!status.ok()) {
+      delete h->tracer;
+      h->tracer = NULL;
+    }
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_get_stats(tablefs_t* h, char* buf, size_t buf_size) {
+  pdlfs::FilesystemOpStats stats;
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else if (!buf) {
+    status = BadArgs();
+  } else {
+    status = h->fs->GetOpStats(&stats);
+    if (status.ok()) {
+      const std::string result = stats.ToString();
+      if (result.size() >= buf_size) {
+        status = pdlfs::Status::BufferFull(pdlfs::Slice());
+      } else {
+        memcpy(buf, result.c_str(), result.size() + 1);
+      }
+    }
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
 int tablefs_openfs(tablefs_t* h, const char* fsloc) {
   pdlfs::Status status;
   if (!h) {
@@ -172,17 +387,44 @@ int tablefs_openfs(tablefs_t* h, const char* fsloc) {
   }
 }
 
+int tablefs_sync_epoch(tablefs_t* h) {
+  pdlfs::Status status;
+  if (!h) {
+    status = BadArgs();
+  } else {
+    uint64_t epoch;
+    status = h->fs->SyncEpoch(&epoch);
+  }
+
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
 int tablefs_closefs(tablefs_t* h) {
+  pdlfs::Status status;
   if (h) {
     delete h->fsopts;
     delete h->fs;
+    if (h->tracer) {
+      status = h->tracer->Close();
+      delete h->tracer;
+    }
     free(h);
   }
-  return 0;
+
+  if (!status.ok()) {
+    return FilesystemError(NULL, status);
+  } else {
+    return 0;
+  }
 }
 
 int tablefs_mkfile(tablefs_t* h, const char* path, uint32_t mode) {
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   if (!h) {
     status = BadArgs();
   } else if (!path || path[0] != '/') {
@@ -191,6 +433,9 @@ int tablefs_mkfile(tablefs_t* h, const char* path, uint32_t mode) {
     status = h->fs->Creat(h->me, path, mode, NULL);
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceMkfile, path, mode, 0, status);
+  }
   if (!status.ok()) {
     return FilesystemError(h, status);
   } else {
@@ -200,6 +445,7 @@ int tablefs_mkfile(tablefs_t* h, const char* path, uint32_t mode) {
 
 int tablefs_unlink(tablefs_t* h, const char* path) {
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   if (!h) {
     status = BadArgs();
   } else if (!path || path[0] != '/') {
@@ -208,6 +454,9 @@ int tablefs_unlink(tablefs_t* h, const char* path) {
     status = h->fs->Unlnk(h->me, path, NULL);
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceUnlink, path, 0, 0, status);
+  }
   if (!status.ok()) {
     return FilesystemError(h, status);
   } else {
@@ -217,6 +466,7 @@ int tablefs_unlink(tablefs_t* h, const char* path) {
 
 int tablefs_mkdir(tablefs_t* h, const char* path, uint32_t mode) {
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   if (!h) {
     status = BadArgs();
   } else if (!path || path[0] != '/') {
@@ -225,6 +475,9 @@ int tablefs_mkdir(tablefs_t* h, const char* path, uint32_t mode) {
     status = h->fs->Mkdir(h->me, path, mode, NULL);
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceMkdir, path, mode, 0, status);
+  }
   if (!status.ok()) {
     return FilesystemError(h, status);
   } else {
@@ -234,6 +487,7 @@ int tablefs_mkdir(tablefs_t* h, const char* path, uint32_t mode) {
 
 int tablefs_rmdir(tablefs_t* h, const char* path) {
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   if (!h) {
     status = BadArgs();
   } else if (!path || path[0] != '/') {
@@ -242,6 +496,30 @@ int tablefs_rmdir(tablefs_t* h, const char* path) {
     status = h->fs->Rmdir(h->me, path, NULL);
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceRmdir, path, 0, 0, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_rmtree(tablefs_t* h, const char* path) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else {
+    status = h->fs->RemoveTree(h->me, path, NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceRmtree, path, 0, 0, status);
+  }
   if (!status.ok()) {
     return FilesystemError(h, status);
   } else {
@@ -251,6 +529,7 @@ int tablefs_rmdir(tablefs_t* h, const char* path) {
 
 int tablefs_lstat(tablefs_t* h, const char* path, struct stat* const buf) {
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   pdlfs::Stat stat;
   if (!h) {
     status = BadArgs();
@@ -260,25 +539,14 @@ int tablefs_lstat(tablefs_t* h, const char* path, struct stat* const buf) {
     status = BadArgs();
   } else {
     status = h->fs->Lstat(h->me, path, &stat, NULL);
-    if (status.ok()) {  /// XXX: currently no atimes are maintained
-#ifdef PDLFS_OS_MACOSX
-      SetTimespec(&buf->st_atimespec, stat.ModifyTime());
-      SetTimespec(&buf->st_mtimespec, stat.ModifyTime());
-      SetTimespec(&buf->st_ctimespec, stat.ChangeTime());
-#else
-      SetTimespec(&buf->st_atim, stat.ModifyTime());
-      SetTimespec(&buf->st_mtim, stat.ModifyTime());
-      SetTimespec(&buf->st_ctim, stat.ChangeTime());
-#endif
-      buf->st_ino = stat.InodeNo();
-      buf->st_size = stat.FileSize();
-      buf->st_mode = stat.FileMode();
-      buf->st_uid = stat.UserId();
-      buf->st_gid = stat.GroupId();
-      buf->st_nlink = 1;
+    if (status.ok()) {
+      CopyStat(stat, buf);
     }
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceLstat, path, 0, 0, status);
+  }
   if (!status.ok()) {
     return FilesystemError(h, status);
   } else {
@@ -286,9 +554,182 @@ int tablefs_lstat(tablefs_t* h, const char* path, struct stat* const buf) {
   }
 }
 
+int tablefs_chmod(tablefs_t* h, const char* path, uint32_t mode) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else {
+    status = h->fs->Chmod(h->me, path, mode, NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceChmod, path, mode, 0, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_chown(tablefs_t* h, const char* path, uid_t uid, gid_t gid) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else {
+    status = h->fs->Chown(h->me, path, uid, gid, NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceChown, path, uid, gid, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_utimes(tablefs_t* h, const char* path,
+                   const struct timeval times[2]) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else if (times && (times[1].tv_sec < 0 || times[1].tv_usec < 0)) {
+    status = BadArgs();
+  } else {
+    const uint64_t mtime = times ? Micros(times[1]) : pdlfs::CurrentMicros();
+    status = h->fs->Utimes(h->me, path, mtime, NULL);
+  }
+
+  if (Tracing(h)) {
+    const uint64_t mtime = times ? Micros(times[1]) : 0;
+    Trace(h, start, pdlfs::kTraceUtimes, path, mtime, 0, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_truncate(tablefs_t* h, const char* path, off_t length) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else if (length < 0) {
+    status = BadArgs();
+  } else {
+    status = h->fs->Truncate(h->me, path, length, NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceTruncate, path, length, 0, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return 0;
+  }
+}
+
+ssize_t tablefs_pread(tablefs_t* h, const char* path, void* buf, size_t n,
+                      off_t off) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  pdlfs::Slice result;
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else if (!buf || off < 0) {
+    status = BadArgs();
+  } else {
+    status = h->fs->Pread(h->me, path, off, n, &result,
+                          static_cast<char*>(buf), NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTracePread, path, n, off, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return result.size();
+  }
+}
+
+ssize_t tablefs_pwrite(tablefs_t* h, const char* path, const void* buf,
+                       size_t n, off_t off) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else if (!buf || off < 0) {
+    status = BadArgs();
+  } else {
+    status = h->fs->Pwrite(h->me, path, off,
+                           pdlfs::Slice(static_cast<const char*>(buf), n),
+                           NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTracePwrite, path, n, off, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return n;
+  }
+}
+
+ssize_t tablefs_read(tablefs_t* h, const char* path, void* buf, size_t n) {
+  return tablefs_pread(h, path, buf, n, 0);
+}
+
+ssize_t tablefs_write(tablefs_t* h, const char* path, const void* buf,
+                      size_t n) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
+  if (!h) {
+    status = BadArgs();
+  } else if (!path || path[0] != '/') {
+    status = BadArgs();
+  } else if (!buf) {
+    status = BadArgs();
+  } else {
+    status = h->fs->Write(h->me, path,
+                          pdlfs::Slice(static_cast<const char*>(buf), n), NULL);
+  }
+
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceWrite, path, n, 0, status);
+  }
+  if (!status.ok()) {
+    return FilesystemError(h, status);
+  } else {
+    return n;
+  }
+}
+
 tablefs_dir_t* tablefs_opendir(tablefs_t* h, const char* path) {
   pdlfs::FilesystemDir* dir;
   pdlfs::Status status;
+  const uint64_t start = TraceStart(h);
   if (!h) {
     status = BadArgs();
   } else if (!path || path[0] != '/') {
@@ -297,6 +738,9 @@ tablefs_dir_t* tablefs_opendir(tablefs_t* h, const char* path) {
     status = h->fs->Opendir(h->me, path, &dir, NULL);
   }
 
+  if (Tracing(h)) {
+    Trace(h, start, pdlfs::kTraceListdir, path, 0, 0, status);
+  }
   if (!status.ok()) {
     FilesystemError(h, status);
     return NULL;
@@ -304,6 +748,7 @@ tablefs_dir_t* tablefs_opendir(tablefs_t* h, const char* path) {
     tablefs_dir_t* const dh =
         static_cast<tablefs_dir_t*>(malloc(sizeof(struct tablefs_dir)));
     dh->dir = dir;
+    dh->path = Tracing(h) ? strdup(path) : NULL;
     dh->h = h;
     return dh;
   }
@@ -339,6 +784,7 @@ int tablefs_closedir(tablefs_dir_t* dh) {
   } else {
     status = dh->h->fs->Closdir(dh->dir);
     if (status.ok()) {
+      free(dh->path);
       free(dh);
     }
   }
@@ -350,4 +796,95 @@ int tablefs_closedir(tablefs_dir_t* dh) {
   }
 }
 
+int tablefs_lstatat(tablefs_dir_t* dh, const char* path,
+                    struct stat* const buf) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(dh);
+  pdlfs::Stat stat;
+  if (!dh) {
+    status = BadArgs();
+  } else if (!path || !path[0]) {
+    status = BadArgs();
+  } else if (!buf) {
+    status = BadArgs();
+  } else {
+    status = dh->h->fs->Lstatat(dh->h->me, dh->dir, path, &stat, NULL);
+    if (status.ok()) {
+      CopyStat(stat, buf);
+    }
+  }
+
+  if (Tracing(dh)) {
+    TraceAt(dh, start, pdlfs::kTraceLstat, path, 0, status);
+  }
+  if (!status.ok()) {
+    return DirError(dh, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_mkfileat(tablefs_dir_t* dh, const char* path, uint32_t mode) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(dh);
+  if (!dh) {
+    status = BadArgs();
+  } else if (!path || !path[0]) {
+    status = BadArgs();
+  } else {
+    status = dh->h->fs->Creatat(dh->h->me, dh->dir, path, mode, NULL);
+  }
+
+  if (Tracing(dh)) {
+    TraceAt(dh, start, pdlfs::kTraceMkfile, path, mode, status);
+  }
+  if (!status.ok()) {
+    return DirError(dh, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_unlinkat(tablefs_dir_t* dh, const char* path) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(dh);
+  if (!dh) {
+    status = BadArgs();
+  } else if (!path || !path[0]) {
+    status = BadArgs();
+  } else {
+    status = dh->h->fs->Unlnkat(dh->h->me, dh->dir, path, NULL);
+  }
+
+  if (Tracing(dh)) {
+    TraceAt(dh, start, pdlfs::kTraceUnlink, path, 0, status);
+  }
+  if (!status.ok()) {
+    return DirError(dh, status);
+  } else {
+    return 0;
+  }
+}
+
+int tablefs_mkdirat(tablefs_dir_t* dh, const char* path, uint32_t mode) {
+  pdlfs::Status status;
+  const uint64_t start = TraceStart(dh);
+  if (!dh) {
+    status = BadArgs();
+  } else if (!path || !path[0]) {
+    status = BadArgs();
+  } else {
+    status = dh->h->fs->Mkdirat(dh->h->me, dh->dir, path, mode, NULL);
+  }
+
+  if (Tracing(dh)) {
+    TraceAt(dh, start, pdlfs::kTraceMkdir, path, mode, status);
+  }
+  if (!status.ok()) {
+    return DirError(dh, status);
+  } else {
+    return 0;
+  }
+}
+
 }  // extern "C"
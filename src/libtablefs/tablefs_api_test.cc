@@ -33,20 +33,39 @@
  */
 #include "tablefs/tablefs_api.h"
 
+#include "fs_trace.h"
 #include "port.h"
 
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
 
+#include <unistd.h>
+
 #include <map>
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 
+// Remove the file set holding the contents of large files. DestroyDb only
+// removes the files of the db.
+void DestroyData(const std::string& fsloc) {
+  Env* const env = Env::Default();
+  const std::string dir = fsloc + "/data";
+  std::vector<std::string> names;
+  env->GetChildren(dir.c_str(), &names);
+  for (size_t i = 0; i < names.size(); i++) {
+    env->DeleteFile((dir + "/" + names[i]).c_str());
+  }
+  env->DeleteDir(dir.c_str());
+}
+
 class FilesystemAPI {
  public:
   FilesystemAPI() {
     fsloc_ = test::TmpDir() + "/filesystem_api_test";
+    DestroyData(fsloc_);
     DestroyDb(fsloc_);
     fs_ = tablefs_newfshdl();
   }
@@ -102,6 +121,32 @@ TEST(FilesystemAPI, OpenFs) {
   ASSERT_TRUE(r == 0);
 }
 
+TEST(FilesystemAPI, Stats) {
+  int r = tablefs_set_stats(fs_, 1, 0);
+  ASSERT_TRUE(r == 0);
+  r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Mkdir("/1");
+  Creat("/1/a");
+  char buf[4096];
+  r = tablefs_get_stats(fs_, buf, 10);
+  ASSERT_TRUE(r == -1 && errno == ENOBUFS);
+  r = tablefs_get_stats(fs_, buf, sizeof(buf));
+  ASSERT_TRUE(r == 0);
+  ASSERT_TRUE(strstr(buf, "mkdir: ops=1 errs=0") != NULL);
+  ASSERT_TRUE(strstr(buf, "creat: ops=1 errs=0") != NULL);
+}
+
+TEST(FilesystemAPI, BgIoLimit) {
+  int r = tablefs_set_bg_io_limit(fs_, 1 << 20, 1000);
+  ASSERT_TRUE(r == 0);
+  r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Mkdir("/1");
+  Creat("/1/a");
+  ASSERT_TRUE(S_ISREG(Fmode("/1/a")));
+}
+
 TEST(FilesystemAPI, Fmodes) {
   int r = tablefs_openfs(fs_, fsloc_.c_str());
   ASSERT_TRUE(r == 0);
@@ -117,6 +162,85 @@ TEST(FilesystemAPI, Fmodes) {
   ASSERT_TRUE(S_ISDIR(Fmode("/5")));
 }
 
+TEST(FilesystemAPI, Setattr) {
+  int r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Creat("/1");
+  r = tablefs_chmod(fs_, "/1", 0600);
+  ASSERT_TRUE(r == 0);
+  ASSERT_TRUE(Fmode("/1") == (S_IFREG | 0600));
+  struct timeval times[2];
+  times[0].tv_sec = times[1].tv_sec = 10;
+  times[0].tv_usec = times[1].tv_usec = 0;
+  r = tablefs_utimes(fs_, "/1", times);
+  ASSERT_TRUE(r == 0);
+  r = tablefs_truncate(fs_, "/1", 4096);
+  ASSERT_TRUE(r == 0);
+  struct stat buf;
+  r = tablefs_lstat(fs_, "/1", &buf);
+  ASSERT_TRUE(r == 0);
+  ASSERT_TRUE(buf.st_size == 4096);
+  ASSERT_TRUE(buf.st_mtime > 10);
+  r = tablefs_truncate(fs_, "/1", -1);
+  ASSERT_TRUE(r == -1 && errno == EINVAL);
+  r = tablefs_chmod(fs_, "/2", 0600);
+  ASSERT_TRUE(r == -1 && errno == ENOENT);
+}
+
+TEST(FilesystemAPI, Atops) {
+  int r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Mkdir("/1");
+  tablefs_dir_t* dir = tablefs_opendir(fs_, "/1");
+  ASSERT_TRUE(dir != NULL);
+  r = tablefs_mkfileat(dir, "a", 0660);
+  ASSERT_TRUE(r == 0);
+  r = tablefs_mkdirat(dir, "b", 0770);
+  ASSERT_TRUE(r == 0);
+  struct stat buf;
+  r = tablefs_lstatat(dir, "b", &buf);
+  ASSERT_TRUE(r == 0);
+  ASSERT_TRUE(S_ISDIR(buf.st_mode));
+  ASSERT_TRUE(buf.st_ino == Fid("/1/b"));
+  ASSERT_TRUE(S_ISREG(Fmode("/1/a")));
+  r = tablefs_unlinkat(dir, "a");
+  ASSERT_TRUE(r == 0);
+  r = tablefs_lstatat(dir, "a", &buf);
+  ASSERT_TRUE(r == -1 && errno == ENOENT);
+  r = tablefs_mkfileat(dir, "", 0660);
+  ASSERT_TRUE(r == -1 && errno == EINVAL);
+  r = tablefs_mkfileat(NULL, "a", 0660);
+  ASSERT_TRUE(r == -1 && errno == EINVAL);
+  tablefs_closedir(dir);
+}
+
+TEST(FilesystemAPI, Data) {
+  int r = tablefs_set_inline_data_size(fs_, 8);
+  ASSERT_TRUE(r == 0);
+  r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Creat("/1");
+  ssize_t n = tablefs_write(fs_, "/1", "abc", 3);
+  ASSERT_TRUE(n == 3);
+  n = tablefs_pwrite(fs_, "/1", "0123456789", 10, 3);
+  ASSERT_TRUE(n == 10);
+  char buf[20];
+  n = tablefs_read(fs_, "/1", buf, sizeof(buf));
+  ASSERT_TRUE(n == 13);
+  ASSERT_TRUE(memcmp(buf, "abc0123456789", 13) == 0);
+  n = tablefs_pread(fs_, "/1", buf, 4, 2);
+  ASSERT_TRUE(n == 4);
+  ASSERT_TRUE(memcmp(buf, "c012", 4) == 0);
+  struct stat st;
+  r = tablefs_lstat(fs_, "/1", &st);
+  ASSERT_TRUE(r == 0);
+  ASSERT_TRUE(st.st_size == 13);
+  n = tablefs_pread(fs_, "/1", buf, 4, -1);
+  ASSERT_TRUE(n == -1 && errno == EINVAL);
+  n = tablefs_read(fs_, "/2", buf, 4);
+  ASSERT_TRUE(n == -1 && errno == ENOENT);
+}
+
 TEST(FilesystemAPI, Fids) {
   int r = tablefs_openfs(fs_, fsloc_.c_str());
   ASSERT_TRUE(r == 0);
@@ -177,6 +301,54 @@ TEST(FilesystemAPI, Listdirs2) {
   tablefs_closedir(dir);
 }
 
+TEST(FilesystemAPI, Trace) {
+  const std::string trace = fsloc_ + ".trace";
+  int r = tablefs_set_trace(fs_, trace.c_str());
+  ASSERT_TRUE(r == 0);
+  r = tablefs_openfs(fs_, fsloc_.c_str());
+  ASSERT_TRUE(r == 0);
+  Mkdir("/1");
+  Creat("/1/a");
+  r = tablefs_mkfile(fs_, "/1/a", 0660);
+  ASSERT_TRUE(r == -1 && errno == EEXIST);
+  r = tablefs_chown(fs_, "/1/a", 7, 8);
+  ASSERT_TRUE(r == 0);
+  tablefs_dir_t* dir = tablefs_opendir(fs_, "/1");
+  ASSERT_TRUE(dir != NULL);
+  r = tablefs_mkdirat(dir, "b", 0770);
+  ASSERT_TRUE(r == 0);
+  tablefs_closedir(dir);
+  r = tablefs_closefs(fs_);
+  fs_ = NULL;
+  ASSERT_TRUE(r == 0);
+  FilesystemTraceReader reader;
+  ASSERT_OK(reader.Open(trace.c_str()));
+  const int ops[] = {kTraceMkdir,  kTraceMkfile,  kTraceMkfile,
+                     kTraceChown,  kTraceListdir, kTraceMkdir};
+  const char* const paths[] = {"/1",   "/1/a", "/1/a",
+                               "/1/a", "/1",   "/1/b"};
+  FilesystemTraceRecord rec;
+  uint64_t last = 0;
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    ASSERT_TRUE(reader.Next(&rec));
+    ASSERT_EQ(rec.op, ops[i]);
+    ASSERT_EQ(rec.path, paths[i]);
+    ASSERT_EQ(rec.err, i == 2 ? EEXIST : 0);
+    ASSERT_EQ(rec.uid, getuid());
+    ASSERT_GE(rec.micros, last);
+    last = rec.micros;
+    if (rec.op == kTraceChown) {
+      ASSERT_EQ(rec.arg0, 7);
+      ASSERT_EQ(rec.arg1, 8);
+    } else if (rec.op == kTraceMkdir) {
+      ASSERT_EQ(rec.arg0, 0770);
+    }
+  }
+  ASSERT_TRUE(!reader.Next(&rec));
+  ASSERT_OK(reader.status());
+  Env::Default()->DeleteFile(trace.c_str());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
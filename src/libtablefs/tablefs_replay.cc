@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of CMU, TRIAD, Los Alamos National Laboratory, LANL, the
+ *    U.S. Government, nor the names of its contributors may be used to endorse
+ *    or promote products derived from this software without specific prior
+ *    written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Replay a trace recorded through tablefs_set_trace() against a filesystem
+ * image and report the throughput and latencies observed.
+ *
+ * Usage: tablefs_replay [flags] <trace> <fsloc>
+ *
+ *   --threads=N     Replay with N threads (default 1). Records are spread
+ *                   across threads by the dir they work in, so that ops in
+ *                   a single dir are replayed in the order they were traced.
+ *                   A dir is created, listed, and removed by the thread
+ *                   working in it.
+ *   --timed=1       Issue each op at the time it was issued in the trace
+ *                   instead of as fast as possible.
+ *   --snapshot=DIR  Copy the image at DIR to fsloc before replaying.
+ *                   Otherwise the image at fsloc is used as is, and a fresh
+ *                   image is created if fsloc holds none.
+ *
+ * The replay runs as the current user. Writes replay the traced sizes with
+ * zeroed data.
+ */
+#include "fs_trace.h"
+
+#include "tablefs/tablefs_api.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace {
+
+int FLAGS_threads = 1;
+bool FLAGS_timed = false;
+const char* FLAGS_snapshot = NULL;
+
+// Return the dir an op works in.
+std::string WorkingDir(const FilesystemTraceRecord& rec) {
+  switch (rec.op) {
+    case kTraceMkdir:
+    case kTraceRmdir:
+    case kTraceRmtree:
+    case kTraceListdir:
+      return rec.path;
+    default:
+      break;
+  }
+  size_t i = rec.path.rfind('/');
+  if (i == std::string::npos || i == 0) {
+    return "/";
+  } else {
+    return rec.path.substr(0, i);
+  }
+}
+
+struct ReplayThread {
+  ReplayThread() : mismatches(0) {
+    for (int op = 0; op <= kMaxTraceOp; op++) {
+      hists[op].Clear();
+      ops[op] = 0;
+    }
+  }
+  std::vector<const FilesystemTraceRecord*> records;
+  Histogram hists[kMaxTraceOp + 1];
+  uint64_t ops[kMaxTraceOp + 1];
+  uint64_t mismatches;  // Results differing from the trace
+  std::string buf;
+};
+
+struct ReplayState {
+  ReplayState(tablefs_t* h, int n) : h(h), cv(&mu), num_running(n) {}
+  tablefs_t* const h;
+  uint64_t start_micros;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+};
+
+// Replay one record. Return the errno of the call, or 0 on success.
+int Replay(tablefs_t* h, const FilesystemTraceRecord& rec, std::string* buf) {
+  const char* const path = rec.path.c_str();
+  if (rec.op == kTracePread || rec.op == kTracePwrite ||
+      rec.op == kTraceWrite) {
+    if (buf->size() < rec.arg0) {
+      buf->resize(rec.arg0);
+    }
+  }
+  int r = 0;
+  errno = 0;
+  switch (rec.op) {
+    case kTraceLstat: {
+      struct stat st;
+      r = tablefs_lstat(h, path, &st);
+      break;
+    }
+    case kTraceMkfile:
+      r = tablefs_mkfile(h, path, rec.arg0);
+      break;
+    case kTraceMkdir:
+      r = tablefs_mkdir(h, path, rec.arg0);
+      break;
+    case kTraceUnlink:
+      r = tablefs_unlink(h, path);
+      break;
+    case kTraceRmdir:
+      r = tablefs_rmdir(h, path);
+      break;
+    case kTraceRmtree:
+      r = tablefs_rmtree(h, path);
+      break;
+    case kTraceChmod:
+      r = tablefs_chmod(h, path, rec.arg0);
+      break;
+    case kTraceChown:
+      r = tablefs_chown(h, path, rec.arg0, rec.arg1);
+      break;
+    case kTraceUtimes: {
+      struct timeval times[2];
+      times[1].tv_sec = rec.arg0 / 1000000;
+      times[1].tv_usec = rec.arg0 % 1000000;
+      times[0] = times[1];
+      r = tablefs_utimes(h, path, rec.arg0 != 0 ? times : NULL);
+      break;
+    }
+    case kTraceTruncate:
+      r = tablefs_truncate(h, path, rec.arg0);
+      break;
+    case kTracePread:
+      r = tablefs_pread(h, path, &(*buf)[0], rec.arg0, rec.arg1);
+      break;
+    case kTracePwrite:
+      memset(&(*buf)[0], 0, rec.arg0);
+      r = tablefs_pwrite(h, path, buf->data(), rec.arg0, rec.arg1);
+      break;
+    case kTraceWrite:
+      memset(&(*buf)[0], 0, rec.arg0);
+      r = tablefs_write(h, path, buf->data(), rec.arg0);
+      break;
+    case kTraceListdir: {
+      tablefs_dir_t* const dh = tablefs_opendir(h, path);
+      if (dh) {
+        while (tablefs_readdir(dh) != NULL) {
+        }
+        tablefs_closedir(dh);
+      } else {
+        r = -1;
+      }
+      break;
+    }
+    default:
+      return EINVAL;
+  }
+  return r < 0 ? errno : 0;
+}
+
+void ReplayBody(ReplayState* state, ReplayThread* t) {
+  for (size_t i = 0; i < t->records.size(); i++) {
+    const FilesystemTraceRecord& rec = *t->records[i];
+    if (FLAGS_timed) {
+      const uint64_t due = state->start_micros + rec.micros;
+      const uint64_t now = CurrentMicros();
+      if (due > now) {
+        SleepForMicroseconds(static_cast<int>(due - now));
+      }
+    }
+    const uint64_t start = CurrentMicros();
+    const int err = Replay(state->h, rec, &t->buf);
+    const int op = rec.op <= kMaxTraceOp ? rec.op : 0;
+    t->hists[op].Add(CurrentMicros() - start);
+    t->ops[op]++;
+    if (static_cast<uint32_t>(err) != rec.err) {
+      t->mismatches++;
+    }
+  }
+}
+
+struct ThreadArg {
+  ReplayState* state;
+  ReplayThread* t;
+};
+
+void ReplayThreadBody(void* arg) {
+  ThreadArg* const ta = static_cast<ThreadArg*>(arg);
+  ReplayBody(ta->state, ta->t);
+  MutexLock ml(&ta->state->mu);
+  ta->state->num_running--;
+  ta->state->cv.SignalAll();
+}
+
+Status CopyImage(const std::string& src, const std::string& dst) {
+  Env* const env = Env::Default();
+  const char* const subdirs[] = {"", "/data"};
+  Status s;
+  for (size_t i = 0; s.ok() && i < 2; i++) {
+    const std::string from = src + subdirs[i];
+    const std::string to = dst + subdirs[i];
+    std::vector<std::string> names;
+    if (!env->FileExists(from.c_str())) continue;
+    env->CreateDir(to.c_str());
+    s = env->GetChildren(from.c_str(), &names);
+    for (size_t j = 0; s.ok() && j < names.size(); j++) {
+      if (names[j] != "." && names[j] != ".." && names[j] != "data") {
+        s = env->CopyFile((from + "/" + names[j]).c_str(),
+                          (to + "/" + names[j]).c_str());
+      }
+    }
+  }
+  return s;
+}
+
+int Run(const char* trace, const char* fsloc) {
+  FilesystemTraceReader reader;
+  Status s = reader.Open(trace);
+  std::vector<FilesystemTraceRecord*> records;
+  FilesystemTraceRecord rec;
+  while (s.ok() && reader.Next(&rec)) {
+    records.push_back(new FilesystemTraceRecord(rec));
+  }
+  if (s.ok()) s = reader.status();
+  if (s.ok() && FLAGS_snapshot) {
+    s = CopyImage(FLAGS_snapshot, fsloc);
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "%s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  tablefs_t* const h = tablefs_newfshdl();
+  if (tablefs_openfs(h, fsloc) != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", fsloc, strerror(errno));
+    tablefs_closefs(h);
+    return 1;
+  }
+
+  const int n = FLAGS_threads;
+  std::vector<ReplayThread> threads(n);
+  for (size_t i = 0; i < records.size(); i++) {
+    const std::string dir = WorkingDir(*records[i]);
+    threads[Hash(dir.data(), dir.size(), 0) % n].records.push_back(records[i]);
+  }
+  ReplayState state(h, n);
+  std::vector<ThreadArg> args(n);
+  state.start_micros = CurrentMicros();
+  for (int i = 0; i < n; i++) {
+    args[i].state = &state;
+    args[i].t = &threads[i];
+    Env::Default()->StartThread(ReplayThreadBody, &args[i]);
+  }
+  {
+    MutexLock ml(&state.mu);
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+  }
+  const uint64_t micros = CurrentMicros() - state.start_micros;
+  tablefs_closefs(h);
+
+  ReplayThread total;
+  Histogram all;
+  all.Clear();
+  uint64_t ops = 0;
+  for (int i = 0; i < n; i++) {
+    for (int op = 0; op <= kMaxTraceOp; op++) {
+      total.hists[op].Merge(threads[i].hists[op]);
+      total.ops[op] += threads[i].ops[op];
+      all.Merge(threads[i].hists[op]);
+      ops += threads[i].ops[op];
+    }
+    total.mismatches += threads[i].mismatches;
+  }
+  const double secs = micros / 1000000.0;
+  fprintf(stdout, "Replayed %llu ops with %d threads in %.3f s (%s)\n",
+          static_cast<unsigned long long>(ops), n, secs,
+          FLAGS_timed ? "timed" : "as fast as possible");
+  fprintf(stdout, "Throughput: %.1f ops/s\n", secs > 0 ? ops / secs : 0.0);
+  fprintf(stdout, "Results differing from the trace: %llu\n",
+          static_cast<unsigned long long>(total.mismatches));
+  fprintf(stdout, "\nLatency (micros) of all ops:\n%s",
+          all.ToString().c_str());
+  for (int op = 1; op <= kMaxTraceOp; op++) {
+    if (total.ops[op] != 0) {
+      fprintf(stdout, "\nLatency (micros) of %s:\n%s",
+              FilesystemTraceOpName(op), total.hists[op].ToString().c_str());
+    }
+  }
+
+  for (size_t i = 0; i < records.size(); i++) {
+    delete records[i];
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  const char* trace = NULL;
+  const char* fsloc = NULL;
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      pdlfs::FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--timed=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      pdlfs::FLAGS_timed = n;
+    } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+      pdlfs::FLAGS_snapshot = argv[i] + 11;
+    } else if (argv[i][0] != '-' && !trace) {
+      trace = argv[i];
+    } else if (argv[i][0] != '-' && !fsloc) {
+      fsloc = argv[i];
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (!trace || !fsloc) {
+    fprintf(stderr,
+            "Usage: %s [--threads=N] [--timed=0|1] [--snapshot=DIR] "
+            "<trace> <fsloc>\n",
+            argv[0]);
+    exit(1);
+  }
+  return pdlfs::Run(trace, fsloc);
+}